@@ -8,6 +8,10 @@ MAKE?=make
 
 prefix=/usr/local
 
+# The async API (library/tek_async.h) needs C++20 coroutines; it's left
+# out if $(CXX) can't do them
+HAVE_CXX20:=$(shell printf '\043include <coroutine>\n' | $(CXX) -std=c++20 -x c++ -fsyntax-only - 2>/dev/null && echo yes)
+
 soversion=0
 libname=libtek_vxi11.so
 full_libname=$(libname).$(soversion)
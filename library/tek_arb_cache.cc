@@ -0,0 +1,410 @@
+/* tek_arb_cache.cc
+ * Not sending arbitrary waveforms that the AFG already has. See
+ * tek_arb_cache.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
+#include "tek_arb_cache.h"
+#include "tek_transport.h"
+
+/* The registry file has a line for each slot we know about:
+ *   <serial> <slot> <hash, in hex> <length in bytes> <last used> */
+#define TEK_ARB_LINE_LEN	256
+
+/* Points of a user memory compared with the waveform, before believing
+ * the registry that it's there */
+#define TEK_ARB_CHECK_POINTS	8
+
+/* tek_afg_deploy() etc rewrite the registry from several threads at once */
+#ifdef WIN32
+#define tek_arb_registry_lock()
+#define tek_arb_registry_unlock()
+#else
+static pthread_mutex_t tek_arb_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define tek_arb_registry_lock()	pthread_mutex_lock(&tek_arb_registry_mutex)
+#define tek_arb_registry_unlock()	pthread_mutex_unlock(&tek_arb_registry_mutex)
+#endif
+
+#define TEK_ARB_K1	0x9e3779b97f4a7c15ULL
+#define TEK_ARB_K2	0xc2b2ae3d27d4eb4fULL
+
+static uint64_t tek_arb_rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+/* The finaliser from MurmurHash3 */
+static uint64_t tek_arb_mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/* Eight bytes at a time; the waveforms are at most 256kB, so this is a
+ * few tens of microseconds against the best part of a second to send one */
+uint64_t tek_arb_hash(const char *buf, size_t len)
+{
+	uint64_t h = TEK_ARB_K1 ^ len, w;
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&w, buf + i, 8);
+		h ^= tek_arb_rotl(w * TEK_ARB_K2, 31) * TEK_ARB_K1;
+		h = tek_arb_rotl(h, 27) * 5 + 0x52dce729;
+	}
+	if (i < len) {
+		w = 0;
+		memcpy(&w, buf + i, len - i);
+		h ^= tek_arb_rotl(w * TEK_ARB_K2, 31) * TEK_ARB_K1;
+	}
+	return tek_arb_mix(h);
+}
+
+static void tek_arb_registry_name(TEK_ARB_CACHE * cache, const char *registry)
+{
+	const char *home;
+
+	if (registry == NULL) {
+		registry = getenv("TEK_ARB_CACHE");
+	}
+	if (registry) {
+		snprintf(cache->registry, sizeof(cache->registry), "%s",
+			 registry);
+		return;
+	}
+	home = getenv("HOME");
+#ifdef WIN32
+	if (home == NULL) {
+		home = getenv("USERPROFILE");
+	}
+#endif
+	snprintf(cache->registry, sizeof(cache->registry), "%s/.tek_arb_cache",
+		 home ? home : ".");
+}
+
+/* Rewrites the registry: everyone else's lines as they were, then ours */
+static int tek_arb_cache_save(TEK_ARB_CACHE * cache)
+{
+	char tmpname[272], line[TEK_ARB_LINE_LEN], serial[64];
+	FILE *fi, *fo;
+	int slot;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", cache->registry);
+	tek_arb_registry_lock();
+	fo = fopen(tmpname, "w");
+	if (fo == NULL) {
+		tek_arb_registry_unlock();
+		printf("Error: tek_arb_cache: could not write %s\n", tmpname);
+		return -1;
+	}
+	fi = fopen(cache->registry, "r");
+	if (fi) {
+		while (fgets(line, sizeof(line), fi)) {
+			if (sscanf(line, "%63s", serial) == 1
+			    && strcmp(serial, cache->serial) != 0) {
+				fputs(line, fo);
+			}
+		}
+		fclose(fi);
+	}
+	for (slot = 0; slot < TEK_ARB_SLOTS; slot++) {
+		if (cache->slots[slot].len > 0) {
+			fprintf(fo, "%s %d %016llx %lu %lu\n", cache->serial,
+				slot,
+				(unsigned long long)cache->slots[slot].hash,
+				cache->slots[slot].len,
+				cache->slots[slot].last_used);
+		}
+	}
+	fclose(fo);
+#ifdef WIN32
+	remove(cache->registry);
+#endif
+	if (rename(tmpname, cache->registry) != 0) {
+		tek_arb_registry_unlock();
+		printf("Error: tek_arb_cache: could not write %s\n",
+		       cache->registry);
+		return -1;
+	}
+	tek_arb_registry_unlock();
+	return 0;
+}
+
+/* Reads the registry entries for the AFG that answered *IDN? with idn.
+ * Returns -2 if there's no serial number in it. */
+static int tek_arb_cache_load(TEK_ARB_CACHE * cache, const char *registry,
+			      const char *idn)
+{
+	char line[TEK_ARB_LINE_LEN], serial[64];
+	const char *p, *q;
+	char *s;
+	unsigned long long hash;
+	unsigned long len, last_used;
+	int slot;
+	FILE *f;
+
+	memset(cache, 0, sizeof(TEK_ARB_CACHE));
+	tek_arb_registry_name(cache, registry);
+
+	/* *IDN? is "TEKTRONIX,AFG3102,C012345,SCPI:99.0 FV:1.1.2"; the serial
+	 * number is the third field */
+	p = strchr(idn, ',');
+	p = p ? strchr(p + 1, ',') : NULL;
+	if (p == NULL) {
+		return -2;
+	}
+	p++;
+	q = p + strcspn(p, ",\r\n");
+	snprintf(cache->serial, sizeof(cache->serial), "%.*s", (int)(q - p), p);
+	for (s = cache->serial; *s; s++) {
+		if (*s == ' ' || *s == '\t') {
+			*s = '_';
+		}
+	}
+
+	f = fopen(cache->registry, "r");
+	if (f == NULL) {
+		return 0;	/* nothing known yet */
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63s %d %llx %lu %lu", serial, &slot, &hash,
+			   &len, &last_used) != 5
+		    || strcmp(serial, cache->serial) != 0 || slot < 0
+		    || slot >= TEK_ARB_SLOTS) {
+			continue;
+		}
+		cache->slots[slot].hash = (uint64_t) hash;
+		cache->slots[slot].len = len;
+		cache->slots[slot].last_used = last_used;
+		if (last_used > cache->tick) {
+			cache->tick = last_used;
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+int tek_arb_cache_open(VXI11_CLINK * clink, TEK_ARB_CACHE * cache,
+		       const char *registry)
+{
+	char idn[256];
+
+	memset(idn, 0, sizeof(idn));
+	if (tek_send_and_receive(clink, "*IDN?", idn, sizeof(idn) - 1,
+				 VXI11_READ_TIMEOUT) != 0) {
+		memset(cache, 0, sizeof(TEK_ARB_CACHE));
+		printf("Error: tek_arb_cache_open: no reply to *IDN?\n");
+		return -1;
+	}
+	if (tek_arb_cache_load(cache, registry, idn) != 0) {
+		printf("Error: tek_arb_cache_open: can't find a serial number in \"%s\"\n",
+		       idn);
+		return -2;
+	}
+	return 0;
+}
+
+int tek_arb_cache_note_idn(const char *idn, uint64_t hash, size_t len,
+			   int chan)
+{
+	TEK_ARB_CACHE cache;
+
+	if (tek_arb_cache_load(&cache, NULL, idn) != 0) {
+		return -2;	/* not one we can keep track of */
+	}
+	cache.slots[0].hash = hash;
+	cache.slots[0].len = len;
+	cache.slots[0].last_used = len ? ++cache.tick : 0;
+	if (chan > 0 && chan < TEK_ARB_SLOTS) {
+		cache.slots[chan] = cache.slots[0];
+	}
+	return tek_arb_cache_save(&cache);
+}
+
+int tek_arb_cache_note(VXI11_CLINK * clink, uint64_t hash, size_t len,
+		       int chan)
+{
+	char idn[256];
+
+	memset(idn, 0, sizeof(idn));
+	if (tek_send_and_receive(clink, "*IDN?", idn, sizeof(idn) - 1,
+				 VXI11_READ_TIMEOUT) != 0) {
+		return -1;
+	}
+	return tek_arb_cache_note_idn(idn, hash, len, chan);
+}
+
+int tek_arb_cache_forget(TEK_ARB_CACHE * cache, int slot)
+{
+	if (slot >= TEK_ARB_SLOTS) {
+		return -1;
+	}
+	if (slot < 0) {
+		memset(cache->slots, 0, sizeof(cache->slots));
+	} else {
+		memset(&cache->slots[slot], 0, sizeof(TEK_ARB_SLOT));
+	}
+	return tek_arb_cache_save(cache);
+}
+
+static int tek_arb_holds(TEK_ARB_CACHE * cache, int slot, uint64_t hash,
+			 size_t len)
+{
+	return cache->slots[slot].len == len && cache->slots[slot].hash == hash;
+}
+
+/* Unlike the user memories, the edit memory doesn't survive the AFG being
+ * switched off, so check it's still the length we think it is */
+static int tek_arb_emem_holds(VXI11_CLINK * clink, TEK_ARB_CACHE * cache,
+			      uint64_t hash, size_t len)
+{
+	if (!tek_arb_holds(cache, 0, hash, len)) {
+		return 0;
+	}
+	if (tek_obtain_long_value(clink, "DATA:POINTS? EMEMORY") == (long)len / 2) {
+		return 1;
+	}
+	memset(&cache->slots[0], 0, sizeof(TEK_ARB_SLOT));
+	return 0;
+}
+
+/* The registry only knows what went into the user memories from here; they
+ * could have been changed since from the front panel, or by something
+ * that doesn't use this library. The AFG has no checksum to ask for, and
+ * reading the whole waveform back takes about as long as sending it, so
+ * copy the user memory into the edit memory, and compare its length and a
+ * few of its points with the waveform. Either way, the edit memory then
+ * has whatever the user memory had. */
+static int tek_arb_user_holds(VXI11_CLINK * clink, TEK_ARB_CACHE * cache,
+			      int chan, const char *buf, size_t len,
+			      uint64_t hash)
+{
+	long no_points = (long)len / 2, point, expected;
+	char cmd[64];
+	int i;
+
+	if (!tek_arb_holds(cache, chan, hash, len)) {
+		return 0;
+	}
+	memset(&cache->slots[0], 0, sizeof(TEK_ARB_SLOT));
+	if (tek_send_printf(clink, "TRACE:COPY EMEM,USER%d", chan) != 0
+	    || tek_obtain_long_value(clink, "DATA:POINTS? EMEMORY") != no_points) {
+		memset(&cache->slots[chan], 0, sizeof(TEK_ARB_SLOT));
+		return 0;
+	}
+	for (i = 0; i < TEK_ARB_CHECK_POINTS; i++) {
+		point = (no_points - 1) * i / (TEK_ARB_CHECK_POINTS - 1);
+		expected = (unsigned char)buf[2 * point]
+		    | ((unsigned char)buf[2 * point + 1] << 8);
+		snprintf(cmd, sizeof(cmd), "DATA:DATA:VALUE? EMEMORY,%ld",
+			 point + 1);
+		if (tek_obtain_long_value(clink, cmd) != expected) {
+			printf("USER%d doesn't have the waveform it had, sending it again\n",
+			       chan);
+			memset(&cache->slots[chan], 0, sizeof(TEK_ARB_SLOT));
+			return 0;
+		}
+	}
+	cache->slots[0].hash = hash;
+	cache->slots[0].len = len;
+	return 1;
+}
+
+int tek_afg_send_arb_cached(VXI11_CLINK * clink, TEK_ARB_CACHE * cache,
+			    const char *buf, size_t len, int chan)
+{
+	uint64_t hash = tek_arb_hash(buf, len);
+	char *copy;
+	int slot, ret;
+
+	if (len == 0 || chan < 0 || chan >= TEK_ARB_SLOTS) {
+		printf("Error: tek_afg_send_arb_cached: no waveform, or no USER%d\n",
+		       chan);
+		return -1;
+	}
+
+	/* Which user memory? */
+	if (chan == 0) {
+		for (slot = 1; slot < TEK_ARB_SLOTS; slot++) {
+			if (tek_arb_holds(cache, slot, hash, len)) {
+				chan = slot;
+				break;
+			}
+		}
+	}
+	if (chan == 0) {
+		chan = 1;
+		for (slot = 1; slot < TEK_ARB_SLOTS; slot++) {
+			if (cache->slots[slot].len == 0) {
+				chan = slot;
+				break;
+			}
+			if (cache->slots[slot].last_used
+			    < cache->slots[chan].last_used) {
+				chan = slot;
+			}
+		}
+	}
+
+	if (tek_arb_user_holds(clink, cache, chan, buf, len, hash)) {
+		cache->no_hits++;
+	} else {
+		if (tek_arb_emem_holds(clink, cache, hash, len)) {
+			cache->no_copied++;
+		} else {
+			/* tek_afg_send_arb swaps the bytes in place */
+			copy = (char *)malloc(len);
+			if (copy == NULL) {
+				printf("Error: tek_afg_send_arb_cached: out of memory\n");
+				return -2;
+			}
+			memcpy(copy, buf, len);
+			ret = tek_afg_send_arb(clink, copy, len);
+			free(copy);
+			if (ret != 0) {
+				tek_arb_cache_forget(cache, 0);
+				return -3;
+			}
+			cache->slots[0].hash = hash;
+			cache->slots[0].len = len;
+			cache->no_sent++;
+		}
+		if (tek_send_printf(clink, "TRACE:COPY USER%d,EMEM", chan) != 0) {
+			tek_arb_cache_forget(cache, chan);
+			return -3;
+		}
+		cache->slots[chan].hash = hash;
+		cache->slots[chan].len = len;
+		cache->slots[0].last_used = ++cache->tick;
+	}
+	cache->slots[chan].last_used = ++cache->tick;
+	/* the waveform's there even if we couldn't write that down */
+	tek_arb_cache_save(cache);
+	return chan;
+}
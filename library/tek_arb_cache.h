@@ -0,0 +1,92 @@
+/* tek_arb_cache.h
+ * Keeps track of which arbitrary waveforms are already in an AFG3000's
+ * user memories (USER1-USER4) and in its edit memory (EMEMORY), so that
+ * tek_afg_send_arb_cached() only sends a waveform when the AFG doesn't
+ * already have it. Waveforms are known by a 64 bit hash of their contents
+ * (as they'd be given to tek_afg_send_arb, i.e. little-endian) and length.
+ *
+ * The registry lives in a small text file on the host, so it carries over
+ * from one run to the next; each AFG has its own entries, known by the
+ * serial number from *IDN?. Everything in the library that sends a
+ * waveform (tek_afg_send_arb(), tek_afg_deploy(), tek_async_upload_arb())
+ * writes down what it sent, or that it's no longer known. Other changes
+ * (the front panel, another program) aren't seen, but a user memory is
+ * checked against the waveform before it's used without sending it, and
+ * you can call tek_arb_cache_forget() to be sure.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_ARB_CACHE_H_
+#define _TEK_ARB_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tek_vxi11.h"
+
+/* Slot 0 is the edit memory, 1-4 are USER1-USER4 */
+#define TEK_ARB_SLOTS		5
+
+typedef struct {
+	uint64_t hash;
+	unsigned long len;	/* 0 if we don't know what's there */
+	unsigned long last_used;
+} TEK_ARB_SLOT;
+
+typedef struct {
+	char registry[256];
+	char serial[64];
+	TEK_ARB_SLOT slots[TEK_ARB_SLOTS];
+	unsigned long tick;	/* for the least recently used */
+	unsigned long no_sent, no_copied, no_hits;
+} TEK_ARB_CACHE;
+
+/* Reads the registry entries for the AFG on clink. registry is the file to
+ * keep them in; if NULL, $TEK_ARB_CACHE, or else ~/.tek_arb_cache.
+ * Returns 0, or negative if the AFG wouldn't say what it is. */
+tk_EXPORT int tek_arb_cache_open(VXI11_CLINK * clink, TEK_ARB_CACHE * cache,
+				 const char *registry);
+
+/* Writes down that the edit memory, and USER<chan> if chan is 1-4, of the
+ * AFG on clink now hold the waveform with this hash and length, or, if len
+ * is 0, that we don't know what they hold. For the functions that send
+ * waveforms; the _idn version is for the AFG that answered *IDN? with idn.
+ * Returns 0, or negative if the registry wasn't changed. */
+tk_EXPORT int tek_arb_cache_note(VXI11_CLINK * clink, uint64_t hash,
+				 size_t len, int chan);
+tk_EXPORT int tek_arb_cache_note_idn(const char *idn, uint64_t hash,
+				     size_t len, int chan);
+
+/* Forgets what's in a slot (0-4), or in all of them if slot < 0 */
+tk_EXPORT int tek_arb_cache_forget(TEK_ARB_CACHE * cache, int slot);
+
+/* Makes sure the waveform in buf is in USER<chan>, or if chan is 0, in
+ * whichever user memory it's already in; failing that, the one that's
+ * empty or has gone longest without being used. Only sends the waveform if
+ * neither that user memory (checked with DATA:POINTS? and a few points of
+ * it) nor the edit memory has it already; if just the edit memory does,
+ * it's copied across. Unlike tek_afg_send_arb, buf is
+ * left alone. Returns the user memory (1-4) it's in, or negative. */
+tk_EXPORT int tek_afg_send_arb_cached(VXI11_CLINK * clink,
+				      TEK_ARB_CACHE * cache, const char *buf,
+				      size_t len, int chan);
+
+/* The hash that the waveforms are known by */
+tk_EXPORT uint64_t tek_arb_hash(const char *buf, size_t len);
+
+#endif
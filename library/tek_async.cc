@@ -0,0 +1,921 @@
+/* tek_async.cc
+ * Coroutine versions of the raw socket transport and a few of the scope and
+ * AFG functions, all run from one poll() loop. See tek_async.h.
+ *
+ * Each link has a read-ahead buffer and reads replies the same way as
+ * tek_socket.cc does, except that its socket is non-blocking: whenever a
+ * recv() or sendmsg() would block, the task co_awaits the link, which
+ * parks it there until poll() says the link is ready (or it times out).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "tek_async.h"
+#include "tek_transport.h"
+#include "tek_arb_cache.h"
+
+/* As in tek_socket.cc */
+#define TEK_ASYNC_PORT		"4000"
+#define TEK_ASYNC_READAHEAD	65536
+#define TEK_ASYNC_RCVBUF	(4 * 1024 * 1024)
+
+typedef std::coroutine_handle<tek_task<long>::promise_type> TEK_LOOP_HANDLE;
+
+typedef struct {
+	TEK_LOOP_HANDLE h;
+	long *result;
+	int started;
+} TEK_LOOP_TASK;
+
+struct tek_loop {
+	TEK_ASYNC_LINK *links;	/* all the open ones */
+	TEK_LOOP_TASK *tasks;
+	int no_tasks, max_tasks;
+	struct pollfd *pfds;	/* for the links that something's waiting on */
+	TEK_ASYNC_LINK **pfd_links;
+	int max_pfds;
+};
+
+struct tek_async_link {
+	TEK_LOOP *loop;
+	TEK_ASYNC_LINK *next;
+	int fd;
+	unsigned long timeout;	/* for connecting and sending */
+
+	/* The task waiting for the link, if there is one */
+	std::coroutine_handle<> waiting;
+	short events;
+	double deadline;	/* tek_time_us(), or 0 for none */
+	int timed_out;
+
+	char data_source[16];	/* as TEK_LINK_STATE's */
+	char rbuf[TEK_ASYNC_READAHEAD];
+	size_t rpos;		/* start of unread data in rbuf */
+	size_t rlen;		/* end of unread data in rbuf */
+};
+
+/* co_await this to wait until the link is readable (POLLIN) or writable
+ * (POLLOUT). Gives 0, or -1 if timeout (ms, 0 for never) ran out first. */
+struct tek_async_wait {
+	TEK_ASYNC_LINK *link;
+	short events;
+	unsigned long timeout;
+
+	bool await_ready() noexcept {
+		return false;
+	}
+	void await_suspend(std::coroutine_handle<> h) noexcept {
+		link->waiting = h;
+		link->events = events;
+		link->timed_out = 0;
+		link->deadline = timeout ? tek_time_us() + 1000.0 * timeout : 0;
+	}
+	int await_resume() noexcept {
+		return link->timed_out ? -1 : 0;
+	}
+};
+
+/*****************************************************************************
+ * The loop
+ *****************************************************************************/
+
+TEK_LOOP *tek_loop_new(void)
+{
+	return (TEK_LOOP *) calloc(1, sizeof(TEK_LOOP));
+}
+
+void tek_loop_free(TEK_LOOP * loop)
+{
+	int i;
+
+	if (!loop) {
+		return;
+	}
+	for (i = 0; i < loop->no_tasks; i++) {
+		loop->tasks[i].h.destroy();
+	}
+	while (loop->links) {
+		tek_async_close(loop->links);
+	}
+	free(loop->tasks);
+	free(loop->pfds);
+	free(loop->pfd_links);
+	free(loop);
+}
+
+int tek_loop_spawn(TEK_LOOP * loop, tek_task<long> task, long *result)
+{
+	TEK_LOOP_TASK *tasks;
+	int n;
+
+	if (loop->no_tasks == loop->max_tasks) {
+		n = loop->max_tasks ? 2 * loop->max_tasks : 16;
+		tasks = (TEK_LOOP_TASK *) realloc(loop->tasks,
+						  n * sizeof(TEK_LOOP_TASK));
+		if (!tasks) {
+			return -1;
+		}
+		loop->tasks = tasks;
+		loop->max_tasks = n;
+	}
+	loop->tasks[loop->no_tasks].h = task.release();
+	loop->tasks[loop->no_tasks].result = result;
+	loop->tasks[loop->no_tasks].started = 0;
+	loop->no_tasks++;
+	return 0;
+}
+
+/* Starts any new tasks, and clears away any that have finished. Returns
+ * how many are left. */
+static int tek_loop_tasks(TEK_LOOP * loop)
+{
+	TEK_LOOP_TASK *t;
+	int i = 0;
+
+	while (i < loop->no_tasks) {
+		/* starting it may spawn more, and move loop->tasks */
+		if (!loop->tasks[i].started) {
+			loop->tasks[i].started = 1;
+			loop->tasks[i].h.resume();
+		}
+		t = &loop->tasks[i];
+		if (!t->h.done()) {
+			i++;
+			continue;
+		}
+		if (t->result) {
+			*t->result = t->h.promise().value;
+		}
+		t->h.destroy();
+		*t = loop->tasks[--loop->no_tasks];
+	}
+	return loop->no_tasks;
+}
+
+int tek_loop_run(TEK_LOOP * loop)
+{
+	TEK_ASYNC_LINK *link, **pfd_links;
+	struct pollfd *pfds;
+	std::coroutine_handle<> h;
+	double now, first;
+	int i, n, ms, ret;
+
+	while (tek_loop_tasks(loop) > 0) {
+		/* Who's waiting for what, and for how long */
+		n = 0;
+		first = 0;
+		for (link = loop->links; link; link = link->next) {
+			if (!link->waiting) {
+				continue;
+			}
+			if (n == loop->max_pfds) {
+				pfds = (struct pollfd *)realloc(loop->pfds,
+								2 * (n + 8) * sizeof(struct pollfd));
+				if (pfds) {
+					loop->pfds = pfds;
+				}
+				pfd_links = (TEK_ASYNC_LINK **)
+				    realloc(loop->pfd_links,
+					    2 * (n + 8) * sizeof(TEK_ASYNC_LINK *));
+				if (pfd_links) {
+					loop->pfd_links = pfd_links;
+				}
+				if (!pfds || !pfd_links) {
+					return -1;
+				}
+				loop->max_pfds = 2 * (n + 8);
+			}
+			loop->pfds[n].fd = link->fd;
+			loop->pfds[n].events = link->events;
+			loop->pfds[n].revents = 0;
+			loop->pfd_links[n] = link;
+			if (link->deadline > 0
+			    && (first == 0 || link->deadline < first)) {
+				first = link->deadline;
+			}
+			n++;
+		}
+		if (n == 0) {
+			/* Can only happen if a task is co_awaiting something
+			 * that isn't ours */
+			printf("tek_loop_run: tasks left, but none of them waiting for a link\n");
+			return -1;
+		}
+
+		ms = -1;
+		if (first > 0) {
+			now = tek_time_us();
+			ms = (first > now) ? (int)ceil((first - now) / 1000) : 0;
+		}
+		do {
+			ret = poll(loop->pfds, n, ms);
+		} while (ret < 0 && errno == EINTR);
+		if (ret < 0) {
+			printf("tek_loop_run: poll() failed\n");
+			return -1;
+		}
+
+		/* Carry on with each task whose link is ready, or whose time
+		 * is up. (Each one runs until it has to wait again.) */
+		now = tek_time_us();
+		for (i = 0; i < n; i++) {
+			link = loop->pfd_links[i];
+			if (loop->pfds[i].revents == 0) {
+				if (link->deadline == 0 || now < link->deadline) {
+					continue;
+				}
+				link->timed_out = 1;
+			}
+			h = link->waiting;
+			link->waiting = nullptr;
+			h.resume();
+		}
+	}
+	return 0;
+}
+
+/*****************************************************************************
+ * Links
+ *****************************************************************************/
+
+static TEK_ASYNC_LINK *tek_async_link_new(TEK_LOOP * loop,
+					  unsigned long timeout)
+{
+	TEK_ASYNC_LINK *link = new TEK_ASYNC_LINK();
+
+	link->loop = loop;
+	link->fd = -1;
+	link->timeout = timeout;
+	link->next = loop->links;
+	loop->links = link;
+	return link;
+}
+
+void tek_async_close(TEK_ASYNC_LINK * link)
+{
+	TEK_ASYNC_LINK **l;
+
+	if (!link) {
+		return;
+	}
+	for (l = &link->loop->links; *l; l = &(*l)->next) {
+		if (*l == link) {
+			*l = link->next;
+			break;
+		}
+	}
+	if (link->fd >= 0) {
+		close(link->fd);
+	}
+	delete link;
+}
+
+tek_task<long> tek_async_open(TEK_LOOP * loop, const char *address,
+			      unsigned long timeout, TEK_ASYNC_LINK ** link)
+{
+	TEK_ASYNC_LINK *l;
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *port = TEK_ASYNC_PORT;
+	int one = 1, rcvbuf = TEK_ASYNC_RCVBUF;
+	int ret, err;
+	socklen_t err_len;
+
+	*link = NULL;
+	if (strncmp(address, "socket:", 7) == 0) {
+		address += 7;
+	}
+	if (tek_socket_split_address(address, host, sizeof(host), &port) != 0) {
+		printf("tek_async_open: can't make sense of address '%s'\n",
+		       address);
+		co_return -1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	ret = getaddrinfo(host, port, &hints, &res);
+	if (ret != 0) {
+		printf("tek_async_open: could not look up %s: %s\n", host,
+		       gai_strerror(ret));
+		co_return -1;
+	}
+
+	l = tek_async_link_new(loop, timeout);
+	for (ai = res; ai; ai = ai->ai_next) {
+		l->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (l->fd < 0) {
+			continue;
+		}
+		fcntl(l->fd, F_SETFL, fcntl(l->fd, F_GETFL) | O_NONBLOCK);
+		setsockopt(l->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+			   sizeof(rcvbuf));
+		if (connect(l->fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			break;
+		}
+		if (errno == EINPROGRESS) {
+			ret = co_await tek_async_wait {l, POLLOUT, timeout};
+			err = -1;
+			err_len = sizeof(err);
+			if (ret == 0) {
+				getsockopt(l->fd, SOL_SOCKET, SO_ERROR, &err,
+					   &err_len);
+			}
+			if (err == 0) {
+				break;
+			}
+		}
+		close(l->fd);
+		l->fd = -1;
+	}
+	freeaddrinfo(res);
+	if (l->fd < 0) {
+		printf("tek_async_open: could not connect to %s port %s\n",
+		       host, port);
+		tek_async_close(l);
+		co_return -1;
+	}
+	setsockopt(l->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	*link = l;
+	co_return 0;
+}
+
+/*****************************************************************************
+ * Sending and receiving
+ *
+ * NB: gcc 12 gets coroutines wrong with a co_await inside an if (...), so
+ * it's always ret = co_await ...; if (ret ...) here.
+ *****************************************************************************/
+
+/* Sends the lot, waiting for room whenever the socket's full */
+static tek_task<long> tek_async_writev(TEK_ASYNC_LINK * l, struct iovec *iov,
+				       int cnt)
+{
+	struct msghdr msg;
+	ssize_t n;
+	int first = 0, ret;
+
+	while (first < cnt) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov + first;
+		msg.msg_iovlen = cnt - first;
+		n = sendmsg(l->fd, &msg, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				printf("tek_async: error sending command\n");
+				co_return -1;
+			}
+			ret = co_await tek_async_wait {l, POLLOUT, l->timeout};
+			if (ret < 0) {
+				printf("tek_async: timed out sending command\n");
+				co_return -1;
+			}
+			continue;
+		}
+		while (first < cnt && (size_t)n >= iov[first].iov_len) {
+			n -= iov[first].iov_len;
+			first++;
+		}
+		if (first < cnt) {
+			iov[first].iov_base = (char *)iov[first].iov_base + n;
+			iov[first].iov_len -= n;
+		}
+	}
+	co_return 0;
+}
+
+/* Receives whatever's there (at least one byte), waiting if there's
+ * nothing yet */
+static tek_task<long> tek_async_recv(TEK_ASYNC_LINK * l, char *buf,
+				     size_t len, unsigned long timeout)
+{
+	ssize_t n;
+	int ret;
+
+	for (;;) {
+		n = recv(l->fd, buf, len, 0);
+		if (n > 0) {
+			co_return (long)n;
+		}
+		if (n == 0) {
+			printf("tek_async: connection closed by instrument\n");
+			co_return -1;
+		}
+		if (errno == EINTR) {
+			continue;
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			printf("tek_async: error reading reply\n");
+			co_return -1;
+		}
+		ret = co_await tek_async_wait {l, POLLIN, timeout};
+		if (ret < 0) {
+			printf("tek_async: timed out waiting for reply\n");
+			co_return -1;
+		}
+	}
+}
+
+/* As tek_socket_fill */
+static tek_task<long> tek_async_fill(TEK_ASYNC_LINK * l, unsigned long timeout)
+{
+	long n;
+
+	if (l->rpos == l->rlen) {
+		l->rpos = l->rlen = 0;
+	} else if (l->rpos > 0 && l->rlen == TEK_ASYNC_READAHEAD) {
+		memmove(l->rbuf, l->rbuf + l->rpos, l->rlen - l->rpos);
+		l->rlen -= l->rpos;
+		l->rpos = 0;
+	}
+	n = co_await tek_async_recv(l, l->rbuf + l->rlen,
+				    TEK_ASYNC_READAHEAD - l->rlen, timeout);
+	if (n < 0) {
+		co_return -1;
+	}
+	l->rlen += n;
+	co_return (long)(l->rlen - l->rpos);
+}
+
+/* Makes sure there's at least one unread byte in the read-ahead buffer */
+static tek_task<long> tek_async_peek(TEK_ASYNC_LINK * l, unsigned long timeout)
+{
+	if (l->rpos < l->rlen) {
+		co_return 0;
+	}
+	co_return co_await tek_async_fill(l, timeout);
+}
+
+/* As tek_socket_read: exactly len bytes, the bulk of them straight into
+ * buf (or thrown away if buf is NULL) */
+static tek_task<long> tek_async_read(TEK_ASYNC_LINK * l, char *buf,
+				     size_t len, unsigned long timeout)
+{
+	size_t got, n;
+	long r;
+
+	n = l->rlen - l->rpos;
+	if (n > len) {
+		n = len;
+	}
+	if (buf) {
+		memcpy(buf, l->rbuf + l->rpos, n);
+	}
+	l->rpos += n;
+	got = n;
+	while (got < len) {
+		if (!buf || len - got < TEK_ASYNC_READAHEAD / 4) {
+			r = co_await tek_async_fill(l, timeout);
+			if (r < 0) {
+				co_return -1;
+			}
+			n = l->rlen - l->rpos;
+			if (n > len - got) {
+				n = len - got;
+			}
+			if (buf) {
+				memcpy(buf + got, l->rbuf + l->rpos, n);
+			}
+			l->rpos += n;
+			got += n;
+			continue;
+		}
+		r = co_await tek_async_recv(l, buf + got, len - got, timeout);
+		if (r < 0) {
+			co_return -1;
+		}
+		got += r;
+	}
+	co_return (long)got;
+}
+
+/* As tek_socket_block_header: hdr needs room for 12 bytes */
+static tek_task<long> tek_async_block_header(TEK_ASYNC_LINK * l, char *hdr,
+					     int *hdr_len,
+					     unsigned long timeout)
+{
+	int ndigits, i;
+	long n = 0, ret;
+
+	ret = co_await tek_async_read(l, hdr, 2, timeout);
+	if (ret < 0) {
+		co_return -1;
+	}
+	ndigits = hdr[1] - '0';
+	if (ndigits < 0 || ndigits > 9) {
+		printf("tek_async: bad data block header\n");
+		co_return -1;
+	}
+	ret = co_await tek_async_read(l, hdr + 2, ndigits, timeout);
+	if (ret < 0) {
+		co_return -1;
+	}
+	for (i = 0; i < ndigits; i++) {
+		n = n * 10 + (hdr[2 + i] - '0');
+	}
+	*hdr_len = 2 + ndigits;
+	co_return n;
+}
+
+static tek_task<long> tek_async_skip_newline(TEK_ASYNC_LINK * l,
+					     unsigned long timeout)
+{
+	long ret;
+
+	ret = co_await tek_async_peek(l, timeout);
+	if (ret < 0) {
+		co_return -1;
+	}
+	if (l->rbuf[l->rpos] == '\n') {
+		l->rpos++;
+	}
+	co_return 0;
+}
+
+tek_task<long> tek_async_send(TEK_ASYNC_LINK * link, const char *cmd)
+{
+	struct iovec iov[2];
+	char nl = '\n';
+	size_t len = strlen(cmd);
+
+	/* As tek_send(), so a DATA:SOURCE sent by hand isn't skipped later */
+	if (tek_cmd_changes_data_source(cmd, len)) {
+		link->data_source[0] = '\0';
+	}
+
+	/* Newline on the end, in the same write, as tek_socket_send() */
+	iov[0].iov_base = (void *)cmd;
+	iov[0].iov_len = len;
+	iov[1].iov_base = &nl;
+	iov[1].iov_len = 1;
+	co_return co_await tek_async_writev(link, iov,
+					    (len > 0 && cmd[len - 1] == '\n')
+					    ? 1 : 2);
+}
+
+tek_task<long> tek_async_send_data_block(TEK_ASYNC_LINK * link,
+					 const char *cmd, const char *buf,
+					 size_t len)
+{
+	struct iovec iov[3];
+	char *hdr;
+	char nl = '\n';
+	size_t cmd_len = strlen(cmd);
+	long ret;
+
+	if (tek_cmd_changes_data_source(cmd, cmd_len)) {
+		link->data_source[0] = '\0';
+	}
+	hdr = (char *)malloc(cmd_len + 11);
+	if (!hdr) {
+		co_return -1;
+	}
+	snprintf(hdr, cmd_len + 11, "%s#8%08lu", cmd, (unsigned long)len);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = cmd_len + 10;
+	iov[1].iov_base = (void *)buf;
+	iov[1].iov_len = len;
+	iov[2].iov_base = &nl;
+	iov[2].iov_len = 1;
+	ret = co_await tek_async_writev(link, iov, 3);
+	free(hdr);
+	co_return ret;
+}
+
+/* As tek_socket_receive */
+tek_task<long> tek_async_receive(TEK_ASYNC_LINK * link, char *buf,
+				 size_t len, unsigned long timeout)
+{
+	TEK_ASYNC_LINK *l = link;
+	char *nl;
+	long n, ret;
+	int hdr_len;
+	size_t got = 0, avail;
+
+	ret = co_await tek_async_peek(l, timeout);
+	if (ret < 0) {
+		co_return -1;
+	}
+	if (l->rbuf[l->rpos] == '#') {
+		if (len < 12) {
+			co_return -100;
+		}
+		n = co_await tek_async_block_header(l, buf, &hdr_len, timeout);
+		if (n < 0) {
+			co_return -1;
+		}
+		if ((size_t)(hdr_len + n) >= len) {
+			printf("tek_async: buffer too small for reply of %ld bytes\n",
+			       hdr_len + n);
+			co_await tek_async_read(l, NULL, n, timeout);
+			co_await tek_async_skip_newline(l, timeout);
+			co_return -100;
+		}
+		ret = co_await tek_async_read(l, buf + hdr_len, n, timeout);
+		if (ret < 0) {
+			co_return -1;
+		}
+		co_await tek_async_skip_newline(l, timeout);
+		buf[hdr_len + n] = '\n';
+		co_return hdr_len + n + 1;
+	}
+	for (;;) {
+		avail = l->rlen - l->rpos;
+		nl = (char *)memchr(l->rbuf + l->rpos, '\n', avail);
+		if (nl) {
+			avail = nl - (l->rbuf + l->rpos) + 1;
+		}
+		if (got + avail > len) {
+			printf("tek_async: buffer too small for reply\n");
+			co_return -100;
+		}
+		memcpy(buf + got, l->rbuf + l->rpos, avail);
+		l->rpos += avail;
+		got += avail;
+		if (nl) {
+			co_return (long)got;
+		}
+		ret = co_await tek_async_fill(l, timeout);
+		if (ret < 0) {
+			co_return -1;
+		}
+	}
+}
+
+/* As tek_socket_receive_data_block */
+tek_task<long> tek_async_receive_data_block(TEK_ASYNC_LINK * link, char *buf,
+					    size_t len, unsigned long timeout)
+{
+	TEK_ASYNC_LINK *l = link;
+	char hdr[12];
+	int hdr_len;
+	long n, ret;
+
+	ret = co_await tek_async_peek(l, timeout);
+	if (ret < 0) {
+		co_return -1;
+	}
+	if (l->rbuf[l->rpos] != '#') {
+		printf("tek_async_receive_data_block: data block does not begin with '#'\n");
+		co_return -3;
+	}
+	n = co_await tek_async_block_header(l, hdr, &hdr_len, timeout);
+	if (n < 0) {
+		co_return -1;
+	}
+	if ((size_t)n > len) {
+		printf("tek_async_receive_data_block: block of %ld bytes is too big for buffer of %lu\n",
+		       n, (unsigned long)len);
+		co_await tek_async_read(l, NULL, n, timeout);
+		co_await tek_async_skip_newline(l, timeout);
+		co_return -3;
+	}
+	ret = co_await tek_async_read(l, buf, n, timeout);
+	if (ret < 0) {
+		co_return -1;
+	}
+	co_await tek_async_skip_newline(l, timeout);
+	co_return n;
+}
+
+tek_task<long> tek_async_query(TEK_ASYNC_LINK * link, const char *cmd,
+			       char *buf, size_t len, unsigned long timeout)
+{
+	long bytes_returned, ret;
+
+	ret = co_await tek_async_send(link, cmd);
+	if (ret != 0) {
+		printf("Error: tek_async_query: could not send cmd.\n");
+		co_return -1;
+	}
+	bytes_returned = co_await tek_async_receive(link, buf, len, timeout);
+	if (bytes_returned <= 0) {
+		printf("Error: tek_async_query: problem reading reply.\n");
+		co_return -2;
+	}
+	if ((size_t)bytes_returned < len) {
+		buf[bytes_returned] = '\0';
+	}
+	co_return 0;
+}
+
+tek_task<long> tek_async_obtain_long(TEK_ASYNC_LINK * link, const char *cmd,
+				     unsigned long timeout)
+{
+	char buf[50];
+	long ret;
+
+	memset(buf, 0, 50);
+	ret = co_await tek_async_query(link, cmd, buf, 49, timeout);
+	if (ret != 0) {
+		printf("Returning 0\n");
+		co_return 0;
+	}
+	co_return strtol(buf, (char **)NULL, 10);
+}
+
+tek_task<double> tek_async_obtain_double(TEK_ASYNC_LINK * link,
+					 const char *cmd,
+					 unsigned long timeout)
+{
+	char buf[50];
+	long ret;
+
+	memset(buf, 0, 50);
+	ret = co_await tek_async_query(link, cmd, buf, 49, timeout);
+	if (ret != 0) {
+		printf("Returning 0.0\n");
+		co_return 0.0;
+	}
+	co_return strtod(buf, (char **)NULL);
+}
+
+/*****************************************************************************
+ * Scope and AFG
+ *****************************************************************************/
+
+tek_task<long> tek_async_scope_init(TEK_ASYNC_LINK * link)
+{
+	long ret;
+
+	ret = co_await tek_async_send(link, ":HEADER 0");	/* no headers in replies */
+	if (ret < 0) {
+		printf("error in tek_async_scope_init, could not send command ':HEADER 0'\n");
+		co_return ret;
+	}
+	co_await tek_async_send(link, ":DATA:WIDTH 2");
+	co_await tek_async_send(link, ":DATA:ENCDG SRIBINARY");
+	co_return 0;
+}
+
+tek_task<long> tek_async_set_for_capture(TEK_ASYNC_LINK * link,
+					 int clear_sweeps, long record_length,
+					 unsigned long timeout)
+{
+	char cmd[64];
+	long no_acq_points, no_points, start, stop;
+	double hor_scale, sample_rate;
+
+	if (record_length > 0) {
+		snprintf(cmd, sizeof(cmd), "HOR:RECORDLENGTH %ld",
+			 record_length);
+		co_await tek_async_send(link, cmd);
+	}
+	/* Not clearing sweeps means RUNSTOP mode, as in
+	 * tek_scope_set_for_capture() */
+	if (clear_sweeps == 0) {
+		co_await tek_async_send(link, "ACQUIRE:STATE 0");
+		co_await tek_async_obtain_long(link, "*OPC?", timeout);
+	}
+
+	no_acq_points = co_await tek_async_obtain_long(link, "HOR:RECORD?",
+						       timeout);
+	hor_scale = co_await tek_async_obtain_double(link, "HOR:MAIN:SCALE?",
+						     timeout);
+	sample_rate = co_await tek_async_obtain_double(link,
+						       "HOR:MAIN:SAMPLERATE?",
+						       timeout);
+	no_points = (long)round(sample_rate * 10 * hor_scale);
+	if (no_acq_points <= 0 || no_points <= 0) {
+		printf("tek_async_set_for_capture: could not work out the number of points\n");
+		co_return -1;
+	}
+
+	start = ((no_acq_points - no_points) / 2) + 1;
+	stop = ((no_acq_points + no_points) / 2);
+	snprintf(cmd, sizeof(cmd), "DATA:START %ld", start);
+	co_await tek_async_send(link, cmd);
+	snprintf(cmd, sizeof(cmd), "DATA:STOP %ld", stop);
+	co_await tek_async_send(link, cmd);
+	if (clear_sweeps == 1) {
+		co_await tek_async_send(link, "ACQUIRE:STOPAFTER SEQUENCE");
+	}
+	co_return 2 * no_points;
+}
+
+tek_task<long> tek_async_capture(TEK_ASYNC_LINK * link, const char *source,
+				 int clear_sweeps, char *buf, size_t len,
+				 unsigned long timeout)
+{
+	char src[16];
+	char cmd[64];
+	long opc_value, bytes_returned, ret;
+
+	snprintf(src, sizeof(src), "%s", source);
+	tek_scope_channel_str(src);
+
+	/* set the source channel, if it needs setting (and remember it once
+	 * it's been sent, as tek_scope_get_data() does) */
+	if (strcmp(link->data_source, src) == 0) {
+		cmd[0] = '\0';
+	} else {
+		snprintf(cmd, sizeof(cmd), "DATA:SOURCE %s;:", src);
+	}
+
+	/* This is where all the waiting is: *OPC? doesn't reply until the
+	 * acquisition is complete, and meanwhile the loop gets on with
+	 * everyone else */
+	if (clear_sweeps == 1) {
+		strcat(cmd, "ACQUIRE:STATE 1;*OPC?");
+		opc_value = co_await tek_async_obtain_long(link, cmd, timeout);
+		if (opc_value != 1) {
+			printf
+			    ("OPC? request returned %ld, (should be 1), maybe you\nneed a longer timeout?\n",
+			     opc_value);
+			printf("Not grabbing any data, returning -1\n");
+			link->data_source[0] = '\0';
+			co_return -1;
+		}
+		snprintf(link->data_source, sizeof(link->data_source), "%s",
+			 src);
+		cmd[0] = '\0';
+	}
+	strcat(cmd, "CURVE?");
+	ret = co_await tek_async_send(link, cmd);
+	if (ret < 0) {
+		printf("error, could not send CURVE? cmd, quitting...\n");
+		link->data_source[0] = '\0';
+		co_return ret;
+	}
+	snprintf(link->data_source, sizeof(link->data_source), "%s", src);
+	bytes_returned = co_await tek_async_receive_data_block(link, buf, len,
+							       timeout);
+	if (bytes_returned < 0) {
+		link->data_source[0] = '\0';
+	}
+	co_return bytes_returned;
+}
+
+tek_task<long> tek_async_upload_arb(TEK_ASYNC_LINK * link, char *buf,
+				    size_t len, int chan,
+				    unsigned long timeout)
+{
+	uint64_t hash = tek_arb_hash(buf, len);
+	char cmd[32], idn[256];
+	long ret;
+
+	/* for tek_arb_cache.h's registry, whichever way it goes */
+	memset(idn, 0, sizeof(idn));
+	ret = co_await tek_async_query(link, "*IDN?", idn, sizeof(idn) - 1,
+				       timeout);
+	if (ret != 0) {
+		co_return ret;
+	}
+
+	tek_afg_swap_bytes(buf, len);	/* little endian -> big endian */
+	ret = co_await tek_async_send_data_block(link, ":TRACE:DATA EMEMORY,",
+						 buf, len);
+	if (ret < 0) {
+		printf("tek_async_upload_arb: error sending waveform data...\n");
+		tek_arb_cache_note_idn(idn, 0, 0, chan);
+		co_return ret;
+	}
+	if (chan > 0 && chan < 5) {
+		snprintf(cmd, sizeof(cmd), "TRACE:COPY USER%d,EMEM", chan);
+		ret = co_await tek_async_send(link, cmd);
+		if (ret < 0) {
+			tek_arb_cache_note_idn(idn, 0, 0, chan);
+			co_return ret;
+		}
+	}
+	ret = co_await tek_async_obtain_long(link, "*OPC?", timeout);
+	if (ret != 1) {
+		printf("tek_async_upload_arb: no *OPC? reply\n");
+		tek_arb_cache_note_idn(idn, 0, 0, chan);
+		co_return -1;
+	}
+	tek_arb_cache_note_idn(idn, hash, len, chan);
+	co_return 0;
+}
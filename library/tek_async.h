@@ -0,0 +1,222 @@
+/* tek_async.h
+ * Driving lots of instruments from one thread. The ordinary calls
+ * (tek_scope_get_data() and friends) block until the instrument answers,
+ * so talking to twenty scopes at once means twenty threads, most of them
+ * sat waiting for *OPC?. Here, instead, each operation is a C++20
+ * coroutine that you co_await: when it has to wait for an instrument it
+ * hands the thread back to an event loop, which poll()s all the links at
+ * once and carries on with whichever coroutine's instrument is ready.
+ *
+ * Only the raw socket transport (see tek_socket.cc) can be done this way;
+ * the VXI11 library's RPC calls block, and there's no getting round that.
+ * So it has its own links, opened with tek_async_open(), rather than
+ * VXI11_CLINKs. Only one operation at a time on each link, as you'd expect.
+ * Anything you pass in (commands, buffers) has to stay put until the task
+ * is done, which it will if you co_await it straight away.
+ *
+ * Anything that includes this needs -std=c++20 (gcc 10 or later). Not
+ * available on Windows (yet). Beware: gcc 12 gets it wrong if there's a
+ * co_await inside an if (...); do ret = co_await ...; if (ret ...) instead.
+ *
+ * e.g.
+ *	tek_task<long> grab(TEK_LOOP * loop, const char *ip, char *buf,
+ *			    size_t len)
+ *	{
+ *		TEK_ASYNC_LINK *link;
+ *		long ret;
+ *
+ *		ret = co_await tek_async_open(loop, ip, 10000, &link);
+ *		if (ret != 0)
+ *			co_return ret;
+ *		co_await tek_async_scope_init(link);
+ *		ret = co_await tek_async_capture(link, "CH1", 1, buf, len,
+ *						 10000);
+ *		tek_async_close(link);
+ *		co_return ret;
+ *	}
+ *	...
+ *	for (i = 0; i < no_scopes; i++)
+ *		tek_loop_spawn(loop, grab(loop, ip[i], buf[i], len), &ret[i]);
+ *	tek_loop_run(loop);
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_ASYNC_H_
+#define _TEK_ASYNC_H_
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <coroutine>
+
+#include "tek_vxi11.h"
+
+typedef struct tek_loop TEK_LOOP;
+typedef struct tek_async_link TEK_ASYNC_LINK;
+
+/* What every async operation returns, and what your own coroutines that
+ * use them should return too. It doesn't start until it's co_awaited (or
+ * handed to tek_loop_spawn), and whoever co_awaits it carries on as soon
+ * as it's finished, without going back to the loop. */
+template <typename T> class tek_task {
+ public:
+	struct promise_type;
+	typedef std::coroutine_handle<promise_type> handle;
+
+	struct final_awaiter {
+		bool await_ready() noexcept {
+			return false;
+		}
+		std::coroutine_handle<> await_suspend(handle h) noexcept {
+			if (h.promise().continuation) {
+				return h.promise().continuation;
+			}
+			return std::noop_coroutine();
+		}
+		void await_resume() noexcept {
+		}
+	};
+
+	struct promise_type {
+		T value;
+		std::coroutine_handle<> continuation;
+
+		tek_task get_return_object() {
+			return tek_task(handle::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() noexcept {
+			return {};
+		}
+		final_awaiter final_suspend() noexcept {
+			return {};
+		}
+		void return_value(T v) {
+			value = v;
+		}
+		/* Nothing in here throws */
+		void unhandled_exception() {
+			abort();
+		}
+	};
+
+	tek_task(tek_task && t) noexcept : h(t.h) {
+		t.h = nullptr;
+	}
+	tek_task(const tek_task &) = delete;
+	~tek_task() {
+		if (h) {
+			h.destroy();
+		}
+	}
+
+	bool await_ready() noexcept {
+		return false;
+	}
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+		h.promise().continuation = c;
+		return h;
+	}
+	T await_resume() {
+		return h.promise().value;
+	}
+
+	/* For tek_loop_spawn: the loop looks after it from then on */
+	handle release() {
+		handle r = h;
+		h = nullptr;
+		return r;
+	}
+
+ private:
+	explicit tek_task(handle h_) : h(h_) {
+	}
+	handle h;
+};
+
+/* The event loop. One per thread; everything on its links has to be done
+ * from tasks it's running. */
+tk_EXPORT TEK_LOOP *tek_loop_new(void);
+tk_EXPORT void tek_loop_free(TEK_LOOP * loop);
+
+/* Hands a task to the loop, to start when it runs. When it finishes, what
+ * it returned goes in *result (if result isn't NULL). Can be called from
+ * inside a running task, too. Returns 0, or -1 if out of memory. */
+tk_EXPORT int tek_loop_spawn(TEK_LOOP * loop, tek_task<long> task,
+			     long *result);
+
+/* Runs until all the tasks it's been given have finished. Returns 0, or
+ * -1 if poll() fails. */
+tk_EXPORT int tek_loop_run(TEK_LOOP * loop);
+
+/* Links. The address is as for tek_socket_open, HOST or HOST:PORT, with or
+ * without "socket:" in front; timeout (ms) is for connecting, and for
+ * sending anything afterwards. The name lookup isn't asynchronous, so use
+ * IP addresses if there are a lot of them. Returns 0 or -1. */
+tk_EXPORT tek_task<long> tek_async_open(TEK_LOOP * loop, const char *address,
+					unsigned long timeout,
+					TEK_ASYNC_LINK ** link);
+tk_EXPORT void tek_async_close(TEK_ASYNC_LINK * link);
+
+/* As tek_send, tek_receive, tek_send_and_receive (which NUL-terminates
+ * the reply and returns 0), tek_obtain_long_value, tek_obtain_double_value,
+ * tek_send_data_block and tek_receive_data_block. */
+tk_EXPORT tek_task<long> tek_async_send(TEK_ASYNC_LINK * link,
+					const char *cmd);
+tk_EXPORT tek_task<long> tek_async_receive(TEK_ASYNC_LINK * link, char *buf,
+					   size_t len, unsigned long timeout);
+tk_EXPORT tek_task<long> tek_async_query(TEK_ASYNC_LINK * link,
+					 const char *cmd, char *buf,
+					 size_t len, unsigned long timeout);
+tk_EXPORT tek_task<long> tek_async_obtain_long(TEK_ASYNC_LINK * link,
+					       const char *cmd,
+					       unsigned long timeout);
+tk_EXPORT tek_task<double> tek_async_obtain_double(TEK_ASYNC_LINK * link,
+						   const char *cmd,
+						   unsigned long timeout);
+tk_EXPORT tek_task<long> tek_async_send_data_block(TEK_ASYNC_LINK * link,
+						   const char *cmd,
+						   const char *buf,
+						   size_t len);
+tk_EXPORT tek_task<long> tek_async_receive_data_block(TEK_ASYNC_LINK * link,
+						      char *buf, size_t len,
+						      unsigned long timeout);
+
+/* As tek_scope_init */
+tk_EXPORT tek_task<long> tek_async_scope_init(TEK_ASYNC_LINK * link);
+
+/* As tek_scope_set_for_capture, the DPO/MSO4000 way (HOR:MAIN:SAMPLERATE?).
+ * Returns the number of bytes to expect, or negative. */
+tk_EXPORT tek_task<long> tek_async_set_for_capture(TEK_ASYNC_LINK * link,
+						   int clear_sweeps,
+						   long record_length,
+						   unsigned long timeout);
+
+/* As tek_scope_get_data: with clear_sweeps, an ACQUIRE:STATE 1;*OPC? first
+ * (which is where the waiting is), then CURVE?. Returns the number of
+ * bytes. */
+tk_EXPORT tek_task<long> tek_async_capture(TEK_ASYNC_LINK * link,
+					   const char *source,
+					   int clear_sweeps, char *buf,
+					   size_t len, unsigned long timeout);
+
+/* As tek_afg_send_arb (so buf is byte-swapped in place), with an *OPC? at
+ * the end so that it's finished when the AFG has. Returns 0 or negative. */
+tk_EXPORT tek_task<long> tek_async_upload_arb(TEK_ASYNC_LINK * link,
+					      char *buf, size_t len, int chan,
+					      unsigned long timeout);
+
+#endif
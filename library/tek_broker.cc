@@ -0,0 +1,343 @@
+/* tek_broker.cc
+ * The client end of the broker (see tek_broker.h): a transport that hands
+ * everything to the broker, over its Unix socket, to pass on to the link
+ * it's lent us.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tek_broker.h"
+#include "tek_transport.h"
+
+static int tek_broker_disabled = 0;
+
+void tek_broker_disable(void)
+{
+	tek_broker_disabled = 1;
+}
+
+const char *tek_broker_path(void)
+{
+	const char *path = getenv("TEK_BROKER");
+
+	if (tek_broker_disabled) {
+		return NULL;
+	}
+	if (path == NULL || path[0] == '\0') {
+		return tek_broker_default_path();
+	}
+	if (strcmp(path, "none") == 0) {
+		return NULL;
+	}
+	return path;
+}
+
+#ifdef WIN32
+
+/* No Unix sockets; there's never a broker */
+const char *tek_broker_default_path(void)
+{
+	return TEK_BROKER_SOCKET;
+}
+
+int tek_broker_connect(const char *path)
+{
+	return -1;
+}
+
+int tek_broker_peer_is_us(int fd)
+{
+	return 0;
+}
+
+int tek_broker_open(VXI11_CLINK ** clink, const char *address)
+{
+	return 1;
+}
+
+int tek_broker_write(int fd, const void *buf, size_t len)
+{
+	return -1;
+}
+
+int tek_broker_read(int fd, void *buf, size_t len)
+{
+	return -1;
+}
+
+int tek_broker_read_line(int fd, char *line, size_t len)
+{
+	return -1;
+}
+
+#else
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+typedef struct tek_broker_link {
+	TEK_TRANSPORT transport;
+	int fd;
+} TEK_BROKER_LINK;
+
+int tek_broker_write(int fd, const void *buf, size_t len)
+{
+	const char *p = (const char *)buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int tek_broker_read(int fd, void *buf, size_t len)
+{
+	char *p = (char *)buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* A byte at a time, so as not to read into whatever follows the line.
+ * Lines are short. */
+int tek_broker_read_line(int fd, char *line, size_t len)
+{
+	size_t i = 0;
+
+	for (;;) {
+		if (tek_broker_read(fd, line + i, 1) != 0) {
+			return -1;
+		}
+		if (line[i] == '\n') {
+			line[i] = '\0';
+			return 0;
+		}
+		if (i < len - 1) {
+			i++;
+		}
+	}
+}
+
+/* Not /tmp/tek_broker.sock, where anyone could be listening; somewhere
+ * only we can get at */
+const char *tek_broker_default_path(void)
+{
+	static char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+
+	if (dir && dir[0] == '/') {
+		snprintf(path, sizeof(path), "%s/%s", dir, TEK_BROKER_SOCKET);
+	} else {
+		snprintf(path, sizeof(path), "/tmp/tek_broker-%lu/%s",
+			 (unsigned long)getuid(), TEK_BROKER_SOCKET);
+	}
+	return path;
+}
+
+int tek_broker_peer_is_us(int fd)
+{
+#ifdef SO_PEERCRED
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+		return 0;
+	}
+	return cred.uid == getuid();
+#else
+	uid_t uid;
+	gid_t gid;
+
+	if (getpeereid(fd, &uid, &gid) != 0) {
+		return 0;
+	}
+	return uid == getuid();
+#endif
+}
+
+int tek_broker_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Reads "RET n", and then n bytes into buf if there are any (and there's
+ * room: the broker never sends more than we asked for) */
+static long tek_broker_result(TEK_BROKER_LINK * b, char *buf, size_t len)
+{
+	char line[TEK_BROKER_LINE];
+	long n;
+
+	if (tek_broker_read_line(b->fd, line, sizeof(line)) != 0
+	    || sscanf(line, "RET %ld", &n) != 1) {
+		printf("tek_broker: lost the broker\n");
+		return -1;
+	}
+	if (buf && n > 0) {
+		if ((size_t)n > len || tek_broker_read(b->fd, buf, n) != 0) {
+			printf("tek_broker: lost the broker\n");
+			return -1;
+		}
+	}
+	return n;
+}
+
+static int tek_broker_send(TEK_TRANSPORT * t, const char *cmd, size_t len)
+{
+	TEK_BROKER_LINK *b = (TEK_BROKER_LINK *) t->priv;
+	char line[32];
+
+	snprintf(line, sizeof(line), "send %lu\n", (unsigned long)len);
+	if (tek_broker_write(b->fd, line, strlen(line)) != 0
+	    || tek_broker_write(b->fd, cmd, len) != 0) {
+		printf("tek_broker: lost the broker\n");
+		return -1;
+	}
+	return (int)tek_broker_result(b, NULL, 0);
+}
+
+static long tek_broker_request(TEK_TRANSPORT * t, const char *what,
+			       char *buf, size_t len, unsigned long timeout)
+{
+	TEK_BROKER_LINK *b = (TEK_BROKER_LINK *) t->priv;
+	char line[64];
+
+	snprintf(line, sizeof(line), "%s %lu %lu\n", what, (unsigned long)len,
+		 timeout);
+	if (tek_broker_write(b->fd, line, strlen(line)) != 0) {
+		printf("tek_broker: lost the broker\n");
+		return -1;
+	}
+	return tek_broker_result(b, buf, len);
+}
+
+static long tek_broker_receive(TEK_TRANSPORT * t, char *buf, size_t len,
+			       unsigned long timeout)
+{
+	return tek_broker_request(t, "recv", buf, len, timeout);
+}
+
+static long tek_broker_receive_data_block(TEK_TRANSPORT * t, char *buf,
+					  size_t len, unsigned long timeout)
+{
+	return tek_broker_request(t, "block", buf, len, timeout);
+}
+
+/* The broker keeps the link, for next time */
+static int tek_broker_close(TEK_TRANSPORT * t)
+{
+	TEK_BROKER_LINK *b = (TEK_BROKER_LINK *) t->priv;
+
+	close(b->fd);
+	free(b);
+	return 0;
+}
+
+static const TEK_TRANSPORT_OPS tek_broker_ops = {
+	"broker",
+	tek_broker_send,
+	tek_broker_receive,
+	tek_broker_receive_data_block,
+	tek_broker_close
+};
+
+int tek_broker_open(VXI11_CLINK ** clink, const char *address)
+{
+	TEK_BROKER_LINK *b;
+	const char *path = tek_broker_path();
+	char line[TEK_BROKER_LINE];
+	int fd;
+
+	if (path == NULL || strlen(address) > TEK_BROKER_LINE - 8) {
+		return 1;
+	}
+	fd = tek_broker_connect(path);
+	if (fd < 0) {
+		return 1;
+	}
+	if (!tek_broker_peer_is_us(fd)) {
+		printf("tek_broker: the broker on %s isn't ours, not using it\n",
+		       path);
+		close(fd);
+		return 1;
+	}
+	snprintf(line, sizeof(line), "open %s\n", address);
+	if (tek_broker_write(fd, line, strlen(line)) != 0
+	    || tek_broker_read_line(fd, line, sizeof(line)) != 0) {
+		/* it's there, but not answering: do without */
+		close(fd);
+		return 1;
+	}
+	if (strcmp(line, "OK") != 0) {
+		printf("tek_broker: %s\n", line);
+		close(fd);
+		return -1;
+	}
+
+	b = (TEK_BROKER_LINK *) calloc(1, sizeof(TEK_BROKER_LINK));
+	if (!b) {
+		close(fd);
+		return -1;
+	}
+	b->fd = fd;
+	b->transport.ops = &tek_broker_ops;
+	b->transport.priv = b;
+	*clink = tek_transport_add(&b->transport);
+	return 0;
+}
+
+#endif
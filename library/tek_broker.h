@@ -0,0 +1,84 @@
+/* tek_broker.h
+ * Keeping links warm between runs. Opening a VXI11 link to a scope, and
+ * finding out what it is, takes a good fraction of a second, and a script
+ * that runs tgetwf a few thousand times pays that every time. The broker
+ * (utils/tek_broker) is a little daemon that opens links on behalf of
+ * other programs and keeps them open after they've finished; tek_open()
+ * asks it for a link first, and only opens its own if there's no broker
+ * running. All the program sees is a link like any other. It also
+ * remembers each instrument's *IDN? reply, which is how the library works
+ * out what model it's talking to.
+ *
+ * The broker listens on a Unix socket, $TEK_BROKER if that's set, or
+ * otherwise TEK_BROKER_SOCKET in $XDG_RUNTIME_DIR, or, failing that, in
+ * /tmp/tek_broker-UID (which the broker makes, for nobody but you).
+ * TEK_BROKER=none stops tek_open() from using it. Both ends check that the
+ * other is being run by the same user (SO_PEERCRED), and tek_open() opens
+ * its own link rather than use somebody else's broker. record: and
+ * replay: addresses never go through the broker.
+ *
+ * The protocol is a text line for each request, followed by any data:
+ *   open ADDRESS            a link to ADDRESS, until the connection closes
+ *   send LEN                then LEN bytes, to send to the instrument
+ *   recv LEN TIMEOUT        read a reply (up to LEN bytes)
+ *   block LEN TIMEOUT       read a definite length block's data
+ *   list                    the broker's links, one per line, then END
+ *   stop                    the broker closes its links and exits
+ * Each is answered by "OK", "ERR message", or (send/recv/block) "RET n",
+ * with n as tek_send/tek_receive/tek_receive_data_block would return, and
+ * then n bytes of reply if it's a recv or block and n > 0.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_BROKER_H_
+#define _TEK_BROKER_H_
+
+#include <stddef.h>
+
+#include "tek_vxi11.h"
+
+#define TEK_BROKER_SOCKET	"tek_broker.sock"
+
+/* Longest request line, ADDRESS and all */
+#define TEK_BROKER_LINE		512
+
+/* Where the broker is (or would be); NULL if it's not to be used. The
+ * default is where it is if $TEK_BROKER isn't set. */
+tk_EXPORT const char *tek_broker_path(void);
+tk_EXPORT const char *tek_broker_default_path(void);
+
+/* Stops this program's tek_open() from using the broker (the broker itself
+ * calls this, so that it opens real links) */
+tk_EXPORT void tek_broker_disable(void);
+
+/* Asks the broker for a link to address. Returns 0 if it's given us one,
+ * negative if it couldn't open one, or 1 if there's no broker running. */
+tk_EXPORT int tek_broker_open(VXI11_CLINK ** clink, const char *address);
+
+/* For both ends of the socket: all of buf, a whole line (without its
+ * newline), or a connection to the broker (-1 if there isn't one). */
+tk_EXPORT int tek_broker_write(int fd, const void *buf, size_t len);
+tk_EXPORT int tek_broker_read(int fd, void *buf, size_t len);
+tk_EXPORT int tek_broker_read_line(int fd, char *line, size_t len);
+tk_EXPORT int tek_broker_connect(const char *path);
+
+/* 1 if whoever's at the other end of the Unix socket fd is running as the
+ * same user as us, 0 if not (or if we can't tell) */
+tk_EXPORT int tek_broker_peer_is_us(int fd);
+
+#endif
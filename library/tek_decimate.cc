@@ -0,0 +1,482 @@
+/* tek_decimate.cc
+ * Filtering and decimating raw traces. See tek_decimate.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "tek_decimate.h"
+#include "tek_jobs.h"
+
+/* As in tek_measure.cc, the vector loop loads the scope's LSB-first data
+ * straight into registers, which is fine on anything with SSE2 */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TEK_DECIMATE_SSE2
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define TEK_DECIMATE_FIR	0
+#define TEK_DECIMATE_CIC	1
+
+/* The CIC's compensator has 2 * this + 1 taps */
+#define TEK_DECIMATE_COMP_HALF	8
+
+struct tek_decimate {
+	int type, factor, output;
+
+	/* FIR: taps coefficients (2^15 = 1), then zeros up to a multiple
+	 * of 8, centred on half */
+	int16_t *coef;
+	long taps, padded, half;
+
+	/* CIC */
+	int stages;
+	double gain;		/* factor^stages */
+	long delay;		/* whole input points of group delay */
+	double frac;		/* and the rest */
+	float comp[2 * TEK_DECIMATE_COMP_HALF + 1];
+};
+
+/* Sample i, from the scope's LSB-first data, whatever the host */
+static inline int tek_sample(const unsigned char *p, long i)
+{
+	return (short)(p[2 * i] | (p[2 * i + 1] << 8));
+}
+
+static inline long tek_clamp(long i, long n)
+{
+	return (i < 0) ? 0 : ((i >= n) ? n - 1 : i);
+}
+
+static TEK_DECIMATE *tek_decimate_alloc(int type, int factor, int output)
+{
+	TEK_DECIMATE *d;
+
+	if (factor < 2) {
+		printf("tek_decimate: can't decimate by %d\n", factor);
+		return NULL;
+	}
+	if (output != TEK_DECIMATE_INT16 && output != TEK_DECIMATE_INT32
+	    && output != TEK_DECIMATE_FLOAT) {
+		return NULL;
+	}
+	d = (TEK_DECIMATE *) calloc(1, sizeof(TEK_DECIMATE));
+	if (d) {
+		d->type = type;
+		d->factor = factor;
+		d->output = output;
+	}
+	return d;
+}
+
+TEK_DECIMATE *tek_decimate_new_fir(int factor, int taps_per_phase, int output)
+{
+	TEK_DECIMATE *d;
+	double *h, fc, x, w, sum = 0, abs_sum = 0;
+	long k, q, qsum = 0, centre;
+
+	if (taps_per_phase <= 0) {
+		taps_per_phase = 16;
+	}
+	d = tek_decimate_alloc(TEK_DECIMATE_FIR, factor, output);
+	if (!d) {
+		return NULL;
+	}
+	d->half = (long)taps_per_phase * factor / 2;
+	d->taps = 2 * d->half + 1;
+	d->padded = (d->taps + 7) & ~7L;
+
+	/* cut off at 0.4 of the output sample rate (in input cycles per
+	 * sample) */
+	fc = 0.4 / factor;
+	h = new double[d->taps];
+	for (k = 0; k < d->taps; k++) {
+		x = (double)(k - d->half);
+		w = 0.42 - 0.5 * cos(2 * M_PI * k / (d->taps - 1))
+		    + 0.08 * cos(4 * M_PI * k / (d->taps - 1));
+		h[k] = (x == 0) ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x);
+		h[k] *= w;
+		sum += h[k];
+	}
+
+	/* Unity gain at DC, exactly, once rounded: any error goes in the
+	 * centre tap */
+	d->coef = new int16_t[d->padded];
+	memset(d->coef, 0, d->padded * sizeof(int16_t));
+	for (k = 0; k < d->taps; k++) {
+		q = lrint(h[k] / sum * 32768);
+		d->coef[k] = (int16_t)q;
+		qsum += q;
+		abs_sum += fabs(h[k] / sum);
+	}
+	centre = d->coef[d->half] + (32768 - qsum);
+	delete[]h;
+	/* 32 bit sums of 16 bit samples times these can't overflow as long
+	 * as the coefficients' magnitudes add up to less than 2 */
+	if (centre > 32767 || abs_sum >= 2) {
+		printf("tek_decimate: can't make a filter with %ld taps\n",
+		       d->taps);
+		tek_decimate_free(d);
+		return NULL;
+	}
+	d->coef[d->half] = (int16_t)centre;
+	return d;
+}
+
+/* The CIC's response, relative to DC, at f cycles per output sample */
+static double tek_decimate_cic_response(const TEK_DECIMATE * d, double f)
+{
+	if (f == 0) {
+		return 1;
+	}
+	return pow(fabs(sin(M_PI * f) / (d->factor * sin(M_PI * f / d->factor))),
+		   d->stages);
+}
+
+TEK_DECIMATE *tek_decimate_new_cic(int factor, int stages, int output)
+{
+	TEK_DECIMATE *d;
+	const int grid = 2048;
+	const double pass = 0.2;
+	double f, target, c, sum = 0, bits;
+	int i, k;
+
+	if (stages <= 0) {
+		stages = 4;
+	}
+	d = tek_decimate_alloc(TEK_DECIMATE_CIC, factor, output);
+	if (!d) {
+		return NULL;
+	}
+	d->stages = stages;
+	d->gain = pow((double)factor, stages);
+
+	/* The integrators grow by log2(factor) bits a stage, on top of the
+	 * 16 we start with; 64 bit ones wrap round harmlessly as long as the
+	 * answer fits */
+	bits = 16 + stages * ceil(log2((double)factor));
+	if (bits > 63) {
+		printf("tek_decimate: a %d stage CIC can't decimate by %d\n",
+		       stages, factor);
+		tek_decimate_free(d);
+		return NULL;
+	}
+	d->delay = (long)stages * (factor - 1) / 2;
+	d->frac = stages * (factor - 1) / 2.0 - d->delay;
+
+	/* Compensator: the inverse of the CIC up to pass, nothing above,
+	 * by integrating over the frequency response, then windowed */
+	for (k = 0; k <= TEK_DECIMATE_COMP_HALF; k++) {
+		c = 0;
+		for (i = 0; i < grid; i++) {
+			f = (i + 0.5) * 0.5 / grid;
+			if (f > pass) {
+				break;
+			}
+			target = 1 / tek_decimate_cic_response(d, f);
+			c += target * cos(2 * M_PI * f * k);
+		}
+		c *= 2 * 0.5 / grid;
+		c *= 0.54 + 0.46 * cos(M_PI * k / (TEK_DECIMATE_COMP_HALF + 1));
+		d->comp[TEK_DECIMATE_COMP_HALF + k] = (float)c;
+		d->comp[TEK_DECIMATE_COMP_HALF - k] = (float)c;
+	}
+	for (k = 0; k <= 2 * TEK_DECIMATE_COMP_HALF; k++) {
+		sum += d->comp[k];
+	}
+	for (k = 0; k <= 2 * TEK_DECIMATE_COMP_HALF; k++) {
+		d->comp[k] /= (float)sum;
+	}
+	return d;
+}
+
+void tek_decimate_free(TEK_DECIMATE * d)
+{
+	if (d) {
+		delete[]d->coef;
+		free(d);
+	}
+}
+
+long tek_decimate_points(const TEK_DECIMATE * d, long n)
+{
+	return (n + d->factor - 1) / d->factor;
+}
+
+int tek_decimate_bytes_per_point(const TEK_DECIMATE * d)
+{
+	return (d->output == TEK_DECIMATE_INT16) ? 2 : 4;
+}
+
+/* Output point j of value v, in units of 2^-15 of an input unit */
+static inline void tek_decimate_put_fixed(const TEK_DECIMATE * d, void *out,
+					  long j, int32_t v)
+{
+	int32_t s;
+
+	switch (d->output) {
+	case TEK_DECIMATE_INT16:
+		s = (v + 16384) >> 15;
+		((int16_t *) out)[j] = (int16_t)((s > 32767) ? 32767
+						 : ((s < -32768) ? -32768 : s));
+		break;
+	case TEK_DECIMATE_INT32:
+		((int32_t *) out)[j] = v;
+		break;
+	default:
+		((float *)out)[j] = v * (1.0f / 32768);
+	}
+}
+
+/* ... and of value v in input units */
+static inline void tek_decimate_put(const TEK_DECIMATE * d, void *out,
+				    long j, float v)
+{
+	double s;
+
+	switch (d->output) {
+	case TEK_DECIMATE_INT16:
+		s = floor(v + 0.5);
+		((int16_t *) out)[j] = (int16_t)((s > 32767) ? 32767
+						 : ((s < -32768) ? -32768 : s));
+		break;
+	case TEK_DECIMATE_INT32:
+		s = floor(v * 32768.0 + 0.5);
+		((int32_t *) out)[j] = (int32_t)((s > 2147483647.0) ? 2147483647.0
+						 : ((s < -2147483648.0) ? -2147483648.0 : s));
+		break;
+	default:
+		((float *)out)[j] = v;
+	}
+}
+
+/* Output points j0 to j1 - 1 of one trace of n points, by FIR */
+static void tek_decimate_fir(const TEK_DECIMATE * d, const char *data,
+			     long n, void *out, long j0, long j1)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	long j, k, start;
+	int32_t acc;
+
+	for (j = j0; j < j1; j++) {
+		start = j * d->factor - d->half;
+#ifdef TEK_DECIMATE_SSE2
+		if (start >= 0 && start + d->padded <= n) {
+			__m128i sum = _mm_setzero_si128(), v, c;
+			int32_t part[4];
+
+			for (k = 0; k < d->padded; k += 8) {
+				v = _mm_loadu_si128((const __m128i *)
+						    (p + 2 * (start + k)));
+				c = _mm_loadu_si128((const __m128i *)
+						    (d->coef + k));
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(v, c));
+			}
+			_mm_storeu_si128((__m128i *) part, sum);
+			acc = part[0] + part[1] + part[2] + part[3];
+			tek_decimate_put_fixed(d, out, j, acc);
+			continue;
+		}
+#endif
+		/* near the ends (or no SSE2): one at a time, repeating the
+		 * end points */
+		acc = 0;
+		for (k = 0; k < d->taps; k++) {
+			acc += d->coef[k] * tek_sample(p, tek_clamp(start + k, n));
+		}
+		tek_decimate_put_fixed(d, out, j, acc);
+	}
+}
+
+/* One whole trace of n points, by CIC and then the compensator */
+static void tek_decimate_cic(const TEK_DECIMATE * d, const char *data,
+			     long n, void *out)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const int half = TEK_DECIMATE_COMP_HALF;
+	long m = tek_decimate_points(d, n);
+	long v, j, i, k;
+	uint64_t integ[16], comb[16], x, prev;
+	float *y, acc;
+	int s, stages = d->stages;
+
+	if (stages > 16) {
+		stages = 16;
+	}
+	memset(integ, 0, sizeof(integ));
+	memset(comb, 0, sizeof(comb));
+	y = new float[m];
+
+	/* Output j is centred on input point j * factor, so comes out of
+	 * the integrators at j * factor + delay. Start far enough back (in
+	 * copies of the first point) for the combs to have their previous
+	 * values and the integrators to have filled. */
+	j = -stages;
+	for (v = -stages * (long)d->factor + d->delay; j < m; v++) {
+		x = (uint64_t)(int64_t)tek_sample(p, tek_clamp(v, n));
+		integ[0] += x;
+		for (s = 1; s < stages; s++) {
+			integ[s] += integ[s - 1];
+		}
+		if ((v - d->delay) % d->factor != 0) {
+			continue;
+		}
+		x = integ[stages - 1];
+		for (s = 0; s < stages; s++) {
+			prev = comb[s];
+			comb[s] = x;
+			x -= prev;
+		}
+		if (j >= 0) {
+			y[j] = (float)((double)(int64_t)x / d->gain);
+		}
+		j++;
+	}
+
+	for (j = 0; j < m; j++) {
+		acc = 0;
+		for (k = -half; k <= half; k++) {
+			i = tek_clamp(j + k, m);
+			acc += d->comp[k + half] * y[i];
+		}
+		tek_decimate_put(d, out, j, acc);
+	}
+	delete[]y;
+}
+
+typedef struct {
+	const TEK_DECIMATE *d;
+	const char *data;
+	long n, m;
+	int no_traces;
+	long parts;		/* per trace */
+	long first, step;
+	char *out;
+} TEK_DECIMATE_JOB;
+
+static void *tek_decimate_job(void *arg)
+{
+	TEK_DECIMATE_JOB *job = (TEK_DECIMATE_JOB *) arg;
+	const TEK_DECIMATE *d = job->d;
+	int bpp = tek_decimate_bytes_per_point(d);
+	long u, t, part, j0, j1, per_part;
+
+	per_part = (job->m + job->parts - 1) / job->parts;
+	for (u = job->first; u < job->no_traces * job->parts; u += job->step) {
+		t = u / job->parts;
+		part = u % job->parts;
+		if (d->type == TEK_DECIMATE_CIC) {
+			tek_decimate_cic(d, job->data + 2 * job->n * t, job->n,
+					 job->out + bpp * job->m * t);
+			continue;
+		}
+		j0 = part * per_part;
+		j1 = (j0 + per_part < job->m) ? j0 + per_part : job->m;
+		tek_decimate_fir(d, job->data + 2 * job->n * t, job->n,
+				 job->out + bpp * job->m * t, j0, j1);
+	}
+	return NULL;
+}
+
+long tek_decimate_traces(const TEK_DECIMATE * d, const char *data, long n,
+			 int no_traces, void *out, int no_threads)
+{
+	TEK_DECIMATE_JOB *jobs;
+	long parts = 1, units;
+	int t;
+
+	if (no_traces < 1 || n < 1) {
+		return -1;
+	}
+	/* no more than one per point, as a trace may be split up below */
+	no_threads = tek_jobs_threads(no_threads, (long)no_traces * n);
+	/* A long trace is worth splitting, if there aren't enough traces
+	 * to go round; the CIC has to do a trace from start to finish */
+	if (d->type == TEK_DECIMATE_FIR && no_traces < no_threads
+	    && n >= 65536) {
+		parts = (no_threads + no_traces - 1) / no_traces;
+	}
+	units = parts * no_traces;
+	no_threads = tek_jobs_threads(no_threads, units);
+
+	/* Every thread takes every no_threads'th piece */
+	jobs = new TEK_DECIMATE_JOB[no_threads];
+	for (t = 0; t < no_threads; t++) {
+		jobs[t].d = d;
+		jobs[t].data = data;
+		jobs[t].n = n;
+		jobs[t].m = tek_decimate_points(d, n);
+		jobs[t].no_traces = no_traces;
+		jobs[t].parts = parts;
+		jobs[t].first = t;
+		jobs[t].step = no_threads;
+		jobs[t].out = (char *)out;
+	}
+	tek_jobs_run(tek_decimate_job, jobs, sizeof(TEK_DECIMATE_JOB),
+		     no_threads);
+	delete[]jobs;
+	return (long)no_traces * tek_decimate_points(d, n)
+	    * tek_decimate_bytes_per_point(d);
+}
+
+void tek_decimate_scaling(const TEK_DECIMATE * d, double *vgain,
+			  double *hinterval, double *hoffset)
+{
+	/* output j is at input j * factor, less any half point of CIC
+	 * delay that couldn't be taken out */
+	if (d->type == TEK_DECIMATE_CIC) {
+		*hoffset -= d->frac * *hinterval;
+	}
+	*hinterval *= d->factor;
+	if (d->output == TEK_DECIMATE_INT32) {
+		*vgain /= TEK_DECIMATE_INT32_SCALE;
+	}
+}
+
+long tek_decimate_write_wfi_file(VXI11_CLINK * clink, const TEK_DECIMATE * d,
+				 char *wfiname, char *captured_by,
+				 int no_of_traces, unsigned long timeout)
+{
+	double vgain, voffset, hinterval, hoffset;
+	long no_of_bytes;
+
+	if (d->output == TEK_DECIMATE_FLOAT) {
+		printf("error: tek_decimate_write_wfi_file: .wf files can't hold floats\n");
+		return -1;
+	}
+	/* Whatever DATA:START/STOP the traces were captured with, which
+	 * needn't be the screen (see tek_plan.h) */
+	no_of_bytes = tek_decimate_points(d, tek_scope_get_no_points(clink))
+	    * tek_decimate_bytes_per_point(d);
+	tek_scope_get_scaling(clink, &vgain, &voffset, &hinterval, &hoffset);
+	tek_decimate_scaling(d, &vgain, &hinterval, &hoffset);
+	if (tek_write_wfi_file(wfiname, captured_by, no_of_bytes, vgain,
+			       voffset, hinterval, hoffset, no_of_traces,
+			       tek_decimate_bytes_per_point(d)) != 0) {
+		return -1;
+	}
+	return no_of_bytes;
+}
@@ -0,0 +1,97 @@
+/* tek_decimate.h
+ * Low-pass filtering and decimation of raw traces, for when the scope has
+ * to sample much faster than the bandwidth you actually want (to get the
+ * timing, or the trigger, right) and there's no point storing all of it.
+ * Each trace (or FastFrame segment) is filtered on its own, with the ends
+ * padded by repeating the first and last points, so there are no start-up
+ * transients and point j of the output is centred on point j * factor of
+ * the input: the time of point 0 doesn't move.
+ *
+ * Two kinds of filter:
+ *  - FIR: a windowed-sinc (Blackman) low-pass with taps_per_phase * factor
+ *    + 1 taps, flat to 0.2 of the output sample rate and half amplitude
+ *    at 0.4, and only the outputs that are kept are worked out (which is
+ *    all a polyphase decimator does). The coefficients are 16 bit fixed
+ *    point, so the multiply-adds are done 8 at a time with SSE2, into 32
+ *    bits with nothing lost. More taps give a sharper cut-off, and take
+ *    longer.
+ *  - CIC: stages of integrate and comb (no multiplies at all, however big
+ *    the factor), followed by a short FIR at the output rate that undoes
+ *    the CIC's droop, flat to 0.1 of the output sample rate and half
+ *    amplitude at 0.2. Cheaper than FIR for big factors, but with less of
+ *    the band left.
+ *
+ * The output can be 16 bit, in the same units as the input (so the .wfi
+ * scaling still holds, and everything that reads .wf files still can);
+ * 32 bit, with TEK_DECIMATE_INT32_SCALE (2^15) to each input unit, so the
+ * extra resolution that filtering gives isn't rounded away; or float, in
+ * input units. tek_decimate_scaling() and tek_decimate_write_wfi_file()
+ * work out the vertical gain and time base to go with it.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_DECIMATE_H_
+#define _TEK_DECIMATE_H_
+
+#include "tek_vxi11.h"
+
+/* output */
+#define TEK_DECIMATE_INT16	0
+#define TEK_DECIMATE_INT32	1
+#define TEK_DECIMATE_FLOAT	2
+
+#define TEK_DECIMATE_INT32_SCALE	32768
+
+typedef struct tek_decimate TEK_DECIMATE;
+
+/* taps_per_phase (FIR) or stages (CIC) <= 0 gives the default, 16 or 4.
+ * Return NULL if the factor is < 2 or (CIC) too big for the stages. One
+ * decimator can be used by any number of threads at once. */
+tk_EXPORT TEK_DECIMATE *tek_decimate_new_fir(int factor, int taps_per_phase,
+					     int output);
+tk_EXPORT TEK_DECIMATE *tek_decimate_new_cic(int factor, int stages,
+					     int output);
+tk_EXPORT void tek_decimate_free(TEK_DECIMATE * d);
+
+/* Points out for n points in, and the size of each */
+tk_EXPORT long tek_decimate_points(const TEK_DECIMATE * d, long n);
+tk_EXPORT int tek_decimate_bytes_per_point(const TEK_DECIMATE * d);
+
+/* no_traces traces of n points each, one after the other in data (two
+ * bytes per point, LSB first, as tek_scope_get_data() gives them), into
+ * out, tek_decimate_points() for each trace, one after the other (in host
+ * byte order). Shared between no_threads threads (<= 0 means one per
+ * processor), by trace, or by parts of a trace for the FIR filter if there
+ * are more threads than traces. Returns the number of bytes in out. */
+tk_EXPORT long tek_decimate_traces(const TEK_DECIMATE * d, const char *data,
+				   long n, int no_traces, void *out,
+				   int no_threads);
+
+/* Turns the input's scaling (as from tek_scope_get_scaling()) into the
+ * output's */
+tk_EXPORT void tek_decimate_scaling(const TEK_DECIMATE * d, double *vgain,
+				    double *hinterval, double *hoffset);
+
+/* tek_scope_write_wfi_file(), for traces that have been through d */
+tk_EXPORT long tek_decimate_write_wfi_file(VXI11_CLINK * clink,
+					   const TEK_DECIMATE * d,
+					   char *wfiname, char *captured_by,
+					   int no_of_traces,
+					   unsigned long timeout);
+
+#endif
@@ -0,0 +1,237 @@
+/* tek_deploy.cc
+ * Sending arbitrary waveforms to several AFGs at once. See tek_deploy.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
+#include "tek_deploy.h"
+#include "tek_transport.h"
+#include "tek_arb_cache.h"
+#include "tek_jobs.h"
+
+typedef struct {
+	TEK_DEPLOY_PROGRESS progress;
+	void *arg;
+	int verify;
+	unsigned long timeout;
+#ifndef WIN32
+	pthread_mutex_t lock;
+#endif
+} TEK_DEPLOY_SHARED;
+
+typedef struct {
+	TEK_DEPLOY *d;
+	const char *swapped;	/* big-endian, shared with other AFGs */
+	TEK_DEPLOY_SHARED *sh;
+} TEK_DEPLOY_JOB;
+
+static void tek_deploy_progress(TEK_DEPLOY_JOB * job, int stage)
+{
+	TEK_DEPLOY_SHARED *sh = job->sh;
+
+	if (sh->progress == NULL) {
+		return;
+	}
+#ifndef WIN32
+	pthread_mutex_lock(&sh->lock);
+#endif
+	sh->progress(job->d, stage, sh->arg);
+#ifndef WIN32
+	pthread_mutex_unlock(&sh->lock);
+#endif
+}
+
+/* Gets the user memory back into the edit memory, and reads it */
+static int tek_deploy_verify(VXI11_CLINK * clink, TEK_DEPLOY_JOB * job)
+{
+	TEK_DEPLOY *d = job->d;
+	char *readback;
+	long bytes;
+	int ret;
+
+	if (d->chan > 0) {
+		tek_send_printf(clink, "TRACE:COPY EMEM,USER%d", d->chan);
+	}
+	/* one spare byte, so that a longer waveform doesn't look the same */
+	readback = (char *)malloc(d->len + 1);
+	if (readback == NULL) {
+		return -1;
+	}
+	if (tek_send(clink, "TRACE:DATA? EMEMORY") != 0) {
+		free(readback);
+		return -1;
+	}
+	bytes = tek_receive_data_block(clink, readback, d->len + 1,
+				       job->sh->timeout);
+	ret = (bytes == (long)d->len
+	       && memcmp(readback, job->swapped, d->len) == 0) ? 1 : -1;
+	free(readback);
+	return ret;
+}
+
+static void *tek_deploy_one(void *arg)
+{
+	TEK_DEPLOY_JOB *job = (TEK_DEPLOY_JOB *) arg;
+	TEK_DEPLOY *d = job->d;
+	VXI11_CLINK *clink;
+	double t0, t1;
+
+	t0 = tek_time_us();
+	if (tek_open(&clink, d->ip) != 0) {
+		printf("Error: tek_afg_deploy: could not open %s\n", d->ip);
+		d->ret = -1;
+		tek_deploy_progress(job, TEK_DEPLOY_FAILED);
+		return NULL;
+	}
+	t1 = tek_time_us();
+	d->open_ms = (t1 - t0) / 1000;
+	tek_deploy_progress(job, TEK_DEPLOY_OPENED);
+
+	/* tek_send_data_block doesn't touch the data, so it can be shared */
+	if (tek_send_data_block(clink, ":TRACE:DATA EMEMORY,",
+				(char *)job->swapped, d->len) != 0
+	    || tek_obtain_long_value(clink, "*OPC?", job->sh->timeout) != 1) {
+		printf("Error: tek_afg_deploy: could not send the waveform to %s\n",
+		       d->ip);
+		d->ret = -2;
+		goto done;
+	}
+	t0 = tek_time_us();
+	d->send_ms = (t0 - t1) / 1000;
+	tek_deploy_progress(job, TEK_DEPLOY_SENT);
+
+	if (d->chan > 0) {
+		if (tek_send_printf(clink, "TRACE:COPY USER%d,EMEM", d->chan) != 0
+		    || tek_obtain_long_value(clink, "*OPC?",
+					     job->sh->timeout) != 1) {
+			printf("Error: tek_afg_deploy: could not copy to USER%d on %s\n",
+			       d->chan, d->ip);
+			d->ret = -3;
+			goto done;
+		}
+		t1 = tek_time_us();
+		d->copy_ms = (t1 - t0) / 1000;
+		tek_deploy_progress(job, TEK_DEPLOY_COPIED);
+	}
+
+	if (job->sh->verify) {
+		t0 = tek_time_us();
+		d->verified = tek_deploy_verify(clink, job);
+		d->verify_ms = (tek_time_us() - t0) / 1000;
+		if (d->verified != 1) {
+			printf("Error: tek_afg_deploy: %s doesn't have the waveform it was sent\n",
+			       d->ip);
+			d->ret = -4;
+			goto done;
+		}
+		tek_deploy_progress(job, TEK_DEPLOY_VERIFIED);
+	}
+
+ done:
+	/* what the AFG has now, for tek_afg_send_arb_cached() */
+	if (d->ret == 0) {
+		tek_arb_cache_note(clink, tek_arb_hash(d->buf, d->len), d->len,
+				   d->chan);
+	} else {
+		tek_arb_cache_note(clink, 0, 0, d->chan);
+	}
+	tek_close(clink, d->ip);
+	tek_deploy_progress(job, d->ret == 0 ? TEK_DEPLOY_DONE
+			    : TEK_DEPLOY_FAILED);
+	return NULL;
+}
+
+int tek_afg_deploy(TEK_DEPLOY * afgs, int no_afgs, int verify,
+		   unsigned long timeout, TEK_DEPLOY_PROGRESS progress,
+		   void *arg)
+{
+	TEK_DEPLOY_SHARED sh;
+	TEK_DEPLOY_JOB *jobs;
+	char **swapped;
+	int i, j, no_failed = 0;
+
+	if (no_afgs < 1) {
+		return -1;
+	}
+	jobs = new TEK_DEPLOY_JOB[no_afgs];
+	swapped = new char *[no_afgs];
+	sh.progress = progress;
+	sh.arg = arg;
+	sh.verify = verify;
+	sh.timeout = timeout;
+
+	/* Each waveform is swapped once; AFGs sending the same one share it */
+	for (i = 0; i < no_afgs; i++) {
+		afgs[i].ret = 0;
+		afgs[i].verified = 0;
+		afgs[i].open_ms = afgs[i].send_ms = 0;
+		afgs[i].copy_ms = afgs[i].verify_ms = 0;
+		jobs[i].d = &afgs[i];
+		jobs[i].sh = &sh;
+		swapped[i] = NULL;
+		for (j = 0; j < i; j++) {
+			if (afgs[j].buf == afgs[i].buf
+			    && afgs[j].len == afgs[i].len) {
+				break;
+			}
+		}
+		if (j < i) {
+			jobs[i].swapped = jobs[j].swapped;
+			continue;
+		}
+		swapped[i] = (char *)malloc(afgs[i].len);
+		if (swapped[i] == NULL) {
+			printf("Error: tek_afg_deploy: out of memory\n");
+			no_afgs = i;	/* just to free what we've got */
+			no_failed = -2;
+			break;
+		}
+		memcpy(swapped[i], afgs[i].buf, afgs[i].len);
+		tek_afg_swap_bytes(swapped[i], afgs[i].len);
+		jobs[i].swapped = swapped[i];
+	}
+
+	if (no_failed == 0) {
+#ifndef WIN32
+		pthread_mutex_init(&sh.lock, NULL);
+#endif
+		tek_jobs_run(tek_deploy_one, jobs, sizeof(TEK_DEPLOY_JOB),
+			     no_afgs);
+#ifndef WIN32
+		pthread_mutex_destroy(&sh.lock);
+#endif
+		for (i = 0; i < no_afgs; i++) {
+			if (afgs[i].ret != 0) {
+				no_failed++;
+			}
+		}
+	}
+
+	for (i = 0; i < no_afgs; i++) {
+		free(swapped[i]);
+	}
+	delete[]swapped;
+	delete[]jobs;
+	return no_failed;
+}
@@ -0,0 +1,70 @@
+/* tek_deploy.h
+ * Sending arbitrary waveforms to several AFG3000s at once. Each AFG gets
+ * its own link and its own thread, so the whole lot takes about as long as
+ * the slowest one rather than the sum of them all. Each distinct waveform
+ * is byte-swapped only once, into a buffer that all the AFGs sending it
+ * share. Optionally each AFG's user memory is read back afterwards and
+ * checked against what was sent. (The AFG has no checksum of its own to
+ * ask for, so it's the whole waveform that comes back.) What each AFG has
+ * afterwards is noted in tek_arb_cache.h's registry.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_DEPLOY_H_
+#define _TEK_DEPLOY_H_
+
+#include <stddef.h>
+
+#include "tek_vxi11.h"
+
+/* How far an AFG has got, for the progress function */
+#define TEK_DEPLOY_OPENED	1
+#define TEK_DEPLOY_SENT		2
+#define TEK_DEPLOY_COPIED	3
+#define TEK_DEPLOY_VERIFIED	4
+#define TEK_DEPLOY_DONE		5
+#define TEK_DEPLOY_FAILED	6
+
+typedef struct {
+	/* Filled in by you. AFGs with the same buf share the swapped copy. */
+	const char *ip;
+	const char *buf;	/* as for tek_afg_send_arb (little-endian) */
+	size_t len;
+	int chan;		/* user memory (1-4), or 0 for edit memory only */
+
+	/* Filled in by tek_afg_deploy() */
+	int ret;		/* 0, or negative if this one failed */
+	int verified;		/* 1 matched, -1 didn't, 0 not checked */
+	double open_ms, send_ms, copy_ms, verify_ms;
+} TEK_DEPLOY;
+
+/* Called as each AFG gets to each stage; one at a time, but from the
+ * sending threads */
+typedef void (*TEK_DEPLOY_PROGRESS) (const TEK_DEPLOY * d, int stage,
+				     void *arg);
+
+/* Opens a link to each AFG and sends it its waveform, all at once, then
+ * copies it to its user memory and waits for *OPC?. With verify set, the
+ * user memory is copied back to the edit memory and read, and compared
+ * with what was sent. progress may be NULL. Returns the number of AFGs
+ * that failed (0 if all went well), or negative if it couldn't start. */
+tk_EXPORT int tek_afg_deploy(TEK_DEPLOY * afgs, int no_afgs, int verify,
+			     unsigned long timeout,
+			     TEK_DEPLOY_PROGRESS progress, void *arg);
+
+#endif
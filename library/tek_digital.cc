@@ -0,0 +1,318 @@
+/* tek_digital.cc
+ * Decoding the digital channels into bit-planes and edges. See
+ * tek_digital.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tek_digital.h"
+
+/* As in tek_measure.cc, the vector loops need a little-endian machine */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TEK_DIGITAL_SSE2
+#endif
+
+#define TEK_DIGITAL_MAGIC	"TEKDIGI1"
+
+#ifdef __GNUC__
+#define tek_popcount64(x)	__builtin_popcountll(x)
+#define tek_ctz64(x)		__builtin_ctzll(x)
+#else
+static int tek_popcount64(uint64_t x)
+{
+	int n = 0;
+
+	for (; x; x &= x - 1) {
+		n++;
+	}
+	return n;
+}
+
+static int tek_ctz64(uint64_t x)
+{
+	int n = 0;
+
+	for (; !(x & 1); x >>= 1) {
+		n++;
+	}
+	return n;
+}
+#endif
+
+/* Transposes samples 64 * j onwards (up to 64 of them, fewer at the end)
+ * into word j of each plane */
+static void tek_digital_transpose(const unsigned char *p, long j, long n,
+				  uint64_t ** planes)
+{
+	long i, first = 64 * j, last = first + 64;
+	int line;
+	unsigned int x;
+
+	if (last > n) {
+		last = n;
+	}
+#ifdef TEK_DIGITAL_SSE2
+	if (last - first == 64) {
+		__m128i v0, v1, lo, hi, byte = _mm_set1_epi16(0xff);
+		int c, b;
+
+		/* 16 samples at a time: all their low bytes in one register,
+		 * all their high bytes in another. The top bit of every byte
+		 * is then one line's bits for all 16 samples (movemask), and
+		 * doubling the bytes brings the next line up to the top. */
+		for (c = 0; c < 4; c++) {
+			v0 = _mm_loadu_si128((const __m128i *)
+					     (p + 2 * (first + 16 * c)));
+			v1 = _mm_loadu_si128((const __m128i *)
+					     (p + 2 * (first + 16 * c + 8)));
+			lo = _mm_packus_epi16(_mm_and_si128(v0, byte),
+					      _mm_and_si128(v1, byte));
+			hi = _mm_packus_epi16(_mm_srli_epi16(v0, 8),
+					      _mm_srli_epi16(v1, 8));
+			for (b = 7; b >= 0; b--) {
+				planes[b][j] |= (uint64_t) (unsigned int)
+				    _mm_movemask_epi8(lo) << (16 * c);
+				planes[b + 8][j] |= (uint64_t) (unsigned int)
+				    _mm_movemask_epi8(hi) << (16 * c);
+				lo = _mm_add_epi8(lo, lo);
+				hi = _mm_add_epi8(hi, hi);
+			}
+		}
+		return;
+	}
+#endif
+	for (i = first; i < last; i++) {
+		x = p[2 * i] | (p[2 * i + 1] << 8);
+		for (line = 0; line < TEK_DIGITAL_LINES; line++) {
+			planes[line][j] |= (uint64_t) ((x >> line) & 1) << (i - first);
+		}
+	}
+}
+
+/* Bit i of the result is set if sample 64 * j + i differs from the one
+ * before it */
+static uint64_t tek_digital_changes(const TEK_DIGITAL * d, int line, long j)
+{
+	uint64_t w = d->planes[line][j], prev, t;
+	long left;
+
+	prev = (j > 0) ? d->planes[line][j - 1] >> 63
+	    : (uint64_t) ((d->initial >> line) & 1);
+	t = w ^ ((w << 1) | prev);
+	left = d->no_samples - 64 * j;
+	if (left < 64) {
+		t &= ((uint64_t) 1 << left) - 1;
+	}
+	return t;
+}
+
+int tek_digital_decode(const char *data, long n, TEK_DIGITAL * d)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	uint64_t t;
+	long j, k;
+	int line;
+
+	memset(d, 0, sizeof(TEK_DIGITAL));
+	if (n < 1) {
+		return -1;
+	}
+	d->no_samples = n;
+	d->no_words = (n + 63) / 64;
+	for (line = 0; line < TEK_DIGITAL_LINES; line++) {
+		d->planes[line] = (uint64_t *) calloc(d->no_words,
+						      sizeof(uint64_t));
+		if (!d->planes[line]) {
+			printf("Error: tek_digital_decode: out of memory\n");
+			tek_digital_free(d);
+			return -2;
+		}
+	}
+	for (j = 0; j < d->no_words; j++) {
+		tek_digital_transpose(p, j, n, d->planes);
+	}
+	d->initial = (uint16_t) (p[0] | (p[1] << 8));
+
+	/* Count the edges on each line, then fill them in */
+	for (line = 0; line < TEK_DIGITAL_LINES; line++) {
+		for (j = 0; j < d->no_words; j++) {
+			d->no_edges[line] +=
+			    tek_popcount64(tek_digital_changes(d, line, j));
+		}
+		d->edges[line] = (uint32_t *) malloc((d->no_edges[line] + 1)
+						     * sizeof(uint32_t));
+		if (!d->edges[line]) {
+			printf("Error: tek_digital_decode: out of memory\n");
+			tek_digital_free(d);
+			return -2;
+		}
+		k = 0;
+		for (j = 0; j < d->no_words; j++) {
+			for (t = tek_digital_changes(d, line, j); t;
+			     t &= t - 1) {
+				d->edges[line][k++] =
+				    (uint32_t) (64 * j + tek_ctz64(t));
+			}
+		}
+	}
+	return 0;
+}
+
+void tek_digital_free(TEK_DIGITAL * d)
+{
+	int line;
+
+	for (line = 0; line < TEK_DIGITAL_LINES; line++) {
+		free(d->planes[line]);
+		free(d->edges[line]);
+		d->planes[line] = NULL;
+		d->edges[line] = NULL;
+	}
+}
+
+/* Number of edges on line at or before sample (or, if strictly is set,
+ * before it) */
+static long tek_digital_edges_to(const TEK_DIGITAL * d, int line,
+				 long sample, int strictly)
+{
+	long lo = 0, hi = d->no_edges[line], mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if ((long)d->edges[line][mid] < sample
+		    || (!strictly && (long)d->edges[line][mid] == sample)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+int tek_digital_level(const TEK_DIGITAL * d, int line, long sample)
+{
+	if (line < 0 || line >= TEK_DIGITAL_LINES || sample < 0
+	    || sample >= d->no_samples) {
+		return -1;
+	}
+	if (d->planes[line]) {
+		return (int)((d->planes[line][sample / 64] >> (sample % 64)) & 1);
+	}
+	return ((d->initial >> line) & 1) ^ (tek_digital_edges_to(d, line,
+								 sample,
+								 0) & 1);
+}
+
+long tek_digital_next_edge(const TEK_DIGITAL * d, int line, long from)
+{
+	long k;
+
+	if (line < 0 || line >= TEK_DIGITAL_LINES) {
+		return -1;
+	}
+	k = tek_digital_edges_to(d, line, from, 1);
+	return (k < d->no_edges[line]) ? (long)d->edges[line][k] : -1;
+}
+
+long tek_digital_write_magic(FILE * f)
+{
+	if (fwrite(TEK_DIGITAL_MAGIC, 1, 8, f) != 8) {
+		printf("Error: tek_digital_write_magic: could not write\n");
+		return -1;
+	}
+	return 8;
+}
+
+long tek_digital_write(FILE * f, const TEK_DIGITAL * d)
+{
+	uint64_t no_samples = d->no_samples;
+	uint16_t reserved = 0;
+	uint32_t no_edges[TEK_DIGITAL_LINES];
+	long bytes = 12 + sizeof(no_edges);
+	int line;
+
+	for (line = 0; line < TEK_DIGITAL_LINES; line++) {
+		no_edges[line] = (uint32_t) d->no_edges[line];
+	}
+	if (fwrite(&no_samples, 8, 1, f) != 1
+	    || fwrite(&d->initial, 2, 1, f) != 1
+	    || fwrite(&reserved, 2, 1, f) != 1
+	    || fwrite(no_edges, sizeof(no_edges), 1, f) != 1) {
+		printf("Error: tek_digital_write: could not write\n");
+		return -1;
+	}
+	for (line = 0; line < TEK_DIGITAL_LINES; line++) {
+		if ((long)fwrite(d->edges[line], sizeof(uint32_t),
+				 d->no_edges[line], f) != d->no_edges[line]) {
+			printf("Error: tek_digital_write: could not write\n");
+			return -1;
+		}
+		bytes += d->no_edges[line] * sizeof(uint32_t);
+	}
+	return bytes;
+}
+
+int tek_digital_read_magic(FILE * f)
+{
+	char magic[8];
+
+	if (fread(magic, 1, 8, f) != 8
+	    || memcmp(magic, TEK_DIGITAL_MAGIC, 8) != 0) {
+		printf("Error: tek_digital_read_magic: not a digital edges file\n");
+		return -1;
+	}
+	return 0;
+}
+
+int tek_digital_read(FILE * f, TEK_DIGITAL * d)
+{
+	uint64_t no_samples;
+	uint16_t reserved;
+	uint32_t no_edges[TEK_DIGITAL_LINES];
+	int line;
+
+	memset(d, 0, sizeof(TEK_DIGITAL));
+	if (fread(&no_samples, 8, 1, f) != 1) {
+		return 0;
+	}
+	if (fread(&d->initial, 2, 1, f) != 1
+	    || fread(&reserved, 2, 1, f) != 1
+	    || fread(no_edges, sizeof(no_edges), 1, f) != 1) {
+		printf("Error: tek_digital_read: file is cut short\n");
+		return -1;
+	}
+	d->no_samples = (long)no_samples;
+	d->no_words = (d->no_samples + 63) / 64;
+	for (line = 0; line < TEK_DIGITAL_LINES; line++) {
+		d->no_edges[line] = no_edges[line];
+		d->edges[line] = (uint32_t *) malloc((no_edges[line] + 1)
+						     * sizeof(uint32_t));
+		if (!d->edges[line]
+		    || fread(d->edges[line], sizeof(uint32_t), no_edges[line],
+			     f) != no_edges[line]) {
+			printf("Error: tek_digital_read: file is cut short\n");
+			tek_digital_free(d);
+			return -1;
+		}
+	}
+	return 1;
+}
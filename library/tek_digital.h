@@ -0,0 +1,82 @@
+/* tek_digital.h
+ * The digital channels of an MSO scope, D0 to D15, all at once. Rather
+ * than getting each line as a trace of its own (16 bits per sample, for
+ * one bit of information), ask for DATA:SOURCE DIGITAL, which gives one
+ * 16 bit word per sample with a bit for each line, and decode that:
+ *  - into a bit-plane per line (64 samples to a 64 bit word), and
+ *  - into the edges on each line, which is all that needs to be kept:
+ *    most lines change rarely, if ever.
+ * Finding the next edge on a line, or the level at a given sample, is then
+ * a binary search rather than a trawl through millions of samples.
+ *
+ * The edges file (.wfd) is an 8 byte magic number, "TEKDIGI1", and then
+ * for each trace in turn:
+ *   uint64  no_samples
+ *   uint16  initial     level of each line at sample 0 (bit n = Dn)
+ *   uint16  reserved
+ *   uint32  no_edges[16]
+ *   uint32  edges       no_edges[0] sample numbers for D0, then D1, etc.
+ * All little-endian. An edge at sample i means sample i differs from
+ * sample i-1.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_DIGITAL_H_
+#define _TEK_DIGITAL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tek_vxi11.h"
+
+#define TEK_DIGITAL_LINES	16
+
+typedef struct {
+	long no_samples;
+	long no_words;		/* in each plane */
+	uint64_t *planes[TEK_DIGITAL_LINES];	/* bit i of word j is sample
+						 * 64 * j + i; NULL once read
+						 * back from a file */
+	uint16_t initial;
+	long no_edges[TEK_DIGITAL_LINES];
+	uint32_t *edges[TEK_DIGITAL_LINES];
+} TEK_DIGITAL;
+
+/* Decodes n samples of DATA:SOURCE DIGITAL data (two bytes per sample, LSB
+ * first, as from tek_scope_get_data()) into d, which should be freed with
+ * tek_digital_free() afterwards. */
+tk_EXPORT int tek_digital_decode(const char *data, long n, TEK_DIGITAL * d);
+tk_EXPORT void tek_digital_free(TEK_DIGITAL * d);
+
+/* Level (0 or 1) of line at sample, and the first edge on line at or
+ * after sample from (-1 if there are no more) */
+tk_EXPORT int tek_digital_level(const TEK_DIGITAL * d, int line, long sample);
+tk_EXPORT long tek_digital_next_edge(const TEK_DIGITAL * d, int line,
+				     long from);
+
+/* The edges file. tek_digital_write_magic() once at the start of the
+ * file, then tek_digital_write() for each trace; they return the number
+ * of bytes written, or negative. tek_digital_read() reads the next trace,
+ * returning 1, or 0 at the end of the file, or negative; call
+ * tek_digital_read_magic() first. */
+tk_EXPORT long tek_digital_write_magic(FILE * f);
+tk_EXPORT long tek_digital_write(FILE * f, const TEK_DIGITAL * d);
+tk_EXPORT int tek_digital_read_magic(FILE * f);
+tk_EXPORT int tek_digital_read(FILE * f, TEK_DIGITAL * d);
+
+#endif
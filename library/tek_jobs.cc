@@ -0,0 +1,81 @@
+/* tek_jobs.cc
+ * Sharing work out between threads. See tek_jobs.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "tek_jobs.h"
+
+int tek_jobs_threads(int no_threads, long no_units)
+{
+#ifdef WIN32
+	no_threads = 1;
+#else
+	if (no_threads <= 0) {
+		no_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+#endif
+	if (no_threads > no_units) {
+		no_threads = (int)no_units;
+	}
+	if (no_threads < 1) {
+		no_threads = 1;
+	}
+	return no_threads;
+}
+
+void tek_jobs_run(void *(*fn) (void *), void *jobs, size_t size,
+		  int no_jobs)
+{
+	char *job = (char *)jobs;
+	int t;
+
+#ifdef WIN32
+	for (t = 0; t < no_jobs; t++) {
+		fn(job + t * size);
+	}
+#else
+	pthread_t *threads;
+	int *started;
+
+	if (no_jobs < 1) {
+		return;
+	}
+	threads = new pthread_t[no_jobs];
+	started = new int[no_jobs];
+	for (t = 1; t < no_jobs; t++) {
+		started[t] = (pthread_create(&threads[t], NULL, fn,
+					     job + t * size) == 0);
+		if (!started[t]) {
+			fn(job + t * size);
+		}
+	}
+	fn(job);
+	for (t = 1; t < no_jobs; t++) {
+		if (started[t]) {
+			pthread_join(threads[t], NULL);
+		}
+	}
+	delete[]threads;
+	delete[]started;
+#endif
+}
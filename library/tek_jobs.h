@@ -0,0 +1,42 @@
+/* tek_jobs.h
+ * Sharing work out between threads, for the library's own use (it isn't
+ * installed). The measurements, cross-correlations and decimation each
+ * split a batch of traces into one job per thread; parallel downloads and
+ * deploying to several AFGs have one job per link. Either way the jobs are
+ * an array of structs and a function that takes a pointer to one of them.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_JOBS_H_
+#define _TEK_JOBS_H_
+
+#include <stddef.h>
+
+/* How many threads to use for no_units pieces of work: no_threads, or one
+ * per processor if that's <= 0, but never more than there are pieces, and
+ * always at least one (and only one on WIN32, for now) */
+int tek_jobs_threads(int no_threads, long no_units);
+
+/* Runs fn on each of no_jobs jobs (an array of structs, each size bytes),
+ * all at once: the first in this thread, the rest in threads of their own.
+ * A job whose thread can't be started is done in this thread instead, so
+ * they all get done whatever happens. Returns once they've all finished. */
+void tek_jobs_run(void *(*fn) (void *), void *jobs, size_t size,
+		  int no_jobs);
+
+#endif
@@ -0,0 +1,376 @@
+/* tek_measure.cc
+ * Measurements on raw trace data. See tek_measure.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "tek_measure.h"
+#include "tek_jobs.h"
+
+/* The vector loops assume the data can be loaded straight into registers,
+ * i.e. a little-endian machine, which anything with SSE2 is */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TEK_MEASURE_SSE2
+#endif
+
+/* Sample i, from the scope's LSB-first data, whatever the host */
+static inline int tek_sample(const unsigned char *p, long i)
+{
+	return (short)(p[2 * i] | (p[2 * i + 1] << 8));
+}
+
+/* Minimum, maximum, sum and sum of squares, all in raw units */
+static void tek_measure_sums(const unsigned char *p, long n, int *min,
+			     int *max, double *sum, double *sum_sq)
+{
+	long long s = 0;
+	unsigned long long s2 = 0;
+	int lo = 32767, hi = -32768, x;
+	long i = 0;
+
+#ifdef TEK_MEASURE_SSE2
+	__m128i vmin = _mm_set1_epi16(32767), vmax = _mm_set1_epi16(-32768);
+	__m128i ones = _mm_set1_epi16(1), zero = _mm_setzero_si128();
+	__m128i vsum, vsq = zero, v, sq;
+	long block_end;
+	int part[4];
+	short m[8];
+	unsigned long long q[2];
+
+	while (i + 8 <= n) {
+		/* 32 bit sums of pairs can't overflow within a block this size */
+		block_end = (n - i > 8 * 16384) ? i + 8 * 16384 : n;
+		vsum = zero;
+		for (; i + 8 <= block_end; i += 8) {
+			v = _mm_loadu_si128((const __m128i *)(p + 2 * i));
+			vmin = _mm_min_epi16(vmin, v);
+			vmax = _mm_max_epi16(vmax, v);
+			vsum = _mm_add_epi32(vsum, _mm_madd_epi16(v, ones));
+			/* x*x + y*y is at most 2^31, so unsigned 32 bits */
+			sq = _mm_madd_epi16(v, v);
+			vsq = _mm_add_epi64(vsq, _mm_unpacklo_epi32(sq, zero));
+			vsq = _mm_add_epi64(vsq, _mm_unpackhi_epi32(sq, zero));
+		}
+		_mm_storeu_si128((__m128i *) part, vsum);
+		s += (long long)part[0] + part[1] + part[2] + part[3];
+	}
+	_mm_storeu_si128((__m128i *) q, vsq);
+	s2 = q[0] + q[1];
+	_mm_storeu_si128((__m128i *) m, vmin);
+	for (x = 0; x < 8; x++) {
+		lo = (m[x] < lo) ? m[x] : lo;
+	}
+	_mm_storeu_si128((__m128i *) m, vmax);
+	for (x = 0; x < 8; x++) {
+		hi = (m[x] > hi) ? m[x] : hi;
+	}
+#endif
+	for (; i < n; i++) {
+		x = tek_sample(p, i);
+		lo = (x < lo) ? x : lo;
+		hi = (x > hi) ? x : hi;
+		s += x;
+		s2 += (unsigned long long)(x * x);
+	}
+	*min = lo;
+	*max = hi;
+	*sum = (double)s;
+	*sum_sq = (double)s2;
+}
+
+/* First sample from i on that is below level (or n if none) */
+static long tek_find_below(const unsigned char *p, long i, long n, int level)
+{
+#ifdef TEK_MEASURE_SSE2
+	__m128i lv = _mm_set1_epi16((short)level);
+	int mask;
+
+	for (; i + 8 <= n; i += 8) {
+		mask = _mm_movemask_epi8(_mm_cmplt_epi16
+					 (_mm_loadu_si128
+					  ((const __m128i *)(p + 2 * i)), lv));
+		if (mask) {
+			return i + __builtin_ctz(mask) / 2;
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		if (tek_sample(p, i) < level) {
+			return i;
+		}
+	}
+	return n;
+}
+
+/* First sample from i on that is at or above level (or n if none) */
+static long tek_find_at_or_above(const unsigned char *p, long i, long n,
+				 int level)
+{
+#ifdef TEK_MEASURE_SSE2
+	__m128i lv = _mm_set1_epi16((short)level);
+	int mask;
+
+	for (; i + 8 <= n; i += 8) {
+		mask = _mm_movemask_epi8(_mm_cmplt_epi16
+					 (_mm_loadu_si128
+					  ((const __m128i *)(p + 2 * i)), lv));
+		if (mask != 0xffff) {
+			return i + __builtin_ctz(~mask) / 2;
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		if (tek_sample(p, i) >= level) {
+			return i;
+		}
+	}
+	return n;
+}
+
+/* Where (in samples) the trace last crossed level on its way up to sample
+ * k, interpolated. There must be a sample below level before k. */
+static double tek_rising_crossing(const unsigned char *p, long k,
+				  double level)
+{
+	int a, b;
+
+	while (!(tek_sample(p, k - 1) < level)) {
+		k--;
+	}
+	a = tek_sample(p, k - 1);
+	b = tek_sample(p, k);
+	return k - 1 + (level - a) / (b - a);
+}
+
+/* The same on the way down: there must be a sample at or above level
+ * before k */
+static double tek_falling_crossing(const unsigned char *p, long k,
+				   double level)
+{
+	int a, b;
+
+	while (tek_sample(p, k - 1) < level) {
+		k--;
+	}
+	a = tek_sample(p, k - 1);
+	b = tek_sample(p, k);
+	return k - 1 + (level - a) / (b - a);
+}
+
+int tek_measure(const char *data, long n, double vgain, double voffset,
+		double hinterval, TEK_MEASUREMENTS * m)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	int min, max, ilo, ihi;
+	double sum, sum_sq, lo, mid, hi, t10, t50, t90;
+	double rise = 0, fall = 0, pos = 0, neg = 0;
+	double first_rise = 0, last_rise = 0, first_fall = 0, last_fall = 0;
+	long no_pos = 0, no_neg = 0, i, at;
+	int below;
+
+	m->max = m->min = m->vpp = m->mean = m->rms = NAN;
+	m->rise = m->fall = m->period = m->frequency = NAN;
+	m->pos_width = m->neg_width = NAN;
+	m->no_rising = m->no_falling = 0;
+	if (n < 1) {
+		return -1;
+	}
+
+	tek_measure_sums(p, n, &min, &max, &sum, &sum_sq);
+	m->max = vgain * max + voffset;
+	m->min = vgain * min + voffset;
+	if (m->min > m->max) {
+		m->max = vgain * min + voffset;
+		m->min = vgain * max + voffset;
+	}
+	m->vpp = m->max - m->min;
+	m->mean = vgain * sum / n + voffset;
+	m->rms = sqrt(vgain * vgain * sum_sq / n
+		      + 2 * vgain * voffset * sum / n + voffset * voffset);
+	if (max - min < 2) {
+		return 0;
+	}
+
+	/* Edges, in raw units: "below" 10% is < lo, "above" 90% is >= hi,
+	 * which as whole numbers is < ilo and >= ihi */
+	lo = min + 0.1 * (max - min);
+	mid = min + 0.5 * (max - min);
+	hi = min + 0.9 * (max - min);
+	ilo = (int)ceil(lo);
+	ihi = (int)ceil(hi);
+	at = tek_find_below(p, 0, n, ilo);
+	i = tek_find_at_or_above(p, 0, n, ihi);
+	below = (at < i);
+	if (!below) {
+		at = i;
+	}
+	while (at < n) {
+		if (below) {
+			i = tek_find_at_or_above(p, at, n, ihi);
+			if (i >= n) {
+				break;
+			}
+			t90 = i - 1 + (hi - tek_sample(p, i - 1))
+			    / (tek_sample(p, i) - tek_sample(p, i - 1));
+			t50 = tek_rising_crossing(p, i, mid);
+			t10 = tek_rising_crossing(p, i, lo);
+			rise += t90 - t10;
+			if (m->no_rising++ == 0) {
+				first_rise = t50;
+			}
+			if (m->no_falling > 0) {
+				neg += t50 - last_fall;
+				no_neg++;
+			}
+			last_rise = t50;
+		} else {
+			i = tek_find_below(p, at, n, ilo);
+			if (i >= n) {
+				break;
+			}
+			t10 = i - 1 + (lo - tek_sample(p, i - 1))
+			    / (tek_sample(p, i) - tek_sample(p, i - 1));
+			t50 = tek_falling_crossing(p, i, mid);
+			t90 = tek_falling_crossing(p, i, hi);
+			fall += t10 - t90;
+			if (m->no_falling++ == 0) {
+				first_fall = t50;
+			}
+			if (m->no_rising > 0) {
+				pos += t50 - last_rise;
+				no_pos++;
+			}
+			last_fall = t50;
+		}
+		below = !below;
+		at = i;
+	}
+
+	/* Only now into seconds */
+	if (m->no_rising > 0) {
+		m->rise = rise / m->no_rising * hinterval;
+	}
+	if (m->no_falling > 0) {
+		m->fall = fall / m->no_falling * hinterval;
+	}
+	if (m->no_rising > 1) {
+		m->period = (last_rise - first_rise) / (m->no_rising - 1)
+		    * hinterval;
+	} else if (m->no_falling > 1) {
+		m->period = (last_fall - first_fall) / (m->no_falling - 1)
+		    * hinterval;
+	}
+	if (m->period > 0) {
+		m->frequency = 1 / m->period;
+	}
+	if (no_pos > 0) {
+		m->pos_width = pos / no_pos * hinterval;
+	}
+	if (no_neg > 0) {
+		m->neg_width = neg / no_neg * hinterval;
+	}
+	return 0;
+}
+
+typedef struct {
+	const char *data;
+	long n;
+	int first, step, no_traces;
+	double vgain, voffset, hinterval;
+	TEK_MEASUREMENTS *m;
+} TEK_MEASURE_JOB;
+
+static void *tek_measure_job(void *arg)
+{
+	TEK_MEASURE_JOB *job = (TEK_MEASURE_JOB *) arg;
+	int t;
+
+	for (t = job->first; t < job->no_traces; t += job->step) {
+		tek_measure(job->data + 2 * job->n * (long)t, job->n,
+			    job->vgain, job->voffset, job->hinterval,
+			    &job->m[t]);
+	}
+	return NULL;
+}
+
+int tek_measure_traces(const char *data, long n, int no_traces,
+		       double vgain, double voffset, double hinterval,
+		       TEK_MEASUREMENTS * m, int no_threads)
+{
+	TEK_MEASURE_JOB *jobs;
+	int t;
+
+	if (no_traces < 1) {
+		return -1;
+	}
+	no_threads = tek_jobs_threads(no_threads, no_traces);
+
+	/* Every thread takes every no_threads'th trace */
+	jobs = new TEK_MEASURE_JOB[no_threads];
+	for (t = 0; t < no_threads; t++) {
+		jobs[t].data = data;
+		jobs[t].n = n;
+		jobs[t].first = t;
+		jobs[t].step = no_threads;
+		jobs[t].no_traces = no_traces;
+		jobs[t].vgain = vgain;
+		jobs[t].voffset = voffset;
+		jobs[t].hinterval = hinterval;
+		jobs[t].m = m;
+	}
+	tek_jobs_run(tek_measure_job, jobs, sizeof(TEK_MEASURE_JOB), no_threads);
+	delete[]jobs;
+	return 0;
+}
+
+/* NaN as Matlab writes it, so the file loads straight back in */
+static void tek_measure_write_value(FILE * f, double x)
+{
+	if (isnan(x)) {
+		fprintf(f, " NaN");
+	} else {
+		fprintf(f, " %.6g", x);
+	}
+}
+
+void tek_measure_write_header(FILE * f)
+{
+	fprintf(f, "%% trace max min vpp mean rms rise fall period frequency pos_width neg_width no_rising no_falling\n");
+}
+
+void tek_measure_write(FILE * f, long trace, const TEK_MEASUREMENTS * m)
+{
+	fprintf(f, "%ld", trace);
+	tek_measure_write_value(f, m->max);
+	tek_measure_write_value(f, m->min);
+	tek_measure_write_value(f, m->vpp);
+	tek_measure_write_value(f, m->mean);
+	tek_measure_write_value(f, m->rms);
+	tek_measure_write_value(f, m->rise);
+	tek_measure_write_value(f, m->fall);
+	tek_measure_write_value(f, m->period);
+	tek_measure_write_value(f, m->frequency);
+	tek_measure_write_value(f, m->pos_width);
+	tek_measure_write_value(f, m->neg_width);
+	fprintf(f, " %ld %ld\n", m->no_rising, m->no_falling);
+}
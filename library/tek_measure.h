@@ -0,0 +1,71 @@
+/* tek_measure.h
+ * Measurements (Vpp, mean, RMS, rise and fall times, frequency, pulse
+ * widths) worked out on the PC from the raw 16 bit data that
+ * tek_scope_get_data() returns, so you don't have to load every trace into
+ * Matlab just to get a few numbers out of it. Everything is done on the
+ * raw sample values, with vectorised (SSE2) loops where the compiler has
+ * them, and only the results are turned into volts and seconds.
+ *
+ * The reference levels are 10%, 50% and 90% of the way from the minimum to
+ * the maximum of each trace. Crossings are interpolated between samples.
+ * An edge only counts if it goes all the way from below 10% to above 90%
+ * (or back), so noise around a level doesn't make extra edges. Rise and
+ * fall times, and widths, are averages over all the complete edges (or
+ * pulses) in the trace; the period is from the first to the last rising
+ * edge. Anything that can't be worked out (e.g. no edges) is NaN.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_MEASURE_H_
+#define _TEK_MEASURE_H_
+
+#include <stdio.h>
+
+#include "tek_vxi11.h"
+
+typedef struct {
+	double max, min, vpp;	/* volts */
+	double mean, rms;	/* volts; rms is of the whole signal, not AC */
+	double rise, fall;	/* 10-90% and 90-10% times (s) */
+	double period, frequency;	/* s, Hz */
+	double pos_width, neg_width;	/* at 50% (s) */
+	long no_rising, no_falling;	/* complete edges found */
+} TEK_MEASUREMENTS;
+
+/* Measures one trace of n points. data is as it comes from the scope (two
+ * bytes per point, LSB first); vgain, voffset and hinterval are as from
+ * tek_scope_get_scaling(). */
+tk_EXPORT int tek_measure(const char *data, long n, double vgain,
+			  double voffset, double hinterval,
+			  TEK_MEASUREMENTS * m);
+
+/* Measures no_traces traces of n points each, one after the other in data
+ * (e.g. the segments of a FastFrame acquisition), sharing them between
+ * no_threads threads (<= 0 means one per processor). m has no_traces
+ * entries. */
+tk_EXPORT int tek_measure_traces(const char *data, long n, int no_traces,
+				 double vgain, double voffset,
+				 double hinterval, TEK_MEASUREMENTS * m,
+				 int no_threads);
+
+/* One line per trace, with a header line to say what the columns are */
+tk_EXPORT void tek_measure_write_header(FILE * f);
+tk_EXPORT void tek_measure_write(FILE * f, long trace,
+				 const TEK_MEASUREMENTS * m);
+
+#endif
@@ -0,0 +1,418 @@
+/* tek_parallel.cc
+ * Downloading one trace over several links at once. See tek_parallel.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
+#include "tek_parallel.h"
+#include "tek_transport.h"
+#include "tek_jobs.h"
+
+/* Not worth splitting a record into pieces smaller than this (points) */
+#define TEK_PARALLEL_MIN_POINTS	10000
+#define TEK_PARALLEL_AUTO_LINKS	4
+
+typedef struct tek_parallel {
+	VXI11_CLINK *links[TEK_PARALLEL_MAX_LINKS];	/* [0] is the user's */
+	char *ip;
+	int no_links;		/* open */
+	int in_use;		/* used for downloads */
+	int frames;		/* FastFrame queries work: 1, don't: 0, not tried: -1 */
+	struct tek_parallel *next;
+} TEK_PARALLEL;
+
+/* One link's share of the download */
+typedef struct {
+	VXI11_CLINK *clink;
+	char cmd[128];
+	char *buf;
+	long len;
+	unsigned long timeout;
+	long ret;
+} TEK_PIECE;
+
+/* Links that have extra links for downloading, like the list of transports
+ * in tek_transport.cc, for links opened from several threads */
+static TEK_PARALLEL *tek_parallels = NULL;
+#ifdef WIN32
+#define tek_parallels_lock()
+#define tek_parallels_unlock()
+#else
+static pthread_mutex_t tek_parallels_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define tek_parallels_lock()	pthread_mutex_lock(&tek_parallels_mutex)
+#define tek_parallels_unlock()	pthread_mutex_unlock(&tek_parallels_mutex)
+#endif
+
+static TEK_PARALLEL *tek_parallel_get(VXI11_CLINK * clink)
+{
+	TEK_PARALLEL *p;
+
+	tek_parallels_lock();
+	for (p = tek_parallels; p; p = p->next) {
+		if (p->links[0] == clink) {
+			break;
+		}
+	}
+	tek_parallels_unlock();
+	return p;
+}
+
+int tek_parallel_links(VXI11_CLINK * clink)
+{
+	TEK_PARALLEL *p = tek_parallel_get(clink);
+
+	return p ? p->in_use : 1;
+}
+
+/* Closes the extra links beyond the first 'keep' */
+static void tek_parallel_trim(TEK_PARALLEL * p, int keep)
+{
+	while (p->no_links > keep) {
+		p->no_links--;
+		tek_close(p->links[p->no_links], p->ip);
+	}
+	if (p->in_use > p->no_links) {
+		p->in_use = p->no_links;
+	}
+}
+
+void tek_parallel_close(VXI11_CLINK * clink)
+{
+	TEK_PARALLEL **pp, *p = NULL;
+
+	tek_parallels_lock();
+	for (pp = &tek_parallels; *pp; pp = &(*pp)->next) {
+		if ((*pp)->links[0] == clink) {
+			p = *pp;
+			*pp = p->next;
+			break;
+		}
+	}
+	tek_parallels_unlock();
+	/* not while locked, as tek_close() comes back here for each link */
+	if (p) {
+		tek_parallel_trim(p, 1);
+		free(p->ip);
+		free(p);
+	}
+}
+
+static void *tek_piece_fetch(void *arg)
+{
+	TEK_PIECE *piece = (TEK_PIECE *) arg;
+
+	piece->ret = tek_send(piece->clink, piece->cmd);
+	if (piece->ret == 0) {
+		piece->ret = tek_receive_data_block(piece->clink, piece->buf,
+						    piece->len, piece->timeout);
+	}
+	return NULL;
+}
+
+/* Reads DATA:START/STOP and, where there's FastFrame, DATA:FRAMESTART/STOP
+ * and whether it's on. Scopes without FastFrame (TDS3000s) don't answer the
+ * frame queries at all, so they're asked separately, and only until the
+ * first time they fail; after that it's START/STOP only. Returns 0 if all
+ * is well. */
+static int tek_parallel_range(TEK_PARALLEL * p, long *start, long *stop,
+			      long *frame_start, long *frame_stop,
+			      int *fastframe, unsigned long timeout)
+{
+	VXI11_CLINK *clink = p->links[0];
+	char reply[128];
+
+	memset(reply, 0, sizeof(reply));
+	if (tek_send_and_receive(clink, "DATA:START?;STOP?", reply,
+				 sizeof(reply) - 1, timeout) != 0
+	    || sscanf(reply, "%ld;%ld", start, stop) != 2) {
+		return -1;
+	}
+	*frame_start = *frame_stop = 1;
+	*fastframe = 0;
+	if (p->frames == 0) {
+		return 0;
+	}
+	memset(reply, 0, sizeof(reply));
+	if (tek_send_and_receive(clink,
+				 "DATA:FRAMESTART?;FRAMESTOP?;:HOR:FASTFRAME:STATE?",
+				 reply, sizeof(reply) - 1, timeout) != 0
+	    || sscanf(reply, "%ld;%ld;%d", frame_start, frame_stop,
+		      fastframe) != 3) {
+		p->frames = 0;
+		*frame_start = *frame_stop = 1;
+		*fastframe = 0;
+		return 0;
+	}
+	p->frames = 1;
+	return 0;
+}
+
+/* Downloads the current DATA:SOURCE/START/STOP (and FRAMESTART/STOP) over
+ * n links. Returns the number of bytes, as tek_receive_data_block. */
+static long tek_parallel_fetch(TEK_PARALLEL * p, int n, const char *source,
+			       char *buf, size_t len, unsigned long timeout)
+{
+	VXI11_CLINK *clink = p->links[0];
+	TEK_PIECE pieces[TEK_PARALLEL_MAX_LINKS];
+	long start, stop, frame_start, frame_stop, no_points, no_frames;
+	long a, b, total = 0, bytes_per_unit, no_units, first;
+	int fastframe, by_frames, i;
+
+	if (tek_parallel_range(p, &start, &stop, &frame_start, &frame_stop,
+			       &fastframe, timeout) != 0) {
+		printf("tek_parallel: could not read DATA:START/STOP\n");
+		return -1;
+	}
+	no_points = stop - start + 1;
+	no_frames = fastframe ? frame_stop - frame_start + 1 : 1;
+	if (no_points < 1 || no_frames < 1) {
+		return 0;
+	}
+	by_frames = (no_frames > 1);
+	if (by_frames) {
+		bytes_per_unit = 2 * no_points;
+		no_units = no_frames;
+		first = frame_start;
+	} else {
+		bytes_per_unit = 2;
+		no_units = no_points;
+		first = start;
+		if (no_points / TEK_PARALLEL_MIN_POINTS < n) {
+			n = no_points / TEK_PARALLEL_MIN_POINTS;
+		}
+	}
+	if (n > no_units) {
+		n = (int)no_units;
+	}
+	if (n < 1) {
+		n = 1;
+	}
+	if ((size_t)(bytes_per_unit * no_units) > len) {
+		printf("tek_parallel: buffer too small (%ld bytes needed)\n",
+		       bytes_per_unit * no_units);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		a = first + (no_units * i) / n;
+		b = first + (no_units * (i + 1)) / n - 1;
+		pieces[i].clink = p->links[i];
+		pieces[i].buf = buf + (a - first) * bytes_per_unit;
+		pieces[i].len = (b - a + 1) * bytes_per_unit;
+		pieces[i].timeout = timeout;
+		snprintf(pieces[i].cmd, sizeof(pieces[i].cmd),
+			 by_frames ? "DATA:SOURCE %s;FRAMESTART %ld;FRAMESTOP %ld;:CURVE?"
+			 : "DATA:SOURCE %s;START %ld;STOP %ld;:CURVE?",
+			 source, a, b);
+	}
+	tek_jobs_run(tek_piece_fetch, pieces, sizeof(TEK_PIECE), n);
+
+	/* put things back as they were */
+	if (by_frames) {
+		tek_send_printf(clink, "DATA:FRAMESTART %ld;FRAMESTOP %ld",
+				frame_start, frame_stop);
+	} else {
+		tek_send_printf(clink, "DATA:START %ld;STOP %ld", start, stop);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (pieces[i].ret != pieces[i].len) {
+			printf("tek_parallel: link %d returned %ld bytes, expected %ld\n",
+			       i, pieces[i].ret, pieces[i].len);
+			return pieces[i].ret < 0 ? pieces[i].ret : -1;
+		}
+		total += pieces[i].ret;
+	}
+	return total;
+}
+
+long tek_parallel_curve(VXI11_CLINK * clink, const char *source, char *buf,
+			size_t len, unsigned long timeout)
+{
+	TEK_PARALLEL *p = tek_parallel_get(clink);
+
+	if (!p) {
+		return -1;
+	}
+	return tek_parallel_fetch(p, p->in_use, source, buf, len, timeout);
+}
+
+/* Best of two, in us. Returns a negative time if it didn't work. */
+static double tek_parallel_time(TEK_PARALLEL * p, int n, const char *source,
+				char *buf, size_t len, unsigned long timeout)
+{
+	double t0, t, best = -1;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		t0 = tek_time_us();
+		if (tek_parallel_fetch(p, n, source, buf, len, timeout) <= 0) {
+			return -1;
+		}
+		t = tek_time_us() - t0;
+		if (best < 0 || t < best) {
+			best = t;
+		}
+	}
+	return best;
+}
+
+/* Tries 1, 2, ... links, and goes with the quickest, as long as each extra
+ * link is worth it (10% faster) and gives the same data as a single link.
+ * The acquisition has to be stopped while this goes on: see below. */
+static int tek_parallel_compare(TEK_PARALLEL * p, unsigned long timeout)
+{
+	char source[32];
+	long start, stop, frame_start, frame_stop, bytes;
+	int fastframe, n, best = 1;
+	char *single, *buf;
+	double t, t_best;
+
+	memset(source, 0, sizeof(source));
+	if (tek_send_and_receive(p->links[0], "DATA:SOURCE?", source,
+				 sizeof(source) - 1, timeout) != 0
+	    || tek_parallel_range(p, &start, &stop, &frame_start,
+				  &frame_stop, &fastframe, timeout) != 0) {
+		return 1;
+	}
+	source[strcspn(source, "\r\n")] = '\0';
+	bytes = 2 * (stop - start + 1);
+	if (fastframe && frame_stop > frame_start) {
+		bytes *= frame_stop - frame_start + 1;
+	}
+	if (bytes <= 0) {
+		return 1;
+	}
+	single = (char *)malloc(bytes);
+	buf = (char *)malloc(bytes);
+	if (!single || !buf) {
+		free(single);
+		free(buf);
+		return 1;
+	}
+
+	t_best = tek_parallel_time(p, 1, source, single, bytes, timeout);
+	for (n = 2; t_best > 0 && n <= p->no_links; n++) {
+		t = tek_parallel_time(p, n, source, buf, bytes, timeout);
+		if (t < 0) {
+			break;
+		}
+		if (memcmp(single, buf, bytes) != 0) {
+			printf("tek_scope_use_links: the data over %d links doesn't match the data\n"
+			       "over one (is the scope still acquiring?), sticking to one link\n",
+			       n);
+			best = 1;
+			break;
+		}
+		if (t < 0.9 * t_best) {
+			t_best = t;
+			best = n;
+		}
+	}
+	free(single);
+	free(buf);
+	return best;
+}
+
+/* The data mustn't change while we're comparing, so the acquisition is
+ * stopped, then put back the way it was (whether it was running, and in
+ * run/stop or single sequence mode) */
+static int tek_parallel_choose(TEK_PARALLEL * p, unsigned long timeout)
+{
+	char reply[64], stop_after[32];
+	int state, best;
+
+	memset(reply, 0, sizeof(reply));
+	if (tek_send_and_receive(p->links[0], "ACQUIRE:STATE?;STOPAFTER?",
+				 reply, sizeof(reply) - 1, timeout) != 0
+	    || sscanf(reply, "%d;%31[A-Za-z]", &state, stop_after) != 2) {
+		printf("tek_scope_use_links: could not read ACQUIRE:STATE, sticking to one link\n");
+		return 1;
+	}
+	tek_send_printf(p->links[0], "ACQUIRE:STATE 0");
+	tek_obtain_long_value(p->links[0], "*OPC?", timeout);
+
+	best = tek_parallel_compare(p, timeout);
+
+	if (state) {
+		tek_send_printf(p->links[0], "ACQUIRE:STOPAFTER %s;STATE 1",
+				stop_after);
+	}
+	return best;
+}
+
+int tek_scope_use_links(VXI11_CLINK * clink, const char *ip, int no_links,
+			unsigned long timeout)
+{
+	TEK_PARALLEL *p = tek_parallel_get(clink);
+	int want = no_links;
+
+	if (want <= 0) {
+		want = TEK_PARALLEL_AUTO_LINKS;
+	}
+	if (want > TEK_PARALLEL_MAX_LINKS) {
+		want = TEK_PARALLEL_MAX_LINKS;
+	}
+	if (want == 1) {
+		tek_parallel_close(clink);
+		return 1;
+	}
+	if (!p) {
+		p = (TEK_PARALLEL *) calloc(1, sizeof(TEK_PARALLEL));
+		if (!p) {
+			return 1;
+		}
+		p->ip = strdup(ip);
+		p->links[0] = clink;
+		p->no_links = p->in_use = 1;
+		/* no point waiting for the frame queries to time out */
+		p->frames = (tek_scope_is_TDS3000(clink) == 1) ? 0 : -1;
+		tek_parallels_lock();
+		p->next = tek_parallels;
+		tek_parallels = p;
+		tek_parallels_unlock();
+	}
+	tek_parallel_trim(p, want);
+	while (p->no_links < want) {
+		if (tek_open(&p->links[p->no_links], ip) != 0) {
+			printf("tek_scope_use_links: could only open %d links to %s\n",
+			       p->no_links, ip);
+			break;
+		}
+		tek_scope_init(p->links[p->no_links]);
+		p->no_links++;
+	}
+	p->in_use = p->no_links;
+	if (no_links <= 0) {
+		p->in_use = tek_parallel_choose(p, timeout);
+		tek_parallel_trim(p, p->in_use);
+	}
+	/* we've been changing the DATA:SOURCE behind its back */
+	tek_scope_forget_data_source(clink);
+	if (p->in_use == 1) {
+		tek_parallel_close(clink);
+		return 1;
+	}
+	return p->in_use;
+}
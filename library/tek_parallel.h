@@ -0,0 +1,61 @@
+/* tek_parallel.h
+ * Downloading one trace over several links at once. Getting a long record
+ * (or a big FastFrame set) off the scope over a single link is limited by
+ * the back-and-forth of the protocol more than by the network, and DPO
+ * class scopes will happily talk over several links at the same time. So
+ * once tek_scope_use_links() has opened some more links to the same scope,
+ * tek_scope_get_data() splits each CURVE? between them: a single record by
+ * DATA:START/STOP, or a FastFrame set by DATA:FRAMESTART/FRAMESTOP (whole
+ * frames to each link). Every link puts its piece straight into the right
+ * place in your buffer, so what you get back is exactly what one CURVE?
+ * would have given you. DATA:START/STOP etc are put back afterwards.
+ *
+ * Each piece is asked for in one message, e.g.
+ *   DATA:SOURCE CH1;START 50001;STOP 100000;:CURVE?
+ * which relies on the scope carrying out each message as a whole before
+ * looking at the next link. When tek_scope_use_links() is left to choose
+ * how many links to use, it checks this (the pieces must match the data
+ * from a single link) as well as timing it, and falls back to a single
+ * link if need be.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_PARALLEL_H_
+#define _TEK_PARALLEL_H_
+
+#include "tek_vxi11.h"
+
+#define TEK_PARALLEL_MAX_LINKS	8
+
+/* Uses no_links links (including clink itself) to download from the scope
+ * at ip, which clink is already open to. no_links <= 0 means try up to 4
+ * and use however many is quickest for the current settings, so call it
+ * after tek_scope_set_for_capture() etc; it stops the acquisition while it
+ * measures. Returns the number of links it will use. */
+tk_EXPORT int tek_scope_use_links(VXI11_CLINK * clink, const char *ip,
+				  int no_links, unsigned long timeout);
+
+/* For tek_vxi11.cc: how many links clink downloads over (1 if it hasn't
+ * got any extra ones), the download itself, and tidying up in tek_close */
+tk_EXPORT int tek_parallel_links(VXI11_CLINK * clink);
+tk_EXPORT long tek_parallel_curve(VXI11_CLINK * clink, const char *source,
+				  char *buf, size_t len,
+				  unsigned long timeout);
+tk_EXPORT void tek_parallel_close(VXI11_CLINK * clink);
+
+#endif
@@ -0,0 +1,296 @@
+/* tek_plan.cc
+ * Record length and DATA:START/STOP planning. See tek_plan.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "tek_plan.h"
+#include "tek_transport.h"
+
+/* Valid record lengths, at time of writing (see also
+ * tek_scope_set_record_length() in tek_vxi11.cc) */
+static const long tds3000_lengths[] = { 500, 10000 };
+static const long dpo4000_lengths[] =
+    { 1000, 10000, 100000, 1000000, 10000000 };
+
+#define TEK_PLAN_MEASURE_POINTS	100000
+
+int tek_plan_record_lengths(int is_TDS3000, const long **lengths)
+{
+	if (is_TDS3000 == 1) {
+		*lengths = tds3000_lengths;
+		return sizeof(tds3000_lengths) / sizeof(long);
+	}
+	*lengths = dpo4000_lengths;
+	return sizeof(dpo4000_lengths) / sizeof(long);
+}
+
+/* Points of a record_length record, sampled at rate, that cover t_start to
+ * t_stop: the first at or before t_start, to the last at or after t_stop */
+static int tek_plan_window(TEK_PLAN * plan, long record_length, double rate)
+{
+	double first, last;
+
+	first = floor((plan->t_start - plan->xzero) * rate + 1e-6);
+	last = ceil((plan->t_stop - plan->xzero) * rate - 1e-6);
+	if (first < 0) {
+		first = 0;
+	}
+	if (last > record_length - 1) {
+		last = record_length - 1;
+	}
+	if (last < first) {
+		return -1;
+	}
+	plan->record_length = record_length;
+	plan->sample_rate = rate;
+	plan->start = (long)first + 1;
+	plan->stop = (long)last + 1;
+	plan->no_bytes = 2 * (plan->stop - plan->start + 1);
+	return 0;
+}
+
+int tek_plan_make(VXI11_CLINK * clink, double min_rate, double span,
+		  double roi_start, double roi_stop, TEK_PLAN * plan)
+{
+	const long *lengths;
+	double screen, screen_stop, rate = 0;
+	int no_lengths, all_lengths, i;
+
+	memset(plan, 0, sizeof(TEK_PLAN));
+	plan->min_rate = min_rate;
+	plan->is_TDS3000 = tek_scope_is_TDS3000(clink);
+	plan->hor_scale = tek_obtain_double_value(clink, "HOR:MAIN:SCALE?");
+	plan->xzero = tek_obtain_double_value(clink, "WFMPRE:XZERO?");
+	if (plan->hor_scale <= 0) {
+		printf("error: could not get the timebase from the scope\n");
+		return -1;
+	}
+	/* 0 (or nothing) if the scope doesn't say */
+	if (plan->is_TDS3000 != 1) {
+		plan->max_rate = tek_obtain_double_value(clink,
+							 "ACQUIRE:MAXSAMPLERATE?");
+	}
+	if (plan->max_rate > 0 && min_rate > plan->max_rate * (1 + 1e-9)) {
+		printf("error: the scope can't sample faster than %g S/s\n",
+		       plan->max_rate);
+		return -1;
+	}
+	screen = 10 * plan->hor_scale;
+	screen_stop = plan->xzero + screen;
+
+	if (roi_stop > roi_start) {
+		if (roi_stop <= plan->xzero || roi_start >= screen_stop) {
+			printf("error: %g to %g s is off the screen (%g to %g s)\n",
+			       roi_start, roi_stop, plan->xzero, screen_stop);
+			return -1;
+		}
+		plan->t_start = roi_start;
+		plan->t_stop = roi_stop;
+		if (roi_start < plan->xzero || roi_stop > screen_stop) {
+			plan->t_start = roi_start < plan->xzero ?
+			    plan->xzero : roi_start;
+			plan->t_stop = roi_stop > screen_stop ?
+			    screen_stop : roi_stop;
+			printf("Only %g to %g s is on the screen, using that\n",
+			       plan->t_start, plan->t_stop);
+		}
+	} else if (span > 0) {
+		if (span > screen * (1 + 1e-9)) {
+			printf("error: %g s is longer than the screen (%g s); the timebase needs to be\n",
+			       span, screen);
+			printf("%g s/div or slower\n", span / 10);
+			return -1;
+		}
+		plan->t_start = plan->xzero + (screen - span) / 2;
+		plan->t_stop = plan->t_start + span;
+	} else {
+		plan->t_start = plan->xzero;
+		plan->t_stop = screen_stop;
+	}
+
+	/* The smallest record that's sampled quickly enough, of those that
+	 * aren't too long to fill the screen at this timebase */
+	all_lengths = tek_plan_record_lengths(plan->is_TDS3000, &lengths);
+	no_lengths = all_lengths;
+	while (no_lengths > 1 && plan->max_rate > 0
+	       && lengths[no_lengths - 1] / screen
+	       > plan->max_rate * (1 + 1e-9)) {
+		no_lengths--;
+	}
+	for (i = 0; i < no_lengths; i++) {
+		rate = lengths[i] / screen;
+		if (min_rate <= 0 || rate >= min_rate * (1 - 1e-9)) {
+			break;
+		}
+	}
+	if (i == no_lengths) {
+		printf("error: the most the scope can manage at %g s/div is %g S/s (%ld points);\n",
+		       plan->hor_scale, rate, lengths[no_lengths - 1]);
+		if (no_lengths < all_lengths) {
+			/* the next one up fills the screen at a slower timebase */
+			printf("%ld points would need more than the scope's %g S/s, so for %g S/s\n",
+			       lengths[no_lengths], plan->max_rate, min_rate);
+			printf("the timebase needs to be %g to %g s/div\n",
+			       lengths[no_lengths] / (10 * plan->max_rate),
+			       lengths[no_lengths] / (10 * min_rate));
+		} else {
+			printf("for %g S/s, the timebase needs to be %g s/div or faster\n",
+			       min_rate, lengths[no_lengths - 1] / (10 * min_rate));
+		}
+		return -1;
+	}
+	return tek_plan_window(plan, lengths[i], rate);
+}
+
+int tek_plan_measure_link(VXI11_CLINK * clink, char *source, TEK_PLAN * plan,
+			  unsigned long timeout)
+{
+	long record_length, n, bytes = 0, got;
+	double t0, ms, best_ms = 0;
+	char *buf;
+	int i;
+
+	t0 = tek_time_us();
+	tek_obtain_long_value(clink, "*OPC?", timeout);
+	plan->latency_ms = (tek_time_us() - t0) / 1000;
+
+	record_length = tek_obtain_long_value(clink, "HOR:RECORD?");
+	n = record_length < TEK_PLAN_MEASURE_POINTS ?
+	    record_length : TEK_PLAN_MEASURE_POINTS;
+	if (n <= 0) {
+		printf("error: could not get the record length from the scope\n");
+		return -1;
+	}
+	tek_send_printf(clink, "DATA:START 1;STOP %ld", n);
+
+	/* Twice, as the first may have a DATA:SOURCE to send as well */
+	buf = new char[2 * n];
+	for (i = 0; i < 2; i++) {
+		t0 = tek_time_us();
+		got = tek_scope_get_data(clink, source, 0, buf, 2 * n, timeout);
+		ms = (tek_time_us() - t0) / 1000;
+		if (got <= 0) {
+			printf("error: could not get any data to time the link\n");
+			delete[]buf;
+			return -1;
+		}
+		if (i == 0 || ms < best_ms) {
+			best_ms = ms;
+			bytes = got;
+		}
+	}
+	delete[]buf;
+
+	/* What's left after the round trip is the time per byte */
+	ms = best_ms - plan->latency_ms;
+	if (ms <= 0) {
+		ms = best_ms;
+	}
+	plan->bytes_per_s = bytes / (ms / 1000);
+	return 0;
+}
+
+double tek_plan_transfer_ms(const TEK_PLAN * plan, int no_traces)
+{
+	if (plan->bytes_per_s <= 0) {
+		return 0;
+	}
+	return plan->latency_ms +
+	    1000 * (double)plan->no_bytes * no_traces / plan->bytes_per_s;
+}
+
+void tek_plan_print(const TEK_PLAN * plan, int no_traces)
+{
+	long no_points = plan->stop - plan->start + 1;
+
+	printf("Record length %ld points (%g S/s at %g s/div)",
+	       plan->record_length, plan->sample_rate, plan->hor_scale);
+	if (plan->min_rate > 0) {
+		printf(", for at least %g S/s", plan->min_rate);
+	}
+	printf(".\n");
+	printf("Points %ld to %ld (%ld of them, %g to %g s): %ld bytes per trace,\n",
+	       plan->start, plan->stop, no_points,
+	       plan->xzero + (plan->start - 1) / plan->sample_rate,
+	       plan->xzero + (plan->stop - 1) / plan->sample_rate,
+	       plan->no_bytes);
+	printf("rather than %ld for the whole record.\n",
+	       2 * plan->record_length);
+	if (no_traces > 1) {
+		printf("%ld bytes per capture of %d segments.\n",
+		       plan->no_bytes * no_traces, no_traces);
+	}
+	if (plan->bytes_per_s > 0) {
+		printf("Predicted transfer time %.1f ms per capture (%.2f MB/s, %.1f ms round trip).\n",
+		       tek_plan_transfer_ms(plan, no_traces > 1 ? no_traces : 1),
+		       plan->bytes_per_s / 1e6, plan->latency_ms);
+	}
+}
+
+long tek_plan_set_window(VXI11_CLINK * clink, TEK_PLAN * plan)
+{
+	long record_length;
+	double rate;
+
+	record_length = tek_obtain_long_value(clink, "HOR:RECORD?");
+	if (plan->is_TDS3000 == 1) {
+		rate = 1 / tek_obtain_double_value(clink, "WFMPRE:XINCR?");
+	} else {
+		rate = tek_obtain_double_value(clink, "HOR:MAIN:SAMPLERATE?");
+	}
+	plan->xzero = tek_obtain_double_value(clink, "WFMPRE:XZERO?");
+
+	/* e.g. the scope can't sample that quickly */
+	if (record_length != plan->record_length
+	    || fabs(rate - plan->sample_rate) > 1e-6 * plan->sample_rate) {
+		printf("The scope went for %ld points at %g S/s, rather than %ld at %g S/s\n",
+		       record_length, rate, plan->record_length,
+		       plan->sample_rate);
+		if (rate < plan->min_rate * (1 - 1e-6)) {
+			printf("warning: that's slower than the %g S/s asked for\n",
+			       plan->min_rate);
+		}
+	}
+	if (tek_plan_window(plan, record_length, rate) != 0) {
+		printf("error: the region of interest isn't in the record\n");
+		return -1;
+	}
+	tek_send_printf(clink, "DATA:START %ld;STOP %ld", plan->start,
+			plan->stop);
+	return plan->no_bytes;
+}
+
+long tek_plan_write_wfi_file(VXI11_CLINK * clink, const TEK_PLAN * plan,
+			     char *wfiname, char *captured_by,
+			     int no_of_traces)
+{
+	double vgain, voffset, hinterval, hoffset;
+
+	tek_scope_get_scaling(clink, &vgain, &voffset, &hinterval, &hoffset);
+	if (tek_write_wfi_file(wfiname, captured_by, plan->no_bytes, vgain,
+			       voffset, hinterval, hoffset, no_of_traces,
+			       2) != 0) {
+		return -1;
+	}
+	return plan->no_bytes;
+}
@@ -0,0 +1,95 @@
+/* tek_plan.h
+ * Works out the smallest record length, and the DATA:START/STOP window into
+ * it, that gets you the sample rate you need over the part of the screen
+ * you're interested in, so nothing is acquired or sent that you'd only throw
+ * away. The scope only takes a few record lengths (see
+ * tek_plan_record_lengths()), and, at a given timebase, the record always
+ * fills the 10 divisions of the screen, so the sample rate is the record
+ * length over 10 divisions. The timebase is left alone: as everywhere else,
+ * you set that up so you can see what you're after.
+ *
+ * What you want captured can be the whole screen, a span of time centred on
+ * it, or a region of interest (ROI) given as times from the trigger, as in
+ * the .wfi file. tek_plan_make() only asks the scope questions, so the plan
+ * (bytes per trace, and, with tek_plan_measure_link(), how long each will
+ * take to come off) can be printed before anything is changed or armed.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_PLAN_H_
+#define _TEK_PLAN_H_
+
+#include "tek_vxi11.h"
+
+typedef struct {
+	/* asked for */
+	double min_rate;	/* S/s, 0 = any */
+	double t_start, t_stop;	/* s from the trigger */
+	/* from the scope */
+	int is_TDS3000;
+	double max_rate;	/* S/s, 0 if not known */
+	double hor_scale;	/* s/div */
+	double xzero;		/* time of the first point of the record */
+	/* chosen */
+	long record_length;
+	double sample_rate;
+	long start, stop;	/* DATA:START and DATA:STOP, from 1 */
+	long no_bytes;		/* per trace, 2 per point */
+	/* the link, from tek_plan_measure_link(); 0 if not known */
+	double latency_ms;
+	double bytes_per_s;
+} TEK_PLAN;
+
+/* The record lengths the scope will take, smallest first. Returns how many
+ * there are. */
+tk_EXPORT int tek_plan_record_lengths(int is_TDS3000, const long **lengths);
+
+/* At least min_rate samples a second (0 = don't care) from roi_start to
+ * roi_stop seconds from the trigger; or, if roi_stop <= roi_start, over span
+ * seconds centred on the screen; or, if span <= 0 too, over the whole
+ * screen. Record lengths that would need more than the scope's maximum
+ * sample rate (ACQUIRE:MAXSAMPLERATE?, not on the TDS3000s) at this
+ * timebase are left out. Returns -1 if it can't be done at this timebase. */
+tk_EXPORT int tek_plan_make(VXI11_CLINK * clink, double min_rate, double span,
+			    double roi_start, double roi_stop, TEK_PLAN * plan);
+
+/* Times a query, and a CURVE? of up to 100,000 points of source (of
+ * whatever was last acquired, nothing is armed), to predict how long
+ * transfers will take. Leaves DATA:START/STOP changed. */
+tk_EXPORT int tek_plan_measure_link(VXI11_CLINK * clink, char *source,
+				    TEK_PLAN * plan, unsigned long timeout);
+
+/* Predicted ms to get no_traces traces (e.g. FastFrame segments) off in
+ * one CURVE?, or 0 if the link hasn't been measured */
+tk_EXPORT double tek_plan_transfer_ms(const TEK_PLAN * plan, int no_traces);
+tk_EXPORT void tek_plan_print(const TEK_PLAN * plan, int no_traces);
+
+/* Call tek_scope_set_record_length(clink, plan->record_length) before
+ * tek_scope_set_for_capture(), and this after it (which sets the window to
+ * the screen). Works the window out again from the record length and
+ * sample rate the scope actually went for, sets DATA:START/STOP, and
+ * returns the no of bytes per trace. */
+tk_EXPORT long tek_plan_set_window(VXI11_CLINK * clink, TEK_PLAN * plan);
+
+/* tek_scope_write_wfi_file(), for traces captured through the plan's window
+ * (tek_scope_write_wfi_file() would set it back to the screen) */
+tk_EXPORT long tek_plan_write_wfi_file(VXI11_CLINK * clink,
+				       const TEK_PLAN * plan, char *wfiname,
+				       char *captured_by, int no_of_traces);
+
+#endif
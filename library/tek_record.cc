@@ -0,0 +1,420 @@
+/* tek_record.cc
+ * Record and replay transports. The recorder sits on top of a normal VXI11
+ * link (or a socket: one) and logs every request and reply, along with how
+ * long each took, to a compact binary file. The replayer needs no
+ * instrument at all: it serves the recorded replies back, either at the
+ * recorded speed (so you get the same instrument latency profile) or as
+ * fast as possible, reading them from the file as it goes, so a long
+ * recording doesn't have to fit in memory. This lets you capture a session
+ * on the bench once, and then reproduce and profile it offline as often as
+ * you like.
+ *
+ * File format. All numbers are little-endian.
+ *   8 bytes   "TEKREC" 0x00 0x02
+ * then one record per request or reply:
+ *   1 byte    'S' (send) or 'R' (receive)
+ *   8 bytes   start time, microseconds since the link was opened (uint64)
+ *   4 bytes   duration in microseconds (uint32)
+ *   4 bytes   return value of the call (int32)
+ *   4 bytes   payload length (uint32)
+ *   n bytes   payload: the bytes sent, or the bytes received
+ * Version 1 files ("TEKREC" 0x00 0x01) are the same but for a 4 byte start
+ * time, which wrapped after 71 minutes; they can still be replayed.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tek_transport.h"
+
+#define TEK_RECORD_MAGIC	"TEKREC\0\2"
+#define TEK_RECORD_MAGIC_V1	"TEKREC\0\1"
+#define TEK_RECORD_MAGIC_LEN	8
+#define TEK_RECORD_HEADER_LEN	21
+#define TEK_RECORD_HEADER_LEN_V1	17
+/* Where the fields after the start time are, from the end of the header */
+#define TEK_RECORD_DURATION	12
+#define TEK_RECORD_RET		8
+#define TEK_RECORD_LEN		4
+
+typedef struct tek_record {
+	TEK_TRANSPORT transport;
+	VXI11_CLINK *clink;	/* the real link */
+	char *address;		/* needed again by tek_close */
+	FILE *fo;
+	double t_open;
+} TEK_RECORD;
+
+typedef struct tek_replay {
+	TEK_TRANSPORT transport;
+	FILE *fi;		/* at the start of the next record */
+	int hdr_len;		/* depends on the version */
+	long event;		/* index of the next record, for messages */
+	int fast;
+	int warned;
+} TEK_REPLAY;
+
+static void tek_record_put32(unsigned char *p, unsigned long v)
+{
+	p[0] = (unsigned char)(v & 0xff);
+	p[1] = (unsigned char)((v >> 8) & 0xff);
+	p[2] = (unsigned char)((v >> 16) & 0xff);
+	p[3] = (unsigned char)((v >> 24) & 0xff);
+}
+
+static unsigned long tek_record_get32(const unsigned char *p)
+{
+	return (unsigned long)p[0] | ((unsigned long)p[1] << 8)
+	    | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static void tek_record_put64(unsigned char *p, unsigned long long v)
+{
+	tek_record_put32(p, (unsigned long)(v & 0xffffffffUL));
+	tek_record_put32(p + 4, (unsigned long)(v >> 32));
+}
+
+/*****************************************************************************
+ * Recorder                                                                  *
+ *****************************************************************************/
+
+static void tek_record_write(TEK_RECORD * r, char type, double t_start,
+			     double t_end, long ret, const char *buf,
+			     size_t len)
+{
+	unsigned char hdr[TEK_RECORD_HEADER_LEN];
+	double duration = t_end - t_start;
+
+	/* a single call of over an hour and 11 minutes just says so */
+	if (duration > 4294967295.0) {
+		duration = 4294967295.0;
+	}
+	hdr[0] = (unsigned char)type;
+	tek_record_put64(hdr + 1, (unsigned long long)(t_start - r->t_open));
+	tek_record_put32(hdr + 9, (unsigned long)duration);
+	tek_record_put32(hdr + 13, (unsigned long)ret);
+	tek_record_put32(hdr + 17, (unsigned long)len);
+	fwrite(hdr, 1, TEK_RECORD_HEADER_LEN, r->fo);
+	if (len > 0) {
+		fwrite(buf, 1, len, r->fo);
+	}
+}
+
+/* The real link is either plain VXI11 or another transport (socket:). The
+ * latter is called directly, rather than through tek_send() etc, so that
+ * each message is only counted once (see tek_io_counts()). */
+static int tek_record_send(TEK_TRANSPORT * t, const char *cmd, size_t len)
+{
+	TEK_RECORD *r = (TEK_RECORD *) t->priv;
+	TEK_TRANSPORT *inner = tek_transport_get(r->clink);
+	double t_start;
+	int ret;
+
+	t_start = tek_time_us();
+	if (inner) {
+		ret = inner->ops->send(inner, cmd, len);
+	} else {
+		ret = vxi11_send(r->clink, cmd, len);
+	}
+	tek_record_write(r, 'S', t_start, tek_time_us(), ret, cmd, len);
+	return ret;
+}
+
+static long tek_record_receive(TEK_TRANSPORT * t, char *buf, size_t len,
+			       unsigned long timeout)
+{
+	TEK_RECORD *r = (TEK_RECORD *) t->priv;
+	TEK_TRANSPORT *inner = tek_transport_get(r->clink);
+	double t_start;
+	long ret;
+
+	t_start = tek_time_us();
+	if (inner) {
+		ret = inner->ops->receive(inner, buf, len, timeout);
+	} else {
+		ret = vxi11_receive_timeout(r->clink, buf, len, timeout);
+	}
+	tek_record_write(r, 'R', t_start, tek_time_us(), ret, buf,
+			 ret > 0 ? (size_t)ret : 0);
+	return ret;
+}
+
+static int tek_record_close(TEK_TRANSPORT * t)
+{
+	TEK_RECORD *r = (TEK_RECORD *) t->priv;
+	int ret;
+
+	ret = tek_close(r->clink, r->address);
+	fclose(r->fo);
+	free(r->address);
+	free(r);
+	return ret;
+}
+
+static const TEK_TRANSPORT_OPS tek_record_ops = {
+	"record",
+	tek_record_send,
+	tek_record_receive,
+	NULL,
+	tek_record_close
+};
+
+/* Opens a recording link. The address is of the form FILE@ADDRESS, where
+ * ADDRESS is an IP address or a socket: address, as you would normally pass
+ * to tek_open(). Recordings never go through the broker. */
+int tek_record_open(VXI11_CLINK ** clink, const char *address)
+{
+	TEK_RECORD *r;
+	const char *at;
+	char *filename;
+	int ret;
+
+	at = strrchr(address, '@');
+	if (!at || at == address) {
+		printf("tek_record_open: address should be FILE@ADDRESS, not '%s'\n",
+		       address);
+		return -1;
+	}
+	r = (TEK_RECORD *) calloc(1, sizeof(TEK_RECORD));
+	filename = (char *)malloc(at - address + 1);
+	if (!r || !filename) {
+		free(r);
+		free(filename);
+		return -1;
+	}
+	memcpy(filename, address, at - address);
+	filename[at - address] = '\0';
+	r->address = strdup(at + 1);
+	r->fo = fopen(filename, "wb");
+	if (!r->fo) {
+		printf("tek_record_open: could not open %s for writing\n",
+		       filename);
+		free(filename);
+		free(r->address);
+		free(r);
+		return -1;
+	}
+	free(filename);
+
+	if (strncmp(r->address, "socket:", 7) == 0) {
+		ret = tek_socket_open(&r->clink, r->address + 7);
+	} else if (strncmp(r->address, "record:", 7) == 0
+		   || strncmp(r->address, "replay", 6) == 0) {
+		printf("tek_record_open: can't record '%s'\n", r->address);
+		ret = -1;
+	} else {
+		ret = vxi11_open_device(&r->clink, r->address, NULL);
+	}
+	if (ret != 0) {
+		fclose(r->fo);
+		free(r->address);
+		free(r);
+		return ret;
+	}
+	fwrite(TEK_RECORD_MAGIC, 1, TEK_RECORD_MAGIC_LEN, r->fo);
+	r->t_open = tek_time_us();
+	r->transport.ops = &tek_record_ops;
+	r->transport.priv = r;
+	*clink = tek_transport_add(&r->transport);
+	return 0;
+}
+
+/*****************************************************************************
+ * Replayer                                                                  *
+ *****************************************************************************/
+
+/* One of the fields after the start time in a record's header */
+static unsigned long tek_replay_field(TEK_REPLAY * r, const unsigned char *hdr,
+				      int from_end)
+{
+	return tek_record_get32(hdr + r->hdr_len - from_end);
+}
+
+/* Finds the next record of the given type, skipping (and complaining about)
+ * any others in the way. Reads its header into hdr, and leaves the file at
+ * the start of its payload. Returns -1 at the end of the recording. */
+static int tek_replay_next(TEK_REPLAY * r, char type, unsigned char *hdr)
+{
+	while (fread(hdr, 1, r->hdr_len, r->fi) == (size_t)r->hdr_len) {
+		r->event++;
+		if (hdr[0] == (unsigned char)type) {
+			return 0;
+		}
+		if (fseek(r->fi, (long)tek_replay_field(r, hdr, TEK_RECORD_LEN),
+			  SEEK_CUR) != 0) {
+			break;
+		}
+		if (!r->warned) {
+			printf("tek_replay: expected a %s at record %ld, the session has diverged from the recording\n",
+			       type == 'S' ? "send" : "receive", r->event);
+			r->warned = 1;
+		}
+	}
+	printf("tek_replay: end of recording\n");
+	return -1;
+}
+
+/* Reads the rest of a payload of rec_len bytes, and says whether it's the
+ * same as cmd (a chunk at a time, as a send can be a whole arb) */
+static int tek_replay_same(TEK_REPLAY * r, const char *cmd, size_t len,
+			   size_t rec_len)
+{
+	char chunk[4096];
+	size_t pos = 0, n;
+	int same = (rec_len == len);
+
+	while (pos < rec_len) {
+		n = rec_len - pos < sizeof(chunk) ? rec_len - pos : sizeof(chunk);
+		if (fread(chunk, 1, n, r->fi) != n) {
+			return 0;
+		}
+		if (same && memcmp(chunk, cmd + pos, n) != 0) {
+			same = 0;
+		}
+		pos += n;
+	}
+	return same;
+}
+
+static int tek_replay_send(TEK_TRANSPORT * t, const char *cmd, size_t len)
+{
+	TEK_REPLAY *r = (TEK_REPLAY *) t->priv;
+	unsigned char hdr[TEK_RECORD_HEADER_LEN];
+	size_t rec_len;
+
+	if (tek_replay_next(r, 'S', hdr) != 0) {
+		return -1;
+	}
+	rec_len = tek_replay_field(r, hdr, TEK_RECORD_LEN);
+	if (!tek_replay_same(r, cmd, len, rec_len) && !r->warned) {
+		printf("tek_replay: request %ld differs from the recording ('%.*s')\n",
+		       r->event, (int)(len < 60 ? len : 60), cmd);
+		r->warned = 1;
+	}
+	if (!r->fast) {
+		tek_sleep_us(tek_replay_field(r, hdr, TEK_RECORD_DURATION));
+	}
+	return (int)(long)tek_replay_field(r, hdr, TEK_RECORD_RET);
+}
+
+static long tek_replay_receive(TEK_TRANSPORT * t, char *buf, size_t len,
+			       unsigned long timeout)
+{
+	TEK_REPLAY *r = (TEK_REPLAY *) t->priv;
+	unsigned char hdr[TEK_RECORD_HEADER_LEN];
+	size_t rec_len, n;
+	long ret;
+	double duration;
+
+	if (tek_replay_next(r, 'R', hdr) != 0) {
+		return -1;
+	}
+	ret = (long)(int)tek_replay_field(r, hdr, TEK_RECORD_RET);
+	rec_len = tek_replay_field(r, hdr, TEK_RECORD_LEN);
+	duration = tek_replay_field(r, hdr, TEK_RECORD_DURATION);
+
+	/* A reply that took longer than this caller is prepared to wait
+	 * wouldn't have got to it in time; nor will it now */
+	if (duration > timeout * 1000.0) {
+		if (fseek(r->fi, (long)rec_len, SEEK_CUR) != 0) {
+			printf("tek_replay: end of recording\n");
+			return -1;
+		}
+		if (!r->fast) {
+			tek_sleep_us(timeout * 1000.0);
+		}
+		printf("tek_replay: timed out waiting for reply\n");
+		return -1;
+	}
+	n = rec_len;
+	if (rec_len > len) {
+		printf("tek_replay: recorded reply of %lu bytes is longer than the buffer (%lu bytes)\n",
+		       (unsigned long)rec_len, (unsigned long)len);
+		n = len;
+		ret = (long)len;
+	}
+	if (fread(buf, 1, n, r->fi) != n) {
+		printf("tek_replay: end of recording\n");
+		return -1;
+	}
+	if (n < rec_len) {
+		fseek(r->fi, (long)(rec_len - n), SEEK_CUR);
+	}
+	if (!r->fast) {
+		tek_sleep_us(duration);
+	}
+	return ret;
+}
+
+static int tek_replay_close(TEK_TRANSPORT * t)
+{
+	TEK_REPLAY *r = (TEK_REPLAY *) t->priv;
+
+	fclose(r->fi);
+	free(r);
+	return 0;
+}
+
+static const TEK_TRANSPORT_OPS tek_replay_ops = {
+	"replay",
+	tek_replay_send,
+	tek_replay_receive,
+	NULL,
+	tek_replay_close
+};
+
+/* Opens a link that replays a recording. If fast is nonzero, replies are
+ * served as quickly as possible, otherwise each request and reply takes as
+ * long as it did when it was recorded. */
+int tek_replay_open(VXI11_CLINK ** clink, const char *filename, int fast)
+{
+	TEK_REPLAY *r;
+	FILE *fi;
+	char magic[TEK_RECORD_MAGIC_LEN];
+
+	fi = fopen(filename, "rb");
+	if (!fi) {
+		printf("tek_replay_open: could not open %s for reading\n",
+		       filename);
+		return -1;
+	}
+	r = (TEK_REPLAY *) calloc(1, sizeof(TEK_REPLAY));
+	if (!r || fread(magic, 1, TEK_RECORD_MAGIC_LEN, fi) !=
+	    TEK_RECORD_MAGIC_LEN) {
+		magic[0] = '\0';
+	}
+	if (r && memcmp(magic, TEK_RECORD_MAGIC, TEK_RECORD_MAGIC_LEN) == 0) {
+		r->hdr_len = TEK_RECORD_HEADER_LEN;
+	} else if (r && memcmp(magic, TEK_RECORD_MAGIC_V1,
+			       TEK_RECORD_MAGIC_LEN) == 0) {
+		r->hdr_len = TEK_RECORD_HEADER_LEN_V1;
+	} else {
+		printf("tek_replay_open: %s is not a recording\n", filename);
+		free(r);
+		fclose(fi);
+		return -1;
+	}
+	r->fi = fi;
+	r->fast = fast;
+	r->transport.ops = &tek_replay_ops;
+	r->transport.priv = r;
+	*clink = tek_transport_add(&r->transport);
+	return 0;
+}
@@ -0,0 +1,451 @@
+/* tek_session.cc
+ * Sharing one link between several threads. See tek_session.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tek_session.h"
+#include "tek_transport.h"
+
+#ifdef WIN32
+
+/* Not (yet) supported on Windows */
+TEK_SESSION *tek_session_open(VXI11_CLINK * clink, unsigned long timeout)
+{
+	printf("tek_session_open: sessions not available on this platform\n");
+	return NULL;
+}
+
+void tek_session_close(TEK_SESSION * s)
+{
+}
+
+TEK_FUTURE *tek_session_send(TEK_SESSION * s, const char *cmd, int priority)
+{
+	return NULL;
+}
+
+TEK_FUTURE *tek_session_query(TEK_SESSION * s, const char *cmd, int priority)
+{
+	return NULL;
+}
+
+TEK_FUTURE *tek_session_call(TEK_SESSION * s, TEK_SESSION_FN fn, void *arg,
+			     int priority)
+{
+	return NULL;
+}
+
+TEK_FUTURE *tek_session_get_data(TEK_SESSION * s, const char *source,
+				 char *buf, size_t len, long chunk_points,
+				 int priority)
+{
+	return NULL;
+}
+
+long tek_future_wait(TEK_FUTURE * f)
+{
+	return -1;
+}
+
+int tek_future_ready(TEK_FUTURE * f)
+{
+	return 0;
+}
+
+const char *tek_future_reply(TEK_FUTURE * f)
+{
+	return "";
+}
+
+void tek_future_free(TEK_FUTURE * f)
+{
+}
+
+long tek_session_send_and_receive(TEK_SESSION * s, const char *cmd,
+				  char *buf, size_t len)
+{
+	return -1;
+}
+
+#else
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#define TEK_SESSION_SEND	0
+#define TEK_SESSION_QUERY	1
+#define TEK_SESSION_CALL	2
+#define TEK_SESSION_DATA	3
+
+struct tek_future {
+	int type;
+	int priority;
+	char *cmd;
+	char reply[TEK_SESSION_REPLY_LEN];
+	TEK_SESSION_FN fn;
+	void *arg;
+	char source[20];
+	char *buf;
+	size_t len;
+	long chunk_points;
+
+	long ret;
+	int done;
+	sem_t finished;
+	struct tek_future *next;
+};
+
+struct tek_session {
+	VXI11_CLINK *clink;
+	unsigned long timeout;
+
+	/* Handed in, newest first; only ever pushed onto, or emptied in one
+	 * go by the worker, so no lock and no ABA problem */
+	TEK_FUTURE *incoming[TEK_SESSION_PRIORITIES];
+
+	/* The worker's own queues, oldest first */
+	TEK_FUTURE *head[TEK_SESSION_PRIORITIES];
+	TEK_FUTURE *tail[TEK_SESSION_PRIORITIES];
+
+	/* Posted once for every request (and once more by
+	 * tek_session_close), and waited on once for every request taken */
+	sem_t work;
+	pthread_t thread;
+};
+
+/* Moves everything handed in onto the worker's queues, then takes the
+ * oldest request from the most urgent queue, down to priority 'lowest' */
+static TEK_FUTURE *tek_session_take(TEK_SESSION * s, int lowest)
+{
+	TEK_FUTURE *f, *reversed, *next;
+	int p;
+
+	for (p = 0; p < TEK_SESSION_PRIORITIES; p++) {
+		f = __atomic_exchange_n(&s->incoming[p], (TEK_FUTURE *) NULL,
+					__ATOMIC_ACQUIRE);
+		for (reversed = NULL; f; f = next) {
+			next = f->next;
+			f->next = reversed;
+			reversed = f;
+		}
+		if (reversed == NULL) {
+			continue;
+		}
+		if (s->tail[p]) {
+			s->tail[p]->next = reversed;
+		} else {
+			s->head[p] = reversed;
+		}
+		for (f = reversed; f->next; f = f->next) ;
+		s->tail[p] = f;
+	}
+	for (p = 0; p <= lowest; p++) {
+		f = s->head[p];
+		if (f) {
+			s->head[p] = f->next;
+			if (s->head[p] == NULL) {
+				s->tail[p] = NULL;
+			}
+			return f;
+		}
+	}
+	return NULL;
+}
+
+static void tek_session_run(TEK_SESSION * s, TEK_FUTURE * f);
+
+/* Between the chunks of a download */
+static void tek_session_run_control(TEK_SESSION * s)
+{
+	TEK_FUTURE *f;
+
+	while ((f = tek_session_take(s, TEK_PRIORITY_CONTROL))) {
+		/* its post may not quite have happened yet, but it will */
+		sem_wait(&s->work);
+		tek_session_run(s, f);
+	}
+}
+
+static long tek_session_get_chunks(TEK_SESSION * s, TEK_FUTURE * f)
+{
+	VXI11_CLINK *clink = s->clink;
+	char reply[128];
+	long start, stop, a, b, got, total = 0;
+	int fastframe;
+
+	if (f->chunk_points <= 0) {
+		return tek_scope_get_data(clink, f->source, 0, f->buf, f->len,
+					  s->timeout);
+	}
+	memset(reply, 0, sizeof(reply));
+	if (tek_send_and_receive(clink, "DATA:START?;STOP?;:HOR:FASTFRAME:STATE?",
+				 reply, sizeof(reply) - 1, s->timeout) != 0
+	    || sscanf(reply, "%ld;%ld;%d", &start, &stop, &fastframe) != 3) {
+		printf("tek_session: could not read DATA:START/STOP\n");
+		return -1;
+	}
+	if (fastframe) {
+		return tek_scope_get_data(clink, f->source, 0, f->buf, f->len,
+					  s->timeout);
+	}
+	if ((size_t)(2 * (stop - start + 1)) > f->len) {
+		printf("tek_session: buffer too small (%ld bytes needed)\n",
+		       2 * (stop - start + 1));
+		return -1;
+	}
+
+	tek_scope_channel_str(f->source);
+	for (a = start; a <= stop; a = b + 1) {
+		b = a + f->chunk_points - 1;
+		if (b > stop) {
+			b = stop;
+		}
+		if (a > start) {
+			tek_session_run_control(s);
+		}
+		if (tek_send_printf(clink, "DATA:SOURCE %s;START %ld;STOP %ld;:CURVE?",
+				    f->source, a, b) != 0) {
+			total = -1;
+			break;
+		}
+		got = tek_receive_data_block(clink, f->buf + 2 * (a - start),
+					     2 * (b - a + 1), s->timeout);
+		if (got != 2 * (b - a + 1)) {
+			printf("tek_session: chunk returned %ld bytes, expected %ld\n",
+			       got, 2 * (b - a + 1));
+			total = got < 0 ? got : -1;
+			break;
+		}
+		total += got;
+	}
+
+	/* put things back as they were */
+	tek_send_printf(clink, "DATA:START %ld;STOP %ld", start, stop);
+	tek_scope_forget_data_source(clink);
+	return total;
+}
+
+static void tek_session_run(TEK_SESSION * s, TEK_FUTURE * f)
+{
+	switch (f->type) {
+	case TEK_SESSION_SEND:
+		f->ret = tek_send(s->clink, f->cmd);
+		break;
+	case TEK_SESSION_QUERY:
+		f->ret = tek_send_and_receive(s->clink, f->cmd, f->reply,
+					      TEK_SESSION_REPLY_LEN - 1,
+					      s->timeout);
+		if (f->ret == 0) {
+			f->ret = (long)strlen(f->reply);
+		}
+		break;
+	case TEK_SESSION_CALL:
+		f->ret = f->fn(s->clink, f->arg);
+		break;
+	default:
+		f->ret = tek_session_get_chunks(s, f);
+		break;
+	}
+	/* sem_post is the last we touch it: tek_future_free waits for that
+	 * even if it's seen done already */
+	__atomic_store_n(&f->done, 1, __ATOMIC_RELEASE);
+	sem_post(&f->finished);
+}
+
+static void *tek_session_worker(void *arg)
+{
+	TEK_SESSION *s = (TEK_SESSION *) arg;
+	TEK_FUTURE *f;
+
+	for (;;) {
+		sem_wait(&s->work);
+		f = tek_session_take(s, TEK_SESSION_PRIORITIES - 1);
+		if (f == NULL) {
+			break;	/* tek_session_close */
+		}
+		tek_session_run(s, f);
+	}
+	return NULL;
+}
+
+TEK_SESSION *tek_session_open(VXI11_CLINK * clink, unsigned long timeout)
+{
+	TEK_SESSION *s;
+
+	s = (TEK_SESSION *) calloc(1, sizeof(TEK_SESSION));
+	if (s == NULL) {
+		return NULL;
+	}
+	s->clink = clink;
+	s->timeout = timeout;
+	sem_init(&s->work, 0, 0);
+	if (pthread_create(&s->thread, NULL, tek_session_worker, s) != 0) {
+		printf("tek_session_open: could not start the session's thread\n");
+		sem_destroy(&s->work);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+void tek_session_close(TEK_SESSION * s)
+{
+	if (s == NULL) {
+		return;
+	}
+	sem_post(&s->work);
+	pthread_join(s->thread, NULL);
+	sem_destroy(&s->work);
+	free(s);
+}
+
+static TEK_FUTURE *tek_future_new(int type, int priority)
+{
+	TEK_FUTURE *f;
+
+	f = (TEK_FUTURE *) calloc(1, sizeof(TEK_FUTURE));
+	if (f == NULL) {
+		return NULL;
+	}
+	f->type = type;
+	if (priority < 0) {
+		priority = 0;
+	}
+	if (priority >= TEK_SESSION_PRIORITIES) {
+		priority = TEK_SESSION_PRIORITIES - 1;
+	}
+	f->priority = priority;
+	sem_init(&f->finished, 0, 0);
+	return f;
+}
+
+static TEK_FUTURE *tek_session_submit(TEK_SESSION * s, TEK_FUTURE * f)
+{
+	TEK_FUTURE **top = &s->incoming[f->priority];
+
+	f->next = __atomic_load_n(top, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(top, &f->next, f, 1,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED)) ;
+	sem_post(&s->work);
+	return f;
+}
+
+TEK_FUTURE *tek_session_send(TEK_SESSION * s, const char *cmd, int priority)
+{
+	TEK_FUTURE *f = tek_future_new(TEK_SESSION_SEND, priority);
+
+	if (f == NULL || (f->cmd = strdup(cmd)) == NULL) {
+		free(f);
+		return NULL;
+	}
+	return tek_session_submit(s, f);
+}
+
+TEK_FUTURE *tek_session_query(TEK_SESSION * s, const char *cmd, int priority)
+{
+	TEK_FUTURE *f = tek_future_new(TEK_SESSION_QUERY, priority);
+
+	if (f == NULL || (f->cmd = strdup(cmd)) == NULL) {
+		free(f);
+		return NULL;
+	}
+	return tek_session_submit(s, f);
+}
+
+TEK_FUTURE *tek_session_call(TEK_SESSION * s, TEK_SESSION_FN fn, void *arg,
+			     int priority)
+{
+	TEK_FUTURE *f = tek_future_new(TEK_SESSION_CALL, priority);
+
+	if (f == NULL) {
+		return NULL;
+	}
+	f->fn = fn;
+	f->arg = arg;
+	return tek_session_submit(s, f);
+}
+
+TEK_FUTURE *tek_session_get_data(TEK_SESSION * s, const char *source,
+				 char *buf, size_t len, long chunk_points,
+				 int priority)
+{
+	TEK_FUTURE *f = tek_future_new(TEK_SESSION_DATA, priority);
+
+	if (f == NULL) {
+		return NULL;
+	}
+	snprintf(f->source, sizeof(f->source), "%s", source);
+	f->buf = buf;
+	f->len = len;
+	f->chunk_points = chunk_points;
+	return tek_session_submit(s, f);
+}
+
+long tek_future_wait(TEK_FUTURE * f)
+{
+	sem_wait(&f->finished);
+	sem_post(&f->finished);	/* for anyone else waiting */
+	return f->ret;
+}
+
+int tek_future_ready(TEK_FUTURE * f)
+{
+	return __atomic_load_n(&f->done, __ATOMIC_ACQUIRE);
+}
+
+const char *tek_future_reply(TEK_FUTURE * f)
+{
+	tek_future_wait(f);
+	return f->reply;
+}
+
+void tek_future_free(TEK_FUTURE * f)
+{
+	if (f == NULL) {
+		return;
+	}
+	tek_future_wait(f);
+	sem_destroy(&f->finished);
+	free(f->cmd);
+	free(f);
+}
+
+long tek_session_send_and_receive(TEK_SESSION * s, const char *cmd,
+				  char *buf, size_t len)
+{
+	TEK_FUTURE *f = tek_session_query(s, cmd, TEK_PRIORITY_CONTROL);
+	long ret;
+
+	if (f == NULL) {
+		return -1;
+	}
+	ret = tek_future_wait(f);
+	if (ret >= 0) {
+		snprintf(buf, len, "%s", f->reply);
+		ret = 0;
+	}
+	tek_future_free(f);
+	return ret;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/* tek_session.h
+ * Sharing one link between several threads. A VXI11_CLINK can only be used
+ * by one thread at a time, so a session gives the link a thread of its
+ * own, and everyone else hands it requests: commands, queries, trace
+ * downloads, or any function of your own that wants the link. Each request
+ * gives you back a future, to wait on for the result whenever you want it.
+ *
+ * Requests go in one of three queues. The worker always takes from the
+ * control queue first, then normal, then bulk. Bulk trace downloads can be
+ * split into chunks (by DATA:START/STOP), and between chunks the worker
+ * deals with anything in the control queue, so a quick ACQUIRE:MODE? from
+ * a GUI doesn't have to wait for a 10M point CURVE? to finish. (Which does
+ * mean control requests mustn't change DATA:SOURCE/START/STOP.)
+ *
+ * Handing in a request doesn't take a lock: each queue is a lock-free
+ * stack that the worker empties in one go. Not available on Windows (yet).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_SESSION_H_
+#define _TEK_SESSION_H_
+
+#include <stddef.h>
+
+#include "tek_vxi11.h"
+
+#define TEK_PRIORITY_CONTROL	0
+#define TEK_PRIORITY_NORMAL	1
+#define TEK_PRIORITY_BULK	2
+#define TEK_SESSION_PRIORITIES	3
+
+#define TEK_SESSION_REPLY_LEN	256
+
+typedef struct tek_session TEK_SESSION;
+typedef struct tek_future TEK_FUTURE;
+
+/* For tek_session_call: runs in the session's thread, with the link */
+typedef long (*TEK_SESSION_FN) (VXI11_CLINK * clink, void *arg);
+
+/* Starts a session on clink, which is already open (and stays yours to
+ * close, after tek_session_close). Returns NULL if it can't. */
+tk_EXPORT TEK_SESSION *tek_session_open(VXI11_CLINK * clink,
+					unsigned long timeout);
+
+/* Finishes everything that's been handed in, then stops */
+tk_EXPORT void tek_session_close(TEK_SESSION * s);
+
+/* Requests. All return NULL only if out of memory. */
+tk_EXPORT TEK_FUTURE *tek_session_send(TEK_SESSION * s, const char *cmd,
+				       int priority);
+tk_EXPORT TEK_FUTURE *tek_session_query(TEK_SESSION * s, const char *cmd,
+					int priority);
+tk_EXPORT TEK_FUTURE *tek_session_call(TEK_SESSION * s, TEK_SESSION_FN fn,
+				       void *arg, int priority);
+/* As tek_scope_get_data without clear sweeps (CURVE? only), in chunks of
+ * chunk_points (<= 0 for all in one go; FastFrame is always all in one
+ * go). buf must stay put until the future is done. */
+tk_EXPORT TEK_FUTURE *tek_session_get_data(TEK_SESSION * s,
+					   const char *source, char *buf,
+					   size_t len, long chunk_points,
+					   int priority);
+
+/* Futures. tek_future_wait() returns what the request did: 0 for a
+ * command, the number of bytes of a reply or trace, or what your function
+ * returned; negative if it went wrong. A query's reply is in
+ * tek_future_reply(). tek_future_free() waits first if it has to. */
+tk_EXPORT long tek_future_wait(TEK_FUTURE * f);
+tk_EXPORT int tek_future_ready(TEK_FUTURE * f);
+tk_EXPORT const char *tek_future_reply(TEK_FUTURE * f);
+tk_EXPORT void tek_future_free(TEK_FUTURE * f);
+
+/* Shortcut: a query at control priority, waited for. Returns as
+ * tek_send_and_receive. */
+tk_EXPORT long tek_session_send_and_receive(TEK_SESSION * s, const char *cmd,
+					    char *buf, size_t len);
+
+#endif
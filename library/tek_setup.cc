@@ -0,0 +1,731 @@
+/* tek_setup.cc
+ * Structured handling of Tektronix scope setups, as returned by the "SET?"
+ * query. See tek_setup.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tek_setup.h"
+#include "tek_transport.h"
+
+#ifdef WIN32
+#define snprintf sprintf_s
+#define strncasecmp _strnicmp
+#define strcasecmp _stricmp
+#endif
+
+/*****************************************************************************
+ * Building the tree                                                         *
+ *****************************************************************************/
+
+/* A few words on what "SET?" returns. It is one long string of semicolon
+ * separated commands, e.g.
+ *   :ACQUIRE:STOPAFTER RUNSTOP;STATE 1;MODE SAMPLE;:HEADER 1;:CH1:SCALE 1.0E-1
+ * A command that starts with a colon is a full path from the root. One that
+ * doesn't is relative to the branch of the previous command, so "STATE 1"
+ * above really means ":ACQUIRE:STATE 1". Common commands (those starting
+ * with '*') don't change the branch. Arguments can contain quoted strings,
+ * which may themselves contain semicolons. We keep every header as a node in
+ * a tree, so that the same branch structure can be used when we send it back
+ * to the scope. */
+
+static char *tek_setup_strndup(const char *s, size_t n)
+{
+	char *d;
+
+	d = (char *)malloc(n + 1);
+	if (!d) {
+		return NULL;
+	}
+	memcpy(d, s, n);
+	d[n] = '\0';
+	return d;
+}
+
+static TEK_SETUP_NODE *tek_setup_find_child(TEK_SETUP_NODE * parent,
+					    const char *name, size_t len)
+{
+	TEK_SETUP_NODE *node;
+
+	for (node = parent->child; node; node = node->next) {
+		if (strlen(node->name) == len
+		    && strncasecmp(node->name, name, len) == 0) {
+			return node;
+		}
+	}
+	return NULL;
+}
+
+static TEK_SETUP_NODE *tek_setup_add_child(TEK_SETUP_NODE * parent,
+					   const char *name, size_t len)
+{
+	TEK_SETUP_NODE *node;
+
+	node = (TEK_SETUP_NODE *) calloc(1, sizeof(TEK_SETUP_NODE));
+	if (!node) {
+		return NULL;
+	}
+	node->name = tek_setup_strndup(name, len);
+	if (!node->name) {
+		free(node);
+		return NULL;
+	}
+	node->parent = parent;
+	if (parent->last_child) {
+		parent->last_child->next = node;
+	} else {
+		parent->child = node;
+	}
+	parent->last_child = node;
+	return node;
+}
+
+static void tek_setup_free_children(TEK_SETUP_NODE * parent)
+{
+	TEK_SETUP_NODE *node, *next;
+
+	for (node = parent->child; node; node = next) {
+		next = node->next;
+		tek_setup_free_children(node);
+		free(node->name);
+		free(node->value);
+		free(node);
+	}
+	parent->child = NULL;
+	parent->last_child = NULL;
+}
+
+/* Sets the value of a node, adding it to the command list if this is the
+ * first time it has been given a value. If the same header appears twice,
+ * the last value wins but the command keeps its original position. */
+static int tek_setup_set_node(TEK_SETUP * setup, TEK_SETUP_NODE * node,
+			      const char *value, size_t len)
+{
+	char *v;
+	TEK_SETUP_NODE **cmds;
+
+	v = tek_setup_strndup(value, len);
+	if (!v) {
+		return -1;
+	}
+	if (node->value) {
+		free(node->value);
+		node->value = v;
+		return 0;
+	}
+	if (setup->no_cmds == setup->cmds_alloc) {
+		setup->cmds_alloc = setup->cmds_alloc ? 2 * setup->cmds_alloc : 256;
+		cmds = (TEK_SETUP_NODE **) realloc(setup->cmds,
+						  setup->cmds_alloc *
+						  sizeof(TEK_SETUP_NODE *));
+		if (!cmds) {
+			free(v);
+			return -1;
+		}
+		setup->cmds = cmds;
+	}
+	node->value = v;
+	setup->cmds[setup->no_cmds++] = node;
+	return 0;
+}
+
+/* Walks down (creating as necessary) from "branch" along a colon-separated
+ * header, returning the node for the last mnemonic. */
+static TEK_SETUP_NODE *tek_setup_walk(TEK_SETUP_NODE * branch,
+				      const char *header, size_t len)
+{
+	TEK_SETUP_NODE *node = branch;
+	const char *end = header + len;
+	const char *p, *q;
+
+	p = header;
+	while (p < end) {
+		q = p;
+		while (q < end && *q != ':') {
+			q++;
+		}
+		if (q > p) {
+			branch = node;
+			node = tek_setup_find_child(branch, p, q - p);
+			if (!node) {
+				node = tek_setup_add_child(branch, p, q - p);
+				if (!node) {
+					return NULL;
+				}
+			}
+		}
+		p = q + 1;
+	}
+	return node;
+}
+
+TEK_SETUP *tek_setup_new(void)
+{
+	return (TEK_SETUP *) calloc(1, sizeof(TEK_SETUP));
+}
+
+/* Parses the reply to "SET?" (or the contents of a .tss file, which is the
+ * same thing) into a tree. Returns NULL if we run out of memory. */
+TEK_SETUP *tek_setup_parse(const char *buf, size_t len)
+{
+	TEK_SETUP *setup;
+	TEK_SETUP_NODE *branch, *node;
+	const char *p, *end, *hdr, *hdr_end, *arg, *arg_end;
+	char quote;
+
+	setup = tek_setup_new();
+	if (!setup) {
+		return NULL;
+	}
+	branch = &setup->root;
+	p = buf;
+	end = buf + len;
+
+	while (p < end && *p != '\0') {
+		/* skip white space (and stray separators) before the header */
+		while (p < end && (isspace((unsigned char)*p) || *p == ';')) {
+			p++;
+		}
+		if (p >= end || *p == '\0') {
+			break;
+		}
+		hdr = p;
+		while (p < end && *p != '\0' && *p != ';'
+		       && !isspace((unsigned char)*p)) {
+			p++;
+		}
+		hdr_end = p;
+		while (p < end && (*p == ' ' || *p == '\t')) {
+			p++;
+		}
+		/* the arguments run to the next semicolon that isn't quoted */
+		arg = p;
+		quote = 0;
+		while (p < end && *p != '\0') {
+			if (quote) {
+				if (*p == quote) {
+					quote = 0;
+				}
+			} else if (*p == '"' || *p == '\'') {
+				quote = *p;
+			} else if (*p == ';' || *p == '\n' || *p == '\r') {
+				break;
+			}
+			p++;
+		}
+		arg_end = p;
+		while (arg_end > arg && isspace((unsigned char)arg_end[-1])) {
+			arg_end--;
+		}
+
+		if (*hdr == '*') {
+			/* common command, sits at the root and leaves the
+			 * current branch alone */
+			node = tek_setup_walk(&setup->root, hdr, hdr_end - hdr);
+		} else if (*hdr == ':') {
+			node = tek_setup_walk(&setup->root, hdr, hdr_end - hdr);
+			if (node) {
+				branch = node->parent;
+			}
+		} else {
+			node = tek_setup_walk(branch, hdr, hdr_end - hdr);
+			if (node) {
+				branch = node->parent;
+			}
+		}
+		if (node == &setup->root) {
+			continue;	/* a lone colon, nothing to set */
+		}
+		if (!node || tek_setup_set_node(setup, node, arg,
+						arg_end - arg) != 0) {
+			tek_setup_free(setup);
+			return NULL;
+		}
+		/* a newline also ends a program message, so go back to root */
+		if (p < end && (*p == '\n' || *p == '\r')) {
+			branch = &setup->root;
+		}
+	}
+	return setup;
+}
+
+void tek_setup_free(TEK_SETUP * setup)
+{
+	if (!setup) {
+		return;
+	}
+	tek_setup_free_children(&setup->root);
+	free(setup->cmds);
+	free(setup);
+}
+
+/* Sets (or adds) a single command, given its full header, e.g.
+ * tek_setup_set(setup, "HORIZONTAL:MAIN:SCALE", "1.0E-6") */
+int tek_setup_set(TEK_SETUP * setup, const char *header, const char *value)
+{
+	TEK_SETUP_NODE *node;
+
+	node = tek_setup_walk(&setup->root, header, strlen(header));
+	if (!node) {
+		return -1;
+	}
+	return tek_setup_set_node(setup, node, value, strlen(value));
+}
+
+/* Returns the value of a command given its full header, or NULL if the setup
+ * doesn't contain it. */
+const char *tek_setup_get(TEK_SETUP * setup, const char *header)
+{
+	TEK_SETUP_NODE *node = &setup->root;
+	const char *p, *q;
+
+	p = header;
+	while (*p && node) {
+		q = p;
+		while (*q && *q != ':') {
+			q++;
+		}
+		if (q > p) {
+			node = tek_setup_find_child(node, p, q - p);
+		}
+		p = (*q) ? q + 1 : q;
+	}
+	if (!node) {
+		return NULL;
+	}
+	return node->value;
+}
+
+/* Writes the full header of a node, e.g. ":ACQUIRE:MODE", into buf. Returns
+ * the length, or -1 if it doesn't fit. */
+int tek_setup_header(TEK_SETUP_NODE * node, char *buf, size_t len)
+{
+	int n;
+
+	if (!node->parent) {
+		if (len < 1) {
+			return -1;
+		}
+		buf[0] = '\0';
+		return 0;
+	}
+	n = tek_setup_header(node->parent, buf, len);
+	if (n < 0) {
+		return -1;
+	}
+	if (node->name[0] == '*') {
+		/* common commands are never prefixed by a colon */
+		n = snprintf(buf + n, len - n, "%s", node->name) + n;
+	} else {
+		n = snprintf(buf + n, len - n, ":%s", node->name) + n;
+	}
+	if ((size_t)n >= len) {
+		return -1;
+	}
+	return n;
+}
+
+/* The same, in a buffer of its own (free() it), however long the header.
+ * Returns NULL if out of memory. */
+static char *tek_setup_header_dup(TEK_SETUP_NODE * node)
+{
+	TEK_SETUP_NODE *n;
+	size_t len = 1;
+	char *buf;
+
+	for (n = node; n->parent; n = n->parent) {
+		len += strlen(n->name) + 1;
+	}
+	buf = (char *)malloc(len);
+	if (buf && tek_setup_header(node, buf, len) < 0) {
+		free(buf);
+		buf = NULL;
+	}
+	return buf;
+}
+
+/*****************************************************************************
+ * Comparing setups                                                          *
+ *****************************************************************************/
+
+/* Finds the node in "setup" with the same path as "node" (which belongs to
+ * some other tree), without creating anything. */
+static TEK_SETUP_NODE *tek_setup_match(TEK_SETUP * setup, TEK_SETUP_NODE * node)
+{
+	TEK_SETUP_NODE *parent;
+
+	if (!node->parent) {
+		return &setup->root;
+	}
+	parent = tek_setup_match(setup, node->parent);
+	if (!parent) {
+		return NULL;
+	}
+	return tek_setup_find_child(parent, node->name, strlen(node->name));
+}
+
+/* Two values are the same if they are the same number (the scope is free to
+ * report "1.0000E-3" for something we asked to be "1.0E-3"), or otherwise if
+ * they are the same string, ignoring case except inside quotes. */
+static int tek_setup_values_equal(const char *a, const char *b)
+{
+	char *ea, *eb;
+	double da, db;
+
+	if (strcmp(a, b) == 0) {
+		return 1;
+	}
+	da = strtod(a, &ea);
+	db = strtod(b, &eb);
+	if (ea != a && eb != b && *ea == '\0' && *eb == '\0') {
+		if (da == db) {
+			return 1;
+		}
+		return fabs(da - db) <= 1e-9 * fmax(fabs(da), fabs(db));
+	}
+	if (a[0] == '"' || a[0] == '\'') {
+		return 0;
+	}
+	return strcasecmp(a, b) == 0;
+}
+
+/* Returns a new setup holding only those commands in "target" whose values
+ * differ from (or are missing in) "current", in the order they appear in
+ * "target". If "current" is NULL, this is just a copy of "target". */
+TEK_SETUP *tek_setup_diff(TEK_SETUP * current, TEK_SETUP * target)
+{
+	TEK_SETUP *diff;
+	TEK_SETUP_NODE *node, *cur, *dnode;
+	char *header;
+	int i;
+
+	diff = tek_setup_new();
+	if (!diff) {
+		return NULL;
+	}
+	for (i = 0; i < target->no_cmds; i++) {
+		node = target->cmds[i];
+		if (current) {
+			cur = tek_setup_match(current, node);
+			if (cur && cur->value
+			    && tek_setup_values_equal(cur->value, node->value)) {
+				continue;
+			}
+		}
+		header = tek_setup_header_dup(node);
+		if (!header) {
+			tek_setup_free(diff);
+			return NULL;
+		}
+		dnode = tek_setup_walk(&diff->root, header, strlen(header));
+		free(header);
+		if (!dnode || tek_setup_set_node(diff, dnode, node->value,
+						 strlen(node->value)) != 0) {
+			tek_setup_free(diff);
+			return NULL;
+		}
+	}
+	return diff;
+}
+
+/* Copies every command in "src" into "dest", overwriting existing values.
+ * Used to keep a cached copy of the scope setup up to date after we've sent
+ * it some changes. */
+int tek_setup_merge(TEK_SETUP * dest, TEK_SETUP * src)
+{
+	TEK_SETUP_NODE *node;
+	char *header;
+	int i, ret;
+
+	for (i = 0; i < src->no_cmds; i++) {
+		node = src->cmds[i];
+		header = tek_setup_header_dup(node);
+		if (!header) {
+			return -1;
+		}
+		ret = tek_setup_set(dest, header, node->value);
+		free(header);
+		if (ret != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*****************************************************************************
+ * Turning a setup back into messages                                        *
+ *****************************************************************************/
+
+/* Packs commands, starting at index *start, into one compound message in buf
+ * (which is len bytes long, including the terminating null). The first
+ * command uses its full header; subsequent ones on the same branch just use
+ * the last mnemonic, in the same way as the scope does itself. Stops when the
+ * next command wouldn't fit. Updates *start and returns the message length,
+ * which is zero once all commands have been packed. Returns -1 if a single
+ * command is too long to fit in buf at all. */
+long tek_setup_pack(TEK_SETUP * setup, int *start, char *buf, size_t len)
+{
+	TEK_SETUP_NODE *node, *prev = NULL;
+	char header[512];
+	size_t pos = 0;
+	int n;
+
+	if (len < 1) {
+		return -1;
+	}
+	buf[0] = '\0';
+	while (*start < setup->no_cmds) {
+		node = setup->cmds[*start];
+		if (prev && prev->name[0] != '*' && node->name[0] != '*'
+		    && prev->parent == node->parent) {
+			n = snprintf(header, sizeof(header), "%s", node->name);
+		} else {
+			n = tek_setup_header(node, header, sizeof(header));
+		}
+		if (n < 0) {
+			return -1;
+		}
+		n = snprintf(buf + pos, len - pos, "%s%s%s%s",
+			     prev ? ";" : "", header,
+			     node->value[0] ? " " : "", node->value);
+		if (n < 0 || pos + n >= len) {
+			buf[pos] = '\0';
+			if (!prev) {
+				return -1;
+			}
+			break;
+		}
+		pos += n;
+		prev = node;
+		(*start)++;
+	}
+	return (long)pos;
+}
+
+/* One command, with its full header, in a buffer of its own (free() it),
+ * for a command too long for tek_setup_pack(), e.g. a long label or math
+ * expression. Returns NULL on error. */
+static char *tek_setup_command(TEK_SETUP_NODE * node)
+{
+	char *header;
+	char *buf;
+	size_t len;
+
+	header = tek_setup_header_dup(node);
+	if (!header) {
+		return NULL;
+	}
+	len = strlen(header) + 1 + strlen(node->value) + 1;
+	buf = (char *)malloc(len);
+	if (buf) {
+		snprintf(buf, len, "%s%s%s", header, node->value[0] ? " " : "",
+			 node->value);
+	}
+	free(header);
+	return buf;
+}
+
+/* Loads a setup from a file, such as a .tss file written by tek_save_setup.
+ * The file can be any length. */
+TEK_SETUP *tek_setup_load(const char *filename)
+{
+	FILE *fi;
+	char *buf;
+	long len;
+	size_t bytes_read;
+	TEK_SETUP *setup;
+
+	fi = fopen(filename, "rb");
+	if (!fi) {
+		return NULL;
+	}
+	fseek(fi, 0, SEEK_END);
+	len = ftell(fi);
+	fseek(fi, 0, SEEK_SET);
+	if (len < 0) {
+		fclose(fi);
+		return NULL;
+	}
+	buf = (char *)malloc(len + 1);
+	if (!buf) {
+		fclose(fi);
+		return NULL;
+	}
+	bytes_read = fread(buf, sizeof(char), len, fi);
+	fclose(fi);
+	buf[bytes_read] = '\0';
+	setup = tek_setup_parse(buf, bytes_read);
+	free(buf);
+	return setup;
+}
+
+/* Saves a setup to a file, as a single line of commands in the same format
+ * the scope uses, so the result can also be loaded with tek_load_setup. */
+int tek_setup_save(TEK_SETUP * setup, const char *filename)
+{
+	FILE *fo;
+	char buf[TEK_SETUP_MAX_MSG];
+	char *big;
+	long n;
+	int start = 0;
+	int first = 1;
+
+	fo = fopen(filename, "w");
+	if (!fo) {
+		printf("error: tek_setup_save: could not open %s for writing\n",
+		       filename);
+		return -1;
+	}
+	while (start < setup->no_cmds) {
+		n = tek_setup_pack(setup, &start, buf, sizeof(buf));
+		if (n == 0) {
+			break;
+		}
+		/* each packed message starts from the root, so they can
+		 * simply be joined together */
+		if (n > 0) {
+			fprintf(fo, "%s%s", first ? "" : ";", buf);
+		} else {
+			big = tek_setup_command(setup->cmds[start++]);
+			if (!big) {
+				fclose(fo);
+				return -1;
+			}
+			fprintf(fo, "%s%s", first ? "" : ";", big);
+			free(big);
+		}
+		first = 0;
+	}
+	fprintf(fo, "\n");
+	fclose(fo);
+	return 0;
+}
+
+/*****************************************************************************
+ * Talking to the scope                                                      *
+ *****************************************************************************/
+
+/* Asks the scope for its setup and parses it. The reply is read into a heap
+ * buffer of TEK_SETUP_MAX_LEN bytes, rather than relying on the caller to
+ * guess how big it might be. Returns NULL on error. */
+TEK_SETUP *tek_scope_get_setup_tree(VXI11_CLINK * clink)
+{
+	char *buf;
+	int bytes_returned;
+	TEK_SETUP *setup;
+
+	buf = (char *)malloc(TEK_SETUP_MAX_LEN);
+	if (!buf) {
+		return NULL;
+	}
+	bytes_returned = tek_scope_get_setup(clink, buf, TEK_SETUP_MAX_LEN);
+	if (bytes_returned <= 0) {
+		printf("error, could not read Tek scope system setup...\n");
+		free(buf);
+		return NULL;
+	}
+	setup = tek_setup_parse(buf, bytes_returned);
+	free(buf);
+	return setup;
+}
+
+/* Sends a whole setup to the scope, as compound messages of up to
+ * TEK_SETUP_MAX_MSG bytes. A command that's longer than that on its own is
+ * sent by itself, as tek_load_setup always used to. Returns the number of
+ * messages sent, or a negative value on error. */
+int tek_scope_send_setup_tree(VXI11_CLINK * clink, TEK_SETUP * setup)
+{
+	char buf[TEK_SETUP_MAX_MSG];
+	char *big;
+	long n;
+	int ret;
+	int start = 0;
+	int no_msgs = 0;
+
+	/* A setup can change the DATA:SOURCE. tek_send() would spot it, but
+	 * there's no sense relying on that for a whole setup. */
+	tek_scope_forget_data_source(clink);
+	while (start < setup->no_cmds) {
+		n = tek_setup_pack(setup, &start, buf, sizeof(buf));
+		if (n == 0) {
+			break;
+		}
+		if (n > 0) {
+			ret = tek_send(clink, buf, n);
+		} else {
+			big = tek_setup_command(setup->cmds[start++]);
+			if (!big) {
+				printf("error, could not send setup to scope...\n");
+				return -1;
+			}
+			ret = tek_send(clink, big, strlen(big));
+			free(big);
+		}
+		if (ret < 0) {
+			printf("error, could not send setup to scope...\n");
+			return ret;
+		}
+		no_msgs++;
+	}
+	return no_msgs;
+}
+
+/* Sends only those commands in "target" that differ from "current". If
+ * "current" is NULL, the scope is asked for its setup first. Otherwise
+ * "current" is treated as a cache of the scope state: it is used instead of
+ * asking the scope, and is updated with whatever we send, so that it can be
+ * passed straight back in next time (or saved with tek_setup_save()). It is
+ * up to the user to make sure nobody has been twiddling the knobs in the
+ * meantime. Returns the number of commands sent, or a negative value on
+ * error. */
+int tek_scope_send_setup_diff(VXI11_CLINK * clink, TEK_SETUP * current,
+			      TEK_SETUP * target)
+{
+	TEK_SETUP *scope_setup = NULL;
+	TEK_SETUP *diff;
+	int ret;
+
+	if (!current) {
+		scope_setup = tek_scope_get_setup_tree(clink);
+		if (!scope_setup) {
+			return -1;
+		}
+		current = scope_setup;
+	}
+	tek_scope_forget_data_source(clink);
+	diff = tek_setup_diff(current, target);
+	if (!diff) {
+		tek_setup_free(scope_setup);
+		return -1;
+	}
+	ret = tek_scope_send_setup_tree(clink, diff);
+	if (ret >= 0) {
+		ret = diff->no_cmds;
+		if (!scope_setup) {
+			tek_setup_merge(current, diff);
+		}
+	}
+	tek_setup_free(diff);
+	tek_setup_free(scope_setup);
+	return ret;
+}
@@ -0,0 +1,74 @@
+/* tek_setup.h
+ * Structured handling of Tektronix scope setups, as returned by the "SET?"
+ * query. The setup string is parsed into a tree of command headers, so that
+ * two setups can be compared and only the commands that differ need to be
+ * sent to the scope.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_SETUP_H_
+#define _TEK_SETUP_H_
+
+#include "tek_vxi11.h"
+
+/* Largest compound message we will build when sending a setup (or the
+ * differences between two setups) to the scope. */
+#define TEK_SETUP_MAX_MSG 1024
+
+/* Largest "SET?" reply we are prepared to read. Typical replies are a few
+ * thousand bytes, but a DPO4000 with verbose headers can go well past the
+ * 30000 bytes the command line utilities used to allow for. */
+#define TEK_SETUP_MAX_LEN 262144
+
+typedef struct tek_setup_node {
+	char *name;		/* header mnemonic, as the scope spelt it */
+	char *value;		/* argument(s), or NULL if just a branch */
+	struct tek_setup_node *parent;
+	struct tek_setup_node *child;	/* first child */
+	struct tek_setup_node *last_child;
+	struct tek_setup_node *next;	/* next sibling */
+} TEK_SETUP_NODE;
+
+typedef struct tek_setup {
+	TEK_SETUP_NODE root;
+	TEK_SETUP_NODE **cmds;	/* nodes carrying a value, in command order */
+	int no_cmds;
+	int cmds_alloc;
+} TEK_SETUP;
+
+tk_EXPORT TEK_SETUP *tek_setup_new(void);
+tk_EXPORT TEK_SETUP *tek_setup_parse(const char *buf, size_t len);
+tk_EXPORT void tek_setup_free(TEK_SETUP * setup);
+tk_EXPORT int tek_setup_set(TEK_SETUP * setup, const char *header,
+			    const char *value);
+tk_EXPORT const char *tek_setup_get(TEK_SETUP * setup, const char *header);
+tk_EXPORT int tek_setup_header(TEK_SETUP_NODE * node, char *buf, size_t len);
+tk_EXPORT TEK_SETUP *tek_setup_diff(TEK_SETUP * current, TEK_SETUP * target);
+tk_EXPORT int tek_setup_merge(TEK_SETUP * dest, TEK_SETUP * src);
+tk_EXPORT long tek_setup_pack(TEK_SETUP * setup, int *start, char *buf,
+			      size_t len);
+tk_EXPORT TEK_SETUP *tek_setup_load(const char *filename);
+tk_EXPORT int tek_setup_save(TEK_SETUP * setup, const char *filename);
+tk_EXPORT TEK_SETUP *tek_scope_get_setup_tree(VXI11_CLINK * clink);
+tk_EXPORT int tek_scope_send_setup_tree(VXI11_CLINK * clink,
+					TEK_SETUP * setup);
+tk_EXPORT int tek_scope_send_setup_diff(VXI11_CLINK * clink,
+					TEK_SETUP * current,
+					TEK_SETUP * target);
+
+#endif
@@ -0,0 +1,404 @@
+/* tek_shm.cc
+ * Shared memory trace ring; see tek_shm.h.
+ *
+ * Layout of the shared memory:
+ *   header, padded to TEK_SHM_HEADER_LEN
+ *   no_slots slots, each slot_stride bytes apart:
+ *     uint64_t stamp    seq + 1 of the trace in the slot, 0 while being
+ *                       (over)written
+ *     TEK_SHM_INFO
+ *     padding up to TEK_SHM_SLOT_HEADER_LEN
+ *     slot_size bytes of data
+ *
+ * The writer publishes trace n by clearing the slot's stamp, writing the
+ * data and info, setting the stamp to n + 1 and then the header's write_seq
+ * to n + 1. A reader that wants trace n checks the stamp before and after
+ * looking at the slot; if it has changed, the writer got there first.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tek_shm.h"
+#include "tek_transport.h"
+
+#ifdef WIN32
+
+/* Not (yet) supported on Windows */
+TEK_SHM *tek_shm_create(const char *name, size_t slot_size, int no_slots)
+{
+	printf("tek_shm_create: shared memory rings not available on this platform\n");
+	return NULL;
+}
+
+TEK_SHM *tek_shm_attach(const char *name)
+{
+	printf("tek_shm_attach: shared memory rings not available on this platform\n");
+	return NULL;
+}
+
+char *tek_shm_write_begin(TEK_SHM * shm, size_t * len)
+{
+	return NULL;
+}
+
+int tek_shm_write_end(TEK_SHM * shm, size_t bytes, TEK_SHM_INFO * info)
+{
+	return -1;
+}
+
+long tek_shm_read(TEK_SHM * shm, const TEK_SHM_INFO ** info,
+		  const char **data, unsigned long timeout)
+{
+	return -1;
+}
+
+int tek_shm_read_done(TEK_SHM * shm)
+{
+	return -1;
+}
+
+uint64_t tek_shm_lost(TEK_SHM * shm)
+{
+	return 0;
+}
+
+const char *tek_shm_name(TEK_SHM * shm)
+{
+	return "";
+}
+
+void tek_shm_close(TEK_SHM * shm)
+{
+}
+
+#else
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TEK_SHM_MAGIC		"TEKSHM\0\1"
+#define TEK_SHM_HEADER_LEN	4096
+#define TEK_SHM_SLOT_HEADER_LEN	128
+#define TEK_SHM_POLL_US		100	/* how often a waiting reader looks */
+
+typedef struct {
+	char magic[8];
+	uint32_t no_slots;
+	uint32_t closed;	/* set when the writer has finished */
+	uint64_t slot_size;	/* maximum bytes of data per slot */
+	uint64_t slot_stride;
+	uint64_t write_seq;	/* number of traces published so far */
+} TEK_SHM_HEADER;
+
+typedef struct {
+	uint64_t stamp;
+	TEK_SHM_INFO info;
+} TEK_SHM_SLOT;
+
+struct tek_shm {
+	int fd;
+	int writer;
+	char name[256];
+	char *map;
+	size_t map_len;
+	TEK_SHM_HEADER *hdr;
+	uint64_t next;		/* writer: seq being written; reader: seq wanted */
+	uint64_t reading;	/* reader: seq handed out by tek_shm_read */
+	uint64_t lost;		/* reader: traces overwritten before we got them */
+};
+
+static TEK_SHM_SLOT *tek_shm_slot(TEK_SHM * shm, uint64_t seq)
+{
+	return (TEK_SHM_SLOT *) (shm->map + TEK_SHM_HEADER_LEN
+				 + (seq % shm->hdr->no_slots)
+				 * shm->hdr->slot_stride);
+}
+
+static char *tek_shm_slot_data(TEK_SHM_SLOT * slot)
+{
+	return (char *)slot + TEK_SHM_SLOT_HEADER_LEN;
+}
+
+/* Creates a ring of no_slots slots of up to slot_size bytes each. If name
+ * is NULL (or empty), the ring is anonymous (memfd) and other processes
+ * find it through tek_shm_name(). */
+TEK_SHM *tek_shm_create(const char *name, size_t slot_size, int no_slots)
+{
+	TEK_SHM *shm;
+	size_t stride;
+
+	if (no_slots < 1 || slot_size == 0) {
+		printf("tek_shm_create: need at least one slot of at least one byte\n");
+		return NULL;
+	}
+	shm = (TEK_SHM *) calloc(1, sizeof(TEK_SHM));
+	if (!shm) {
+		return NULL;
+	}
+	shm->writer = 1;
+	if (name && name[0]) {
+		snprintf(shm->name, sizeof(shm->name), "%s", name);
+		shm_unlink(name);	/* left over from last time? */
+		shm->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	} else {
+#ifdef __linux__
+		shm->fd = memfd_create("tek_shm", 0);
+		snprintf(shm->name, sizeof(shm->name), "/proc/%d/fd/%d",
+			 (int)getpid(), shm->fd);
+#else
+		snprintf(shm->name, sizeof(shm->name), "/tek_shm.%d",
+			 (int)getpid());
+		shm_unlink(shm->name);
+		shm->fd = shm_open(shm->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+#endif
+	}
+	if (shm->fd < 0) {
+		printf("tek_shm_create: could not create shared memory '%s'\n",
+		       shm->name);
+		free(shm);
+		return NULL;
+	}
+
+	/* keep each slot's data page aligned, it's good for everybody */
+	stride = (TEK_SHM_SLOT_HEADER_LEN + slot_size + 4095) & ~(size_t)4095;
+	shm->map_len = TEK_SHM_HEADER_LEN + stride * no_slots;
+	if (ftruncate(shm->fd, shm->map_len) != 0) {
+		printf("tek_shm_create: could not make shared memory %lu bytes long\n",
+		       (unsigned long)shm->map_len);
+		tek_shm_close(shm);
+		return NULL;
+	}
+	shm->map = (char *)mmap(NULL, shm->map_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED, shm->fd, 0);
+	if (shm->map == MAP_FAILED) {
+		shm->map = NULL;
+		printf("tek_shm_create: could not map shared memory\n");
+		tek_shm_close(shm);
+		return NULL;
+	}
+	shm->hdr = (TEK_SHM_HEADER *) shm->map;
+	shm->hdr->no_slots = no_slots;
+	shm->hdr->slot_size = slot_size;
+	shm->hdr->slot_stride = stride;
+	shm->hdr->write_seq = 0;
+	/* the magic goes in last, so nobody attaches to a half-made ring */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(shm->hdr->magic, TEK_SHM_MAGIC, 8);
+	return shm;
+}
+
+/* Returns the next slot to write into, and its size in len. The slot
+ * isn't visible to readers until tek_shm_write_end(). */
+char *tek_shm_write_begin(TEK_SHM * shm, size_t * len)
+{
+	TEK_SHM_SLOT *slot;
+
+	if (!shm->writer) {
+		return NULL;
+	}
+	slot = tek_shm_slot(shm, shm->next);
+	/* tell any reader still looking at the old contents that they've
+	 * gone */
+	__atomic_store_n(&slot->stamp, 0, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (len) {
+		*len = shm->hdr->slot_size;
+	}
+	return tek_shm_slot_data(slot);
+}
+
+/* Publishes the slot from tek_shm_write_begin(), holding bytes of data.
+ * The seq, time_us and bytes members of info are filled in for you. */
+int tek_shm_write_end(TEK_SHM * shm, size_t bytes, TEK_SHM_INFO * info)
+{
+	TEK_SHM_SLOT *slot;
+
+	if (!shm->writer || bytes > shm->hdr->slot_size) {
+		return -1;
+	}
+	slot = tek_shm_slot(shm, shm->next);
+	if (info) {
+		slot->info = *info;
+	} else {
+		memset(&slot->info, 0, sizeof(TEK_SHM_INFO));
+	}
+	slot->info.seq = shm->next;
+	slot->info.time_us = (uint64_t)tek_time_us();
+	slot->info.bytes = bytes;
+	if (info) {
+		info->seq = slot->info.seq;
+		info->time_us = slot->info.time_us;
+		info->bytes = bytes;
+	}
+	shm->next++;
+	__atomic_store_n(&slot->stamp, shm->next, __ATOMIC_RELEASE);
+	__atomic_store_n(&shm->hdr->write_seq, shm->next, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Attaches to a ring made by tek_shm_create(), by the name it was given,
+ * or by the /proc/PID/fd/FD path of an anonymous one. Reading starts with
+ * the next trace published. */
+TEK_SHM *tek_shm_attach(const char *name)
+{
+	TEK_SHM *shm;
+	struct stat st;
+
+	shm = (TEK_SHM *) calloc(1, sizeof(TEK_SHM));
+	if (!shm) {
+		return NULL;
+	}
+	snprintf(shm->name, sizeof(shm->name), "%s", name);
+	if (strncmp(name, "/proc/", 6) == 0 || strncmp(name, "/dev/", 5) == 0) {
+		shm->fd = open(name, O_RDONLY);
+	} else {
+		shm->fd = shm_open(name, O_RDONLY, 0);
+	}
+	if (shm->fd < 0 || fstat(shm->fd, &st) != 0
+	    || st.st_size < TEK_SHM_HEADER_LEN) {
+		printf("tek_shm_attach: could not open shared memory '%s'\n",
+		       name);
+		tek_shm_close(shm);
+		return NULL;
+	}
+	shm->map_len = st.st_size;
+	shm->map = (char *)mmap(NULL, shm->map_len, PROT_READ, MAP_SHARED,
+				shm->fd, 0);
+	if (shm->map == MAP_FAILED) {
+		shm->map = NULL;
+		printf("tek_shm_attach: could not map shared memory\n");
+		tek_shm_close(shm);
+		return NULL;
+	}
+	shm->hdr = (TEK_SHM_HEADER *) shm->map;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (memcmp(shm->hdr->magic, TEK_SHM_MAGIC, 8) != 0
+	    || shm->hdr->no_slots == 0
+	    || TEK_SHM_HEADER_LEN + shm->hdr->slot_stride * shm->hdr->no_slots
+	    > shm->map_len) {
+		printf("tek_shm_attach: '%s' is not a trace ring\n", name);
+		tek_shm_close(shm);
+		return NULL;
+	}
+	shm->next = __atomic_load_n(&shm->hdr->write_seq, __ATOMIC_ACQUIRE);
+	return shm;
+}
+
+/* Gets the next trace. Waits up to timeout ms for one to arrive. On
+ * success, *info and *data point at the trace in shared memory (no copy),
+ * and the number of bytes of data is returned. Once you've finished with
+ * it, call tek_shm_read_done() to find out whether the writer overwrote it
+ * while you were looking. Returns 0 on timeout, and -1 if the writer has
+ * finished and there's nothing left to read. Traces that were overwritten
+ * before we got to them are skipped, and counted by tek_shm_lost(). */
+long tek_shm_read(TEK_SHM * shm, const TEK_SHM_INFO ** info,
+		  const char **data, unsigned long timeout)
+{
+	TEK_SHM_SLOT *slot;
+	uint64_t write_seq, stamp;
+	double t_end = tek_time_us() + timeout * 1000.0;
+
+	for (;;) {
+		write_seq = __atomic_load_n(&shm->hdr->write_seq,
+					    __ATOMIC_ACQUIRE);
+		if (write_seq > shm->next) {
+			/* lapped? skip to the oldest one still there */
+			if (write_seq - shm->next > shm->hdr->no_slots) {
+				shm->lost += write_seq - shm->hdr->no_slots
+				    - shm->next;
+				shm->next = write_seq - shm->hdr->no_slots;
+			}
+			slot = tek_shm_slot(shm, shm->next);
+			stamp = __atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE);
+			if (stamp != shm->next + 1) {
+				/* being overwritten as we speak */
+				shm->lost++;
+				shm->next++;
+				continue;
+			}
+			shm->reading = shm->next;
+			shm->next++;
+			*info = &slot->info;
+			*data = tek_shm_slot_data(slot);
+			return (long)slot->info.bytes;
+		}
+		if (__atomic_load_n(&shm->hdr->closed, __ATOMIC_ACQUIRE)) {
+			return -1;
+		}
+		if (tek_time_us() >= t_end) {
+			return 0;
+		}
+		tek_sleep_us(TEK_SHM_POLL_US);
+	}
+}
+
+/* Returns 0 if the trace from the last tek_shm_read() is still intact, or
+ * -1 if it was overwritten while we were using it (in which case it counts
+ * as lost, and whatever was worked out from it should be thrown away). */
+int tek_shm_read_done(TEK_SHM * shm)
+{
+	TEK_SHM_SLOT *slot = tek_shm_slot(shm, shm->reading);
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE)
+	    != shm->reading + 1) {
+		shm->lost++;
+		return -1;
+	}
+	return 0;
+}
+
+uint64_t tek_shm_lost(TEK_SHM * shm)
+{
+	return shm->lost;
+}
+
+const char *tek_shm_name(TEK_SHM * shm)
+{
+	return shm->name;
+}
+
+/* Readers just detach. The writer tells readers it has finished, and
+ * removes the name (readers already attached keep their mapping). */
+void tek_shm_close(TEK_SHM * shm)
+{
+	if (!shm) {
+		return;
+	}
+	if (shm->writer && shm->hdr) {
+		__atomic_store_n(&shm->hdr->closed, 1, __ATOMIC_RELEASE);
+	}
+	if (shm->map) {
+		munmap(shm->map, shm->map_len);
+	}
+	if (shm->fd >= 0) {
+		close(shm->fd);
+	}
+	if (shm->writer && shm->name[0] == '/'
+	    && strncmp(shm->name, "/proc/", 6) != 0) {
+		shm_unlink(shm->name);
+	}
+	free(shm);
+}
+
+#endif
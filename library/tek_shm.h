@@ -0,0 +1,79 @@
+/* tek_shm.h
+ * A ring of trace buffers in shared memory, so that one capturing process
+ * can hand its traces to any number of local consumers (live analysis,
+ * display, archiving...) without copying them or waiting for them.
+ *
+ * There is a single writer. It asks for the next slot, captures straight
+ * into it (e.g. with tek_scope_get_data), then publishes it along with the
+ * scaling information that would go in a .wfi file. Readers attach to the
+ * ring by name, map it read-only and work through the traces at their own
+ * pace, looking at the data where it lies. Nothing is locked: if a reader
+ * falls more than a ring's worth behind, the writer simply overwrites the
+ * slots it hasn't got to yet. Each trace carries a sequence number, so the
+ * reader can tell that this happened (see tek_shm_read and
+ * tek_shm_read_done) and how many traces it missed.
+ *
+ * The ring is created with shm_open() if you give it a name (e.g.
+ * "/tek_scope1"), or memfd_create() if you don't; in that case other
+ * processes can attach to it through /proc/PID/fd/FD, which is what
+ * tek_shm_name() returns. Either way only the same user can read it (mode
+ * 0600), as with the broker's socket. POSIX only.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_SHM_H_
+#define _TEK_SHM_H_
+
+#include <stdint.h>
+
+#include "tek_vxi11.h"
+
+/* What we know about each trace. The scaling is as returned by
+ * tek_scope_get_scaling(), so volts = vgain * data[i] + voffset. */
+typedef struct {
+	uint64_t seq;		/* trace number, from 0; filled in by the ring */
+	uint64_t time_us;	/* when it was published (tek_time_us()); ditto */
+	uint64_t bytes;		/* bytes of data; ditto */
+	double vgain, voffset;
+	double hinterval, hoffset;
+	uint32_t no_traces;	/* more than 1 for FastFrame */
+	uint32_t bytes_per_point;
+	char source[16];
+} TEK_SHM_INFO;
+
+typedef struct tek_shm TEK_SHM;
+
+/* Writer */
+tk_EXPORT TEK_SHM *tek_shm_create(const char *name, size_t slot_size,
+				  int no_slots);
+tk_EXPORT char *tek_shm_write_begin(TEK_SHM * shm, size_t * len);
+tk_EXPORT int tek_shm_write_end(TEK_SHM * shm, size_t bytes,
+				TEK_SHM_INFO * info);
+
+/* Readers */
+tk_EXPORT TEK_SHM *tek_shm_attach(const char *name);
+tk_EXPORT long tek_shm_read(TEK_SHM * shm, const TEK_SHM_INFO ** info,
+			    const char **data, unsigned long timeout);
+tk_EXPORT int tek_shm_read_done(TEK_SHM * shm);
+tk_EXPORT uint64_t tek_shm_lost(TEK_SHM * shm);
+
+/* Both */
+tk_EXPORT const char *tek_shm_name(TEK_SHM * shm);
+tk_EXPORT void tek_shm_close(TEK_SHM * shm);
+
+#endif
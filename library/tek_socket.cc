@@ -0,0 +1,460 @@
+/* tek_socket.cc
+ * Raw SCPI socket transport. Many Tek scopes (e.g. the DPO/MSO4000 series,
+ * with the "socket server" turned on) will also accept SCPI commands over a
+ * plain TCP connection, usually on port 4000. There is no RPC framing at
+ * all: commands are terminated with a newline, and so are replies. Bulk
+ * CURVE? data can then be read straight into the caller's buffer, without
+ * the chunking and copying that goes on inside the VXI11 library.
+ *
+ * Open with tek_open(&clink, "socket:HOST") or "socket:HOST:PORT".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tek_transport.h"
+
+#ifdef WIN32
+
+/* Not (yet) supported on Windows; use VXI11 */
+int tek_socket_open(VXI11_CLINK ** clink, const char *address)
+{
+	printf("tek_socket_open: socket transport not available on this platform\n");
+	return -1;
+}
+
+#else
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Default port of the Tek socket server */
+#define TEK_SOCKET_PORT		"4000"
+
+/* Size of our own read-ahead buffer. Replies to ordinary queries (and the
+ * header of a data block) are read into this in as few recv() calls as
+ * possible; the bulk of a data block bypasses it. */
+#define TEK_SOCKET_READAHEAD	65536
+
+/* Kernel receive buffer we ask for, so that the scope can keep streaming
+ * while we're busy elsewhere. The kernel may give us less. */
+#define TEK_SOCKET_RCVBUF	(4 * 1024 * 1024)
+
+typedef struct tek_socket {
+	TEK_TRANSPORT transport;
+	int fd;
+	char rbuf[TEK_SOCKET_READAHEAD];
+	size_t rpos;		/* start of unread data in rbuf */
+	size_t rlen;		/* end of unread data in rbuf */
+} TEK_SOCKET;
+
+/* Waits for the socket to become readable. Returns 0 when it is, or
+ * a negative value on timeout or error. */
+static int tek_socket_wait(TEK_SOCKET * s, unsigned long timeout)
+{
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = s->fd;
+	pfd.events = POLLIN;
+	do {
+		ret = poll(&pfd, 1, (int)timeout);
+	} while (ret < 0 && errno == EINTR);
+	if (ret == 0) {
+		printf("tek_socket: timed out waiting for reply\n");
+		return -1;
+	}
+	return (ret < 0) ? -1 : 0;
+}
+
+/* Tops up the read-ahead buffer with whatever is available (at least one
+ * byte). Returns the number of unread bytes, or a negative value. */
+static long tek_socket_fill(TEK_SOCKET * s, unsigned long timeout)
+{
+	ssize_t n;
+
+	if (s->rpos == s->rlen) {
+		s->rpos = s->rlen = 0;
+	} else if (s->rpos > 0 && s->rlen == TEK_SOCKET_READAHEAD) {
+		memmove(s->rbuf, s->rbuf + s->rpos, s->rlen - s->rpos);
+		s->rlen -= s->rpos;
+		s->rpos = 0;
+	}
+	if (tek_socket_wait(s, timeout) < 0) {
+		return -1;
+	}
+	do {
+		n = recv(s->fd, s->rbuf + s->rlen,
+			 TEK_SOCKET_READAHEAD - s->rlen, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0) {
+		printf("tek_socket: connection closed by instrument\n");
+		return -1;
+	}
+	s->rlen += n;
+	return (long)(s->rlen - s->rpos);
+}
+
+/* Reads exactly len bytes into buf, using up the read-ahead buffer first
+ * and then reading directly from the socket. If buf is NULL the bytes are
+ * thrown away. */
+static long tek_socket_read(TEK_SOCKET * s, char *buf, size_t len,
+			    unsigned long timeout)
+{
+	size_t got = 0, n;
+	ssize_t r;
+
+	n = s->rlen - s->rpos;
+	if (n > len) {
+		n = len;
+	}
+	if (buf) {
+		memcpy(buf, s->rbuf + s->rpos, n);
+	}
+	s->rpos += n;
+	got = n;
+	while (got < len) {
+		if (!buf || len - got < TEK_SOCKET_READAHEAD / 4) {
+			/* small remainder (or discarding): go via read-ahead */
+			if (tek_socket_fill(s, timeout) < 0) {
+				return -1;
+			}
+			n = s->rlen - s->rpos;
+			if (n > len - got) {
+				n = len - got;
+			}
+			if (buf) {
+				memcpy(buf + got, s->rbuf + s->rpos, n);
+			}
+			s->rpos += n;
+			got += n;
+			continue;
+		}
+		if (tek_socket_wait(s, timeout) < 0) {
+			return -1;
+		}
+		do {
+			r = recv(s->fd, buf + got, len - got, 0);
+		} while (r < 0 && errno == EINTR);
+		if (r <= 0) {
+			printf("tek_socket: connection closed by instrument\n");
+			return -1;
+		}
+		got += r;
+	}
+	return (long)got;
+}
+
+/* Reads the "#<n><length>" header of a definite length block, assuming the
+ * '#' is next in the stream. The header itself is left in hdr (which must
+ * have room for 12 bytes) if you want it. Returns the data length, or -1. */
+static long tek_socket_block_header(TEK_SOCKET * s, char *hdr, int *hdr_len,
+				    unsigned long timeout)
+{
+	int ndigits, i;
+	long n = 0;
+
+	if (tek_socket_read(s, hdr, 2, timeout) < 0) {
+		return -1;
+	}
+	ndigits = hdr[1] - '0';
+	if (ndigits < 0 || ndigits > 9) {
+		printf("tek_socket: bad data block header\n");
+		return -1;
+	}
+	if (tek_socket_read(s, hdr + 2, ndigits, timeout) < 0) {
+		return -1;
+	}
+	for (i = 0; i < ndigits; i++) {
+		n = n * 10 + (hdr[2 + i] - '0');
+	}
+	*hdr_len = 2 + ndigits;
+	return n;
+}
+
+/* Eats the newline that terminates a reply, if there is one */
+static void tek_socket_skip_newline(TEK_SOCKET * s, unsigned long timeout)
+{
+	if (s->rpos == s->rlen && tek_socket_fill(s, timeout) < 0) {
+		return;
+	}
+	if (s->rbuf[s->rpos] == '\n') {
+		s->rpos++;
+	}
+}
+
+static int tek_socket_send(TEK_TRANSPORT * t, const char *cmd, size_t len)
+{
+	TEK_SOCKET *s = (TEK_SOCKET *) t->priv;
+	struct iovec iov[2];
+	struct msghdr msg;
+	char nl = '\n';
+	ssize_t n;
+	int first = 0, cnt = 2;
+
+	/* Every program message has to be terminated with a newline; if the
+	 * caller hasn't done it, we do it for them, in the same write. */
+	iov[0].iov_base = (void *)cmd;
+	iov[0].iov_len = len;
+	iov[1].iov_base = &nl;
+	iov[1].iov_len = 1;
+	if (len > 0 && cmd[len - 1] == '\n') {
+		cnt = 1;
+	}
+	while (first < cnt) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov + first;
+		msg.msg_iovlen = cnt - first;
+		n = sendmsg(s->fd, &msg, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			printf("tek_socket: error sending command\n");
+			return -1;
+		}
+		while (first < cnt && (size_t)n >= iov[first].iov_len) {
+			n -= iov[first].iov_len;
+			first++;
+		}
+		if (first < cnt) {
+			iov[first].iov_base = (char *)iov[first].iov_base + n;
+			iov[first].iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+/* Reads one reply. This is either a definite length block (which can
+ * contain newlines, so we have to go by its length) or text up to a
+ * newline. */
+static long tek_socket_receive(TEK_TRANSPORT * t, char *buf, size_t len,
+			       unsigned long timeout)
+{
+	TEK_SOCKET *s = (TEK_SOCKET *) t->priv;
+	char *nl;
+	long n;
+	int hdr_len;
+	size_t got = 0, avail;
+
+	if (s->rpos == s->rlen && tek_socket_fill(s, timeout) < 0) {
+		return -1;
+	}
+	if (s->rbuf[s->rpos] == '#') {
+		if (len < 12) {
+			return -100;
+		}
+		n = tek_socket_block_header(s, buf, &hdr_len, timeout);
+		if (n < 0) {
+			return -1;
+		}
+		if ((size_t)(hdr_len + n) >= len) {
+			printf("tek_socket: buffer too small for reply of %ld bytes\n",
+			       hdr_len + n);
+			tek_socket_read(s, NULL, n, timeout);
+			tek_socket_skip_newline(s, timeout);
+			return -100;
+		}
+		if (tek_socket_read(s, buf + hdr_len, n, timeout) < 0) {
+			return -1;
+		}
+		tek_socket_skip_newline(s, timeout);
+		buf[hdr_len + n] = '\n';
+		return hdr_len + n + 1;
+	}
+	for (;;) {
+		avail = s->rlen - s->rpos;
+		nl = (char *)memchr(s->rbuf + s->rpos, '\n', avail);
+		if (nl) {
+			avail = nl - (s->rbuf + s->rpos) + 1;
+		}
+		if (got + avail > len) {
+			printf("tek_socket: buffer too small for reply\n");
+			return -100;
+		}
+		memcpy(buf + got, s->rbuf + s->rpos, avail);
+		s->rpos += avail;
+		got += avail;
+		if (nl) {
+			return (long)got;
+		}
+		if (tek_socket_fill(s, timeout) < 0) {
+			return -1;
+		}
+	}
+}
+
+/* Reads a definite length block directly into the caller's buffer: only
+ * the header goes through the read-ahead buffer. */
+static long tek_socket_receive_data_block(TEK_TRANSPORT * t, char *buf,
+					  size_t len, unsigned long timeout)
+{
+	TEK_SOCKET *s = (TEK_SOCKET *) t->priv;
+	char hdr[12];
+	int hdr_len;
+	long n;
+
+	if (s->rpos == s->rlen && tek_socket_fill(s, timeout) < 0) {
+		return -1;
+	}
+	if (s->rbuf[s->rpos] != '#') {
+		printf("tek_receive_data_block: data block does not begin with '#'\n");
+		return -3;
+	}
+	n = tek_socket_block_header(s, hdr, &hdr_len, timeout);
+	if (n < 0) {
+		return -1;
+	}
+	if ((size_t)n > len) {
+		printf("tek_receive_data_block: block of %ld bytes is too big for buffer of %lu\n",
+		       n, (unsigned long)len);
+		tek_socket_read(s, NULL, n, timeout);
+		tek_socket_skip_newline(s, timeout);
+		return -3;
+	}
+	if (tek_socket_read(s, buf, n, timeout) < 0) {
+		return -1;
+	}
+	tek_socket_skip_newline(s, timeout);
+	return n;
+}
+
+static int tek_socket_close(TEK_TRANSPORT * t)
+{
+	TEK_SOCKET *s = (TEK_SOCKET *) t->priv;
+
+	close(s->fd);
+	free(s);
+	return 0;
+}
+
+static const TEK_TRANSPORT_OPS tek_socket_ops = {
+	"socket",
+	tek_socket_send,
+	tek_socket_receive,
+	tek_socket_receive_data_block,
+	tek_socket_close
+};
+
+/* Splits HOST[:PORT] into host and port. An IPv6 address with a port goes
+ * in square brackets, [fe80::1]:4000, as in URLs; without the brackets,
+ * anything with more than one colon is taken to be just an address. *port
+ * is left alone if there's no port. Returns 0, or -1 if it makes no sense
+ * or the host doesn't fit. */
+int tek_socket_split_address(const char *address, char *host, size_t len,
+			     const char **port)
+{
+	const char *end, *colon;
+	int n;
+
+	if (address[0] == '[') {
+		end = strchr(address, ']');
+		if (!end || (end[1] != '\0' && end[1] != ':')) {
+			return -1;
+		}
+		n = snprintf(host, len, "%.*s", (int)(end - address - 1),
+			     address + 1);
+		if (end[1] == ':') {
+			*port = end + 2;
+		}
+	} else {
+		colon = strchr(address, ':');
+		if (colon && strchr(colon + 1, ':') == NULL) {
+			n = snprintf(host, len, "%.*s",
+				     (int)(colon - address), address);
+			*port = colon + 1;
+		} else {
+			n = snprintf(host, len, "%s", address);
+		}
+	}
+	if (n < 0 || (size_t)n >= len || host[0] == '\0') {
+		return -1;
+	}
+	return 0;
+}
+
+/* Opens a raw socket link. The address is HOST or HOST:PORT (see above). */
+int tek_socket_open(VXI11_CLINK ** clink, const char *address)
+{
+	TEK_SOCKET *s;
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *port = TEK_SOCKET_PORT;
+	int fd = -1, one = 1, rcvbuf = TEK_SOCKET_RCVBUF;
+	int ret;
+
+	if (tek_socket_split_address(address, host, sizeof(host), &port) != 0) {
+		printf("tek_socket_open: can't make sense of address '%s'\n",
+		       address);
+		return -1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	ret = getaddrinfo(host, port, &hints, &res);
+	if (ret != 0) {
+		printf("tek_socket_open: could not look up %s: %s\n", host,
+		       gai_strerror(ret));
+		return -1;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		/* The receive buffer has to be set before connecting for the
+		 * TCP window to be scaled accordingly. */
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0) {
+		printf("tek_socket_open: could not connect to %s port %s\n",
+		       host, port);
+		return -1;
+	}
+	/* Commands and queries are small; don't let Nagle sit on them */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	s = (TEK_SOCKET *) calloc(1, sizeof(TEK_SOCKET));
+	if (!s) {
+		close(fd);
+		return -1;
+	}
+	s->fd = fd;
+	s->transport.ops = &tek_socket_ops;
+	s->transport.priv = s;
+	*clink = tek_transport_add(&s->transport);
+	return 0;
+}
+
+#endif
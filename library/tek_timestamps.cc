@@ -0,0 +1,337 @@
+/* tek_timestamps.cc
+ * FastFrame trigger times, fetched in bulk. See tek_timestamps.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "tek_timestamps.h"
+#include "tek_transport.h"
+
+#define TEK_TS_MAGIC		"TEKTIME1"
+#define TEK_TS_HEADER_LEN	16
+/* Each timestamp comes back as e.g. "02 Mar 2006 14:31:26.470 891 230 000",
+ * plus a comma: allow a little more in case of longer fractions */
+#define TEK_TS_REPLY_LEN	48
+
+static const char *tek_ts_months[12] = { "JAN", "FEB", "MAR", "APR", "MAY",
+	"JUN", "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"
+};
+
+/* Days since 1 Jan 1970 of a date in the (proleptic) Gregorian calendar.
+ * Done by hand because timegm() isn't everywhere, and mktime() would bring
+ * the local time zone into it; the scope's clock has no zone anyway. */
+static long tek_ts_days(long y, int m, int d)
+{
+	long era, yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+/* Parses one timestamp (without its quotes) into whole seconds since 1970
+ * and picoseconds into that second. The fraction of a second is grouped in
+ * threes with spaces; there may be anything up to 12 digits of it. */
+static int tek_ts_parse(const char *s, long *secs, int64_t * ps)
+{
+	int day, month, hh, mm, ss, n, digits;
+	long year;
+	char mon[4];
+	const char *p;
+
+	if (sscanf(s, " %d %3s %ld %d:%d:%d%n", &day, mon, &year, &hh, &mm, &ss,
+		   &n) != 6) {
+		return -1;
+	}
+	for (month = 0; month < 12; month++) {
+		if (strncasecmp(mon, tek_ts_months[month], 3) == 0) {
+			break;
+		}
+	}
+	if (month == 12) {
+		return -1;
+	}
+	*secs = tek_ts_days(year, month + 1, day) * 86400L
+	    + hh * 3600L + mm * 60L + ss;
+	*ps = 0;
+	digits = 0;
+	p = s + n;
+	if (*p == '.') {
+		for (p++; *p; p++) {
+			if (*p >= '0' && *p <= '9') {
+				if (digits < 12) {
+					*ps = *ps * 10 + (*p - '0');
+					digits++;
+				}
+			} else if (*p != ' ') {
+				break;
+			}
+		}
+	}
+	for (; digits < 12; digits++) {
+		*ps *= 10;
+	}
+	return 0;
+}
+
+long tek_scope_get_timestamps(VXI11_CLINK * clink, char *source,
+			      long no_frames, double *t0, int64_t * t_ps,
+			      unsigned long timeout)
+{
+	char cmd[100];
+	char *buf, *p, *end;
+	size_t len;
+	long bytes, n, secs, secs0 = 0;
+	int64_t ps, ps0 = 0;
+
+	if (no_frames < 1) {
+		return -1;
+	}
+	len = TEK_TS_REPLY_LEN * no_frames + 64;
+	buf = new char[len + 1];
+	sprintf(cmd, "HORIZONTAL:FASTFRAME:TIMESTAMP:ALL:%s? 1,%ld", source,
+		no_frames);
+	if (tek_send(clink, cmd) != 0) {
+		printf("Error: tek_scope_get_timestamps: could not send cmd.\n");
+		delete[]buf;
+		return -2;
+	}
+	bytes = tek_receive(clink, buf, len, timeout);
+	if (bytes <= 0) {
+		printf("Error: tek_scope_get_timestamps: no reply.\n");
+		delete[]buf;
+		return -3;
+	}
+	buf[bytes] = '\0';
+
+	/* Every timestamp is in double quotes; there is nothing in between
+	 * them but commas (and, on some firmware, a header) */
+	n = 0;
+	p = buf;
+	while (n < no_frames && (p = strchr(p, '"')) != NULL) {
+		p++;
+		end = strchr(p, '"');
+		if (end == NULL) {
+			break;
+		}
+		*end = '\0';
+		if (tek_ts_parse(p, &secs, &ps) != 0) {
+			printf("Error: tek_scope_get_timestamps: can't make sense of \"%s\"\n", p);
+			delete[]buf;
+			return -4;
+		}
+		if (n == 0) {
+			secs0 = secs;
+			ps0 = ps;
+			*t0 = (double)secs + (double)ps * 1e-12;
+		}
+		t_ps[n++] = (int64_t) (secs - secs0) * 1000000000000LL + ps - ps0;
+		p = end + 1;
+	}
+	delete[]buf;
+	if (n < no_frames) {
+		printf("Warning: tek_scope_get_timestamps: asked for %ld frames, got %ld\n", no_frames, n);
+	}
+	return n;
+}
+
+static int tek_ts_compare(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+void tek_timestamps_analyse(const int64_t * t_ps, long no_frames,
+			    uint32_t * flags, TEK_TS_STATS * stats)
+{
+	int64_t *sorted;
+	double normal, dt, ratio;
+	long i, bin;
+
+	stats->no_frames += no_frames;
+	if (no_frames < 1) {
+		return;
+	}
+	flags[0] = TEK_TS_FIRST;
+	if (no_frames < 2) {
+		return;
+	}
+
+	/* The median interval is what the rep rate "should" be: unlike the
+	 * mean, a few misfires or missed triggers hardly move it */
+	sorted = new int64_t[no_frames - 1];
+	for (i = 1; i < no_frames; i++) {
+		sorted[i - 1] = t_ps[i] - t_ps[i - 1];
+	}
+	qsort(sorted, no_frames - 1, sizeof(int64_t), tek_ts_compare);
+	normal = (double)sorted[(no_frames - 1) / 2];
+	delete[]sorted;
+
+	for (i = 1; i < no_frames; i++) {
+		dt = (double)(t_ps[i] - t_ps[i - 1]);
+		flags[i] = 0;
+		ratio = normal > 0 ? dt / normal : 1;
+		if (ratio < 0.5) {
+			flags[i] |= TEK_TS_SHORT;
+			stats->no_short++;
+		}
+		if (ratio > 1.5) {
+			flags[i] |= TEK_TS_LONG;
+			stats->no_long++;
+		}
+		bin = (long)(ratio * TEK_TS_BINS / 2);
+		if (bin < 0) {
+			bin = 0;
+		}
+		if (bin > TEK_TS_BINS) {
+			bin = TEK_TS_BINS;
+		}
+		stats->hist[bin]++;
+
+		dt *= 1e-12;
+		if (stats->no_intervals == 0 || dt < stats->min) {
+			stats->min = dt;
+		}
+		if (stats->no_intervals == 0 || dt > stats->max) {
+			stats->max = dt;
+		}
+		stats->sum += dt;
+		stats->sum_sq += dt * dt;
+		stats->no_intervals++;
+	}
+}
+
+void tek_timestamps_print_stats(const TEK_TS_STATS * stats)
+{
+	double mean, sd;
+	long i, most = 0;
+	int width;
+
+	printf("Trigger timestamps: %ld frames, %ld intervals\n",
+	       stats->no_frames, stats->no_intervals);
+	if (stats->no_intervals < 1) {
+		return;
+	}
+	mean = stats->sum / stats->no_intervals;
+	sd = stats->sum_sq / stats->no_intervals - mean * mean;
+	sd = sd > 0 ? sqrt(sd) : 0;
+	printf("  interval: mean %g s (%g Hz), std dev %g s, min %g s, max %g s\n",
+	       mean, mean > 0 ? 1 / mean : 0, sd, stats->min, stats->max);
+	printf("  short (< 0.5 x median, misfires?): %ld\n", stats->no_short);
+	printf("  long (> 1.5 x median, missed triggers?): %ld\n",
+	       stats->no_long);
+
+	for (i = 0; i <= TEK_TS_BINS; i++) {
+		if (stats->hist[i] > most) {
+			most = stats->hist[i];
+		}
+	}
+	printf("  interval / median:\n");
+	for (i = 0; i <= TEK_TS_BINS; i++) {
+		if (stats->hist[i] == 0) {
+			continue;
+		}
+		width = (int)((50 * stats->hist[i] + most - 1) / most);
+		if (i < TEK_TS_BINS) {
+			printf("  %5.2f-%5.2f %8ld %.*s\n",
+			       2.0 * i / TEK_TS_BINS,
+			       2.0 * (i + 1) / TEK_TS_BINS, stats->hist[i],
+			       width,
+			       "##################################################");
+		} else {
+			printf("  %5.2f+      %8ld %.*s\n", 2.0, stats->hist[i],
+			       width,
+			       "##################################################");
+		}
+	}
+}
+
+int tek_timestamps_write(FILE * f, double *file_t0, double t0,
+			 const int64_t * t_ps, const uint32_t * flags,
+			 long no_frames, uint32_t trace)
+{
+	TEK_TIMESTAMP *frames;
+	int64_t offset;
+	long i;
+
+	if (*file_t0 < 0) {
+		*file_t0 = t0;
+		if (fwrite(TEK_TS_MAGIC, 1, 8, f) != 8
+		    || fwrite(file_t0, sizeof(double), 1, f) != 1) {
+			printf("Error: tek_timestamps_write: could not write header\n");
+			return -1;
+		}
+	}
+	/* t0 as a double is only good to a microsecond or so: fine for
+	 * putting acquisitions relative to each other, whereas the frames
+	 * within one keep the scope's full resolution */
+	offset = (int64_t) ((t0 - *file_t0) * 1e12 + 0.5);
+	frames = new TEK_TIMESTAMP[no_frames];
+	for (i = 0; i < no_frames; i++) {
+		frames[i].t_ps = offset + t_ps[i];
+		frames[i].trace = trace;
+		frames[i].flags = flags[i];
+	}
+	if (fwrite(frames, sizeof(TEK_TIMESTAMP), no_frames, f)
+	    != (size_t)no_frames) {
+		printf("Error: tek_timestamps_write: could not write frames\n");
+		delete[]frames;
+		return -1;
+	}
+	delete[]frames;
+	return 0;
+}
+
+/* Reads a whole .wft file. *frames is allocated with new[]; returns the
+ * number of frames, or negative */
+long tek_timestamps_read(const char *filename, double *t0,
+			 TEK_TIMESTAMP ** frames)
+{
+	FILE *f;
+	char magic[8];
+	long size, n;
+
+	f = fopen(filename, "rb");
+	if (f == NULL) {
+		printf("Error: tek_timestamps_read: could not open %s\n",
+		       filename);
+		return -1;
+	}
+	if (fread(magic, 1, 8, f) != 8 || memcmp(magic, TEK_TS_MAGIC, 8) != 0
+	    || fread(t0, sizeof(double), 1, f) != 1) {
+		printf("Error: tek_timestamps_read: %s is not a timestamps file\n", filename);
+		fclose(f);
+		return -2;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, TEK_TS_HEADER_LEN, SEEK_SET);
+	n = (size - TEK_TS_HEADER_LEN) / (long)sizeof(TEK_TIMESTAMP);
+	*frames = new TEK_TIMESTAMP[n > 0 ? n : 1];
+	n = (long)fread(*frames, sizeof(TEK_TIMESTAMP), n, f);
+	fclose(f);
+	return n;
+}
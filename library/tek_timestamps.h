@@ -0,0 +1,94 @@
+/* tek_timestamps.h
+ * Trigger times of the frames (segments) of a FastFrame acquisition, all
+ * fetched with one query, rather than one query per frame; plus a compact
+ * binary file to keep them in alongside the .wf file, and some statistics
+ * on the time between triggers (rep rate jitter, misfires).
+ *
+ * The "timestamps" file (.wft) is a 16 byte header
+ *   char    magic[8]    "TEKTIME1"
+ *   double  t0          time of the first frame, seconds since 1970
+ *                       (by the scope's clock)
+ * followed by one TEK_TIMESTAMP per frame, in the same order as the frames
+ * in the .wf file, so frame i is at byte 16 + 16 * i. All little-endian.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_TIMESTAMPS_H_
+#define _TEK_TIMESTAMPS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tek_vxi11.h"
+
+/* Flags for each frame. An interval is the time since the frame before in
+ * the same acquisition; "normal" is the median interval. */
+#define TEK_TS_FIRST	1	/* first frame of an acquisition, no interval */
+#define TEK_TS_SHORT	2	/* interval < half normal: a misfire? */
+#define TEK_TS_LONG	4	/* interval > 1.5 x normal: missed triggers? */
+#define TEK_TS_MISSING	8	/* the scope gave no time for it; t_ps is 0 */
+
+typedef struct {
+	int64_t t_ps;		/* picoseconds since the file's t0 */
+	uint32_t trace;		/* which acquisition (from 0) */
+	uint32_t flags;
+} TEK_TIMESTAMP;
+
+/* Histogram of interval / normal interval, from 0 to 2 */
+#define TEK_TS_BINS	40
+
+typedef struct {
+	long no_frames;
+	long no_intervals;
+	double sum, sum_sq;	/* of the intervals (s) */
+	double min, max;
+	long no_short, no_long;
+	long hist[TEK_TS_BINS + 1];	/* last bin: 2 x normal and over */
+} TEK_TS_STATS;
+
+/* Asks the scope for the trigger times of frames 1..no_frames of source,
+ * in one go (HORIZONTAL:FASTFRAME:TIMESTAMP:ALL). t0 is set to the time of
+ * the first frame (seconds since 1970) and t_ps[i] to that of frame i+1,
+ * in picoseconds after it. Returns the number of frames, or negative. */
+tk_EXPORT long tek_scope_get_timestamps(VXI11_CLINK * clink, char *source,
+					long no_frames, double *t0,
+					int64_t * t_ps,
+					unsigned long timeout);
+
+/* Works out the flags for one acquisition's frames, and adds its
+ * intervals to the statistics, in the same pass. stats should be zeroed
+ * before the first call. */
+tk_EXPORT void tek_timestamps_analyse(const int64_t * t_ps, long no_frames,
+				      uint32_t * flags,
+				      TEK_TS_STATS * stats);
+tk_EXPORT void tek_timestamps_print_stats(const TEK_TS_STATS * stats);
+
+/* The .wft file. tek_timestamps_write() appends one acquisition's frames,
+ * with times relative to the first frame it ever wrote (t0 in the header);
+ * *file_t0 should be < 0 before the first call, and is kept up to date.
+ * Write a record for every frame, even those tek_scope_get_timestamps()
+ * didn't get (flag them TEK_TS_MISSING), so that record i is always
+ * frame i. */
+tk_EXPORT int tek_timestamps_write(FILE * f, double *file_t0, double t0,
+				   const int64_t * t_ps,
+				   const uint32_t * flags, long no_frames,
+				   uint32_t trace);
+tk_EXPORT long tek_timestamps_read(const char *filename, double *t0,
+				   TEK_TIMESTAMP ** frames);
+
+#endif
@@ -0,0 +1,408 @@
+/* tek_transport.cc
+ * The layer underneath the tek_* functions that actually moves bytes to and
+ * from the instrument. See tek_transport.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <windows.h>
+#define snprintf sprintf_s
+#define vsnprintf vsprintf_s
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "tek_transport.h"
+
+/*****************************************************************************
+ * Keeping track of which links are ours                                     *
+ *****************************************************************************/
+
+/* Links that aren't plain VXI11 links are handed out as a pointer to their
+ * TEK_TRANSPORT, cast to a VXI11_CLINK pointer so that the rest of the API
+ * doesn't have to change. We keep a list of them so we can tell them apart
+ * from the real thing. It only ever holds a handful of entries. Links can
+ * be opened and closed from several threads at once (see tek_deploy.cc),
+ * so it has a lock. */
+static TEK_TRANSPORT *tek_transports = NULL;
+#ifdef WIN32
+#define tek_transports_lock()
+#define tek_transports_unlock()
+#else
+static pthread_mutex_t tek_transports_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define tek_transports_lock()	pthread_mutex_lock(&tek_transports_mutex)
+#define tek_transports_unlock()	pthread_mutex_unlock(&tek_transports_mutex)
+#endif
+
+VXI11_CLINK *tek_transport_add(TEK_TRANSPORT * t)
+{
+	tek_transports_lock();
+	t->next = tek_transports;
+	tek_transports = t;
+	tek_transports_unlock();
+	return (VXI11_CLINK *) t;
+}
+
+/* Returns the transport behind a link, or NULL if it's a plain VXI11 link */
+TEK_TRANSPORT *tek_transport_get(VXI11_CLINK * clink)
+{
+	TEK_TRANSPORT *t;
+
+	tek_transports_lock();
+	for (t = tek_transports; t; t = t->next) {
+		if ((VXI11_CLINK *) t == clink) {
+			break;
+		}
+	}
+	tek_transports_unlock();
+	return t;
+}
+
+void tek_transport_remove(TEK_TRANSPORT * t)
+{
+	TEK_TRANSPORT **p;
+
+	tek_transports_lock();
+	for (p = &tek_transports; *p; p = &(*p)->next) {
+		if (*p == t) {
+			*p = t->next;
+			break;
+		}
+	}
+	tek_transports_unlock();
+}
+
+/* Microseconds since some arbitrary point, from a clock that doesn't jump */
+double tek_time_us(void)
+{
+#ifdef WIN32
+	LARGE_INTEGER count, freq;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (double)count.QuadPart * 1e6 / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+#endif
+}
+
+void tek_sleep_us(double us)
+{
+	if (us <= 0) {
+		return;
+	}
+#ifdef WIN32
+	Sleep((DWORD) (us / 1000));
+#else
+	usleep((useconds_t) us);
+#endif
+}
+
+/* Every message sent to or read from an instrument, over any link. Over
+ * VXI11 each of these is an RPC, i.e. a round trip on the network, so this
+ * is what to keep down. Not exact if several threads are talking at once;
+ * it's only for measuring. */
+static unsigned long tek_no_writes = 0;
+static unsigned long tek_no_reads = 0;
+
+void tek_io_counts(unsigned long *writes, unsigned long *reads)
+{
+	*writes = tek_no_writes;
+	*reads = tek_no_reads;
+}
+
+/*****************************************************************************
+ * Generic I/O. For plain VXI11 links these go straight to the vxi11_user   *
+ * library; otherwise we do the same job on top of the transport's own      *
+ * send() and receive().                                                     *
+ *****************************************************************************/
+
+/* Could cmd change the DATA:SOURCE? i.e. does it set it (DATA:SOURCE or
+ * DAT:SOU, or SOURCE after a ';', which might be relative to DATA:), or
+ * reset or recall a setup (*RST, *RCL, RECALL, FACTORY)? Stops at a
+ * definite length block, so an arb upload isn't searched. Errs on the side
+ * of yes, as that only costs the next tek_scope_get_data() a DATA:SOURCE. */
+int tek_cmd_changes_data_source(const char *cmd, size_t len)
+{
+	static const char *words[] = { "DATA:SOU", "DAT:SOU", ";SOU", "*RST",
+		"*RCL", "RECA", "FAC", NULL
+	};
+	size_t i, j;
+	int w;
+
+	for (i = 0; i < len; i++) {
+		if (cmd[i] == '#' && i + 1 < len
+		    && cmd[i + 1] >= '0' && cmd[i + 1] <= '9') {
+			break;
+		}
+		for (w = 0; words[w]; w++) {
+			for (j = 0; words[w][j] && i + j < len; j++) {
+				if (toupper((unsigned char)cmd[i + j]) !=
+				    words[w][j]) {
+					break;
+				}
+			}
+			if (words[w][j] == '\0') {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* The tek_send family keep tek_scope_get_data()'s idea of the DATA:SOURCE
+ * honest (see tek_scope_forget_data_source()), whoever does the sending */
+int tek_send(VXI11_CLINK * clink, const char *cmd, size_t len)
+{
+	TEK_TRANSPORT *t = tek_transport_get(clink);
+
+	tek_no_writes++;
+	if (tek_cmd_changes_data_source(cmd, len)) {
+		tek_scope_forget_data_source(clink);
+	}
+	if (!t) {
+		return vxi11_send(clink, cmd, len);
+	}
+	return t->ops->send(t, cmd, len);
+}
+
+int tek_send(VXI11_CLINK * clink, const char *cmd)
+{
+	return tek_send(clink, cmd, strlen(cmd));
+}
+
+int tek_send_printf(VXI11_CLINK * clink, const char *format, ...)
+{
+	char buf[1024];
+	char *big = NULL;
+	va_list ap;
+	int len, ret;
+
+	va_start(ap, format);
+	len = vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+	if (len < 0) {
+		return -1;
+	}
+	if ((size_t)len < sizeof(buf)) {
+		return tek_send(clink, buf, len);
+	}
+	big = (char *)malloc(len + 1);
+	if (!big) {
+		return -1;
+	}
+	va_start(ap, format);
+	vsnprintf(big, len + 1, format, ap);
+	va_end(ap);
+	ret = tek_send(clink, big, len);
+	free(big);
+	return ret;
+}
+
+long tek_receive(VXI11_CLINK * clink, char *buf, size_t len,
+		 unsigned long timeout)
+{
+	TEK_TRANSPORT *t = tek_transport_get(clink);
+
+	tek_no_reads++;
+	if (!t) {
+		return vxi11_receive_timeout(clink, buf, len, timeout);
+	}
+	return t->ops->receive(t, buf, len, timeout);
+}
+
+long tek_receive(VXI11_CLINK * clink, char *buf, size_t len)
+{
+	return tek_receive(clink, buf, len, VXI11_READ_TIMEOUT);
+}
+
+/* Sends a command followed by a definite length block, e.g.
+ * ":TRACE:DATA EMEMORY,#800001024<1024 bytes of data>" */
+int tek_send_data_block(VXI11_CLINK * clink, const char *cmd, char *buf,
+			size_t len)
+{
+	char *out;
+	size_t cmd_len;
+	int ret;
+
+	if (!tek_transport_get(clink)) {
+		tek_no_writes++;
+		if (tek_cmd_changes_data_source(cmd, strlen(cmd))) {
+			tek_scope_forget_data_source(clink);
+		}
+		return vxi11_send_data_block(clink, cmd, buf, len);
+	}
+	cmd_len = strlen(cmd);
+	out = (char *)malloc(cmd_len + 10 + len + 1);
+	if (!out) {
+		return -1;
+	}
+	snprintf(out, cmd_len + 11, "%s#8%08lu", cmd, (unsigned long)len);
+	memcpy(out + cmd_len + 10, buf, len);
+	ret = tek_send(clink, out, cmd_len + 10 + len);
+	free(out);
+	return ret;
+}
+
+/* Receives a definite length block ("#<n><length><data>"), putting just the
+ * data in buf. Returns the number of data bytes. */
+long tek_receive_data_block(VXI11_CLINK * clink, char *buf, size_t len,
+			    unsigned long timeout)
+{
+	TEK_TRANSPORT *t = tek_transport_get(clink);
+	char *in;
+	long ret;
+	int ndigits, i;
+	unsigned long returned_bytes = 0;
+
+	if (!t) {
+		tek_no_reads++;
+		return vxi11_receive_data_block(clink, buf, len, timeout);
+	}
+	if (t->ops->receive_data_block) {
+		tek_no_reads++;
+		return t->ops->receive_data_block(t, buf, len, timeout);
+	}
+	/* Room for the header ("#" + 1 digit + up to 9 digits) and newline */
+	in = (char *)malloc(len + 12);
+	if (!in) {
+		return -1;
+	}
+	ret = tek_receive(clink, in, len + 12, timeout);
+	if (ret < 0) {
+		free(in);
+		return ret;
+	}
+	if (ret < 2 || in[0] != '#') {
+		printf("tek_receive_data_block: data block does not begin with '#'\n");
+		free(in);
+		return -3;
+	}
+	ndigits = in[1] - '0';
+	/* some instruments, if there is a problem acquiring the data, return
+	 * only "#0" */
+	if (ndigits <= 0 || ndigits > 9 || ret < 2 + ndigits) {
+		free(in);
+		return 0;
+	}
+	for (i = 0; i < ndigits; i++) {
+		returned_bytes = returned_bytes * 10 + (in[2 + i] - '0');
+	}
+	if (returned_bytes > len
+	    || (long)returned_bytes > ret - 2 - ndigits) {
+		printf("tek_receive_data_block: block of %lu bytes is longer than the data received\n",
+		       returned_bytes);
+		free(in);
+		return -3;
+	}
+	memcpy(buf, in + 2 + ndigits, returned_bytes);
+	free(in);
+	return (long)returned_bytes;
+}
+
+/* Sends a query and reads the reply. Returns 0 on success, like
+ * vxi11_send_and_receive. */
+long tek_send_and_receive(VXI11_CLINK * clink, const char *cmd, char *buf,
+			  size_t len, unsigned long timeout)
+{
+	long bytes_returned;
+
+	if (!tek_transport_get(clink)) {
+		tek_no_writes++;
+		tek_no_reads++;
+		if (tek_cmd_changes_data_source(cmd, strlen(cmd))) {
+			tek_scope_forget_data_source(clink);
+		}
+		return vxi11_send_and_receive(clink, cmd, buf, len, timeout);
+	}
+	if (tek_send(clink, cmd) != 0) {
+		printf("Error: tek_send_and_receive: could not send cmd.\n");
+		return -1;
+	}
+	bytes_returned = tek_receive(clink, buf, len, timeout);
+	if (bytes_returned <= 0) {
+		printf("Error: tek_send_and_receive: problem reading reply.\n");
+		return -2;
+	}
+	if ((size_t)bytes_returned < len) {
+		buf[bytes_returned] = '\0';
+	}
+	return 0;
+}
+
+long tek_obtain_long_value(VXI11_CLINK * clink, const char *cmd,
+			   unsigned long timeout)
+{
+	char buf[50];
+
+	if (!tek_transport_get(clink)) {
+		tek_no_writes++;
+		tek_no_reads++;
+		if (tek_cmd_changes_data_source(cmd, strlen(cmd))) {
+			tek_scope_forget_data_source(clink);
+		}
+		return vxi11_obtain_long_value_timeout(clink, cmd, timeout);
+	}
+	memset(buf, 0, 50);
+	if (tek_send_and_receive(clink, cmd, buf, 49, timeout) != 0) {
+		printf("Returning 0\n");
+		return 0;
+	}
+	return strtol(buf, (char **)NULL, 10);
+}
+
+long tek_obtain_long_value(VXI11_CLINK * clink, const char *cmd)
+{
+	return tek_obtain_long_value(clink, cmd, VXI11_READ_TIMEOUT);
+}
+
+double tek_obtain_double_value(VXI11_CLINK * clink, const char *cmd,
+			       unsigned long timeout)
+{
+	char buf[50];
+
+	if (!tek_transport_get(clink)) {
+		tek_no_writes++;
+		tek_no_reads++;
+		if (tek_cmd_changes_data_source(cmd, strlen(cmd))) {
+			tek_scope_forget_data_source(clink);
+		}
+		return vxi11_obtain_double_value_timeout(clink, cmd, timeout);
+	}
+	memset(buf, 0, 50);
+	if (tek_send_and_receive(clink, cmd, buf, 49, timeout) != 0) {
+		printf("Returning 0.0\n");
+		return 0.0;
+	}
+	return strtod(buf, (char **)NULL);
+}
+
+double tek_obtain_double_value(VXI11_CLINK * clink, const char *cmd)
+{
+	return tek_obtain_double_value(clink, cmd, VXI11_READ_TIMEOUT);
+}
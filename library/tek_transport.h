@@ -0,0 +1,121 @@
+/* tek_transport.h
+ * The layer underneath the tek_* functions that actually moves bytes to and
+ * from the instrument. Normally this is just the vxi11_user library, but
+ * tek_open() also understands a few special addresses that give you a
+ * different transport behind the same VXI11_CLINK pointer:
+ *
+ *   record:FILE@ADDRESS   talk to ADDRESS over VXI11 as normal (or over a
+ *                         socket, for a socket: ADDRESS), but log every
+ *                         request, reply and its timing to FILE
+ *   replay:FILE           no instrument at all; replies are served from a
+ *                         file made with record:, at the recorded speed
+ *                         (a reply that took longer than the timeout you
+ *                         give now times out, as it would have done)
+ *   replay_fast:FILE      as replay:, but as fast as possible
+ *   socket:HOST[:PORT]    raw SCPI over a TCP socket (port 4000 by default,
+ *                         the Tek "socket server"), instead of VXI11 RPC;
+ *                         an IPv6 address is socket:fe80::1, or with a
+ *                         port, socket:[fe80::1]:4000
+ *
+ * A link opened this way is NOT a real VXI11_CLINK, so it must only be
+ * used with tek_* functions (including the tek_send/tek_receive family
+ * below, which mirror their vxi11_* namesakes), never passed to vxi11_*
+ * functions directly. Plain addresses give you a plain VXI11 link, exactly
+ * as before, unless there's a broker running (see tek_broker.h), in which
+ * case plain and socket: addresses both get a link lent by the broker.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_TRANSPORT_H_
+#define _TEK_TRANSPORT_H_
+
+#include "tek_vxi11.h"
+
+typedef struct tek_transport TEK_TRANSPORT;
+
+/* What a transport has to provide. send() returns 0 on success (like
+ * vxi11_send), receive() reads one complete response and returns the number
+ * of bytes read (like vxi11_receive_timeout), both negative on error.
+ * receive_data_block() is optional; if a transport can put the data of a
+ * definite length block straight into the caller's buffer, it can do so
+ * here, otherwise leave it NULL and a generic version built on receive()
+ * is used. */
+typedef struct tek_transport_ops {
+	const char *name;
+	int (*send) (TEK_TRANSPORT * t, const char *cmd, size_t len);
+	long (*receive) (TEK_TRANSPORT * t, char *buf, size_t len,
+			 unsigned long timeout);
+	long (*receive_data_block) (TEK_TRANSPORT * t, char *buf, size_t len,
+				    unsigned long timeout);
+	int (*close) (TEK_TRANSPORT * t);
+} TEK_TRANSPORT_OPS;
+
+struct tek_transport {
+	const TEK_TRANSPORT_OPS *ops;
+	void *priv;		/* for the transport's own use */
+	TEK_TRANSPORT *next;	/* list of open transports */
+};
+
+/* Transport registration, for use by transport implementations */
+tk_EXPORT VXI11_CLINK *tek_transport_add(TEK_TRANSPORT * t);
+tk_EXPORT TEK_TRANSPORT *tek_transport_get(VXI11_CLINK * clink);
+tk_EXPORT void tek_transport_remove(TEK_TRANSPORT * t);
+
+/* Timing helpers, shared by the transports */
+tk_EXPORT double tek_time_us(void);
+tk_EXPORT void tek_sleep_us(double us);
+
+/* How many messages have been sent to, and read from, instruments so far */
+tk_EXPORT void tek_io_counts(unsigned long *writes, unsigned long *reads);
+
+/* Transports (see tek_record.cc and tek_socket.cc) */
+tk_EXPORT int tek_record_open(VXI11_CLINK ** clink, const char *address);
+tk_EXPORT int tek_replay_open(VXI11_CLINK ** clink, const char *filename,
+			      int fast);
+tk_EXPORT int tek_socket_open(VXI11_CLINK ** clink, const char *address);
+tk_EXPORT int tek_socket_split_address(const char *address, char *host,
+				       size_t len, const char **port);
+
+/* Generic I/O, works over any transport. Same arguments and return values
+ * as the vxi11_* functions of the same name. Anything that could change the
+ * DATA:SOURCE (see tek_cmd_changes_data_source()) makes the library forget
+ * what it thought it was. */
+tk_EXPORT int tek_send(VXI11_CLINK * clink, const char *cmd, size_t len);
+tk_EXPORT int tek_send(VXI11_CLINK * clink, const char *cmd);
+tk_EXPORT int tek_send_printf(VXI11_CLINK * clink, const char *format, ...);
+tk_EXPORT long tek_receive(VXI11_CLINK * clink, char *buf, size_t len);
+tk_EXPORT long tek_receive(VXI11_CLINK * clink, char *buf, size_t len,
+			   unsigned long timeout);
+tk_EXPORT int tek_send_data_block(VXI11_CLINK * clink, const char *cmd,
+				  char *buf, size_t len);
+tk_EXPORT long tek_receive_data_block(VXI11_CLINK * clink, char *buf,
+				      size_t len, unsigned long timeout);
+tk_EXPORT long tek_send_and_receive(VXI11_CLINK * clink, const char *cmd,
+				    char *buf, size_t len,
+				    unsigned long timeout);
+tk_EXPORT long tek_obtain_long_value(VXI11_CLINK * clink, const char *cmd);
+tk_EXPORT long tek_obtain_long_value(VXI11_CLINK * clink, const char *cmd,
+				     unsigned long timeout);
+tk_EXPORT double tek_obtain_double_value(VXI11_CLINK * clink,
+					 const char *cmd);
+tk_EXPORT double tek_obtain_double_value(VXI11_CLINK * clink,
+					 const char *cmd,
+					 unsigned long timeout);
+tk_EXPORT int tek_cmd_changes_data_source(const char *cmd, size_t len);
+
+#endif
@@ -30,6 +30,7 @@
 #ifdef WIN32
 #include <windows.h>
 #else
+#include <pthread.h>
 #include <unistd.h>
 #endif
 
@@ -38,21 +39,141 @@
 #endif
 
 #include "tek_vxi11.h"
+#include "tek_transport.h"
+#include "tek_parallel.h"
+#include "tek_broker.h"
+#include "tek_arb_cache.h"
+
+/*****************************************************************************
+ * What we remember about each link                                          *
+ *****************************************************************************/
+
+/* Saves us sending commands that wouldn't change anything: the DATA:SOURCE
+ * that was last set, so that tek_scope_get_data() only sends it when the
+ * source changes. Also the *ESE and *SRE masks from before tek_scope_arm()
+ * changed them, to put back once the acquisition is over. Links get an entry in tek_open() and
+ * lose it in tek_close(); a link opened some other way doesn't have one, and
+ * gets everything sent every time, as before. The list is locked, like the
+ * one in tek_transport.cc, for links opened from several threads. */
+typedef struct tek_link_state {
+	VXI11_CLINK *clink;
+	char data_source[20];	/* "" if we don't know */
+	int armed;		/* ese and sre are to be put back */
+	int ese, sre;
+	struct tek_link_state *next;
+} TEK_LINK_STATE;
+
+static TEK_LINK_STATE *tek_link_states = NULL;
+#ifdef WIN32
+#define tek_link_states_lock()
+#define tek_link_states_unlock()
+#else
+static pthread_mutex_t tek_link_states_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define tek_link_states_lock()	pthread_mutex_lock(&tek_link_states_mutex)
+#define tek_link_states_unlock()	pthread_mutex_unlock(&tek_link_states_mutex)
+#endif
+
+static TEK_LINK_STATE *tek_link_state(VXI11_CLINK * clink)
+{
+	TEK_LINK_STATE *s;
+
+	tek_link_states_lock();
+	for (s = tek_link_states; s; s = s->next) {
+		if (s->clink == clink) {
+			break;
+		}
+	}
+	tek_link_states_unlock();
+	return s;
+}
+
+static void tek_link_state_add(VXI11_CLINK * clink)
+{
+	TEK_LINK_STATE *s;
+
+	s = (TEK_LINK_STATE *) calloc(1, sizeof(TEK_LINK_STATE));
+	if (s) {
+		s->clink = clink;
+		tek_link_states_lock();
+		s->next = tek_link_states;
+		tek_link_states = s;
+		tek_link_states_unlock();
+	}
+}
+
+static void tek_link_state_remove(VXI11_CLINK * clink)
+{
+	TEK_LINK_STATE **p, *s = NULL;
+
+	tek_link_states_lock();
+	for (p = &tek_link_states; *p; p = &(*p)->next) {
+		if ((*p)->clink == clink) {
+			s = *p;
+			*p = s->next;
+			break;
+		}
+	}
+	tek_link_states_unlock();
+	free(s);
+}
+
+/* Records what DATA:SOURCE has just been set to (NULL if we're no longer
+ * sure) */
+static void tek_link_set_data_source(VXI11_CLINK * clink, const char *source)
+{
+	TEK_LINK_STATE *s = tek_link_state(clink);
+
+	if (s) {
+		snprintf(s->data_source, sizeof(s->data_source), "%s",
+			 source ? source : "");
+	}
+}
 
 /*****************************************************************************
  * Generic Tektronix functions, suitable for all devices                     *
  *****************************************************************************/
 
 /* This really is just a wrapper. Only here because folk might be uncomfortable
- * using commands from the vxi11_user library directly! */
+ * using commands from the vxi11_user library directly! It also understands
+ * a few special addresses, for recording and replaying sessions and for
+ * talking raw SCPI over a socket; see tek_transport.h. */
 int tek_open(VXI11_CLINK ** clink, const char *ip)
 {
-	return vxi11_open_device(clink, ip, NULL);
+	int ret;
+
+	if (strncmp(ip, "record:", 7) == 0) {
+		ret = tek_record_open(clink, ip + 7);
+	} else if (strncmp(ip, "replay:", 7) == 0) {
+		ret = tek_replay_open(clink, ip + 7, 0);
+	} else if (strncmp(ip, "replay_fast:", 12) == 0) {
+		ret = tek_replay_open(clink, ip + 12, 1);
+	} else {
+		/* If there's a broker running (see tek_broker.h), it has a
+		 * link ready for us; otherwise, open our own */
+		ret = tek_broker_open(clink, ip);
+		if (ret > 0 && strncmp(ip, "socket:", 7) == 0) {
+			ret = tek_socket_open(clink, ip + 7);
+		} else if (ret > 0) {
+			ret = vxi11_open_device(clink, ip, NULL);
+		}
+	}
+	if (ret == 0) {
+		tek_link_state_add(*clink);
+	}
+	return ret;
 }
 
 /* Again, just a wrapper */
 int tek_close(VXI11_CLINK * clink, const char *ip)
 {
+	TEK_TRANSPORT *t = tek_transport_get(clink);
+
+	tek_parallel_close(clink);
+	tek_link_state_remove(clink);
+	if (t) {
+		tek_transport_remove(t);
+		return t->ops->close(t);
+	}
 	return vxi11_close_device(clink, ip);
 }
 
@@ -69,14 +190,14 @@ int tek_close(VXI11_CLINK * clink, const char *ip)
 int tek_scope_init(VXI11_CLINK * clink)
 {
 	int ret;
-	ret = vxi11_send_printf(clink, ":HEADER 0");	/* no headers in replies */
+	ret = tek_send_printf(clink, ":HEADER 0");	/* no headers in replies */
 	if (ret < 0) {
 		printf
 		    ("error in tek_scope_init, could not send command ':HEADER 0'\n");
 		return ret;
 	}
-	vxi11_send_printf(clink, ":DATA:WIDTH 2");	/* 2 bytes per data point (16 bit) */
-	vxi11_send_printf(clink, ":DATA:ENCDG SRIBINARY");	/* little endian, signed */
+	tek_send_printf(clink, ":DATA:WIDTH 2");	/* 2 bytes per data point (16 bit) */
+	tek_send_printf(clink, ":DATA:ENCDG SRIBINARY");	/* little endian, signed */
 	return 0;
 }
 
@@ -91,22 +212,23 @@ int tek_scope_get_setup(VXI11_CLINK * clink, char *buf, size_t len)
 	int ret;
 	long bytes_returned;
 
-	ret = vxi11_send_printf(clink, "SET?");
+	ret = tek_send_printf(clink, "SET?");
 	if (ret < 0) {
 		printf("error, could not ask for Tek scope system setup...\n");
 		return ret;
 	}
-	bytes_returned = vxi11_receive(clink, buf, len);
+	bytes_returned = tek_receive(clink, buf, len);
 
 	return (int)bytes_returned;
 }
 
-/* This is really just a wrapper function for vxi11_send, as the Tektronix way
+/* This is really just a wrapper function for tek_send, as the Tektronix way
  * of saving a setup is to report back a whole string of commands that completely
  * describe the way the scope is set up. */
 int tek_scope_send_setup(VXI11_CLINK * clink, char *buf, size_t len)
 {
-	return vxi11_send(clink, buf, len);
+	tek_link_set_data_source(clink, NULL);	/* it's probably in there */
+	return tek_send(clink, buf, len);
 }
 
 /* This function, tek_scope_write_wfi_file(), saves useful (to us!)
@@ -125,24 +247,32 @@ long tek_scope_write_wfi_file(VXI11_CLINK * clink, char *wfiname,
 			      char *captured_by, int no_of_traces,
 			      unsigned long timeout)
 {
-	FILE *wfi;
 	double vgain, voffset, hinterval, hoffset;	/* names used in wfi file */
-	double xzero, yoff, yzero;	/* names used by scope, needs translating first */
-	long data_start;
 	long no_of_bytes;
 
 	no_of_bytes = tek_scope_calculate_no_of_bytes(clink, timeout);
 
-	yoff = vxi11_obtain_double_value(clink, "WFMPRE:YOFF?");
-	yzero = vxi11_obtain_double_value(clink, "WFMPRE:YZERO?");
-	vgain = vxi11_obtain_double_value(clink, "WFMPRE:YMULT?");
-	voffset = -(yoff * vgain) + yzero;
-	hinterval = vxi11_obtain_double_value(clink, "WFMPRE:XINCR?");
-	data_start = vxi11_obtain_long_value(clink, "DATA:START?");
-	xzero = vxi11_obtain_double_value(clink, "WFMPRE:XZERO?");
-	hoffset = xzero + (((double)(data_start - 1)) * hinterval);
+	tek_scope_get_scaling(clink, &vgain, &voffset, &hinterval, &hoffset);
+	/* always 2 bytes per point on Tek scopes */
+	if (tek_write_wfi_file(wfiname, captured_by, no_of_bytes, vgain,
+			       voffset, hinterval, hoffset, no_of_traces,
+			       2) != 0) {
+		return -1;
+	}
+
+	return no_of_bytes;
+}
+
+/* Writes a wfi file from values you already have (e.g. for data that's been
+ * through tek_decimate.h). voffset is as from tek_scope_get_scaling(). */
+int tek_write_wfi_file(char *wfiname, char *captured_by, long no_of_bytes,
+		       double vgain, double voffset, double hinterval,
+		       double hoffset, int no_of_traces, int bytes_per_point)
+{
+	FILE *wfi;
+
 	wfi = fopen(wfiname, "w");
-	if (wfi > 0) {
+	if (wfi != NULL) {
 		fprintf(wfi, "%% %s\n", wfiname);
 		fprintf(wfi, "%% Waveform captured using %s\n\n", captured_by);
 		fprintf(wfi, "%% Number of bytes:\n%ld\n\n", no_of_bytes);
@@ -151,19 +281,41 @@ long tek_scope_write_wfi_file(VXI11_CLINK * clink, char *wfiname,
 		fprintf(wfi, "%% Horizontal interval:\n%g\n\n", hinterval);
 		fprintf(wfi, "%% Horizontal offset:\n%g\n\n", hoffset);
 		fprintf(wfi, "%% Number of traces:\n%d\n\n", no_of_traces);
-		fprintf(wfi, "%% Number of bytes per data-point:\n%d\n\n", 2);	/* always 2 on Tek scopes */
+		fprintf(wfi, "%% Number of bytes per data-point:\n%d\n\n",
+			bytes_per_point);
 		fprintf(wfi,
 			"%% Keep all datapoints (0 or missing knocks off 1 point, legacy lecroy):\n%d\n\n",
 			1);
 		fclose(wfi);
 	} else {
 		printf
-		    ("error: tek_scope_write_wfi_file: could not open %s for writing\n",
+		    ("error: tek_write_wfi_file: could not open %s for writing\n",
 		     wfiname);
 		return -1;
 	}
+	return 0;
+}
 
-	return no_of_bytes;
+/* Asks the scope how to turn the raw data of the current DATA:SOURCE into
+ * volts and seconds, taking DATA:START into account:
+ *   volts = vgain * data[i] + voffset
+ *   time  = hoffset + i * hinterval
+ * Note that the wfi file stores -voffset as its "vertical offset". */
+int tek_scope_get_scaling(VXI11_CLINK * clink, double *vgain, double *voffset,
+			  double *hinterval, double *hoffset)
+{
+	double xzero, yoff, yzero;	/* names used by scope, needs translating first */
+	long data_start;
+
+	yoff = tek_obtain_double_value(clink, "WFMPRE:YOFF?");
+	yzero = tek_obtain_double_value(clink, "WFMPRE:YZERO?");
+	*vgain = tek_obtain_double_value(clink, "WFMPRE:YMULT?");
+	*voffset = -(yoff * *vgain) + yzero;
+	*hinterval = tek_obtain_double_value(clink, "WFMPRE:XINCR?");
+	data_start = tek_obtain_long_value(clink, "DATA:START?");
+	xzero = tek_obtain_double_value(clink, "WFMPRE:XZERO?");
+	*hoffset = xzero + (((double)(data_start - 1)) * *hinterval);
+	return 0;
 }
 
 /* Wrapper for above fn; this one sets the DATA:SOURCE first */
@@ -175,7 +327,11 @@ long tek_scope_write_wfi_file(VXI11_CLINK * clink, char *wfiname, char *source,
 	 * otherwise leave alone */
 	tek_scope_channel_str(source);
 	/* set the source channel */
-	vxi11_send_printf(clink, "DATA:SOURCE %s", source);
+	if (tek_send_printf(clink, "DATA:SOURCE %s", source) == 0) {
+		tek_link_set_data_source(clink, source);
+	} else {
+		tek_link_set_data_source(clink, NULL);
+	}
 
 	return tek_scope_write_wfi_file(clink, wfiname, captured_by,
 					no_of_traces, timeout);
@@ -200,7 +356,7 @@ long tek_scope_write_wfi_file(VXI11_CLINK * clink, char *wfiname, char chan,
 long tek_scope_set_for_capture(VXI11_CLINK * clink, int clear_sweeps,
 			       unsigned long timeout)
 {
-	long value, no_bytes;
+	long no_bytes;
 	int is_TDS3000;
 
 	/* There is an extra command in the DPO/MSO4000 series scoped that is
@@ -224,14 +380,14 @@ long tek_scope_set_for_capture(VXI11_CLINK * clink, int clear_sweeps,
 	 * over and over again. (If it's a TDS3000, then we've already done
 	 * this anyway in the pratting around waiting for XINCR to update). */
 	} else if (clear_sweeps == 0) {
-		vxi11_send_printf(clink, "ACQUIRE:STATE 0");	//RJS removed the runsrop command and changed STATE 1 to STATE 0 to get segmented noclsw to work correctly. it was breaking repeated runs of clsw and noclsw
-		value = vxi11_obtain_long_value_timeout(clink, "*OPC?", timeout);	//hopefully this wont break anything else!
+		tek_send_printf(clink, "ACQUIRE:STATE 0");	//RJS removed the runsrop command and changed STATE 1 to STATE 0 to get segmented noclsw to work correctly. it was breaking repeated runs of clsw and noclsw
+		tek_obtain_long_value(clink, "*OPC?", timeout);	//hopefully this wont break anything else!
 	}
 
 	no_bytes = tek_scope_calculate_no_of_bytes(clink, is_TDS3000, timeout);
 
 	if (clear_sweeps == 1) {
-		vxi11_send_printf(clink, "ACQUIRE:STOPAFTER SEQUENCE");
+		tek_send_printf(clink, "ACQUIRE:STOPAFTER SEQUENCE");
 	}
 
 	return no_bytes;
@@ -248,6 +404,60 @@ long tek_scope_set_for_capture(VXI11_CLINK * clink, int clear_sweeps,
 	return tek_scope_set_for_capture(clink, clear_sweeps, timeout);
 }
 
+/* Puts back the *ESE and *SRE masks that tek_scope_start() changed */
+static void tek_scope_restore_masks(VXI11_CLINK * clink)
+{
+	TEK_LINK_STATE *s = tek_link_state(clink);
+
+	if (s && s->armed) {
+		s->armed = 0;
+		tek_send_printf(clink, "*ESE %d;*SRE %d", s->ese, s->sre);
+	}
+}
+
+/* Starts an acquisition with acq_cmd, asking for a service request when
+ * it's done (see tek_scope_arm()). The *ESE and *SRE masks are remembered
+ * first, unless they're already ours from an earlier arm that never got
+ * as far as tek_scope_poll() seeing it finish. */
+static int tek_scope_start(VXI11_CLINK * clink, const char *acq_cmd)
+{
+	TEK_LINK_STATE *s = tek_link_state(clink);
+	char buf[50];
+	int ret;
+
+	if (s && !s->armed) {
+		memset(buf, 0, 50);
+		if (tek_send_and_receive(clink, "*ESE?;*SRE?", buf, 49,
+					 VXI11_READ_TIMEOUT) == 0
+		    && sscanf(buf, "%d;%d", &s->ese, &s->sre) == 2) {
+			s->armed = 1;
+		}
+	}
+	ret = tek_send_printf(clink, "*CLS;*ESE 1;*SRE 32;:%s;*OPC", acq_cmd);
+	if (ret < 0) {
+		tek_scope_restore_masks(clink);
+	}
+	return ret;
+}
+
+/* Starts an acquisition with acq_cmd and polls until it has finished, so
+ * that the link isn't tied up in *OPC? meanwhile. */
+static int tek_scope_acquire_and_wait(VXI11_CLINK * clink,
+				      const char *acq_cmd,
+				      unsigned long timeout)
+{
+	if (tek_scope_start(clink, acq_cmd) < 0) {
+		printf("error, could not start an acquisition\n");
+		return -1;
+	}
+	if (tek_scope_wait_any(&clink, 1, timeout) != 0) {
+		tek_scope_restore_masks(clink);
+		printf("error, the acquisition didn't finish, maybe you\nneed a longer timeout?\n");
+		return -1;
+	}
+	return 0;
+}
+
 /* This function forces ACQ:XINC to be updated. It involves changing to RUNSTOP
  * mode, recording the current acquisition mode and no of averages, setting
  * the acquisition mode to sample temporarily, then switching back to whatever
@@ -256,7 +466,6 @@ long tek_scope_set_for_capture(VXI11_CLINK * clink, int clear_sweeps,
  * getting crap data. */
 void tek_scope_force_xincr_update(VXI11_CLINK * clink, unsigned long timeout)
 {
-	long value;
 	int acq_state;
 
 	/* We need to perform an acq:state 1 doing first, otherwise it could
@@ -273,8 +482,9 @@ void tek_scope_force_xincr_update(VXI11_CLINK * clink, unsigned long timeout)
 	 * returning it to averaging if applicable. Seems to work ok. */
 	acq_state = tek_scope_get_averages(clink);
 	tek_scope_set_averages(clink, 0);	/* set to no averaging (sample mode) */
-	vxi11_send_printf(clink, "ACQUIRE:STOPAFTER RUNSTOP;:ACQUIRE:STATE 1");
-	value = vxi11_obtain_long_value_timeout(clink, "*OPC?", timeout);
+	tek_scope_acquire_and_wait(clink,
+				   "ACQUIRE:STOPAFTER RUNSTOP;:ACQUIRE:STATE 1",
+				   timeout);
 	tek_scope_set_averages(clink, acq_state);
 }
 
@@ -298,23 +508,23 @@ long tek_scope_calculate_no_of_bytes(VXI11_CLINK * clink, int is_TDS3000,
 	long start, stop;
 	double xincr, hor_scale;
 
-	no_acq_points = vxi11_obtain_long_value(clink, "HOR:RECORD?");
-	hor_scale = vxi11_obtain_double_value(clink, "HOR:MAIN:SCALE?");
+	no_acq_points = tek_obtain_long_value(clink, "HOR:RECORD?");
+	hor_scale = tek_obtain_double_value(clink, "HOR:MAIN:SCALE?");
 
 	if (is_TDS3000 == 1) {
-		xincr = vxi11_obtain_double_value(clink, "WFMPRE:XINCR?");
+		xincr = tek_obtain_double_value(clink, "WFMPRE:XINCR?");
 		no_points = (long)round((10 * hor_scale) / xincr);
 	} else {
 		sample_rate =
-		    vxi11_obtain_double_value(clink, "HOR:MAIN:SAMPLERATE?");
+		    tek_obtain_double_value(clink, "HOR:MAIN:SAMPLERATE?");
 		no_points = (long)round(sample_rate * 10 * hor_scale);
 	}
 
 	start = ((no_acq_points - no_points) / 2) + 1;
 	stop = ((no_acq_points + no_points) / 2);
 	/* set number of points to receive to be equal to the record length */
-	vxi11_send_printf(clink, "DATA:START %ld", start);
-	vxi11_send_printf(clink, "DATA:STOP %ld", stop);
+	tek_send_printf(clink, "DATA:START %ld", start);
+	tek_send_printf(clink, "DATA:STOP %ld", stop);
 
 /*	printf("no_acq_points = %ld, xincr = %g, no_points = %ld\n",no_acq_points, xincr, no_points);
 	printf("start = %ld, stop = %ld\n",start, stop);
@@ -343,11 +553,20 @@ long tek_scope_get_data(VXI11_CLINK * clink, char chan, int clear_sweeps,
 				  timeout);
 }
 
-/* Grabs data from the scope */
+/* Grabs data from the scope. This is the bit that gets called over and over,
+ * so it does it in as few exchanges with the scope as it can: the
+ * DATA:SOURCE is only sent if it's different from last time (see
+ * tek_scope_forget_data_source), and goes in the same message as whatever
+ * follows it. With clear_sweeps that's
+ *   [DATA:SOURCE CH1;:]ACQUIRE:STATE 1;*OPC?   then   CURVE?
+ * i.e. two queries per trace rather than two commands and two queries;
+ * without, it's just [DATA:SOURCE CH1;:]CURVE? */
 long tek_scope_get_data(VXI11_CLINK * clink, char *source, int clear_sweeps,
 			char *buf, size_t len, unsigned long timeout)
 {
-	int ret;
+	TEK_LINK_STATE *s;
+	char cmd[64];
+	int ret, n;
 	long bytes_returned;
 	long opc_value;
 
@@ -355,40 +574,177 @@ long tek_scope_get_data(VXI11_CLINK * clink, char *source, int clear_sweeps,
 	 * otherwise leave alone */
 	tek_scope_channel_str(source);
 
-	/* set the source channel */
-	ret = vxi11_send_printf(clink, "DATA:SOURCE %s", source);
-	if (ret < 0) {
-		printf("error, could not send DATA SOURCE cmd, quitting...\n");
-		return ret;
+	/* set the source channel, if it needs setting. It's only remembered
+	 * once it's been sent, as sending it makes tek_send() forget it */
+	s = tek_link_state(clink);
+	if (s && strcmp(s->data_source, source) == 0) {
+		n = snprintf(cmd, sizeof(cmd), "%s",
+			     clear_sweeps == 1 ? "ACQUIRE:STATE 1;*OPC?" : "CURVE?");
+	} else {
+		n = snprintf(cmd, sizeof(cmd), "DATA:SOURCE %s;:%s", source,
+			     clear_sweeps == 1 ? "ACQUIRE:STATE 1;*OPC?" : "CURVE?");
+	}
+	if (n < 0 || (size_t)n >= sizeof(cmd)) {
+		printf("error: tek_scope_get_data: source '%s' is too long\n",
+		       source);
+		return -1;
 	}
 
 	/* Do we have to "clear sweeps" ie wait for averaging etc? */
 	if (clear_sweeps == 1) {
-		/* This is the equivalent of pressing the "Single Seq" button
-		 * on the front of the scope */
-		vxi11_send_printf(clink, "ACQUIRE:STATE 1");
-		/* This request will not return ANYTHING until the acquisition
-		 * is complete (OPC? = OPeration Complete?). It's up to the 
-		 * user to supply a long enough timeout. */
-		opc_value = vxi11_obtain_long_value_timeout(clink, "*OPC?", timeout);
+		/* ACQUIRE:STATE 1 is the equivalent of pressing the "Single
+		 * Seq" button on the front of the scope. *OPC? will not return
+		 * ANYTHING until the acquisition is complete (OPC? = OPeration
+		 * Complete?). It's up to the user to supply a long enough
+		 * timeout. */
+		opc_value = tek_obtain_long_value(clink, cmd, timeout);
 		if (opc_value != 1) {
 			printf
 			    ("OPC? request returned %ld, (should be 1), maybe you\nneed a longer timeout?\n",
 			     opc_value);
 			printf("Not grabbing any data, returning -1\n");
+			tek_link_set_data_source(clink, NULL);
 			return -1;
 		}
+		tek_link_set_data_source(clink, source);
+		snprintf(cmd, sizeof(cmd), "CURVE?");
+	}
+	/* ask for the data, and receive it; split between several links if
+	 * we've got them (see tek_parallel.h) */
+	if (tek_parallel_links(clink) > 1) {
+		bytes_returned = tek_parallel_curve(clink, source, buf, len,
+						    timeout);
+		if (bytes_returned < 0) {
+			tek_link_set_data_source(clink, NULL);
+		} else {
+			tek_link_set_data_source(clink, source);
+		}
+		return bytes_returned;
+	}
+	ret = tek_send(clink, cmd);
+	if (ret < 0) {
+		printf("error, could not send CURVE? cmd, quitting...\n");
+		tek_link_set_data_source(clink, NULL);
+		return ret;
+	}
+	tek_link_set_data_source(clink, source);
+	bytes_returned = tek_receive_data_block(clink, buf, len, timeout);
+	if (bytes_returned < 0) {
+		tek_link_set_data_source(clink, NULL);
 	}
-	/* ask for the data, and receive it */
-	vxi11_send_printf(clink, "CURVE?");
-	bytes_returned = vxi11_receive_data_block(clink, buf, len, timeout);
 
 	return bytes_returned;
 }
 
+/* Makes the next tek_scope_get_data() send the DATA:SOURCE again. The
+ * tek_send family call this for anything they send that could change it
+ * (see tek_cmd_changes_data_source()), so it's only needed if it's changed
+ * some other way: from the scope's front panel, by another program, or by
+ * going round the library with vxi11_* directly. */
+void tek_scope_forget_data_source(VXI11_CLINK * clink)
+{
+	tek_link_set_data_source(clink, NULL);
+}
+
+/* Waiting for an acquisition without tying up the link. Rather than sitting
+ * in *OPC? until the scope has finished (which, with a lot of averaging,
+ * can be seconds, during which nothing else can use the link, or the
+ * thread), tek_scope_arm() starts a single acquisition and returns
+ * straight away, having asked the scope to raise a service request (SRQ)
+ * when it's done:
+ *   *ESE 1   the "operation complete" bit sets ESB in the status byte
+ *   *SRE 32  ... and ESB requests service
+ *   *OPC     ... which happens when the acquisition has finished
+ * tek_scope_poll() then reads the status byte (*STB?, which the scope
+ * answers immediately) and returns 1 once the SRQ is there, 0 if not yet,
+ * or negative if there's a problem. Once it's seen the SRQ, the *ESE and
+ * *SRE masks go back to what they were before (for links from tek_open()
+ * only; it doesn't know what they were otherwise). In between, the link is free for
+ * anything else, e.g. arming or reading other channels or instruments.
+ * Once it's complete, read the data as normal without clear sweeps, i.e.
+ * tek_scope_get_data(clink, source, 0, ...).
+ *
+ * (We ask for the status byte, rather than waiting on the VXI11 interrupt
+ * channel, because the vxi11_user library doesn't give us one, and the
+ * socket server doesn't have one at all. Each poll is one short query.) */
+int tek_scope_arm(VXI11_CLINK * clink)
+{
+	int ret;
+
+	ret = tek_scope_start(clink, "ACQUIRE:STOPAFTER SEQUENCE;STATE 1");
+	if (ret < 0) {
+		printf("error, could not arm the scope\n");
+	}
+	return ret;
+}
+
+int tek_scope_poll(VXI11_CLINK * clink)
+{
+	char buf[50];
+	long stb;
+
+	memset(buf, 0, 50);
+	if (tek_send_and_receive(clink, "*STB?", buf, 49, VXI11_READ_TIMEOUT)
+	    != 0) {
+		return -1;
+	}
+	stb = strtol(buf, (char **)NULL, 10);
+	if (!(stb & 64)) {	/* MSS, i.e. service requested */
+		return 0;
+	}
+	tek_scope_restore_masks(clink);
+	return 1;
+}
+
+/* Waits for the first of several armed links (e.g. several scopes) to
+ * finish, polling each in turn, and returns its index, or -1 if none had
+ * finished within the timeout (ms). If a link stops answering, returns -2,
+ * with its index in *failed (if failed isn't NULL). NULL entries are
+ * skipped, so set a link to NULL once you've dealt with it, and call again
+ * for the rest. */
+int tek_scope_wait_any(VXI11_CLINK ** clinks, int no_links,
+		       unsigned long timeout, int *failed)
+{
+	double start = tek_time_us();
+	double delay_us = 200;
+	int i, ret;
+
+	for (;;) {
+		for (i = 0; i < no_links; i++) {
+			if (clinks[i] == NULL) {
+				continue;
+			}
+			ret = tek_scope_poll(clinks[i]);
+			if (ret > 0) {
+				return i;
+			}
+			if (ret < 0) {
+				if (failed) {
+					*failed = i;
+				}
+				return -2;
+			}
+		}
+		if (tek_time_us() - start > timeout * 1000.0) {
+			return -1;
+		}
+		/* don't hammer the scopes during a long acquisition */
+		tek_sleep_us(delay_us);
+		if (delay_us < 20000) {
+			delay_us *= 2;
+		}
+	}
+}
+
+int tek_scope_wait_any(VXI11_CLINK ** clinks, int no_links,
+		       unsigned long timeout)
+{
+	return tek_scope_wait_any(clinks, no_links, timeout, NULL);
+}
+
 void tek_scope_set_for_auto(VXI11_CLINK * clink)
 {
-	vxi11_send_printf(clink, "ACQ:STOPAFTER RUNSTOP;:ACQ:STATE 1");
+	tek_send_printf(clink, "ACQ:STOPAFTER RUNSTOP;:ACQ:STATE 1");
 }
 
 /* Sets the number of averages. If passes a number <= 1, will set the scope to
@@ -408,21 +764,21 @@ void tek_scope_set_for_auto(VXI11_CLINK * clink)
 int tek_scope_set_averages(VXI11_CLINK * clink, int no_averages)
 {
 	if (no_averages == 0) {
-		return vxi11_send_printf(clink, "ACQUIRE:MODE SAMPLE");
+		return tek_send_printf(clink, "ACQUIRE:MODE SAMPLE");
 	}
 	if (no_averages == 1) {
-		return vxi11_send_printf(clink, "ACQUIRE:MODE HIRES");
+		return tek_send_printf(clink, "ACQUIRE:MODE HIRES");
 	}
 	if (no_averages == -1) {
-		return vxi11_send_printf(clink, "ACQUIRE:MODE PEAKDETECT");
+		return tek_send_printf(clink, "ACQUIRE:MODE PEAKDETECT");
 	}
 	if (no_averages > 1) {
-		vxi11_send_printf(clink, "ACQUIRE:NUMAVG %d", no_averages);
-		return vxi11_send_printf(clink, "ACQUIRE:MODE AVERAGE");
+		tek_send_printf(clink, "ACQUIRE:NUMAVG %d", no_averages);
+		return tek_send_printf(clink, "ACQUIRE:MODE AVERAGE");
 	}
 	if (no_averages < -1) {
-		vxi11_send(clink, "ACQUIRE:NUMENV %d", -no_averages);
-		return vxi11_send_printf(clink, "ACQUIRE:MODE ENVELOPE");
+		tek_send_printf(clink, "ACQUIRE:NUMENV %d", -no_averages);
+		return tek_send_printf(clink, "ACQUIRE:MODE ENVELOPE");
 	}
 
 	return 1;
@@ -444,7 +800,7 @@ int tek_scope_get_averages(VXI11_CLINK * clink)
 {
 	char buf[256];
 	long result;
-	vxi11_send_and_receive(clink, "ACQUIRE:MODE?", buf, 256,
+	tek_send_and_receive(clink, "ACQUIRE:MODE?", buf, 256,
 			       VXI11_READ_TIMEOUT);
 	/* Peak detect mode, return -1 */
 	if (strncmp("PEA", buf, 3) == 0) {
@@ -460,12 +816,12 @@ int tek_scope_get_averages(VXI11_CLINK * clink)
 	}
 	/* Average mode */
 	if (strncmp("AVE", buf, 3) == 0) {
-		result = vxi11_obtain_long_value(clink, "ACQUIRE:NUMAVG?");
+		result = tek_obtain_long_value(clink, "ACQUIRE:NUMAVG?");
 		return (int)result;
 	}
 	/* Envelope mode */
 	if (strncmp("ENV", buf, 3) == 0) {
-		vxi11_send_and_receive(clink, "ACQUIRE:NUMENV?", buf, 256,
+		tek_send_and_receive(clink, "ACQUIRE:NUMENV?", buf, 256,
 				       VXI11_READ_TIMEOUT);
 		/* If you query ACQ:NUMENV? on a 4000 series, it returns "INFI".
 		 * This is not a documented feature, we just have to hope that 
@@ -488,22 +844,22 @@ int tek_scope_get_averages(VXI11_CLINK * clink)
 int tek_scope_set_segmented_averages(VXI11_CLINK * clink, int no_averages)
 {
 	int max_segments;
-	long opc_value;
 
 	/* See tek_scope_set_segmented() below for explanation of steps here */
-	vxi11_send_printf(clink, "HOR:FASTFRAME:STATE 0");
-	opc_value = vxi11_obtain_long_value(clink, "*OPC?");
+	tek_send_printf(clink, "HOR:FASTFRAME:STATE 0");
+	tek_obtain_long_value(clink, "*OPC?");
 	//usleep(400000);
-	vxi11_send_printf(clink, "ACQUIRE:STOPAFTER SEQUENCE;:ACQUIRE:STATE 1");
-	opc_value = vxi11_obtain_long_value(clink, "*OPC?");
+	tek_scope_acquire_and_wait(clink,
+				   "ACQUIRE:STOPAFTER SEQUENCE;:ACQUIRE:STATE 1",
+				   VXI11_READ_TIMEOUT);
 	//usleep(400000);
 	max_segments =
-	    (int)vxi11_obtain_long_value(clink,
+	    (int)tek_obtain_long_value(clink,
 					 "HOR:FASTFRAME:STATE 1;:HOR:FASTFRAME:MAXFRAMES?");
 	if (no_averages >= max_segments) {
 		no_averages = max_segments - 1;
 	}
-	vxi11_send_printf(clink, "HOR:FASTFRAME:SUMFRAME AVERAGE;:HOR:FASTFRAME:COUNT %d;:DATA:FRAMESTART %d;:DATA:FRAMESTOP %d",
+	tek_send_printf(clink, "HOR:FASTFRAME:SUMFRAME AVERAGE;:HOR:FASTFRAME:COUNT %d;:DATA:FRAMESTART %d;:DATA:FRAMESTOP %d",
 		       (no_averages + 1), (no_averages + 1), (no_averages + 1));
 #ifdef WIN32
 	Sleep(400);
@@ -516,7 +872,6 @@ int tek_scope_set_segmented_averages(VXI11_CLINK * clink, int no_averages)
 int tek_scope_set_segmented(VXI11_CLINK * clink, int no_segments)
 {
 	int max_segments;
-	long opc_value;
 
 	/* Setting the scope into fastframe (segmented) mode involves getting
 	 * around a few foibles. In order to guarantee that when we ask for the
@@ -530,27 +885,28 @@ int tek_scope_set_segmented(VXI11_CLINK * clink, int no_segments)
 	 * Failure to do (1-2) or (5) will result in incomplete acquisition,
 	 * following a transition from RUNSTOP mode to Fastframe mode. */
 
-	vxi11_send_printf(clink, "HOR:FASTFRAME:STATE 0");
-	opc_value = vxi11_obtain_long_value(clink, "*OPC?");
+	tek_send_printf(clink, "HOR:FASTFRAME:STATE 0");
+	tek_obtain_long_value(clink, "*OPC?");
 #ifdef WIN32
 	Sleep(1000);
 #else
 	usleep(1000000);
 #endif
-	vxi11_send_printf(clink, "ACQUIRE:STOPAFTER SEQUENCE;:ACQUIRE:STATE 1");
-	opc_value = vxi11_obtain_long_value(clink, "*OPC?");
+	tek_scope_acquire_and_wait(clink,
+				   "ACQUIRE:STOPAFTER SEQUENCE;:ACQUIRE:STATE 1",
+				   VXI11_READ_TIMEOUT);
 #ifdef WIN32
 	Sleep(1000);
 #else
 	usleep(1000000);
 #endif
 	max_segments =
-	    (int)vxi11_obtain_long_value(clink,
+	    (int)tek_obtain_long_value(clink,
 					 "HOR:FASTFRAME:STATE 1;:HOR:FASTFRAME:MAXFRAMES?");
 	if (no_segments >= max_segments) {
 		no_segments = max_segments;
 	}
-	vxi11_send_printf(clink,
+	tek_send_printf(clink,
 		"HOR:FASTFRAME:SUMFRAME NONE;:HOR:FASTFRAME:COUNT %d;:DATA:FRAMESTART 1;:DATA:FRAMESTOP %d",
 		no_segments, no_segments);
 #ifdef WIN32
@@ -567,8 +923,8 @@ long tek_scope_get_no_points(VXI11_CLINK * clink)
 {
 	long start, stop, no_points;
 
-	start = vxi11_obtain_long_value(clink, "DATA:START?");
-	stop = vxi11_obtain_long_value(clink, "DATA:STOP?");
+	start = tek_obtain_long_value(clink, "DATA:START?");
+	stop = tek_obtain_long_value(clink, "DATA:STOP?");
 	no_points = (stop - start) + 1;
 	return no_points;
 }
@@ -586,12 +942,13 @@ long tek_scope_get_no_points(VXI11_CLINK * clink)
  * - DPO/MSO4000 series: 1000, 10,000, 100,000, 1,000,000 or 10,000,000
  * This function requests whatever number of points it is passed. It then
  * asks the scope what the record length actually is, and returns this 
- * value. */
+ * value. To work out which one you need for a given sample rate (and how
+ * much of it to get back), see tek_plan.h. */
 long tek_scope_set_record_length(VXI11_CLINK * clink, long record_length)
 {
-	vxi11_send_printf(clink, "HOR:RECORDLENGTH %ld", record_length);
+	tek_send_printf(clink, "HOR:RECORDLENGTH %ld", record_length);
 
-	return vxi11_obtain_long_value(clink, "HOR:RECORDLENGTH?");
+	return tek_obtain_long_value(clink, "HOR:RECORDLENGTH?");
 }
 
 /* Returns the sample rate, based on 1/XINCR */
@@ -600,11 +957,11 @@ double tek_scope_get_sample_rate(VXI11_CLINK * clink)
 	double xincr, s_rate;
 
 	if (tek_scope_is_TDS3000(clink) == 1) {
-		xincr = vxi11_obtain_double_value(clink, "WFMPRE:XINCR?");
+		xincr = tek_obtain_double_value(clink, "WFMPRE:XINCR?");
 		s_rate = 1 / xincr;
 	} else {
 		s_rate =
-		    vxi11_obtain_double_value(clink, "HOR:MAIN:SAMPLERATE?");
+		    tek_obtain_double_value(clink, "HOR:MAIN:SAMPLERATE?");
 	}
 
 	return s_rate;
@@ -616,7 +973,7 @@ int tek_scope_is_TDS3000(VXI11_CLINK * clink)
 {
 	char buf[256];
 
-	vxi11_send_and_receive(clink, "*IDN?", buf, 256, VXI11_READ_TIMEOUT);
+	tek_send_and_receive(clink, "*IDN?", buf, 256, VXI11_READ_TIMEOUT);
 
 	if (strncmp("TDS 3", buf + 10, 5) == 0) {
 		return 1;
@@ -639,23 +996,31 @@ int tek_scope_is_TDS3000(VXI11_CLINK * clink)
  * unfairly) that the native format on the PC we are running this library is
  * little-endian, so we swap the bytes before sending the data. If the data
  * is already in big-endian format, then just call the function
- * tek_afg_swap_bytes() before calling this (a little inefficient I know). */
+ * tek_afg_swap_bytes() before calling this (a little inefficient I know).
+ * The memories written to are noted in tek_arb_cache.h's registry. */
 int tek_afg_send_arb(VXI11_CLINK * clink, char *buf, size_t len,
 		     int chan)
 {
+	uint64_t hash = tek_arb_hash(buf, len);
 	int ret;
 
 	tek_afg_swap_bytes(buf, len);	/* Swap bytes, little endian -> big endian */
 	ret =
-	    vxi11_send_data_block(clink, ":TRACE:DATA EMEMORY,", buf, len);
+	    tek_send_data_block(clink, ":TRACE:DATA EMEMORY,", buf, len);
 	if (ret < 0) {
 		printf("tek_afg_send_arb: error sending waveform data...\n");
+		tek_arb_cache_note(clink, 0, 0, chan);
 		return ret;
 	}
 	if (chan > 0 && chan < 5) {
-		return vxi11_send_printf(clink, "TRACE:COPY USER%d,EMEM", chan);
+		ret = tek_send_printf(clink, "TRACE:COPY USER%d,EMEM", chan);
 	}
-	return 0;
+	if (ret < 0) {
+		tek_arb_cache_note(clink, 0, 0, chan);
+	} else {
+		tek_arb_cache_note(clink, hash, len, chan);
+	}
+	return ret;
 }
 
 /* Wrapper fn for above, just uploads to edit memory, doesn't transfer to user
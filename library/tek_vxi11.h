@@ -56,6 +56,14 @@ tk_EXPORT long tek_scope_write_wfi_file(VXI11_CLINK * clink, char *wfiname,
 tk_EXPORT long tek_scope_write_wfi_file(VXI11_CLINK * clink, char *wfiname, char chan,
 					char *captured_by, int no_of_traces,
 					unsigned long timeout);
+tk_EXPORT int tek_write_wfi_file(char *wfiname, char *captured_by,
+				 long no_of_bytes, double vgain,
+				 double voffset, double hinterval,
+				 double hoffset, int no_of_traces,
+				 int bytes_per_point);
+tk_EXPORT int tek_scope_get_scaling(VXI11_CLINK * clink, double *vgain,
+				    double *voffset, double *hinterval,
+				    double *hoffset);
 tk_EXPORT long tek_scope_set_for_capture(VXI11_CLINK * clink, int clear_sweeps,
 					 unsigned long timeout);
 tk_EXPORT long tek_scope_set_for_capture(VXI11_CLINK * clink, int clear_sweeps,
@@ -73,6 +81,13 @@ tk_EXPORT long tek_scope_get_data(VXI11_CLINK * clink, char chan, int clear_swee
 tk_EXPORT long tek_scope_get_data(VXI11_CLINK * clink, char *source, int clear_sweeps,
 				  char *buf, size_t len,
 				  unsigned long timeout);
+tk_EXPORT void tek_scope_forget_data_source(VXI11_CLINK * clink);
+tk_EXPORT int tek_scope_arm(VXI11_CLINK * clink);
+tk_EXPORT int tek_scope_poll(VXI11_CLINK * clink);
+tk_EXPORT int tek_scope_wait_any(VXI11_CLINK ** clinks, int no_links,
+				 unsigned long timeout, int *failed);
+tk_EXPORT int tek_scope_wait_any(VXI11_CLINK ** clinks, int no_links,
+				 unsigned long timeout);
 tk_EXPORT void tek_scope_set_for_auto(VXI11_CLINK * clink);
 tk_EXPORT int tek_scope_set_averages(VXI11_CLINK * clink, int no_averages);
 tk_EXPORT int tek_scope_get_averages(VXI11_CLINK * clink);
@@ -0,0 +1,299 @@
+/* tek_wf.cc
+ * Memory-mapped reading of .wf/.wfi files. See tek_wf.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "tek_wf.h"
+
+#define TEK_WF_MAX_VALUES	16
+#ifndef PATH_MAX
+#define PATH_MAX	4096
+#endif
+
+/* The .wfi file is just numbers, one to a line, with Matlab comments (%)
+ * in between; this gets the numbers, like Matlab's load() does */
+static int tek_wf_read_wfi(const char *wfiname, double *values)
+{
+	FILE *f;
+	char line[256], *p, *end;
+	int n = 0;
+	double x;
+
+	f = fopen(wfiname, "r");
+	if (f == NULL) {
+		printf("Error: tek_wf_open: could not open %s\n", wfiname);
+		return -1;
+	}
+	while (n < TEK_WF_MAX_VALUES && fgets(line, sizeof(line), f)) {
+		p = line;
+		while (n < TEK_WF_MAX_VALUES) {
+			while (*p == ' ' || *p == '\t') {
+				p++;
+			}
+			if (*p == '%' || *p == '\0' || *p == '\n' || *p == '\r') {
+				break;
+			}
+			x = strtod(p, &end);
+			if (end == p) {
+				break;
+			}
+			values[n++] = x;
+			p = end;
+		}
+	}
+	fclose(f);
+	return n;
+}
+
+static int tek_wf_map(TEK_WF * wf, const char *wfname)
+{
+#ifdef WIN32
+	LARGE_INTEGER size;
+
+	wf->file = CreateFileA(wfname, GENERIC_READ, FILE_SHARE_READ, NULL,
+			       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (wf->file == INVALID_HANDLE_VALUE) {
+		wf->file = NULL;
+		return -1;
+	}
+	GetFileSizeEx(wf->file, &size);
+	wf->size = (size_t) size.QuadPart;
+	if (wf->size == 0) {
+		return 0;
+	}
+	wf->mapping = CreateFileMappingA(wf->file, NULL, PAGE_READONLY, 0, 0,
+					 NULL);
+	if (wf->mapping == NULL) {
+		return -1;
+	}
+	wf->data = (const char *)MapViewOfFile(wf->mapping, FILE_MAP_READ, 0,
+					       0, 0);
+	return wf->data ? 0 : -1;
+#else
+	struct stat st;
+	void *p;
+	int fd;
+
+	fd = open(wfname, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+	wf->size = (size_t) st.st_size;
+	if (wf->size == 0) {
+		close(fd);
+		return 0;
+	}
+	/* the mapping stays good after the file is closed */
+	p = mmap(NULL, wf->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return -1;
+	}
+	wf->data = (const char *)p;
+	return 0;
+#endif
+}
+
+int tek_wf_open(TEK_WF * wf, const char *name)
+{
+	char wfname[PATH_MAX], wfiname[PATH_MAX];
+	double c[TEK_WF_MAX_VALUES];
+	int n, keep_all;
+	size_t len;
+
+	memset(wf, 0, sizeof(TEK_WF));
+	len = strlen(name);
+	if (len > 3 && strcmp(name + len - 3, ".wf") == 0) {
+		len -= 3;
+	}
+	n = snprintf(wfiname, sizeof(wfiname), "%.*s.wfi", (int)len, name);
+	if (n < 0 || (size_t)n >= sizeof(wfiname)) {
+		printf("Error: tek_wf_open: %s is too long a name\n", name);
+		return -1;
+	}
+	snprintf(wfname, sizeof(wfname), "%.*s.wf", (int)len, name);
+
+	/* The same rules as loadwf.m */
+	n = tek_wf_read_wfi(wfiname, c);
+	if (n < 0) {
+		return -1;
+	}
+	if (n < 5) {
+		printf("Error: tek_wf_open: %s has only %d values in it\n",
+		       wfiname, n);
+		return -2;
+	}
+	wf->no_bytes = (long)c[0];
+	wf->vgain = c[1];
+	wf->voffset = c[2];
+	wf->hinterval = c[3];
+	wf->hoffset = c[4];
+	wf->no_traces = (n == 5) ? 1 : (long)c[5];
+	wf->bytes_per_point = (n < 7) ? 1 : (int)c[6];
+	keep_all = (n > 7 && c[7] == 1);
+	if (wf->bytes_per_point != 1 && wf->bytes_per_point != 2
+	    && wf->bytes_per_point != 4) {
+		printf("Error: tek_wf_open: can't read %d bytes per point\n",
+		       wf->bytes_per_point);
+		return -2;
+	}
+	wf->no_points = (wf->no_bytes - (keep_all ? 0 : 2 * wf->bytes_per_point))
+	    / wf->bytes_per_point;
+	if (wf->no_bytes <= 0 || wf->no_points < 0) {
+		printf("Error: tek_wf_open: %s says %ld bytes per trace\n",
+		       wfiname, wf->no_bytes);
+		return -2;
+	}
+
+	if (tek_wf_map(wf, wfname) != 0) {
+		printf("Error: tek_wf_open: could not map %s\n", wfname);
+		tek_wf_close(wf);
+		return -3;
+	}
+	if ((size_t)wf->no_traces * wf->no_bytes > wf->size) {
+		printf("Warning: tek_wf_open: %s only has %ld of its %ld traces\n",
+		       wfname, (long)(wf->size / wf->no_bytes), wf->no_traces);
+		wf->no_traces = (long)(wf->size / wf->no_bytes);
+	}
+	return 0;
+}
+
+void tek_wf_close(TEK_WF * wf)
+{
+#ifdef WIN32
+	if (wf->data) {
+		UnmapViewOfFile(wf->data);
+	}
+	if (wf->mapping) {
+		CloseHandle(wf->mapping);
+	}
+	if (wf->file) {
+		CloseHandle(wf->file);
+	}
+	wf->file = wf->mapping = NULL;
+#else
+	if (wf->data) {
+		munmap((void *)wf->data, wf->size);
+	}
+#endif
+	wf->data = NULL;
+	wf->size = 0;
+	wf->no_traces = 0;
+}
+
+static const char *tek_wf_trace(const TEK_WF * wf, long trace)
+{
+	if (trace < 0 || trace >= wf->no_traces) {
+		return NULL;
+	}
+	return wf->data + (size_t)trace * wf->no_bytes;
+}
+
+const int16_t *tek_wf_trace16(const TEK_WF * wf, long trace)
+{
+	if (wf->bytes_per_point != 2) {
+		return NULL;
+	}
+	return (const int16_t *)tek_wf_trace(wf, trace);
+}
+
+const int8_t *tek_wf_trace8(const TEK_WF * wf, long trace)
+{
+	if (wf->bytes_per_point != 1) {
+		return NULL;
+	}
+	return (const int8_t *)tek_wf_trace(wf, trace);
+}
+
+const int32_t *tek_wf_trace32(const TEK_WF * wf, long trace)
+{
+	if (wf->bytes_per_point != 4) {
+		return NULL;
+	}
+	return (const int32_t *)tek_wf_trace(wf, trace);
+}
+
+int tek_wf_raw(const TEK_WF * wf, long trace, long point)
+{
+	const char *p = tek_wf_trace(wf, trace);
+
+	if (p == NULL || point < 0 || point >= wf->no_points) {
+		return 0;
+	}
+	if (wf->bytes_per_point == 1) {
+		return ((const int8_t *)p)[point];
+	}
+	if (wf->bytes_per_point == 4) {
+		return ((const int32_t *)p)[point];
+	}
+	return ((const int16_t *)p)[point];
+}
+
+double tek_wf_volts(const TEK_WF * wf, long trace, long point)
+{
+	return wf->vgain * tek_wf_raw(wf, trace, point) - wf->voffset;
+}
+
+long tek_wf_trace_volts(const TEK_WF * wf, long trace, double *volts)
+{
+	const char *p = tek_wf_trace(wf, trace);
+	long i;
+
+	if (p == NULL) {
+		return -1;
+	}
+	if (wf->bytes_per_point == 1) {
+		for (i = 0; i < wf->no_points; i++) {
+			volts[i] = wf->vgain * ((const int8_t *)p)[i]
+			    - wf->voffset;
+		}
+	} else if (wf->bytes_per_point == 4) {
+		for (i = 0; i < wf->no_points; i++) {
+			volts[i] = wf->vgain * ((const int32_t *)p)[i]
+			    - wf->voffset;
+		}
+	} else {
+		for (i = 0; i < wf->no_points; i++) {
+			volts[i] = wf->vgain * ((const int16_t *)p)[i]
+			    - wf->voffset;
+		}
+	}
+	return wf->no_points;
+}
+
+double tek_wf_time(const TEK_WF * wf, long point)
+{
+	return wf->hoffset + point * wf->hinterval;
+}
@@ -0,0 +1,87 @@
+/* tek_wf.h
+ * Reading .wf/.wfi files (as written by tgetwf, and getwf before it) from
+ * C or C++. The .wf file is memory-mapped rather than read in, so opening
+ * even a file of several gigabytes is instant, and only the traces you
+ * actually look at are ever read off the disk. Each trace is available as
+ * a pointer straight into the mapping (raw data, no copying), or as volts
+ * on demand.
+ *
+ * The same older variants of the .wfi file as matlab/loadwf.m are
+ * understood:
+ *  - fewer than 7 values: 8 bit data (1 byte per point)
+ *  - only 5 values: just one trace
+ *  - no 8th value (or 0): the last two points of each trace are junk and
+ *    are left off (old LeCroy scopes)
+ * as well as 4 bytes per point (32 bit, from tgetwf -dec -dec_32; see
+ * tek_decimate.h).
+ * As in loadwf.m, volts = vgain * raw - voffset, where voffset is the
+ * "vertical offset" in the .wfi file, and the time of point i is
+ * hoffset + i * hinterval.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_WF_H_
+#define _TEK_WF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tek_vxi11.h"
+
+typedef struct {
+	/* From the .wfi file */
+	long no_bytes;		/* per trace, in the .wf file */
+	double vgain, voffset;
+	double hinterval, hoffset;
+	long no_traces;		/* may be fewer than the .wfi says, if the
+				 * .wf file was cut short */
+	int bytes_per_point;	/* 1, 2 or 4 */
+	long no_points;		/* per trace, that are worth having */
+
+	/* The mapping */
+	const char *data;
+	size_t size;
+#ifdef WIN32
+	void *file, *mapping;
+#endif
+} TEK_WF;
+
+/* Opens name.wf and name.wfi (name may have ".wf" on the end or not).
+ * Returns 0, or negative if either can't be read. */
+tk_EXPORT int tek_wf_open(TEK_WF * wf, const char *name);
+tk_EXPORT void tek_wf_close(TEK_WF * wf);
+
+/* The raw data of a trace (from 0), no_points long, or NULL if there's no
+ * such trace; use the one that matches bytes_per_point */
+tk_EXPORT const int16_t *tek_wf_trace16(const TEK_WF * wf, long trace);
+tk_EXPORT const int8_t *tek_wf_trace8(const TEK_WF * wf, long trace);
+tk_EXPORT const int32_t *tek_wf_trace32(const TEK_WF * wf, long trace);
+
+/* One point, raw or in volts, whatever bytes_per_point is */
+tk_EXPORT int tek_wf_raw(const TEK_WF * wf, long trace, long point);
+tk_EXPORT double tek_wf_volts(const TEK_WF * wf, long trace, long point);
+
+/* A whole trace in volts, into volts[no_points]. Returns no_points, or
+ * negative if there's no such trace. */
+tk_EXPORT long tek_wf_trace_volts(const TEK_WF * wf, long trace,
+				  double *volts);
+
+/* Time of a point, relative to the trigger */
+tk_EXPORT double tek_wf_time(const TEK_WF * wf, long point);
+
+#endif
@@ -0,0 +1,443 @@
+/* tek_xcorr.cc
+ * Cross-correlation against a reference pulse. See tek_xcorr.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "tek_xcorr.h"
+#include "tek_jobs.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* The correlation is circular, over size points (a power of two, at least
+ * the trace length), which is enough for none of the lags we look at to
+ * wrap round. The spectra are of real data, so a size point transform is
+ * done as a half size complex one, and only half of each spectrum (plus
+ * one) is kept. Complex numbers are pairs of floats: 16 bit data doesn't
+ * need doubles, and twice as many floats fit in the cache. */
+
+struct tek_xcorr {
+	long trace_len, ref_len;
+	long size, half;
+	float *tw;		/* by stage, see tek_xcorr_fft() */
+	float *rtw;		/* exp(-2 pi i k / size), k = 0..half */
+	float *ref_spec;	/* conj(reference spectrum) / half, 0..half */
+	double ref_energy;	/* sum of (reference - its mean)^2 */
+	double hinterval;
+	long lag_min, lag_max;
+	int either_sign;
+};
+
+/* In-place complex FFT of n (a power of two) points. The twiddles for the
+ * stage that combines pairs of length len are exp(-2 pi i j / (2 len)),
+ * j = 0..len-1, and are at tw[2 * (len - 1)], so each stage reads its own
+ * in order. inverse gives the unscaled inverse transform. */
+static void tek_xcorr_fft(float *a, long n, const float *tw, int inverse)
+{
+	long i, j, k, len;
+	float s = inverse ? -1.0f : 1.0f;
+	float ur, ui, vr, vi, wr, wi, t;
+
+	/* bit reversed order */
+	for (i = 1, j = 0; i < n; i++) {
+		k = n >> 1;
+		while (j & k) {
+			j ^= k;
+			k >>= 1;
+		}
+		j |= k;
+		if (i < j) {
+			t = a[2 * i];
+			a[2 * i] = a[2 * j];
+			a[2 * j] = t;
+			t = a[2 * i + 1];
+			a[2 * i + 1] = a[2 * j + 1];
+			a[2 * j + 1] = t;
+		}
+	}
+
+	for (len = 1; len < n; len <<= 1) {
+		const float *w = tw + 2 * (len - 1);
+
+		for (i = 0; i < n; i += 2 * len) {
+			float *p = a + 2 * i, *q = a + 2 * (i + len);
+
+			for (j = 0; j < len; j++) {
+				wr = w[2 * j];
+				wi = s * w[2 * j + 1];
+				ur = p[2 * j];
+				ui = p[2 * j + 1];
+				vr = q[2 * j] * wr - q[2 * j + 1] * wi;
+				vi = q[2 * j] * wi + q[2 * j + 1] * wr;
+				p[2 * j] = ur + vr;
+				p[2 * j + 1] = ui + vi;
+				q[2 * j] = ur - vr;
+				q[2 * j + 1] = ui - vi;
+			}
+		}
+	}
+}
+
+/* a holds size real values (as half complex ones); spec gets bins 0..half
+ * of their spectrum, times conj_ref (if not NULL) */
+static void tek_xcorr_forward(const TEK_XCORR * x, float *a, float *spec,
+			      const float *conj_ref)
+{
+	long k, k1, k2, h = x->half;
+	float zr, zi, cr, ci, er, ei, or_, oi, wr, wi, xr, xi;
+
+	tek_xcorr_fft(a, h, x->tw, 0);
+	for (k = 0; k <= h; k++) {
+		/* the half size spectrum repeats: bin h is bin 0 */
+		k1 = (k == h) ? 0 : k;
+		k2 = (k == 0) ? 0 : h - k;
+		zr = a[2 * k1];
+		zi = a[2 * k1 + 1];
+		cr = a[2 * k2];
+		ci = -a[2 * k2 + 1];
+		/* even and odd samples' spectra */
+		er = 0.5f * (zr + cr);
+		ei = 0.5f * (zi + ci);
+		or_ = 0.5f * (zi - ci);
+		oi = -0.5f * (zr - cr);
+		wr = x->rtw[2 * k];
+		wi = x->rtw[2 * k + 1];
+		xr = er + wr * or_ - wi * oi;
+		xi = ei + wr * oi + wi * or_;
+		if (conj_ref) {
+			spec[2 * k] = xr * conj_ref[2 * k] - xi * conj_ref[2 * k + 1];
+			spec[2 * k + 1] = xr * conj_ref[2 * k + 1]
+			    + xi * conj_ref[2 * k];
+		} else {
+			spec[2 * k] = xr;
+			spec[2 * k + 1] = xi;
+		}
+	}
+}
+
+/* The other way: a gets size real values (times half) from spec */
+static void tek_xcorr_inverse(const TEK_XCORR * x, const float *spec,
+			      float *a)
+{
+	long k, h = x->half;
+	float yr, yi, cr, ci, er, ei, dr, di, wr, wi, or_, oi;
+
+	for (k = 0; k < h; k++) {
+		yr = spec[2 * k];
+		yi = spec[2 * k + 1];
+		cr = spec[2 * (h - k)];
+		ci = -spec[2 * (h - k) + 1];
+		er = 0.5f * (yr + cr);
+		ei = 0.5f * (yi + ci);
+		dr = 0.5f * (yr - cr);
+		di = 0.5f * (yi - ci);
+		/* times conj(rtw) */
+		wr = x->rtw[2 * k];
+		wi = -x->rtw[2 * k + 1];
+		or_ = dr * wr - di * wi;
+		oi = dr * wi + di * wr;
+		/* even + i odd */
+		a[2 * k] = er - oi;
+		a[2 * k + 1] = ei + or_;
+	}
+	tek_xcorr_fft(a, h, x->tw, 1);
+}
+
+TEK_XCORR *tek_xcorr_new(const double *ref, long ref_len, long trace_len,
+			 double hinterval)
+{
+	TEK_XCORR *x;
+	double mean = 0, d;
+	float *a;
+	long i, len;
+
+	if (ref_len < 1 || ref_len > trace_len) {
+		printf("tek_xcorr: the reference (%ld points) must be no longer than the traces (%ld)\n",
+		       ref_len, trace_len);
+		return NULL;
+	}
+	x = (TEK_XCORR *) calloc(1, sizeof(TEK_XCORR));
+	if (!x) {
+		return NULL;
+	}
+	x->trace_len = trace_len;
+	x->ref_len = ref_len;
+	x->hinterval = hinterval;
+	x->size = 4;
+	while (x->size < trace_len) {
+		x->size <<= 1;
+	}
+	x->half = x->size / 2;
+	x->tw = new float[2 * x->half];
+	x->rtw = new float[2 * (x->half + 1)];
+	x->ref_spec = new float[2 * (x->half + 1)];
+	for (len = 1; len < x->half; len <<= 1) {
+		for (i = 0; i < len; i++) {
+			x->tw[2 * (len - 1 + i)] = (float)cos(M_PI * i / len);
+			x->tw[2 * (len - 1 + i) + 1] = (float)-sin(M_PI * i / len);
+		}
+	}
+	for (i = 0; i <= x->half; i++) {
+		x->rtw[2 * i] = (float)cos(2 * M_PI * i / x->size);
+		x->rtw[2 * i + 1] = (float)-sin(2 * M_PI * i / x->size);
+	}
+
+	for (i = 0; i < ref_len; i++) {
+		mean += ref[i];
+	}
+	mean /= ref_len;
+	a = new float[x->size];
+	memset(a, 0, x->size * sizeof(float));
+	for (i = 0; i < ref_len; i++) {
+		d = ref[i] - mean;
+		a[i] = (float)d;
+		x->ref_energy += d * d;
+	}
+	if (x->ref_energy == 0) {
+		printf("tek_xcorr: the reference is flat\n");
+		delete[]a;
+		tek_xcorr_free(x);
+		return NULL;
+	}
+	tek_xcorr_forward(x, a, x->ref_spec, NULL);
+	delete[]a;
+	/* conjugate, and fold in the inverse transform's 1/half */
+	for (i = 0; i <= x->half; i++) {
+		x->ref_spec[2 * i] /= x->half;
+		x->ref_spec[2 * i + 1] /= -x->half;
+	}
+	tek_xcorr_search(x, 0, 0, 0);
+	return x;
+}
+
+void tek_xcorr_free(TEK_XCORR * x)
+{
+	if (x) {
+		delete[]x->tw;
+		delete[]x->rtw;
+		delete[]x->ref_spec;
+		free(x);
+	}
+}
+
+void tek_xcorr_search(TEK_XCORR * x, double t_min, double t_max,
+		      int either_sign)
+{
+	long last = x->trace_len - x->ref_len;
+
+	x->either_sign = either_sign;
+	x->lag_min = 0;
+	x->lag_max = last;
+	if (t_max > t_min && x->hinterval > 0) {
+		if (t_min > 0) {
+			x->lag_min = (long)ceil(t_min / x->hinterval);
+		}
+		if (t_max / x->hinterval < last) {
+			x->lag_max = (long)floor(t_max / x->hinterval);
+		}
+		if (x->lag_min > last) {
+			x->lag_min = last;
+		}
+		if (x->lag_max < x->lag_min) {
+			x->lag_max = x->lag_min;
+		}
+	}
+}
+
+/* The trace into a (zero padded, less its mean), and its mean */
+static double tek_xcorr_load(const TEK_XCORR * x, const char *data,
+			     int bytes_per_point, float *a)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	long i, n = x->trace_len;
+	long long sum = 0;
+	float mean;
+
+	if (bytes_per_point == 1) {
+		for (i = 0; i < n; i++) {
+			a[i] = (signed char)p[i];
+			sum += (signed char)p[i];
+		}
+	} else if (bytes_per_point == 4) {
+		for (i = 0; i < n; i++) {
+			a[i] = (float)((const int32_t *)data)[i];
+			sum += ((const int32_t *)data)[i];
+		}
+	} else {
+		for (i = 0; i < n; i++) {
+			a[i] = (short)(p[2 * i] | (p[2 * i + 1] << 8));
+			sum += (short)(p[2 * i] | (p[2 * i + 1] << 8));
+		}
+	}
+	mean = (float)((double)sum / n);
+	for (i = 0; i < n; i++) {
+		a[i] -= mean;
+	}
+	memset(a + n, 0, (x->size - n) * sizeof(float));
+	return (double)sum / n;
+}
+
+/* Sum of (sample - mean)^2 over the points under the reference at lag */
+static double tek_xcorr_energy(const TEK_XCORR * x, const char *data,
+			       int bytes_per_point, double mean, long lag)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	double e = 0, d;
+	long i;
+
+	for (i = lag; i < lag + x->ref_len; i++) {
+		if (bytes_per_point == 1) {
+			d = (signed char)p[i] - mean;
+		} else if (bytes_per_point == 4) {
+			d = ((const int32_t *)data)[i] - mean;
+		} else {
+			d = (short)(p[2 * i] | (p[2 * i + 1] << 8)) - mean;
+		}
+		e += d * d;
+	}
+	return e;
+}
+
+/* a and spec are workspace, size and 2 * (half + 1) floats */
+static void tek_xcorr_one(const TEK_XCORR * x, const char *data,
+			  int bytes_per_point, float *a, float *spec,
+			  TEK_XCORR_RESULT * r)
+{
+	long k, best, last = x->trace_len - x->ref_len;
+	double mean, y0, y1, y2, den, p = 0, height, e;
+	float v, best_v;
+
+	mean = tek_xcorr_load(x, data, bytes_per_point, a);
+	tek_xcorr_forward(x, a, spec, x->ref_spec);
+	tek_xcorr_inverse(x, spec, a);
+
+	best = x->lag_min;
+	best_v = 0;
+	for (k = x->lag_min; k <= x->lag_max; k++) {
+		v = x->either_sign ? fabsf(a[k]) : a[k];
+		if (v > best_v) {
+			best_v = v;
+			best = k;
+		}
+	}
+	if (best_v == 0) {
+		r->lag = r->delay = NAN;
+		r->peak = 0;
+		return;
+	}
+
+	/* the neighbours may be outside the search, as long as they're lags
+	 * where the reference fits */
+	y1 = a[best];
+	height = y1;
+	if (best > 0 && best < last) {
+		y0 = a[best - 1];
+		y2 = a[best + 1];
+		den = y0 - 2 * y1 + y2;
+		if (den != 0) {
+			p = 0.5 * (y0 - y2) / den;
+			if (p > 0.5 || p < -0.5) {
+				p = 0;
+			}
+			height = y1 - 0.25 * (y0 - y2) * p;
+		}
+	}
+	r->lag = best + p;
+	r->delay = r->lag * x->hinterval;
+	e = tek_xcorr_energy(x, data, bytes_per_point, mean, best);
+	r->peak = (e > 0) ? height / sqrt(e * x->ref_energy) : 0;
+	if (r->peak > 1) {
+		r->peak = 1;
+	} else if (r->peak < -1) {
+		r->peak = -1;
+	}
+}
+
+int tek_xcorr_trace(const TEK_XCORR * x, const char *data,
+		    int bytes_per_point, TEK_XCORR_RESULT * r)
+{
+	float *a = new float[x->size];
+	float *spec = new float[2 * (x->half + 1)];
+
+	tek_xcorr_one(x, data, bytes_per_point, a, spec, r);
+	delete[]a;
+	delete[]spec;
+	return 0;
+}
+
+typedef struct {
+	const TEK_XCORR *x;
+	const char *data;
+	long stride;
+	int bytes_per_point;
+	long first, step, no_traces;
+	TEK_XCORR_RESULT *r;
+} TEK_XCORR_JOB;
+
+static void *tek_xcorr_job(void *arg)
+{
+	TEK_XCORR_JOB *job = (TEK_XCORR_JOB *) arg;
+	const TEK_XCORR *x = job->x;
+	float *a = new float[x->size];
+	float *spec = new float[2 * (x->half + 1)];
+	long t;
+
+	for (t = job->first; t < job->no_traces; t += job->step) {
+		tek_xcorr_one(x, job->data + job->stride * t,
+			      job->bytes_per_point, a, spec, &job->r[t]);
+	}
+	delete[]a;
+	delete[]spec;
+	return NULL;
+}
+
+int tek_xcorr_traces(const TEK_XCORR * x, const char *data, long stride,
+		     int bytes_per_point, long no_traces,
+		     TEK_XCORR_RESULT * r, int no_threads)
+{
+	TEK_XCORR_JOB *jobs;
+	int t;
+
+	if (no_traces < 1) {
+		return -1;
+	}
+	no_threads = tek_jobs_threads(no_threads, no_traces);
+
+	/* Every thread takes every no_threads'th trace */
+	jobs = new TEK_XCORR_JOB[no_threads];
+	for (t = 0; t < no_threads; t++) {
+		jobs[t].x = x;
+		jobs[t].data = data;
+		jobs[t].stride = stride;
+		jobs[t].bytes_per_point = bytes_per_point;
+		jobs[t].first = t;
+		jobs[t].step = no_threads;
+		jobs[t].no_traces = no_traces;
+		jobs[t].r = r;
+	}
+	tek_jobs_run(tek_xcorr_job, jobs, sizeof(TEK_XCORR_JOB), no_threads);
+	delete[]jobs;
+	return 0;
+}
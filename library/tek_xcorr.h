@@ -0,0 +1,81 @@
+/* tek_xcorr.h
+ * Time of flight by cross-correlation: where, in each trace, does a
+ * reference pulse (an echo) best match? The correlation is done with FFTs,
+ * so a trace of n points against a reference of any length costs about
+ * n log n, not n times the reference length. The reference's spectrum is
+ * worked out once, when the plan is made, and used for every trace after
+ * that; tek_xcorr_traces() shares a batch of traces (e.g. the segments of
+ * a FastFrame acquisition, or all of a .wf file) between threads.
+ *
+ * Only lags where the whole reference fits inside the trace are looked
+ * at, i.e. delays from 0 to (trace length - reference length) samples,
+ * counted from the start of the trace. The mean of the trace and of the
+ * reference are taken off first, so an offset doesn't pull the peak about.
+ * The peak is then placed between samples by fitting a parabola through
+ * it and its neighbours, which is good to a small fraction of a sample for
+ * anything that isn't sampled too coarsely.
+ *
+ * The traces are raw data, as tek_scope_get_data() returns them, or as in
+ * a .wf file (see tek_wf.h): two bytes per point LSB first, one byte for
+ * the old 8 bit files, or four for decimated ones (tek_decimate.h). There's
+ * no need to scale them to volts, as that doesn't change where the peak
+ * is.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#ifndef _TEK_XCORR_H_
+#define _TEK_XCORR_H_
+
+#include "tek_vxi11.h"
+
+typedef struct tek_xcorr TEK_XCORR;
+
+typedef struct {
+	double lag;		/* samples from the start of the trace */
+	double delay;		/* the same, in seconds (lag * hinterval) */
+	double peak;		/* correlation coefficient there, -1 to 1 */
+} TEK_XCORR_RESULT;
+
+/* A plan for correlating traces of trace_len points against ref[ref_len]
+ * (in any units, e.g. volts from tek_wf_trace_volts()), sampled every
+ * hinterval seconds. Returns NULL if ref is longer than the traces, or is
+ * flat. One plan can be used by any number of threads at once. */
+tk_EXPORT TEK_XCORR *tek_xcorr_new(const double *ref, long ref_len,
+				   long trace_len, double hinterval);
+tk_EXPORT void tek_xcorr_free(TEK_XCORR * x);
+
+/* Only look for the peak between delays of t_min and t_max seconds (from
+ * the start of the trace); t_max <= t_min means anywhere. With
+ * either_sign, an inverted echo counts as well, and has a negative peak. */
+tk_EXPORT void tek_xcorr_search(TEK_XCORR * x, double t_min, double t_max,
+				int either_sign);
+
+/* One trace. If it's flat, lag and delay are NaN and peak is 0. */
+tk_EXPORT int tek_xcorr_trace(const TEK_XCORR * x, const char *data,
+			      int bytes_per_point, TEK_XCORR_RESULT * r);
+
+/* no_traces traces, each stride bytes on from the last, shared between
+ * no_threads threads (<= 0 means one per processor). r has no_traces
+ * entries. Quicker than calling tek_xcorr_trace() for each, as each thread
+ * only sets itself up once. */
+tk_EXPORT int tek_xcorr_traces(const TEK_XCORR * x, const char *data,
+			       long stride, int bytes_per_point,
+			       long no_traces, TEK_XCORR_RESULT * r,
+			       int no_threads);
+
+#endif
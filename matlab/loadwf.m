@@ -52,6 +52,8 @@ wffile=strcat(fname,'.wf');
 fi=fopen(wffile,'r');
 if resolution==1
 	d=fread(fi,[no_bytes no_of_traces],'int8');
+elseif resolution==4 % tgetwf -dec -dec_32
+	d=fread(fi,[(no_bytes)/4 no_of_traces],'int32');
 else
 	d=fread(fi,[(no_bytes)/2 no_of_traces],'int16');
 end
@@ -0,0 +1,18 @@
+# setup.py
+# Builds the tek_vxi11_native extension module. Install the tek_vxi11 and
+# vxi11 libraries first ("make install" at the top level), then:
+#   python3 setup.py build_ext --inplace
+# or
+#   python3 setup.py install
+
+from setuptools import setup, Extension
+
+native = Extension("tek_vxi11_native",
+                   sources=["tek_vxi11_native.cc"],
+                   include_dirs=["../library"],
+                   libraries=["tek_vxi11", "vxi11"])
+
+setup(name="tek_vxi11_native",
+      version="1.06",
+      description="Native interface to the tek_vxi11 library",
+      ext_modules=[native])
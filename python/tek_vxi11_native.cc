@@ -0,0 +1,810 @@
+/* tek_vxi11_native.cc
+ * CPython extension module wrapping the tek_vxi11 C++ library, so that
+ * Python scripts can grab traces at the same speed as the C++ utilities.
+ *
+ * Traces come back as Trace objects, which own the buffer the library wrote
+ * the data into, and export it through the buffer protocol. trace.raw is a
+ * NumPy int16 array on top of that same buffer (no copy, and a new one each
+ * time, as keeping it would make a reference cycle), and trace.volts /
+ * trace.times are float64 arrays scaled using the waveform preamble. If you
+ * already have an array to put the data in, pass it as out= and the data is
+ * written straight into it.
+ *
+ * The GIL is released while talking to the instrument, so several Scope
+ * objects can capture from different threads at the same time. Calls on
+ * the same Scope from different threads are serialised.
+ *
+ * Build with "python3 setup.py build_ext --inplace" (after "make install" of
+ * the library). NumPy is used if it is installed; without it, raw, volts
+ * and times are plain memoryviews.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation;  version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+#include <structmember.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tek_vxi11.h"
+#include "tek_transport.h"
+
+#define TEK_NATIVE_TIMEOUT 10000	/* ms, as tgetwf */
+
+/* Opening and closing links adds to and removes from the library's list
+ * of transports, which isn't thread safe, so only one at a time. */
+static PyThread_type_lock tek_native_open_lock;
+
+/*****************************************************************************
+ * Trace: a buffer of waveform data, plus how to scale it                    *
+ *****************************************************************************/
+
+typedef struct {
+	PyObject_HEAD
+	char *data;
+	Py_ssize_t len;		/* bytes */
+	char format[2];		/* struct module format, "h" or "d" */
+	Py_ssize_t itemsize;
+	int ndim;
+	Py_ssize_t shape[2];	/* traces, points (ndim 2) or points (ndim 1) */
+	Py_ssize_t strides[2];
+	double vgain, voffset, hinterval, hoffset;
+	PyObject *volts, *times;	/* cached arrays (of other Traces) */
+} TraceObject;
+
+/* The rest of the type is filled in by PyInit_tek_vxi11_native() */
+static PyTypeObject TraceType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"tek_vxi11_native.Trace",	/* tp_name */
+	sizeof(TraceObject),	/* tp_basicsize */
+};
+
+static TraceObject *trace_new(Py_ssize_t traces, Py_ssize_t points,
+			      char format, Py_ssize_t itemsize)
+{
+	TraceObject *t;
+
+	t = PyObject_New(TraceObject, &TraceType);
+	if (!t) {
+		return NULL;
+	}
+	t->len = traces * points * itemsize;
+	t->data = (char *)PyMem_RawMalloc(t->len > 0 ? t->len : 1);
+	t->format[0] = format;
+	t->format[1] = '\0';
+	t->itemsize = itemsize;
+	t->vgain = 1;
+	t->voffset = 0;
+	t->hinterval = 1;
+	t->hoffset = 0;
+	t->volts = t->times = NULL;
+	if (traces > 1) {
+		t->ndim = 2;
+		t->shape[0] = traces;
+		t->shape[1] = points;
+		t->strides[0] = points * itemsize;
+		t->strides[1] = itemsize;
+	} else {
+		t->ndim = 1;
+		t->shape[0] = points;
+		t->strides[0] = itemsize;
+	}
+	if (!t->data) {
+		Py_DECREF(t);
+		PyErr_NoMemory();
+		return NULL;
+	}
+	return t;
+}
+
+static void trace_dealloc(TraceObject * t)
+{
+	Py_XDECREF(t->volts);
+	Py_XDECREF(t->times);
+	PyMem_RawFree(t->data);
+	PyObject_Free(t);
+}
+
+static int trace_getbuffer(TraceObject * t, Py_buffer * view, int flags)
+{
+	view->buf = t->data;
+	view->obj = (PyObject *) t;
+	Py_INCREF(t);
+	view->len = t->len;
+	view->readonly = 0;
+	view->itemsize = t->itemsize;
+	view->format = (flags & PyBUF_FORMAT) ? t->format : NULL;
+	view->ndim = t->ndim;
+	view->shape = (flags & PyBUF_ND) ? t->shape : NULL;
+	view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? t->strides : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+	return 0;
+}
+
+static PyBufferProcs trace_as_buffer = {
+	(getbufferproc) trace_getbuffer,
+	NULL
+};
+
+/* Wraps anything with a buffer in a NumPy array, or failing that a
+ * memoryview. Either way, no data is copied. */
+static PyObject *tek_native_array(PyObject * obj)
+{
+	static PyObject *numpy_asarray = NULL;
+	static int tried = 0;
+	PyObject *mv, *arr, *numpy;
+
+	if (!tried) {
+		tried = 1;
+		numpy = PyImport_ImportModule("numpy");
+		if (numpy) {
+			numpy_asarray = PyObject_GetAttrString(numpy, "asarray");
+			Py_DECREF(numpy);
+		}
+		PyErr_Clear();
+	}
+	mv = PyMemoryView_FromObject(obj);
+	if (!mv || !numpy_asarray) {
+		return mv;
+	}
+	arr = PyObject_CallOneArg(numpy_asarray, mv);
+	Py_DECREF(mv);
+	return arr;
+}
+
+/* Not cached: the array holds a reference to t, so t holding one to the
+ * array would be a cycle, and Traces aren't garbage collected. Making a new
+ * view costs next to nothing. */
+static PyObject *trace_get_raw(TraceObject * t, void *closure)
+{
+	return tek_native_array((PyObject *) t);
+}
+
+static PyObject *trace_get_volts(TraceObject * t, void *closure)
+{
+	TraceObject *v;
+	const short *in;
+	double *out;
+	Py_ssize_t i, n;
+
+	if (t->format[0] != 'h') {
+		PyErr_SetString(PyExc_TypeError, "trace is not raw data");
+		return NULL;
+	}
+	if (!t->volts) {
+		n = t->len / 2;
+		v = trace_new(t->ndim == 2 ? t->shape[0] : 1,
+			      t->ndim == 2 ? t->shape[1] : t->shape[0], 'd',
+			      sizeof(double));
+		if (!v) {
+			return NULL;
+		}
+		in = (const short *)t->data;
+		out = (double *)v->data;
+		Py_BEGIN_ALLOW_THREADS
+		for (i = 0; i < n; i++) {
+			out[i] = t->vgain * in[i] + t->voffset;
+		}
+		Py_END_ALLOW_THREADS
+		v->vgain = t->vgain;
+		v->voffset = t->voffset;
+		v->hinterval = t->hinterval;
+		v->hoffset = t->hoffset;
+		t->volts = tek_native_array((PyObject *) v);
+		Py_DECREF(v);
+	}
+	Py_XINCREF(t->volts);
+	return t->volts;
+}
+
+static PyObject *trace_get_times(TraceObject * t, void *closure)
+{
+	TraceObject *x;
+	double *out;
+	Py_ssize_t i, n;
+
+	if (!t->times) {
+		n = (t->ndim == 2) ? t->shape[1] : t->shape[0];
+		x = trace_new(1, n, 'd', sizeof(double));
+		if (!x) {
+			return NULL;
+		}
+		out = (double *)x->data;
+		for (i = 0; i < n; i++) {
+			out[i] = t->hoffset + i * t->hinterval;
+		}
+		t->times = tek_native_array((PyObject *) x);
+		Py_DECREF(x);
+	}
+	Py_XINCREF(t->times);
+	return t->times;
+}
+
+static PyObject *trace_get_traces(TraceObject * t, void *closure)
+{
+	return PyLong_FromSsize_t(t->ndim == 2 ? t->shape[0] : 1);
+}
+
+static PyObject *trace_get_points(TraceObject * t, void *closure)
+{
+	return PyLong_FromSsize_t(t->ndim == 2 ? t->shape[1] : t->shape[0]);
+}
+
+static PyGetSetDef trace_getset[] = {
+	{"raw", (getter) trace_get_raw, NULL,
+	 "The data as signed 16-bit integers, sharing the trace's buffer", NULL},
+	{"volts", (getter) trace_get_volts, NULL,
+	 "The data in volts (float64), worked out on first use", NULL},
+	{"times", (getter) trace_get_times, NULL,
+	 "Time of each point in seconds (float64)", NULL},
+	{"traces", (getter) trace_get_traces, NULL,
+	 "Number of traces (FastFrame segments)", NULL},
+	{"points", (getter) trace_get_points, NULL, "Points per trace", NULL},
+	{NULL}
+};
+
+static PyMemberDef trace_members[] = {
+	{(char *)"vgain", T_DOUBLE, offsetof(TraceObject, vgain), READONLY,
+	 (char *)"Vertical gain, volts per count"},
+	{(char *)"voffset", T_DOUBLE, offsetof(TraceObject, voffset), READONLY,
+	 (char *)"Vertical offset, volts (volts = vgain * raw + voffset)"},
+	{(char *)"hinterval", T_DOUBLE, offsetof(TraceObject, hinterval),
+	 READONLY, (char *)"Horizontal interval, seconds per point"},
+	{(char *)"hoffset", T_DOUBLE, offsetof(TraceObject, hoffset), READONLY,
+	 (char *)"Time of the first point, seconds"},
+	{NULL}
+};
+
+/*****************************************************************************
+ * Scope: a link to a scope (or AFG)                                         *
+ *****************************************************************************/
+
+typedef struct {
+	PyObject_HEAD
+	VXI11_CLINK *clink;
+	char *address;
+	PyThread_type_lock lock;	/* one call on the link at a time */
+	long buf_size;		/* bytes per trace, from set_for_capture() */
+	int segments;
+	/* scaling for the source we last fetched it for */
+	char scaling_source[20];
+	double vgain, voffset, hinterval, hoffset;
+} ScopeObject;
+
+/* Brackets a call into the library: drop the GIL, then take the link */
+#define SCOPE_BEGIN(s) \
+	Py_BEGIN_ALLOW_THREADS \
+	PyThread_acquire_lock((s)->lock, WAIT_LOCK);
+#define SCOPE_END(s) \
+	PyThread_release_lock((s)->lock); \
+	Py_END_ALLOW_THREADS
+
+static int scope_check(ScopeObject * s)
+{
+	if (!s->clink) {
+		PyErr_SetString(PyExc_ValueError, "link is closed");
+		return -1;
+	}
+	return 0;
+}
+
+/* Anything that might change the scaling means we have to ask again */
+static void scope_forget_scaling(ScopeObject * s)
+{
+	s->scaling_source[0] = '\0';
+}
+
+static int scope_init(ScopeObject * s, PyObject * args, PyObject * kwds)
+{
+	static const char *kwlist[] = { "address", NULL };
+	const char *address;
+	VXI11_CLINK *clink = NULL;
+	int ret;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", (char **)kwlist,
+					 &address)) {
+		return -1;
+	}
+	if (s->clink) {
+		PyErr_SetString(PyExc_ValueError, "already open");
+		return -1;
+	}
+	if (!s->lock) {
+		s->lock = PyThread_allocate_lock();
+		if (!s->lock) {
+			PyErr_NoMemory();
+			return -1;
+		}
+	}
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(tek_native_open_lock, WAIT_LOCK);
+	ret = tek_open(&clink, address);
+	PyThread_release_lock(tek_native_open_lock);
+	Py_END_ALLOW_THREADS
+	if (ret != 0) {
+		PyErr_Format(PyExc_OSError, "could not open link to %s", address);
+		return -1;
+	}
+	s->clink = clink;
+	s->address = strdup(address);
+	s->buf_size = 0;
+	s->segments = 1;
+	scope_forget_scaling(s);
+	return 0;
+}
+
+static void scope_do_close(ScopeObject * s)
+{
+	VXI11_CLINK *clink = s->clink;
+
+	if (!clink) {
+		return;
+	}
+	s->clink = NULL;
+	SCOPE_BEGIN(s)
+	PyThread_acquire_lock(tek_native_open_lock, WAIT_LOCK);
+	tek_close(clink, s->address);
+	PyThread_release_lock(tek_native_open_lock);
+	SCOPE_END(s)
+	free(s->address);
+	s->address = NULL;
+}
+
+static void scope_dealloc(ScopeObject * s)
+{
+	scope_do_close(s);
+	if (s->lock) {
+		PyThread_free_lock(s->lock);
+	}
+	Py_TYPE(s)->tp_free((PyObject *) s);
+}
+
+static PyObject *scope_close(ScopeObject * s, PyObject * unused)
+{
+	scope_do_close(s);
+	Py_RETURN_NONE;
+}
+
+static PyObject *scope_enter(ScopeObject * s, PyObject * unused)
+{
+	Py_INCREF(s);
+	return (PyObject *) s;
+}
+
+static PyObject *scope_exit(ScopeObject * s, PyObject * args)
+{
+	scope_do_close(s);
+	Py_RETURN_FALSE;
+}
+
+static PyObject *scope_send(ScopeObject * s, PyObject * args)
+{
+	const char *cmd;
+	Py_ssize_t len;
+	int ret;
+
+	if (!PyArg_ParseTuple(args, "s#", &cmd, &len) || scope_check(s)) {
+		return NULL;
+	}
+	SCOPE_BEGIN(s)
+	ret = tek_send(s->clink, cmd, len);
+	scope_forget_scaling(s);
+	tek_scope_forget_data_source(s->clink);
+	SCOPE_END(s)
+	if (ret < 0) {
+		PyErr_SetString(PyExc_OSError, "could not send command");
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *scope_query(ScopeObject * s, PyObject * args,
+			     PyObject * kwds)
+{
+	static const char *kwlist[] = { "cmd", "timeout", "size", NULL };
+	const char *cmd;
+	unsigned long timeout = TEK_NATIVE_TIMEOUT;
+	Py_ssize_t size = 65536;
+	char *buf;
+	long ret = 0;
+	PyObject *result;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|kn", (char **)kwlist,
+					 &cmd, &timeout, &size)
+	    || scope_check(s)) {
+		return NULL;
+	}
+	buf = (char *)PyMem_RawMalloc(size);
+	if (!buf) {
+		return PyErr_NoMemory();
+	}
+	SCOPE_BEGIN(s)
+	if (tek_send(s->clink, cmd) != 0) {
+		ret = -1;
+	} else {
+		ret = tek_receive(s->clink, buf, size, timeout);
+	}
+	/* a query can set things too, e.g. "DATA:SOURCE CH2;:CURVE?" */
+	tek_scope_forget_data_source(s->clink);
+	SCOPE_END(s)
+	if (ret < 0) {
+		PyMem_RawFree(buf);
+		PyErr_Format(PyExc_OSError, "no reply to '%s'", cmd);
+		return NULL;
+	}
+	while (ret > 0 && (buf[ret - 1] == '\n' || buf[ret - 1] == '\r')) {
+		ret--;
+	}
+	result = PyUnicode_DecodeLatin1(buf, ret, NULL);
+	PyMem_RawFree(buf);
+	return result;
+}
+
+static PyObject *scope_scope_init(ScopeObject * s, PyObject * unused)
+{
+	int ret;
+
+	if (scope_check(s)) {
+		return NULL;
+	}
+	SCOPE_BEGIN(s)
+	ret = tek_scope_init(s->clink);
+	SCOPE_END(s)
+	if (ret != 0) {
+		PyErr_SetString(PyExc_OSError, "could not initialise scope");
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *scope_set_record_length(ScopeObject * s, PyObject * args)
+{
+	long n;
+
+	if (!PyArg_ParseTuple(args, "l", &n) || scope_check(s)) {
+		return NULL;
+	}
+	SCOPE_BEGIN(s)
+	n = tek_scope_set_record_length(s->clink, n);
+	scope_forget_scaling(s);
+	SCOPE_END(s)
+	return PyLong_FromLong(n);
+}
+
+static PyObject *scope_set_for_capture(ScopeObject * s, PyObject * args,
+				       PyObject * kwds)
+{
+	static const char *kwlist[] = { "clear_sweeps", "timeout", NULL };
+	int clear_sweeps = 1;
+	unsigned long timeout = TEK_NATIVE_TIMEOUT;
+	long ret;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|pk", (char **)kwlist,
+					 &clear_sweeps, &timeout)
+	    || scope_check(s)) {
+		return NULL;
+	}
+	SCOPE_BEGIN(s)
+	ret = tek_scope_set_for_capture(s->clink, clear_sweeps, timeout);
+	scope_forget_scaling(s);
+	SCOPE_END(s)
+	if (ret <= 0) {
+		PyErr_SetString(PyExc_OSError, "could not set scope up for capture");
+		return NULL;
+	}
+	s->buf_size = ret;
+	return PyLong_FromLong(ret);
+}
+
+static PyObject *scope_set_averages(ScopeObject * s, PyObject * args)
+{
+	int n, ret;
+
+	if (!PyArg_ParseTuple(args, "i", &n) || scope_check(s)) {
+		return NULL;
+	}
+	SCOPE_BEGIN(s)
+	tek_scope_set_averages(s->clink, n);
+	ret = tek_scope_get_averages(s->clink);
+	scope_forget_scaling(s);
+	SCOPE_END(s)
+	return PyLong_FromLong(ret);
+}
+
+static PyObject *scope_get_averages(ScopeObject * s, PyObject * unused)
+{
+	int ret;
+
+	if (scope_check(s)) {
+		return NULL;
+	}
+	SCOPE_BEGIN(s)
+	ret = tek_scope_get_averages(s->clink);
+	SCOPE_END(s)
+	return PyLong_FromLong(ret);
+}
+
+static PyObject *scope_set_segmented(ScopeObject * s, PyObject * args)
+{
+	int n;
+
+	if (!PyArg_ParseTuple(args, "i", &n) || scope_check(s)) {
+		return NULL;
+	}
+	SCOPE_BEGIN(s)
+	n = tek_scope_set_segmented(s->clink, n);
+	scope_forget_scaling(s);
+	SCOPE_END(s)
+	s->segments = (n > 0) ? n : 1;
+	return PyLong_FromLong(n);
+}
+
+static PyObject *scope_get_sample_rate(ScopeObject * s, PyObject * unused)
+{
+	double ret;
+
+	if (scope_check(s)) {
+		return NULL;
+	}
+	SCOPE_BEGIN(s)
+	ret = tek_scope_get_sample_rate(s->clink);
+	SCOPE_END(s)
+	return PyFloat_FromDouble(ret);
+}
+
+/* get_data(source, clear_sweeps=True, timeout=10000, out=None, scaling=True)
+ * Without out, returns a Trace. With out (any writable buffer, e.g. a
+ * preallocated NumPy array), the data goes straight into it and the number
+ * of points is returned. */
+static PyObject *scope_get_data(ScopeObject * s, PyObject * args,
+				PyObject * kwds)
+{
+	static const char *kwlist[] = { "source", "clear_sweeps", "timeout",
+		"out", "scaling", NULL
+	};
+	const char *src;
+	char source[20];
+	int clear_sweeps = 1, scaling = 1;
+	unsigned long timeout = TEK_NATIVE_TIMEOUT;
+	PyObject *out = NULL;
+	Py_buffer view;
+	TraceObject *t = NULL;
+	char *buf;
+	size_t len;
+	long bytes;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|pkOp", (char **)kwlist,
+					 &src, &clear_sweeps, &timeout, &out,
+					 &scaling)
+	    || scope_check(s)) {
+		return NULL;
+	}
+	snprintf(source, sizeof(source), "%s", src);
+	tek_scope_channel_str(source);
+
+	if (out && out != Py_None) {
+		if (PyObject_GetBuffer(out, &view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS)) {
+			return NULL;
+		}
+		buf = (char *)view.buf;
+		len = view.len;
+	} else {
+		out = NULL;
+		if (s->buf_size <= 0) {
+			PyErr_SetString(PyExc_ValueError,
+					"call set_for_capture() first, or pass out=");
+			return NULL;
+		}
+		t = trace_new(s->segments, s->buf_size / 2, 'h', 2);
+		if (!t) {
+			return NULL;
+		}
+		buf = t->data;
+		len = t->len;
+	}
+
+	SCOPE_BEGIN(s)
+	bytes = tek_scope_get_data(s->clink, source, clear_sweeps, buf, len,
+				   timeout);
+	if (bytes > 0 && t && scaling) {
+		/* only ask for the scaling if something might have changed */
+		if (strcmp(source, s->scaling_source) != 0) {
+			tek_scope_get_scaling(s->clink, &s->vgain, &s->voffset,
+					      &s->hinterval, &s->hoffset);
+			snprintf(s->scaling_source, sizeof(s->scaling_source),
+				 "%s", source);
+		}
+		t->vgain = s->vgain;
+		t->voffset = s->voffset;
+		t->hinterval = s->hinterval;
+		t->hoffset = s->hoffset;
+	}
+	SCOPE_END(s)
+
+	if (out) {
+		PyBuffer_Release(&view);
+		if (bytes <= 0) {
+			PyErr_SetString(PyExc_OSError, "problem reading the data");
+			return NULL;
+		}
+		return PyLong_FromLong(bytes / 2);
+	}
+	if (bytes <= 0) {
+		Py_DECREF(t);
+		PyErr_SetString(PyExc_OSError, "problem reading the data");
+		return NULL;
+	}
+	if ((size_t)bytes < len) {
+		/* the scope sent less than we asked for */
+		t->len = bytes;
+		if (t->ndim == 2) {
+			t->shape[0] = bytes / t->strides[0];
+			t->len = t->shape[0] * t->strides[0];
+		} else {
+			t->shape[0] = bytes / 2;
+			t->len = t->shape[0] * 2;
+		}
+	}
+	return (PyObject *) t;
+}
+
+static PyObject *scope_afg_send_arb(ScopeObject * s, PyObject * args)
+{
+	Py_buffer view;
+	int chan = -1, ret;
+	char *tmp;
+
+	if (!PyArg_ParseTuple(args, "y*|i", &view, &chan)) {
+		return NULL;
+	}
+	if (scope_check(s)) {
+		PyBuffer_Release(&view);
+		return NULL;
+	}
+	/* tek_afg_send_arb() swaps the bytes in place, so work on a copy */
+	tmp = (char *)PyMem_RawMalloc(view.len > 0 ? view.len : 1);
+	if (!tmp) {
+		PyBuffer_Release(&view);
+		return PyErr_NoMemory();
+	}
+	memcpy(tmp, view.buf, view.len);
+	SCOPE_BEGIN(s)
+	ret = tek_afg_send_arb(s->clink, tmp, view.len, chan);
+	SCOPE_END(s)
+	PyMem_RawFree(tmp);
+	PyBuffer_Release(&view);
+	if (ret < 0) {
+		PyErr_SetString(PyExc_OSError, "error sending waveform data");
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef scope_methods[] = {
+	{"close", (PyCFunction) scope_close, METH_NOARGS, "Closes the link"},
+	{"__enter__", (PyCFunction) scope_enter, METH_NOARGS, NULL},
+	{"__exit__", (PyCFunction) scope_exit, METH_VARARGS, NULL},
+	{"send", (PyCFunction) scope_send, METH_VARARGS,
+	 "send(cmd): sends a command"},
+	{"query", (PyCFunction) scope_query, METH_VARARGS | METH_KEYWORDS,
+	 "query(cmd, timeout=10000): sends a query, returns the reply"},
+	{"scope_init", (PyCFunction) scope_scope_init, METH_NOARGS,
+	 "Sets up the data format (see tek_scope_init)"},
+	{"set_record_length", (PyCFunction) scope_set_record_length,
+	 METH_VARARGS, "set_record_length(n): returns the actual length"},
+	{"set_for_capture", (PyCFunction) scope_set_for_capture,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "set_for_capture(clear_sweeps=True, timeout=10000): returns bytes per trace"},
+	{"set_averages", (PyCFunction) scope_set_averages, METH_VARARGS,
+	 "set_averages(n): as tek_scope_set_averages, returns the actual value"},
+	{"get_averages", (PyCFunction) scope_get_averages, METH_NOARGS,
+	 "As tek_scope_get_averages"},
+	{"set_segmented", (PyCFunction) scope_set_segmented, METH_VARARGS,
+	 "set_segmented(n): FastFrame mode, returns the actual no of segments"},
+	{"get_sample_rate", (PyCFunction) scope_get_sample_rate, METH_NOARGS,
+	 "Returns the sample rate"},
+	{"get_data", (PyCFunction) scope_get_data, METH_VARARGS | METH_KEYWORDS,
+	 "get_data(source, clear_sweeps=True, timeout=10000, out=None, scaling=True)"},
+	{"afg_send_arb", (PyCFunction) scope_afg_send_arb, METH_VARARGS,
+	 "afg_send_arb(data, chan=-1): uploads little-endian 16-bit data to an AFG"},
+	{NULL}
+};
+
+static PyTypeObject ScopeType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"tek_vxi11_native.Scope",	/* tp_name */
+	sizeof(ScopeObject),	/* tp_basicsize */
+};
+
+/*****************************************************************************
+ * Module                                                                    *
+ *****************************************************************************/
+
+/* afg_swap_bytes(buf): swaps the bytes of 16-bit data in place */
+static PyObject *native_afg_swap_bytes(PyObject * self, PyObject * args)
+{
+	Py_buffer view;
+	char *p, c;
+	Py_ssize_t i;
+
+	if (!PyArg_ParseTuple(args, "w*", &view)) {
+		return NULL;
+	}
+	p = (char *)view.buf;
+	Py_BEGIN_ALLOW_THREADS
+	for (i = 0; i + 1 < view.len; i += 2) {
+		c = p[i];
+		p[i] = p[i + 1];
+		p[i + 1] = c;
+	}
+	Py_END_ALLOW_THREADS
+	PyBuffer_Release(&view);
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef native_methods[] = {
+	{"afg_swap_bytes", native_afg_swap_bytes, METH_VARARGS,
+	 "afg_swap_bytes(buf): swaps the bytes of 16-bit data in place"},
+	{NULL}
+};
+
+static struct PyModuleDef native_module = {
+	PyModuleDef_HEAD_INIT,
+	"tek_vxi11_native",
+	"Native interface to the tek_vxi11 library",
+	-1,
+	native_methods
+};
+
+PyMODINIT_FUNC PyInit_tek_vxi11_native(void)
+{
+	PyObject *m;
+
+	TraceType.tp_dealloc = (destructor) trace_dealloc;
+	TraceType.tp_as_buffer = &trace_as_buffer;
+	TraceType.tp_flags = Py_TPFLAGS_DEFAULT;
+	TraceType.tp_doc = "Waveform data captured from a scope";
+	TraceType.tp_getset = trace_getset;
+	TraceType.tp_members = trace_members;
+
+	ScopeType.tp_dealloc = (destructor) scope_dealloc;
+	ScopeType.tp_flags = Py_TPFLAGS_DEFAULT;
+	ScopeType.tp_doc = "Scope(address): a link to a Tektronix instrument";
+	ScopeType.tp_methods = scope_methods;
+	ScopeType.tp_init = (initproc) scope_init;
+	ScopeType.tp_new = PyType_GenericNew;
+
+	if (PyType_Ready(&TraceType) < 0 || PyType_Ready(&ScopeType) < 0) {
+		return NULL;
+	}
+	tek_native_open_lock = PyThread_allocate_lock();
+	if (!tek_native_open_lock) {
+		return PyErr_NoMemory();
+	}
+	m = PyModule_Create(&native_module);
+	if (!m) {
+		return NULL;
+	}
+	Py_INCREF(&TraceType);
+	PyModule_AddObject(m, "Trace", (PyObject *) & TraceType);
+	Py_INCREF(&ScopeType);
+	PyModule_AddObject(m, "Scope", (PyObject *) & ScopeType);
+	return m;
+}
@@ -32,12 +32,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include "vxi11_user.h"
+#include "tek_vxi11.h"
+#include "tek_transport.h"
 
 #ifdef WIN32
+#include <windows.h>
 #define snprintf sprintf_s
 #define strcasecmp stricmp
+#else
+#include <sys/time.h>
+#include <unistd.h>
 #endif
 
+/* Commands are packed into compound messages of at most this many bytes
+ * before sending. Comfortably inside what the AFG3000s will accept in one
+ * go. */
+#define MAX_MSG_LEN 1000
+
 char **cmds = NULL;
 int cmd_count = 0;
 
@@ -59,14 +70,300 @@ int cmd_add(const char *cmd)
 	return 0;
 }
 
+/* Sends the commands queued up with cmd_add(), joined together with
+ * semicolons into as few messages as possible (rather than one round trip
+ * per command). Commands that don't start with ':' or '*' are given a
+ * leading colon when joined, otherwise the AFG would treat them as being
+ * relative to the previous command's subsystem. If "all" is zero, only full
+ * messages are sent, and whatever is left over stays queued for next time.
+ * Returns the number of messages sent, or -1 on error. */
+int cmd_flush(VXI11_CLINK * clink, int all, int verbose)
+{
+	char msg[MAX_MSG_LEN + 1];
+	const char *sep;
+	size_t len = 0, cmd_len;
+	int i, first = 0, no_msgs = 0;
+
+	for (i = 0; i < cmd_count; i++) {
+		cmd_len = strlen(cmds[i]);
+		sep = (cmds[i][0] == ':' || cmds[i][0] == '*') ? ";" : ";:";
+		if (len > 0 && len + strlen(sep) + cmd_len > MAX_MSG_LEN) {
+			if (verbose > 0)
+				printf("tek_send: %s\n", msg);
+			if (tek_send(clink, msg, len) < 0) {
+				return -1;
+			}
+			no_msgs++;
+			len = 0;
+			for (; first < i; first++) {
+				free(cmds[first]);
+			}
+		}
+		if (len == 0 && cmd_len > MAX_MSG_LEN) {
+			/* too long to pack, send it on its own */
+			if (verbose > 0)
+				printf("tek_send: %s\n", cmds[i]);
+			if (tek_send(clink, cmds[i], cmd_len) < 0) {
+				return -1;
+			}
+			no_msgs++;
+			free(cmds[i]);
+			first = i + 1;
+		} else {
+			len += snprintf(msg + len, sizeof(msg) - len, "%s%s",
+					len > 0 ? sep : "", cmds[i]);
+		}
+	}
+	if (len > 0 && all) {
+		if (verbose > 0)
+			printf("tek_send: %s\n", msg);
+		if (tek_send(clink, msg, len) < 0) {
+			return -1;
+		}
+		no_msgs++;
+		for (; first < cmd_count; first++) {
+			free(cmds[first]);
+		}
+	}
+	/* shuffle anything left over down to the start of the queue */
+	cmd_count -= first;
+	memmove(cmds, cmds + first, cmd_count * sizeof(char *));
+	if (cmd_count == 0) {
+		free(cmds);
+		cmds = NULL;
+	}
+	return no_msgs;
+}
+
+/* Turns a "normal mode" command such as F:1:10000 into the SCPI command(s)
+ * that do the job, and queues them up. Returns 0 on success. */
+int cmd_parse(const char *word, int verbose)
+{
+	int channel;
+	float arg = 0;
+	const char *shape = NULL;
+	char cmd[256];
+
+	if (verbose > 0) {
+		printf("Processing: %s\n", word);
+	}
+	if (strlen(word) < 4) {
+		printf("Unknown command in \"normal\" mode\n");
+		return 0;
+	}
+	channel = atoi(word + 2);
+	if (word[0] == 'S') {
+		shape = word + 4;
+	} else {
+		arg = atof(word + 4);
+	}
+	if (verbose > 0) {
+		printf("Channel = %d argument = %f\n", channel, arg);
+	}
+	switch (word[0]) {
+	case 'E':
+		snprintf(cmd, 256, "OUTP%d:STAT %s", channel, word + 4);
+		break;
+	case 'O':
+		snprintf(cmd, 256, "SOUR%d:VOLT:LEV:IMM:OFFS %fV", channel, arg);
+		break;
+	case 'A':
+	case 'V':
+		snprintf(cmd, 256, "SOUR%d:VOLT:LEV:IMM:AMPL %fVPP", channel,
+			 arg);
+		break;
+	case 'F':
+		snprintf(cmd, 256, "SOUR%d:FREQ:FIX %fHz", channel, arg);
+		break;
+	case 'P':
+		snprintf(cmd, 256, "SOUR%d:PHAS:ADJ %fDEG", channel, arg);
+		break;
+	case 'S':
+		if (!strcasecmp(shape, "DC")) {
+			snprintf(cmd, 256, "SOUR%d:FUNC:SHAP DC", channel);
+		} else if (!strcasecmp(shape, "SINE")) {
+			snprintf(cmd, 256, "SOUR%d:FUNC:SHAP SIN", channel);
+		} else if (!strcasecmp(shape, "SQUARE")) {
+			snprintf(cmd, 256, "SOUR%d:FUNC:SHAP SQU", channel);
+		} else if (!strcasecmp(shape, "TRIANGLE")) {
+			snprintf(cmd, 256, "SOUR%d:FUNC:SHAP TRI", channel);
+		} else {
+			printf("Unknown shape '%s'.\n", shape);
+			return 1;
+		}
+		break;
+	default:
+		printf("Unknown command in \"normal\" mode\n");
+		return 0;
+	}
+	if (verbose > 0)
+		printf("queued: %s\n", cmd);
+	return cmd_add(cmd);
+}
+
+/* Milliseconds since some arbitrary point, for the step timing */
+double now_ms(void)
+{
+#ifdef WIN32
+	return (double)GetTickCount();
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+#endif
+}
+
+/* Script mode. Reads commands from a file (or stdin, if the filename is "-")
+ * and sends them all over the one link, instead of having to run tek_afg
+ * (and open the device) once per step. Each line is one step, made up of
+ * one or more "normal mode" commands separated by spaces, e.g.
+ *   F:1:10000 V:1:2
+ * or a line starting with -d, the rest of which is sent directly. A line
+ * "wait N" pauses for N milliseconds. Blank lines and lines starting with
+ * '#' are ignored. Normally the commands in each step are packed together
+ * and sent at the end of the line; if batch is set, successive steps are
+ * packed together too, and only sent when the message is full, before a
+ * wait or query, or at the end of the script. Any direct command ending in
+ * '?' is a query, and the reply is printed. Returns 0 on success. */
+int run_script(VXI11_CLINK * clink, const char *filename, int batch,
+	       int timing, int verbose)
+{
+	FILE *fi;
+	char line[1024];
+	char reply[1024];
+	char *p, *word;
+	int step = 0, msgs, total_msgs = 0;
+	int query;
+	size_t len;
+	long bytes_returned;
+	double t_start, t_step;
+
+	if (!strcmp(filename, "-")) {
+		fi = stdin;
+	} else {
+		fi = fopen(filename, "r");
+		if (!fi) {
+			printf("error: could not open %s for reading\n",
+			       filename);
+			return 1;
+		}
+	}
+
+	t_start = now_ms();
+	while (fgets(line, sizeof(line), fi)) {
+		p = line + strlen(line);
+		while (p > line && (p[-1] == '\n' || p[-1] == '\r'
+				    || p[-1] == ' ' || p[-1] == '\t')) {
+			*(--p) = '\0';
+		}
+		p = line;
+		while (*p == ' ' || *p == '\t') {
+			p++;
+		}
+		if (*p == '\0' || *p == '#') {
+			continue;
+		}
+
+		t_step = now_ms();
+		query = 0;
+		if (!strncmp(p, "wait", 4) && (p[4] == ' ' || p[4] == '\t')) {
+			msgs = cmd_flush(clink, 1, verbose);
+			if (msgs < 0) {
+				printf("Error sending to device...\n");
+				return 1;
+			}
+			total_msgs += msgs;
+#ifdef WIN32
+			Sleep(atoi(p + 5));
+#else
+			usleep(1000 * atoi(p + 5));
+#endif
+			continue;
+		}
+		if (!strncmp(p, "-d", 2) && (p[2] == ' ' || p[2] == '\t')) {
+			p += 3;
+			while (*p == ' ' || *p == '\t') {
+				p++;
+			}
+			/* quoted as on the command line, so lose the quotes
+			 * like the shell would */
+			len = strlen(p);
+			if (len >= 2 && (p[0] == '"' || p[0] == '\'')
+			    && p[len - 1] == p[0]) {
+				p[len - 1] = '\0';
+				p++;
+				len -= 2;
+			}
+			if (len == 0) {
+				printf("error: nothing to send after -d at step %d\n",
+				       step + 1);
+				return 1;
+			}
+			if (cmd_add(p)) {
+				return 1;
+			}
+			query = (p[len - 1] == '?');
+		} else {
+			for (word = strtok(p, " \t"); word;
+			     word = strtok(NULL, " \t")) {
+				if (cmd_parse(word, verbose)) {
+					return 1;
+				}
+			}
+		}
+		step++;
+
+		/* In batch mode we only send full messages, unless we need a
+		 * reply back */
+		msgs = cmd_flush(clink, !batch || query, verbose);
+		if (msgs < 0) {
+			printf("Error sending to device...\n");
+			return 1;
+		}
+		total_msgs += msgs;
+		if (query) {
+			bytes_returned = tek_receive(clink, reply,
+						     sizeof(reply) - 1);
+			if (bytes_returned < 0) {
+				printf("Error reading reply from device...\n");
+				return 1;
+			}
+			reply[bytes_returned] = '\0';
+			printf("%s", reply);
+			if (bytes_returned == 0
+			    || reply[bytes_returned - 1] != '\n') {
+				printf("\n");
+			}
+		}
+		if (timing) {
+			printf("step %d: %.3f ms\n", step, now_ms() - t_step);
+		}
+	}
+	msgs = cmd_flush(clink, 1, verbose);
+	if (msgs < 0) {
+		printf("Error sending to device...\n");
+		return 1;
+	}
+	total_msgs += msgs;
+	if (fi != stdin) {
+		fclose(fi);
+	}
+	if (timing) {
+		printf("%d steps in %d messages, %.3f ms total\n", step,
+		       total_msgs, now_ms() - t_start);
+	}
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	char *device_ip = NULL;
+	char *script = NULL;
 	VXI11_CLINK *clink = NULL;
-	int i, channel, verbose = 0;
-	float arg;
-	char *shape;
-	char cmd[256];
+	int i, verbose = 0;
+	int batch = 0, timing = 0;
+	int ret = 0;
 
 	if (argc == 1) {
 		printhelp();
@@ -74,6 +371,12 @@ int main(int argc, char *argv[])
 	}
 
 	for (i = 1; i < argc; i++) {
+		if ((!strcmp(argv[i], "-ip") || !strcmp(argv[i], "-usb")
+		     || !strcmp(argv[i], "-d") || !strcmp(argv[i], "-s"))
+		    && i + 1 >= argc) {
+			printf("error: %s needs an argument\n", argv[i]);
+			return 1;
+		}
 		if (!strcmp(argv[i], "-h")) {
 			printhelp();
 			return 0;
@@ -87,105 +390,16 @@ int main(int argc, char *argv[])
 			if (cmd_add(argv[++i])) {
 				return 1;
 			}
+		} else if (!strcmp(argv[i], "-s")) {
+			script = argv[++i];
+		} else if (!strcmp(argv[i], "-b")) {
+			batch = 1;
+		} else if (!strcmp(argv[i], "-t")) {
+			timing = 1;
 			// this isn't an option so it must be a command,
 		} else {
-			if (verbose > 0) {
-				printf("Processing: %s\n", argv[i]);
-			}
-			channel = atoi(argv[i] + 2);
-			if (argv[i][0] == 'S') {
-				shape = argv[i] + 4;
-			} else {
-				arg = atof(argv[i] + 4);
-			}
-			if (verbose > 0) {
-				printf("Channel = %d argument = %f\n", channel,
-				       arg);
-			}
-			switch (argv[i][0]) {
-			case 'E':
-				snprintf(cmd, 256, "OUTP%d:STAT %s", channel,
-					 argv[i] + 4);
-				if (verbose > 0)
-					printf("vxi11_send: %s\n", cmd);
-				if (cmd_add(cmd)) {
-					return 1;
-				}
-				break;
-			case 'O':
-				snprintf(cmd, 256,
-					 "SOUR%d:VOLT:LEV:IMM:OFFS %fV",
-					 channel, arg);
-				if (verbose > 0)
-					printf("vxi11_send: %s\n", cmd);
-				if (cmd_add(cmd)) {
-					return 1;
-				}
-				break;
-			case 'A':
-			case 'V':
-				snprintf(cmd, 256,
-					 "SOUR%d:VOLT:LEV:IMM:AMPL %fVPP",
-					 channel, arg);
-				if (verbose > 0)
-					printf("vxi11_send: %s\n", cmd);
-				if (cmd_add(cmd)) {
-					return 1;
-				}
-				break;
-			case 'F':
-				snprintf(cmd, 256, "SOUR%d:FREQ:FIX %fHz",
-					 channel, arg);
-				if (verbose > 0)
-					printf("vxi11_send: %s\n", cmd);
-				if (cmd_add(cmd)) {
-					return 1;
-				}
-				break;
-			case 'P':
-				snprintf(cmd, 256, "SOUR%d:PHAS:ADJ %fDEG",
-					 channel, arg);
-				if (verbose > 0)
-					printf("vxi11_send: %s\n", cmd);
-				if (cmd_add(cmd)) {
-					return 1;
-				}
-				break;
-			case 'S':
-				if (!strcasecmp(shape, "DC")) {
-					snprintf(cmd, 256,
-						 "SOUR%d:FUNC:SHAP DC",
-						 channel);
-					if (verbose > 0)
-						printf("vxi11_send: %s\n", cmd);
-				} else if (!strcasecmp(shape, "SINE")) {
-					snprintf(cmd, 256,
-						 "SOUR%d:FUNC:SHAP SIN",
-						 channel);
-					if (verbose > 0)
-						printf("vxi11_send: %s\n", cmd);
-				} else if (!strcasecmp(shape, "SQUARE")) {
-					snprintf(cmd, 256,
-						 "SOUR%d:FUNC:SHAP SQU",
-						 channel);
-					if (verbose > 0)
-						printf("vxi11_send: %s\n", cmd);
-				} else if (!strcasecmp(shape, "TRIANGLE")) {
-					snprintf(cmd, 256,
-						 "SOUR%d:FUNC:SHAP TRI",
-						 channel);
-					if (verbose > 0)
-						printf("vxi11_send: %s\n", cmd);
-				} else {
-					printf("Unknown shape '%s'.\n", shape);
-					return 1;
-				}
-				if (cmd_add(cmd)) {
-					return 1;
-				}
-				break;
-			default:
-				printf("Unknown command in \"normal\" mode\n");
+			if (cmd_parse(argv[i], verbose)) {
+				return 1;
 			}
 		}
 	}
@@ -196,15 +410,20 @@ int main(int argc, char *argv[])
 		device_ip = strdup("128.243.74.108");
 	}
 
-	if(vxi11_open_device(&clink, device_ip, NULL)){
+	if(tek_open(&clink, device_ip)){
 		printf("Error opening device...\n");
 		exit(2);
 	}
 
-	for (i = 0; i < cmd_count; i++) {
-		vxi11_send_printf(clink, cmds[i]);
+	/* Anything given on the command line goes first */
+	if (cmd_flush(clink, 1, verbose) < 0) {
+		printf("Error sending to device...\n");
+		ret = 2;
+	} else if (script) {
+		ret = run_script(clink, script, batch, timing, verbose);
 	}
-	vxi11_close_device(clink, device_ip);
+	tek_close(clink, device_ip);
+	return ret;
 }
 
 void printhelp(void)
@@ -221,7 +440,19 @@ void printhelp(void)
 	printf("-v increase verbosity, -q decrease verbosity\n");
 	printf("-h help - this help page\n");
 	printf
-	    ("-d \"string\" - send string direct to AFG (see AFG SCPI manual)\n\n");
+	    ("-d \"string\" - send string direct to AFG (see AFG SCPI manual)\n");
+	printf
+	    ("-s file - script mode: read commands from file ('-' for stdin), one\n");
+	printf
+	    ("          step per line, all over the same link. A line can hold\n");
+	printf
+	    ("          commands (eg F:1:1000 V:1:2), or -d \"string\", or wait N\n");
+	printf("          to pause for N milliseconds.\n");
+	printf
+	    ("-b batch - in script mode, pack successive steps into as few\n");
+	printf
+	    ("          messages as possible, rather than one message per step\n");
+	printf("-t time each step in script mode\n\n");
 	printf("Commands:\n");
 	printf("E - enable channel eg E:1:ON or E:2:OFF\n");
 	printf("O - Offset voltage eg O:1:0.5 (offset on channel 1 is 0.5V)\n");
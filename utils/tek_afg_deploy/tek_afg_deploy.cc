@@ -0,0 +1,231 @@
+/* tek_afg_deploy.cc
+ * Sends arbitrary waveforms to several Tek AFG3000s at once, rather than
+ * calling tek_afg_upload_arb for each one in turn. All the AFGs can be
+ * sent the same waveform, or each its own (or a mixture). It says how
+ * each one is getting on as it goes, and how long each stage took at the
+ * end; with -verify, each AFG's user memory is read back and checked.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tek_vxi11.h"
+#include "tek_transport.h"
+#include "tek_deploy.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+BOOL sc(const char *, const char *);
+
+/* As in tek_afg_upload_arb */
+#define BUF_LEN		262144
+#define MAX_AFGS	64
+
+typedef struct {
+	char *name;
+	char *buf;
+	size_t len;
+} ARB_FILE;
+
+/* Each file is only read once, however many AFGs it's going to */
+static int arb_file(ARB_FILE * files, int *no_files, char *name)
+{
+	FILE *fi;
+	int i;
+
+	for (i = 0; i < *no_files; i++) {
+		if (strcmp(files[i].name, name) == 0) {
+			return i;
+		}
+	}
+	fi = fopen(name, "rb");
+	if (fi == NULL) {
+		printf("error: could not open %s for reading, quitting...\n",
+		       name);
+		exit(3);
+	}
+	files[i].name = name;
+	files[i].buf = new char[BUF_LEN];
+	files[i].len = fread(files[i].buf, sizeof(char), BUF_LEN, fi);
+	fclose(fi);
+	(*no_files)++;
+	return i;
+}
+
+static void progress(const TEK_DEPLOY * d, int stage, void *arg)
+{
+	double *t_begin = (double *)arg;
+	const char *what;
+
+	switch (stage) {
+	case TEK_DEPLOY_OPENED:
+		what = "link open";
+		break;
+	case TEK_DEPLOY_SENT:
+		what = "waveform sent";
+		break;
+	case TEK_DEPLOY_COPIED:
+		what = "copied to user memory";
+		break;
+	case TEK_DEPLOY_VERIFIED:
+		what = "read back ok";
+		break;
+	case TEK_DEPLOY_DONE:
+		what = "done";
+		break;
+	default:
+		what = "FAILED";
+		break;
+	}
+	printf("%9.1f ms  %-24s %s\n", (tek_time_us() - *t_begin) / 1000, d->ip,
+	       what);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	ARB_FILE files[MAX_AFGS];
+	TEK_DEPLOY afgs[MAX_AFGS];
+	char *filename = NULL;
+	int no_files = 0;
+	int no_afgs = 0;
+	int chan = 0;
+	int index = 1;
+	int i, f, no_failed;
+	BOOL verify = FALSE;
+	BOOL quiet = FALSE;
+	unsigned long timeout = 10000;
+	double t_begin, total, sum;
+
+	progname = argv[0];
+	memset(afgs, 0, sizeof(afgs));
+
+	while (index < argc) {
+		if (sc(argv[index], "-filename") || sc(argv[index], "-f")
+		    || sc(argv[index], "-file")) {
+			filename = argv[++index];
+		}
+
+		if (sc(argv[index], "-channel") || sc(argv[index], "-c")
+		    || sc(argv[index], "-ch")) {
+			sscanf(argv[++index], "%d", &chan);
+		}
+
+		if (sc(argv[index], "-ip") || sc(argv[index], "-ip_address")
+		    || sc(argv[index], "-IP")) {
+			index++;
+			if (filename == NULL) {
+				printf("error: -f has to come before the -ip it's for\n");
+				exit(1);
+			}
+			if (no_afgs == MAX_AFGS) {
+				printf("error: no more than %d AFGs, quitting...\n",
+				       MAX_AFGS);
+				exit(1);
+			}
+			f = arb_file(files, &no_files, filename);
+			afgs[no_afgs].ip = argv[index];
+			afgs[no_afgs].buf = files[f].buf;
+			afgs[no_afgs].len = files[f].len;
+			afgs[no_afgs].chan = chan;
+			no_afgs++;
+		}
+
+		if (sc(argv[index], "-verify") || sc(argv[index], "-v")) {
+			verify = TRUE;
+		}
+
+		if (sc(argv[index], "-quiet") || sc(argv[index], "-q")) {
+			quiet = TRUE;
+		}
+
+		if (sc(argv[index], "-timeout") || sc(argv[index], "-t")) {
+			sscanf(argv[++index], "%lu", &timeout);
+		}
+
+		index++;
+	}
+
+	if (no_afgs == 0) {
+		printf("%s: sends arbitrary waveforms to several Tek AFG3000s at once\n",
+		       progname);
+		printf("Run using %s [arguments]\n\n", progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf("-f     -filename       -file : waveform file (e.g. sig.arb), for the\n");
+		printf("                               AFGs that follow\n");
+		printf("-ip    -ip_address     -IP   : IP address of an AFG (repeat for each)\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf("-c     -channel        -ch   : user channel (1-4) to load waveform into,\n");
+		printf("                               for the AFGs that follow (otherwise just\n");
+		printf("                               uploaded to edit memory)\n");
+		printf("-v     -verify               : read each waveform back and check it\n");
+		printf("-q     -quiet                : don't show progress as it goes\n");
+		printf("-t     -timeout              : timeout (in milliseconds)\n\n");
+		printf("Waveform files are 14-bit unsigned integers, little-endian, as for\n");
+		printf("tek_afg_upload_arb.\n\n");
+		printf("EXAMPLE:\n");
+		printf("%s -f sig.arb -c 1 -ip 128.243.74.107 -ip 128.243.74.108 -f ref.arb -ip 128.243.74.109 -verify\n",
+		       progname);
+		exit(1);
+	}
+
+	t_begin = tek_time_us();
+	no_failed = tek_afg_deploy(afgs, no_afgs, verify, timeout,
+				   quiet ? NULL : progress, &t_begin);
+	total = (tek_time_us() - t_begin) / 1000;
+
+	printf("\nAFG                       open ms  send ms  copy ms verify ms\n");
+	sum = 0;
+	for (i = 0; i < no_afgs; i++) {
+		printf("%-24s %8.1f %8.1f %8.1f %9.1f %s\n", afgs[i].ip,
+		       afgs[i].open_ms, afgs[i].send_ms, afgs[i].copy_ms,
+		       afgs[i].verify_ms, afgs[i].ret == 0 ? "ok" : "FAILED");
+		sum += afgs[i].open_ms + afgs[i].send_ms + afgs[i].copy_ms
+		    + afgs[i].verify_ms;
+	}
+	printf("%d AFGs (%d waveforms) in %.1f ms; one after the other would have taken %.1f ms\n",
+	       no_afgs, no_files, total, sum);
+
+	for (i = 0; i < no_files; i++) {
+		delete[]files[i].buf;
+	}
+	if (no_failed != 0) {
+		printf("%d failed\n", no_failed < 0 ? no_afgs : no_failed);
+		exit(2);
+	}
+	return 0;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "tek_vxi11.h"
+#include "tek_arb_cache.h"
 
 #ifndef	BOOL
 #define	BOOL	int
@@ -70,6 +71,8 @@ int main(int argc, char *argv[])
 	BOOL change_endian = FALSE;
 	BOOL got_ip = FALSE;
 	BOOL got_file = FALSE;
+	BOOL use_cache = FALSE;
+	TEK_ARB_CACHE cache;
 
 	progname = argv[0];
 
@@ -95,6 +98,10 @@ int main(int argc, char *argv[])
 		    || sc(argv[index], "-ch")) {
 			sscanf(argv[++index], "%d", &chan);
 		}
+
+		if (sc(argv[index], "-cache")) {
+			use_cache = TRUE;
+		}
 		index++;
 	}
 
@@ -128,6 +135,14 @@ int main(int argc, char *argv[])
 		printf
 		    ("                               is already in big-endian format, you will\n");
 		printf("                               need this option.\n");
+		printf
+		    ("-cache                       : don't upload the waveform if the AFG already\n");
+		printf
+		    ("                               has it (see tek_arb_cache.h); without -c it\n");
+		printf
+		    ("                               goes in whichever user memory is free, or\n");
+		printf
+		    ("                               has gone longest without being used\n");
 		printf("EXAMPLE:\n");
 		printf("%s -ip 128.243.74.107 -f sig.arb -c 1\n", progname);
 		exit(1);
@@ -149,10 +164,25 @@ int main(int argc, char *argv[])
 			tek_afg_swap_bytes(buf, bytes_returned);
 		}
 
-		ret = tek_afg_send_arb(clink, buf, bytes_returned, chan);
-		if (ret != 0) {
-			printf("Uh oh, I was returned %d, quitting.\n", ret);
-			exit(2);
+		if (use_cache == TRUE) {
+			if (tek_arb_cache_open(clink, &cache, NULL) != 0) {
+				exit(2);
+			}
+			ret = tek_afg_send_arb_cached(clink, &cache, buf,
+						      bytes_returned, chan);
+			if (ret < 0) {
+				printf("Uh oh, I was returned %d, quitting.\n", ret);
+				exit(2);
+			}
+			printf("Waveform is in USER%d (%s)\n", ret,
+			       cache.no_sent ? "uploaded" : cache.no_copied ?
+			       "copied from edit memory" : "already there");
+		} else {
+			ret = tek_afg_send_arb(clink, buf, bytes_returned, chan);
+			if (ret != 0) {
+				printf("Uh oh, I was returned %d, quitting.\n", ret);
+				exit(2);
+			}
 		}
 		tek_close(clink, device_ip);
 	} else {
@@ -0,0 +1,298 @@
+/* tek_async_bench.cc
+ * Grabs traces from several scopes at once, first the usual way (a thread
+ * for each scope, calling tek_scope_get_data()), then with the async API
+ * (tek_async.h: one thread, one event loop, one task for each scope), and
+ * compares how long each took and how much CPU time went on it. Each
+ * trace waits for a fresh acquisition (ACQUIRE:STATE 1;*OPC?), which is
+ * where the threads spend most of their time.
+ *
+ * Works with tek_scope_sim: start one for each pretend scope, on its own
+ * port, with an acquisition time (-a).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "tek_vxi11.h"
+#include "tek_transport.h"
+#include "tek_async.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+BOOL sc(const char *, const char *);
+
+#define MAX_SCOPES	256
+
+typedef struct {
+	const char *ip;
+	const char *channel;
+	long npoints;
+	int no_traces;
+	unsigned long timeout;
+
+	/* results */
+	long traces_got;
+	long bytes;
+	int failed;
+} SCOPE;
+
+/* CPU time (user + system) used by the whole process so far, in ms */
+static double cpu_ms(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3
+	    + ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+}
+
+/* The usual way: one of these for each scope */
+static void *scope_thread(void *arg)
+{
+	SCOPE *s = (SCOPE *) arg;
+	VXI11_CLINK *clink;
+	char source[20];
+	char *buf;
+	long buf_size, bytes;
+	int i;
+
+	if (tek_open(&clink, s->ip) != 0) {
+		s->failed = 1;
+		return NULL;
+	}
+	tek_scope_init(clink);
+	buf_size = tek_scope_set_for_capture(clink, 1, s->npoints, s->timeout);
+	if (buf_size <= 0) {
+		s->failed = 1;
+		tek_close(clink, s->ip);
+		return NULL;
+	}
+	buf = new char[buf_size];
+	for (i = 0; i < s->no_traces; i++) {
+		snprintf(source, sizeof(source), "%s", s->channel);
+		bytes = tek_scope_get_data(clink, source, 1, buf, buf_size,
+					   s->timeout);
+		if (bytes <= 0) {
+			s->failed = 1;
+			break;
+		}
+		s->traces_got++;
+		s->bytes += bytes;
+	}
+	delete[]buf;
+	tek_close(clink, s->ip);
+	return NULL;
+}
+
+/* The async way: one of these for each scope, all in the same thread */
+static tek_task<long> scope_task(TEK_LOOP * loop, SCOPE * s)
+{
+	TEK_ASYNC_LINK *link;
+	char *buf;
+	long buf_size, bytes, ret;
+	int i;
+
+	ret = co_await tek_async_open(loop, s->ip, s->timeout, &link);
+	if (ret != 0) {
+		s->failed = 1;
+		co_return -1;
+	}
+	co_await tek_async_scope_init(link);
+	buf_size = co_await tek_async_set_for_capture(link, 1, s->npoints,
+						      s->timeout);
+	if (buf_size <= 0) {
+		s->failed = 1;
+		tek_async_close(link);
+		co_return -1;
+	}
+	buf = new char[buf_size];
+	for (i = 0; i < s->no_traces; i++) {
+		bytes = co_await tek_async_capture(link, s->channel, 1, buf,
+						   buf_size, s->timeout);
+		if (bytes <= 0) {
+			s->failed = 1;
+			break;
+		}
+		s->traces_got++;
+		s->bytes += bytes;
+	}
+	delete[]buf;
+	tek_async_close(link);
+	co_return 0;
+}
+
+static void reset(SCOPE * scopes, int no_scopes)
+{
+	int i;
+
+	for (i = 0; i < no_scopes; i++) {
+		scopes[i].traces_got = 0;
+		scopes[i].bytes = 0;
+		scopes[i].failed = 0;
+	}
+}
+
+static void report(const char *name, SCOPE * scopes, int no_scopes,
+		   int no_threads, double ms, double cpu)
+{
+	long traces = 0, bytes = 0;
+	int i, failed = 0;
+
+	for (i = 0; i < no_scopes; i++) {
+		traces += scopes[i].traces_got;
+		bytes += scopes[i].bytes;
+		failed += scopes[i].failed;
+	}
+	printf("%-22s %7d %9.1f %8.1f %9.2f %9.1f %s\n", name, no_threads, ms,
+	       1000 * traces / ms, bytes / (1e3 * ms), cpu,
+	       failed ? "(some failed)" : "");
+}
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	SCOPE scopes[MAX_SCOPES];
+	pthread_t threads[MAX_SCOPES];
+	TEK_LOOP *loop;
+	const char *channel = NULL;
+	long npoints = 0;
+	int no_traces = 20;
+	int no_scopes = 0;
+	int index = 1;
+	int i;
+	unsigned long timeout = 10000;
+	double t0, c0, ms, cpu;
+
+	progname = argv[0];
+	memset(scopes, 0, sizeof(scopes));
+
+	while (index < argc) {
+		if (sc(argv[index], "-ip") || sc(argv[index], "-ip_address")
+		    || sc(argv[index], "-IP")) {
+			index++;
+			if (no_scopes == MAX_SCOPES) {
+				printf("error: no more than %d scopes, quitting...\n",
+				       MAX_SCOPES);
+				exit(1);
+			}
+			scopes[no_scopes++].ip = argv[index];
+		}
+
+		if (sc(argv[index], "-channel") || sc(argv[index], "-c")
+		    || sc(argv[index], "-scope_channel")) {
+			channel = argv[++index];
+		}
+
+		if (sc(argv[index], "-no_points") || sc(argv[index], "-n")
+		    || sc(argv[index], "-points")) {
+			sscanf(argv[++index], "%ld", &npoints);
+		}
+
+		if (sc(argv[index], "-traces") || sc(argv[index], "-N")) {
+			sscanf(argv[++index], "%d", &no_traces);
+		}
+
+		if (sc(argv[index], "-timeout") || sc(argv[index], "-t")) {
+			sscanf(argv[++index], "%lu", &timeout);
+		}
+
+		index++;
+	}
+
+	if (no_scopes == 0 || channel == NULL) {
+		printf("%s: grabs traces from several scopes at once, with a thread\n",
+		       progname);
+		printf("for each scope and then with one thread and the async API\n");
+		printf("Run using %s [arguments]\n\n", progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf("-ip     -ip_address     -IP      : address of a scope (repeat for each);\n");
+		printf("                                   socket:HOST[:PORT] to compare like with\n");
+		printf("                                   like, as the async API only does sockets\n");
+		printf("-c      -scope_channel  -channel : scope channel (1,2,3,4,M,REF1-REF4,D0-D15)\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf("-n      -no_points       -points : set record length\n");
+		printf("-N      -traces                  : traces from each scope (default 20)\n");
+		printf("-t      -timeout                 : timeout (in milliseconds)\n\n");
+		printf("EXAMPLE:\n");
+		printf("%s -ip socket:128.243.74.98 -ip socket:128.243.74.99 -c 1 -n 100000\n",
+		       progname);
+		exit(1);
+	}
+
+	for (i = 0; i < no_scopes; i++) {
+		scopes[i].channel = channel;
+		scopes[i].npoints = npoints;
+		scopes[i].no_traces = no_traces;
+		scopes[i].timeout = timeout;
+	}
+
+	printf("%d scopes, %d traces from each\n\n", no_scopes, no_traces);
+	printf("%-22s %7s %9s %8s %9s %9s\n", "", "threads", "ms", "traces/s",
+	       "MB/s", "CPU ms");
+
+	reset(scopes, no_scopes);
+	t0 = tek_time_us();
+	c0 = cpu_ms();
+	for (i = 0; i < no_scopes; i++) {
+		pthread_create(&threads[i], NULL, scope_thread, &scopes[i]);
+	}
+	for (i = 0; i < no_scopes; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	ms = (tek_time_us() - t0) / 1000;
+	cpu = cpu_ms() - c0;
+	report("thread per scope", scopes, no_scopes, no_scopes, ms, cpu);
+
+	reset(scopes, no_scopes);
+	loop = tek_loop_new();
+	if (loop == NULL) {
+		exit(2);
+	}
+	t0 = tek_time_us();
+	c0 = cpu_ms();
+	for (i = 0; i < no_scopes; i++) {
+		tek_loop_spawn(loop, scope_task(loop, &scopes[i]), NULL);
+	}
+	tek_loop_run(loop);
+	ms = (tek_time_us() - t0) / 1000;
+	cpu = cpu_ms() - c0;
+	tek_loop_free(loop);
+	report("async, one thread", scopes, no_scopes, 1, ms, cpu);
+
+	return 0;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
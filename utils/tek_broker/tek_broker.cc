@@ -0,0 +1,533 @@
+/* tek_broker.cc
+ * Keeps links to instruments open between runs of the other programs, so
+ * that tgetwf, tek_afg, tek_save_setup, tek_load_setup etc don't have to
+ * open a fresh link (and find out what the instrument is) every time
+ * they're run. Once it's running, tek_open() asks it for a link before
+ * opening its own; see library/tek_broker.h for how, and for the protocol.
+ *
+ * Each program gets a link of its own for as long as it's running (so two
+ * programs talking to the same scope at once get two links, just as they
+ * would without the broker), and when it's finished the link goes back in
+ * the pool for the next one. Links that haven't been used for a while
+ * (-idle) are closed. If a program goes away leaving a query unanswered,
+ * or something goes wrong on a link, it's closed rather than lent out
+ * again. *IDN? is only ever asked once on each link; after that, the
+ * broker answers it. Only programs run by the same user as the broker
+ * are served.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "tek_vxi11.h"
+#include "tek_transport.h"
+#include "tek_broker.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+BOOL sc(const char *, const char *);
+
+#define IDN_LEN		256
+
+typedef struct broker_link {
+	char address[TEK_BROKER_LINE];
+	VXI11_CLINK *clink;
+	BOOL busy;
+	double last_used;	/* tek_time_us() */
+	long uses;
+	char idn[IDN_LEN];
+	long idn_len;		/* 0 until we've seen the reply */
+	struct broker_link *next;
+} BROKER_LINK;
+
+static BROKER_LINK *links = NULL;
+static pthread_mutex_t links_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t stop_requested = 0;
+static BOOL verbose = FALSE;
+
+static void stop_handler(int sig)
+{
+	stop_requested = 1;
+}
+
+/* A link to address that nobody else is using: an old one if we have one,
+ * otherwise a new one. NULL if it can't be opened. */
+static BROKER_LINK *link_take(const char *address)
+{
+	BROKER_LINK *l;
+	VXI11_CLINK *clink;
+
+	pthread_mutex_lock(&links_lock);
+	for (l = links; l; l = l->next) {
+		if (!l->busy && strcmp(l->address, address) == 0) {
+			l->busy = TRUE;
+			l->uses++;
+			pthread_mutex_unlock(&links_lock);
+			return l;
+		}
+	}
+	pthread_mutex_unlock(&links_lock);
+
+	if (tek_open(&clink, address) != 0) {
+		return NULL;
+	}
+	l = (BROKER_LINK *) calloc(1, sizeof(BROKER_LINK));
+	if (!l) {
+		tek_close(clink, address);
+		return NULL;
+	}
+	snprintf(l->address, sizeof(l->address), "%s", address);
+	l->clink = clink;
+	l->busy = TRUE;
+	l->uses = 1;
+	if (verbose) {
+		printf("opened %s\n", address);
+	}
+	pthread_mutex_lock(&links_lock);
+	l->next = links;
+	links = l;
+	pthread_mutex_unlock(&links_lock);
+	return l;
+}
+
+/* Takes l out of the list and closes it. links_lock must be held. */
+static void link_close(BROKER_LINK * l)
+{
+	BROKER_LINK **p;
+
+	for (p = &links; *p; p = &(*p)->next) {
+		if (*p == l) {
+			*p = l->next;
+			break;
+		}
+	}
+	if (verbose) {
+		printf("closed %s (used %ld times)\n", l->address, l->uses);
+	}
+	tek_close(l->clink, l->address);
+	free(l);
+}
+
+/* Back in the pool, unless it can't be trusted any more */
+static void link_give_back(BROKER_LINK * l, BOOL keep)
+{
+	pthread_mutex_lock(&links_lock);
+	if (keep) {
+		l->busy = FALSE;
+		l->last_used = tek_time_us();
+	} else {
+		link_close(l);
+	}
+	pthread_mutex_unlock(&links_lock);
+}
+
+static void links_close_idle(double idle_us)
+{
+	BROKER_LINK *l, *next;
+	double now = tek_time_us();
+
+	pthread_mutex_lock(&links_lock);
+	for (l = links; l; l = next) {
+		next = l->next;
+		if (!l->busy && now - l->last_used >= idle_us) {
+			link_close(l);
+		}
+	}
+	pthread_mutex_unlock(&links_lock);
+}
+
+static int reply(int fd, const char *line)
+{
+	return tek_broker_write(fd, line, strlen(line));
+}
+
+static int reply_result(int fd, long n, const char *buf)
+{
+	char line[32];
+
+	snprintf(line, sizeof(line), "RET %ld\n", n);
+	if (reply(fd, line) != 0) {
+		return -1;
+	}
+	if (buf && n > 0) {
+		return tek_broker_write(fd, buf, n);
+	}
+	return 0;
+}
+
+static void list_links(int fd)
+{
+	BROKER_LINK *l;
+	char line[TEK_BROKER_LINE + 64];
+	double now = tek_time_us();
+
+	pthread_mutex_lock(&links_lock);
+	for (l = links; l; l = l->next) {
+		snprintf(line, sizeof(line), "%-32s %-6s %8ld uses %8.0f s idle\n",
+			 l->address, l->busy ? "in use" : "free", l->uses,
+			 l->busy ? 0 : (now - l->last_used) / 1e6);
+		reply(fd, line);
+	}
+	pthread_mutex_unlock(&links_lock);
+	reply(fd, "END\n");
+}
+
+static BOOL is_idn(const char *cmd, size_t len)
+{
+	while (len > 0 && (cmd[len - 1] == '\n' || cmd[len - 1] == ' ')) {
+		len--;
+	}
+	return len == 5 && strncasecmp(cmd, "*IDN?", 5) == 0;
+}
+
+/* Is there a query in cmd, i.e. will the instrument reply? Only the
+ * command part is looked at: a definite length block (an arb upload, say)
+ * can have any byte in it, '?' included. */
+static BOOL is_query(const char *cmd, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (cmd[i] == '#' && i + 1 < len
+		    && cmd[i + 1] >= '0' && cmd[i + 1] <= '9') {
+			return FALSE;
+		}
+		if (cmd[i] == '?') {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/* Makes sure buf has room for len bytes */
+static int grow(char **buf, size_t * buf_len, size_t len)
+{
+	char *p;
+
+	if (len <= *buf_len) {
+		return 0;
+	}
+	p = (char *)realloc(*buf, len);
+	if (!p) {
+		return -1;
+	}
+	*buf = p;
+	*buf_len = len;
+	return 0;
+}
+
+/* One of these for each program connected to us */
+static void *client_thread(void *arg)
+{
+	int fd = (int)(long)arg;
+	BROKER_LINK *l = NULL;
+	char line[TEK_BROKER_LINE];
+	char *buf = NULL;
+	size_t buf_len = 0;
+	unsigned long len, timeout;
+	long n;
+	long owed = 0;		/* queries gone, whose replies haven't been read */
+	BOOL broken = FALSE;	/* something's gone wrong on the link */
+	BOOL idn_cached = FALSE;	/* next recv gets the *IDN? we know */
+	BOOL idn_asked = FALSE;		/* next recv is the *IDN? reply */
+
+	while (tek_broker_read_line(fd, line, sizeof(line)) == 0) {
+		if (strncmp(line, "open ", 5) == 0) {
+			if (l) {
+				reply(fd, "ERR already open\n");
+				continue;
+			}
+			l = link_take(line + 5);
+			reply(fd, l ? "OK\n" : "ERR could not open a link\n");
+		} else if (sscanf(line, "send %lu", &len) == 1) {
+			if (grow(&buf, &buf_len, len) != 0
+			    || tek_broker_read(fd, buf, len) != 0) {
+				break;
+			}
+			if (!l) {
+				n = -1;
+			} else if (is_idn(buf, len) && l->idn_len > 0) {
+				idn_cached = TRUE;
+				n = 0;
+			} else {
+				n = tek_send(l->clink, buf, len);
+				if (is_query(buf, len)) {
+					owed++;
+				}
+				idn_asked = is_idn(buf, len);
+			}
+			if (n < 0) {
+				broken = TRUE;
+			}
+			reply_result(fd, n, NULL);
+		} else if (sscanf(line, "recv %lu %lu", &len, &timeout) == 2
+			   || sscanf(line, "block %lu %lu", &len,
+				     &timeout) == 2) {
+			if (grow(&buf, &buf_len, len) != 0) {
+				break;
+			}
+			if (!l) {
+				n = -1;
+			} else if (idn_cached) {
+				n = ((size_t)l->idn_len <= len) ? l->idn_len : -100;
+				memcpy(buf, l->idn, n > 0 ? n : 0);
+			} else if (line[0] == 'r') {
+				n = tek_receive(l->clink, buf, len, timeout);
+			} else {
+				n = tek_receive_data_block(l->clink, buf, len,
+							   timeout);
+			}
+			if (l && idn_asked && n > 0 && n < IDN_LEN) {
+				memcpy(l->idn, buf, n);
+				l->idn_len = n;
+			}
+			if (n < 0 && !idn_cached) {
+				broken = TRUE;
+			}
+			if (owed > 0 && !idn_cached) {
+				owed--;
+			}
+			idn_cached = idn_asked = FALSE;
+			reply_result(fd, n, buf);
+		} else if (strcmp(line, "list") == 0) {
+			list_links(fd);
+		} else if (strcmp(line, "stop") == 0) {
+			stop_requested = 1;
+			reply(fd, "OK\n");
+		} else {
+			reply(fd, "ERR what?\n");
+		}
+	}
+
+	if (l) {
+		link_give_back(l, owed == 0 && !broken);
+	}
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+/* -list and -stop: ask the broker that's running */
+static int ask_broker(const char *path, const char *request)
+{
+	char line[TEK_BROKER_LINE + 64];
+	int fd;
+
+	fd = tek_broker_connect(path);
+	if (fd < 0) {
+		printf("no broker running on %s\n", path);
+		return 1;
+	}
+	if (!tek_broker_peer_is_us(fd)) {
+		printf("error: the broker on %s isn't ours\n", path);
+		close(fd);
+		return 2;
+	}
+	tek_broker_write(fd, request, strlen(request));
+	while (tek_broker_read_line(fd, line, sizeof(line)) == 0) {
+		if (strcmp(line, "END") == 0 || strcmp(line, "OK") == 0) {
+			break;
+		}
+		printf("%s\n", line);
+	}
+	close(fd);
+	return 0;
+}
+
+/* The default socket's directory, which can be in /tmp, has to be ours and
+ * nobody else's, or someone could swap the socket for one of their own */
+static int make_socket_dir(const char *path)
+{
+	char dir[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+	struct stat st;
+	char *slash;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	slash = strrchr(dir, '/');
+	if (slash == NULL || slash == dir) {
+		return 0;
+	}
+	*slash = '\0';
+	mkdir(dir, S_IRWXU);
+	if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode)
+	    || st.st_uid != getuid() || (st.st_mode & (S_IRWXG | S_IRWXO))) {
+		printf("error: %s has to be a directory that only you can use, quitting...\n",
+		       dir);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	const char *path;
+	struct sockaddr_un addr;
+	struct pollfd pfd;
+	pthread_t thread;
+	BOOL list = FALSE;
+	BOOL stop = FALSE;
+	double idle = 600;
+	int index = 1;
+	int lfd, fd;
+
+	progname = argv[0];
+	path = tek_broker_path();
+	if (path == NULL) {
+		path = tek_broker_default_path();
+	}
+
+	while (index < argc) {
+		if (sc(argv[index], "-socket") || sc(argv[index], "-s")) {
+			path = argv[++index];
+		}
+
+		if (sc(argv[index], "-idle") || sc(argv[index], "-i")) {
+			sscanf(argv[++index], "%lg", &idle);
+		}
+
+		if (sc(argv[index], "-list") || sc(argv[index], "-l")) {
+			list = TRUE;
+		}
+
+		if (sc(argv[index], "-stop")) {
+			stop = TRUE;
+		}
+
+		if (sc(argv[index], "-verbose") || sc(argv[index], "-v")) {
+			verbose = TRUE;
+		}
+
+		if (sc(argv[index], "-help") || sc(argv[index], "-h")) {
+			printf("%s: keeps links to instruments open for the other programs\n",
+			       progname);
+			printf("Run using %s [arguments]\n\n", progname);
+			printf("OPTIONAL ARGUMENTS:\n");
+			printf("-s      -socket                  : Unix socket to listen on (default\n");
+			printf("                                   $TEK_BROKER, or %s)\n",
+			       tek_broker_default_path());
+			printf("-i      -idle                    : close links not used for this long\n");
+			printf("                                   (in seconds, default 600)\n");
+			printf("-v      -verbose                 : say when links are opened and closed\n");
+			printf("-l      -list                    : list the running broker's links\n");
+			printf("-stop                            : stop the running broker\n\n");
+			printf("While it's running, programs that use tek_open() get their links from it.\n");
+			printf("Set TEK_BROKER=none to stop them.\n\n");
+			printf("EXAMPLE:\n");
+			printf("%s &\n", progname);
+			printf("tgetwf -ip 128.243.74.98 -f test -c 1\n");
+			exit(1);
+		}
+
+		index++;
+	}
+
+	if (list) {
+		return ask_broker(path, "list\n");
+	}
+	if (stop) {
+		return ask_broker(path, "stop\n");
+	}
+
+	/* Our own links are real ones */
+	tek_broker_disable();
+
+	fd = tek_broker_connect(path);
+	if (fd >= 0) {
+		printf("error: there's already a broker on %s, quitting...\n",
+		       path);
+		close(fd);
+		exit(2);
+	}
+	if (strcmp(path, tek_broker_default_path()) == 0
+	    && make_socket_dir(path) != 0) {
+		exit(2);
+	}
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	unlink(path);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || listen(lfd, 64) < 0) {
+		printf("error: could not listen on %s, quitting...\n", path);
+		exit(2);
+	}
+	/* Anyone else's programs just don't use it (and they're turned away
+	 * below if they try) */
+	chmod(path, S_IRUSR | S_IWUSR);
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	signal(SIGPIPE, SIG_IGN);
+	printf("Broker listening on %s\n", path);
+	fflush(stdout);
+
+	pfd.fd = lfd;
+	pfd.events = POLLIN;
+	while (!stop_requested) {
+		if (poll(&pfd, 1, 1000) > 0) {
+			fd = accept(lfd, NULL, NULL);
+			if (fd >= 0 && !tek_broker_peer_is_us(fd)) {
+				reply(fd, "ERR not your broker\n");
+				close(fd);
+			} else if (fd >= 0) {
+				if (pthread_create(&thread, NULL, client_thread,
+						   (void *)(long)fd) == 0) {
+					pthread_detach(thread);
+				} else {
+					close(fd);
+				}
+			}
+		}
+		links_close_idle(idle * 1e6);
+		fflush(stdout);
+	}
+
+	/* Close the idle links. Any still in use belong to client threads
+	 * that are still running, so those are left for the exit to close. */
+	close(lfd);
+	unlink(path);
+	links_close_idle(0);
+	return 0;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
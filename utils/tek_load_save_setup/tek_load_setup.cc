@@ -7,6 +7,11 @@
  * the very simple steps required to begin communicating with your Tek scope
  * from Linux over ethernet, via the VXI11 RPC protocol.
  *
+ * With -diff, the current scope setup is read back and only the settings
+ * that differ are sent, which is a lot quicker when switching between
+ * setups that only differ in (say) the timebase. With -cache, a copy of the
+ * scope setup kept on disk is used instead of reading it back each time.
+ *
  * You will also need the
  * vxi11.tar.gz source, currently available from:
  * http://optics.eee.nottingham.ac.uk/vxi11/
@@ -33,39 +38,97 @@
 #include <string.h>
 
 #include "tek_vxi11.h"
-#define BUF_LEN 30000
+#include "tek_setup.h"
 
 int main(int argc, char *argv[])
 {
 
-	static char *device_ip;
-	static char *filename;
-	char buf[BUF_LEN];
+	static char *device_ip = NULL;
+	static char *filename = NULL;
+	static char *cache_filename = NULL;
+	int diff = 0;
+	int index;
+	int ret;
 
-	FILE *fi;
-	long bytes_returned;
+	TEK_SETUP *target;
+	TEK_SETUP *current = NULL;
 	VXI11_CLINK *clink;
 
-	if (argc != 3) {
-		printf("usage: %s www.xxx.yyy.zzz filename.tss\n", argv[0]);
+	for (index = 1; index < argc; index++) {
+		if (strcmp(argv[index], "-diff") == 0
+		    || strcmp(argv[index], "-d") == 0) {
+			diff = 1;
+		} else if ((strcmp(argv[index], "-cache") == 0
+			    || strcmp(argv[index], "-c") == 0)
+			   && index + 1 < argc) {
+			cache_filename = argv[++index];
+			diff = 1;
+		} else if (!device_ip) {
+			device_ip = argv[index];
+		} else if (!filename) {
+			filename = argv[index];
+		} else {
+			device_ip = NULL;	/* too many arguments */
+			break;
+		}
+	}
+
+	if (!device_ip || !filename) {
+		printf("usage: %s [-diff] [-cache cache.tss] www.xxx.yyy.zzz filename.tss\n", argv[0]);
 		printf
 		    ("Uploads the .tss (Tek Scope Setup) file to a Tektronix scope\n");
+		printf
+		    ("-d  -diff         : only send the commands that differ from the scope's\n");
+		printf
+		    ("                    current setup (which is read first)\n");
+		printf
+		    ("-c  -cache file   : as -diff, but compare against a cached copy of the\n");
+		printf
+		    ("                    scope setup kept in 'file' instead of reading it; the\n");
+		printf
+		    ("                    cache is created if missing and updated afterwards.\n");
+		printf
+		    ("                    Only use this if nobody else changes the scope settings!\n");
 		exit(1);
 	}
-	device_ip = argv[1];
-	filename = argv[2];
 
-	fi = fopen(filename, "r");
-	if (fi > 0) {
-		bytes_returned = fread((char *)buf, sizeof(char), BUF_LEN, fi);
-		fclose(fi);
+	target = tek_setup_load(filename);
+	if (target) {
 		if(tek_open(&clink, device_ip)){
 			printf("Quitting...\n");
 			exit(2);
 		}
 
-		tek_scope_send_setup(clink, buf, strlen(buf));
+		if (diff == 0) {
+			ret = tek_scope_send_setup_tree(clink, target);
+		} else {
+			if (cache_filename) {
+				current = tek_setup_load(cache_filename);
+				if (!current) {
+					/* no cache yet, so ask the scope */
+					current = tek_scope_get_setup_tree(clink);
+				}
+				if (!current) {
+					printf("Problem reading the setup, quitting...\n");
+					exit(2);
+				}
+			}
+			ret = tek_scope_send_setup_diff(clink, current, target);
+			if (ret >= 0) {
+				printf("%d of %d settings changed.\n", ret,
+				       target->no_cmds);
+			}
+			if (ret >= 0 && cache_filename) {
+				tek_setup_save(current, cache_filename);
+			}
+		}
+		if (ret < 0) {
+			printf("Problem sending the setup, quitting...\n");
+			exit(2);
+		}
 
+		tek_setup_free(current);
+		tek_setup_free(target);
 		tek_close(clink, device_ip);
 	} else {
 		printf("error: could not open file for reading, quitting...\n");
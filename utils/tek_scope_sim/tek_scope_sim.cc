@@ -0,0 +1,891 @@
+/* tek_scope_sim.cc
+ * A stand-in for a Tektronix DPO4000-series scope, talking raw SCPI over a
+ * TCP socket (the same as the scope's "socket server"). It knows just
+ * enough commands for the tek_vxi11 library and the utilities to work
+ * against it: timebase, record length, DATA:START/STOP/SOURCE, acquisition
+ * modes, *OPC? and CURVE? (which returns a made-up, but repeatable,
+ * waveform). Acquisitions take as long as you tell it (-a), and it keeps
+ * the IEEE 488.2 status registers, so *OPC with *ESE and *SRE raises a
+ * service request in the status byte (*STB?) when one finishes, as the
+ * real thing does. FastFrame trigger timestamps come from a steady 10 kHz
+ * trigger with a little jitter and the odd misfire, and DATA:SOURCE
+ * DIGITAL gives made-up D0-D15 lines. It also has an AFG3000's edit and
+ * user memories for arbitrary waveforms (TRACE:DATA, TRACE:DATA?,
+ * TRACE:DATA:VALUE?, TRACE:COPY and DATA:POINTS?), so it can stand in for the AFG too. Useful for trying things out, and for throughput comparisons,
+ * without tying up a real scope.
+ *
+ * Connect with e.g.  tgetwf -ip socket:localhost:4000 -f test -c 1
+ * Each connection is served by its own process, so several links can be
+ * open at once. They all talk to the same pretend scope, which, like the
+ * real one, deals with one message at a time.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <math.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+BOOL sc(const char *, const char *);
+
+/* ACQUIRE:MAXSAMPLERATE? of a DPO4034 */
+#define SIM_MAX_SAMPLE_RATE	2.5e9
+
+/* Arbitrary waveform memories, as on an AFG3000 */
+#define SIM_ARB_SLOTS	5
+#define SIM_ARB_LEN	262144
+
+/* The state of our pretend scope */
+typedef struct {
+	long record_length;
+	double hor_scale;
+	long data_start, data_stop;
+	char source[16];
+	char acq_mode[16];
+	int numavg;
+	int acq_state;
+	int stop_after_sequence;
+	int fastframe_state;
+	int fastframe_count;
+	int frame_start, frame_stop;
+	int acq_ms;		/* how long one acquisition takes */
+	double acq_done_at;	/* when the current one finishes (now_us()) */
+	unsigned long trigger_count;
+	time_t started;		/* wall clock, for the trigger timestamps */
+	int esr, ese, sre;	/* status registers */
+	int opc_pending;	/* *OPC waiting for the acquisition */
+	char *arbs;		/* edit memory, then USER1-4 (shared too) */
+	long arb_bytes[SIM_ARB_SLOTS];
+	pthread_mutex_t lock;	/* shared between all the connections */
+} SIM;
+
+typedef struct {
+	int fd;
+	char *out;
+	size_t out_len, out_alloc;
+	/* CURVE? data still to be made up (see sim_curve) */
+	BOOL curve_pending;
+	SIM curve_sim;
+	size_t curve_at;
+} CONN;
+
+static void out_append(CONN * c, const char *buf, size_t len)
+{
+	if (c->out_len + len > c->out_alloc) {
+		c->out_alloc = 2 * (c->out_len + len);
+		c->out = (char *)realloc(c->out, c->out_alloc);
+	}
+	memcpy(c->out + c->out_len, buf, len);
+	c->out_len += len;
+}
+
+static void out_printf(CONN * c, const char *fmt, ...)
+    __attribute__ ((format(printf, 2, 3)));
+
+static void out_printf(CONN * c, const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (c->out_len > 0) {
+		/* replies to several queries in one message are joined with
+		 * semicolons */
+		out_append(c, ";", 1);
+	}
+	out_append(c, buf, n);
+}
+
+static void out_flush(CONN * c)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	if (c->out_len == 0) {
+		return;
+	}
+	out_append(c, "\n", 1);
+	while (done < c->out_len) {
+		n = send(c->fd, c->out + done, c->out_len - done, MSG_NOSIGNAL);
+		if (n <= 0) {
+			break;
+		}
+		done += n;
+	}
+	c->out_len = 0;
+}
+
+/* Does the header "hdr" match the pattern? Patterns are written as
+ * colon-separated mnemonics with a '|' between the short form (which must
+ * be there) and the rest of the long form (which is optional), e.g.
+ * "HOR|IZONTAL:RECO|RDLENGTH". Case doesn't matter. */
+static BOOL match(const char *hdr, const char *pattern)
+{
+	const char *h = hdr, *p = pattern;
+	size_t hl = strlen(hdr), pl = strlen(pattern);
+	int in_long;
+
+	/* a query only matches a query */
+	if (hl == 0 || pl == 0
+	    || (hdr[hl - 1] == '?') != (pattern[pl - 1] == '?')) {
+		return FALSE;
+	}
+	while (*p && *p != '?') {
+		in_long = 0;
+		while (*p && *p != ':' && *p != '?') {
+			if (*p == '|') {
+				in_long = 1;
+				p++;
+				continue;
+			}
+			if (*h && *h != ':' && *h != '?'
+			    && (*h & ~0x20) == (*p & ~0x20)) {
+				h++;
+				p++;
+			} else if (in_long && (*h == ':' || *h == '?' || *h == '\0')) {
+				while (*p && *p != ':' && *p != '?') {
+					p++;
+				}
+			} else {
+				return FALSE;
+			}
+		}
+		if (*h && *h != ':' && *h != '?') {
+			return FALSE;
+		}
+		if (*p == ':') {
+			if (*h != ':') {
+				return FALSE;
+			}
+			p++;
+			h++;
+		}
+	}
+	return *h == '\0' || (*h == '?' && h[1] == '\0');
+}
+
+/* The length of the data in the definite length block (#<n><length><data>)
+ * at p */
+static long sim_block_length(const char *p)
+{
+	char digits[10];
+
+	snprintf(digits, sizeof(digits), "%.*s", p[1] - '0', p + 2);
+	return atol(digits);
+}
+
+/* Finds the first ch from p onwards that isn't inside a definite length
+ * block. Returns NULL if there isn't one, or if there's a block that hasn't
+ * all arrived yet. */
+static char *sim_find(char *p, char *end, char ch)
+{
+	int n;
+
+	while (p < end) {
+		if (*p == ch) {
+			return p;
+		}
+		if (*p == '#' && p + 1 < end && p[1] >= '1' && p[1] <= '9') {
+			n = p[1] - '0';
+			if (p + 2 + n > end) {
+				return NULL;
+			}
+			p += 2 + n + sim_block_length(p);
+		} else {
+			p++;
+		}
+	}
+	return NULL;
+}
+
+/* EMEMORY is 0, USER1-4 are 1-4 */
+static int sim_arb_slot(const char *name)
+{
+	if (strncasecmp(name, "EMEM", 4) == 0) {
+		return 0;
+	}
+	if (strncasecmp(name, "USER", 4) == 0) {
+		return (name[4] >= '1' && name[4] <= '4') ? name[4] - '0' : 1;
+	}
+	return -1;
+}
+
+static void sim_arb_data(SIM * sim, const char *arg)
+{
+	const char *p = strchr(arg, '#');
+	long len;
+
+	if (p == NULL || p[1] < '1' || p[1] > '9' || sim_arb_slot(arg) != 0) {
+		return;
+	}
+	len = sim_block_length(p);
+	if (len > SIM_ARB_LEN) {
+		len = SIM_ARB_LEN;
+	}
+	memcpy(sim->arbs, p + 2 + (p[1] - '0'), len);
+	sim->arb_bytes[0] = len;
+}
+
+/* TRACE:COPY <to>,<from> */
+static void sim_arb_copy(SIM * sim, const char *arg)
+{
+	const char *comma = strchr(arg, ',');
+	int to, from;
+
+	to = sim_arb_slot(arg);
+	from = comma ? sim_arb_slot(comma + 1) : -1;
+	if (to < 0 || from < 0 || to == from) {
+		return;
+	}
+	memcpy(sim->arbs + to * SIM_ARB_LEN, sim->arbs + from * SIM_ARB_LEN,
+	       sim->arb_bytes[from]);
+	sim->arb_bytes[to] = sim->arb_bytes[from];
+}
+
+/* TRACE:DATA:VALUE? EMEMORY,<point>, from 1 */
+static long sim_arb_value(SIM * sim, const char *arg)
+{
+	const char *comma = strchr(arg, ',');
+	long point = comma ? atol(comma + 1) : 0;
+	const unsigned char *p;
+
+	if (sim_arb_slot(arg) != 0 || point < 1
+	    || 2 * point > sim->arb_bytes[0]) {
+		return 0;
+	}
+	p = (const unsigned char *)sim->arbs + 2 * (point - 1);
+	return (p[0] << 8) | p[1];	/* big-endian, as sent */
+}
+
+static long sim_points(SIM * sim)
+{
+	long n = sim->data_stop - sim->data_start + 1;
+
+	if (sim->data_stop > sim->record_length) {
+		n = sim->record_length - sim->data_start + 1;
+	}
+	return (n > 0) ? n : 0;
+}
+
+static double sim_sample_rate(SIM * sim)
+{
+	return sim->record_length / (10.0 * sim->hor_scale);
+}
+
+/* Makes up one frame of data: a decaying sine wave, with a bit of
+ * deterministic "noise" so that each trigger is slightly different. The
+ * noise depends only on the trigger and the point, so any part of a record
+ * is the same whichever way you ask for it. */
+static void sim_waveform(SIM * sim, short *data, long n, long first,
+			 unsigned long trigger)
+{
+	long i;
+	double t, x;
+	double f = 4.0 / (10.0 * sim->hor_scale);	/* 4 cycles on screen */
+	double dt = 1.0 / sim_sample_rate(sim);
+	int ch = (sim->source[0] == 'C') ? sim->source[2] - '0' : 1;
+	unsigned long r;
+
+	/* DIGITAL is all of D0-D15 at once: D0-D7 count up, D8 goes high
+	 * after the trigger, the rest stay low, as on a quiet bus */
+	if (strncasecmp(sim->source, "DIG", 3) == 0) {
+		for (i = 0; i < n; i++) {
+			data[i] = (short)((((first + i) >> 4) & 0xff)
+					  | ((first + i >= sim->record_length / 2) << 8));
+		}
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		t = (first + i - sim->record_length / 2) * dt;
+		x = (t >= 0) ? sin(2 * M_PI * f * ch * t) * exp(-t * f) : 0;
+		r = 2463534242UL * (trigger + 1) * ch + 2654435761UL * (first + i);
+		r ^= r << 13;
+		r ^= r >> 17;
+		r ^= r << 5;
+		data[i] = (short)(20000 * x / ch) + (short)(r % 64) - 32;
+	}
+}
+
+/* Answers CURVE?. Only the block header goes in now; the data itself is
+ * made up by sim_curve_data() once we've let go of the scope, so that
+ * several connections can be doing it at once, as they would be sending
+ * it on a real scope. */
+static void sim_curve(SIM * sim, CONN * c)
+{
+	long n, frames, bytes;
+	char hdr[24];
+
+	n = sim_points(sim);
+	frames = 1;
+	if (sim->fastframe_state) {
+		frames = sim->frame_stop - sim->frame_start + 1;
+		if (frames < 1) {
+			frames = 1;
+		}
+	}
+	bytes = 2 * n * frames;
+	snprintf(hdr, sizeof(hdr), "%ld", bytes);
+	out_printf(c, "#%d%s", (int)strlen(hdr), hdr);
+	c->curve_at = c->out_len;
+	c->curve_sim = *sim;
+	c->curve_pending = TRUE;
+	if (c->out_len + bytes > c->out_alloc) {
+		c->out_alloc = 2 * (c->out_len + bytes);
+		c->out = (char *)realloc(c->out, c->out_alloc);
+	}
+	c->out_len += bytes;
+}
+
+static void sim_curve_data(CONN * c)
+{
+	SIM *sim = &c->curve_sim;
+	long n, frames, f;
+	short *data;
+
+	n = sim_points(sim);
+	frames = 1;
+	if (sim->fastframe_state) {
+		frames = sim->frame_stop - sim->frame_start + 1;
+		if (frames < 1) {
+			frames = 1;
+		}
+	}
+	data = (short *)malloc(n > 0 ? 2 * n : 1);
+	for (f = 0; f < frames; f++) {
+		sim_waveform(sim, data, n, sim->data_start - 1,
+			     sim->trigger_count + sim->frame_start - 1 + f);
+		memcpy(c->out + c->curve_at + 2 * n * f, data, 2 * n);
+	}
+	free(data);
+	c->curve_pending = FALSE;
+}
+
+/* Trigger k happens every 100 us, give or take a ns; about one in a
+ * hundred is a misfire, a third of the way through the interval before */
+#define SIM_TRIGGER_PS	100000000LL
+
+static int64_t sim_trigger_ps(unsigned long k)
+{
+	unsigned long r = 2654435761UL * (k + 1);
+	int64_t t = (int64_t) k * SIM_TRIGGER_PS;
+
+	r ^= r << 13;
+	r ^= r >> 17;
+	r ^= r << 5;
+	if (k > 0 && r % 97 == 0) {
+		t -= SIM_TRIGGER_PS * 7 / 10;
+	}
+	return t + (int64_t) (r % 2001) - 1000;
+}
+
+/* Answers HORIZONTAL:FASTFRAME:TIMESTAMP:ALL:<source>? first,count, e.g.
+ * "17 Oct 2026 09:12:45.123 456 789 012","17 Oct 2026 ..." which is too
+ * long for out_printf() */
+static void sim_timestamps(SIM * sim, CONN * c, const char *arg)
+{
+	static const char *months[12] = { "Jan", "Feb", "Mar", "Apr", "May",
+		"Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+	};
+	long first = 1, count = 1, f;
+	int64_t t, ps;
+	time_t secs;
+	struct tm tm;
+	char buf[64];
+	int n;
+
+	sscanf(arg, "%ld,%ld", &first, &count);
+	if (first < 1) {
+		first = 1;
+	}
+	if (count > sim->fastframe_count - first + 1) {
+		count = sim->fastframe_count - first + 1;
+	}
+	if (c->out_len > 0) {
+		out_append(c, ";", 1);
+	}
+	for (f = 0; f < count; f++) {
+		t = sim_trigger_ps(sim->trigger_count + first - 1 + f);
+		secs = sim->started + (time_t) (t / 1000000000000LL);
+		ps = t % 1000000000000LL;
+		gmtime_r(&secs, &tm);
+		n = snprintf(buf, sizeof(buf),
+			     "%s\"%02d %s %04d %02d:%02d:%02d.%03d %03d %03d %03d\"",
+			     f ? "," : "", tm.tm_mday, months[tm.tm_mon],
+			     tm.tm_year + 1900, tm.tm_hour, tm.tm_min,
+			     tm.tm_sec, (int)(ps / 1000000000),
+			     (int)(ps / 1000000 % 1000), (int)(ps / 1000 % 1000),
+			     (int)(ps % 1000));
+		out_append(c, buf, n);
+	}
+}
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Starts an acquisition; it finishes in its own time (see sim_update) */
+static void sim_start(SIM * sim)
+{
+	int avg = 1;
+
+	if (strncasecmp(sim->acq_mode, "AVE", 3) == 0) {
+		avg = sim->numavg;
+	}
+	sim->acq_state = 1;
+	sim->acq_done_at = now_us() + 1000.0 * sim->acq_ms * avg;
+}
+
+/* Brings things up to date: if the acquisition has finished by now, count
+ * the triggers, stop (single sequence) or start the next one (run/stop),
+ * and set "operation complete" if anyone's waiting for it, which raises a
+ * service request if *ESE and *SRE say so. */
+static void sim_update(SIM * sim)
+{
+	if (!sim->acq_state || now_us() < sim->acq_done_at) {
+		return;
+	}
+	sim->trigger_count += sim->fastframe_state ? sim->fastframe_count : 1;
+	if (sim->stop_after_sequence) {
+		sim->acq_state = 0;
+		if (sim->opc_pending) {
+			sim->esr |= 1;
+			sim->opc_pending = 0;
+		}
+	} else {
+		sim_start(sim);
+	}
+}
+
+/* Waits for the current acquisition to finish (for *OPC?) */
+static void sim_acquire(SIM * sim)
+{
+	double wait;
+
+	/* let the other connections carry on meanwhile */
+	while ((wait = sim->acq_done_at - now_us()) > 0 && sim->acq_state) {
+		pthread_mutex_unlock(&sim->lock);
+		usleep((useconds_t) wait);
+		pthread_mutex_lock(&sim->lock);
+	}
+	sim_update(sim);
+}
+
+static int sim_stb(SIM * sim)
+{
+	int stb = 0;
+
+	sim_update(sim);
+	if (sim->esr & sim->ese) {
+		stb |= 32;	/* ESB */
+	}
+	if (stb & sim->sre) {
+		stb |= 64;	/* MSS, i.e. SRQ */
+	}
+	return stb;
+}
+
+/* Handles one command or query, with its full header */
+static void sim_command(SIM * sim, CONN * c, const char *hdr, const char *arg)
+{
+	char ts_hdr[512];
+	const char *p;
+
+	/* the timestamp query has the source as its last mnemonic, so match
+	 * it without */
+	p = strrchr(hdr, ':');
+	snprintf(ts_hdr, sizeof(ts_hdr), "%.*s?", p ? (int)(p - hdr) : 0, hdr);
+
+	/* Queries */
+	if (sc(hdr, "*IDN?")) {
+		out_printf(c, "TEKTRONIX,DPO4034,SIM0001,CF:91.1CT FV:v2.16");
+	} else if (match(hdr, "DATA:POIN|TS?")) {
+		out_printf(c, "%ld", sim->arb_bytes[0] / 2);
+	} else if (match(hdr, "TRAC|E:DATA:VAL|UE?")
+		   || match(hdr, "DATA:DATA:VAL|UE?")) {
+		out_printf(c, "%ld", sim_arb_value(sim, arg));
+	} else if (match(hdr, "TRAC|E:DATA?") || match(hdr, "DATA:DATA?")) {
+		out_printf(c, "#8%08ld", sim->arb_bytes[0]);
+		out_append(c, sim->arbs, sim->arb_bytes[0]);
+	} else if (sc(hdr, "*OPC?")) {
+		if (sim->acq_state) {
+			sim_acquire(sim);
+		}
+		out_printf(c, "1");
+	} else if (sc(hdr, "*ESR?")) {
+		sim_update(sim);
+		out_printf(c, "%d", sim->esr);
+		sim->esr = 0;
+	} else if (sc(hdr, "*STB?")) {
+		out_printf(c, "%d", sim_stb(sim));
+	} else if (sc(hdr, "*ESE?")) {
+		out_printf(c, "%d", sim->ese);
+	} else if (sc(hdr, "*SRE?")) {
+		out_printf(c, "%d", sim->sre);
+	} else if (sc(hdr, "BUSY?")) {
+		sim_update(sim);
+		out_printf(c, "%d", sim->acq_state && sim->stop_after_sequence);
+	} else if (match(hdr, "HOR|IZONTAL:RECO|RDLENGTH?")
+		   || match(hdr, "HOR|IZONTAL:RECORD?")) {
+		out_printf(c, "%ld", sim->record_length);
+	} else if (match(hdr, "HOR|IZONTAL:MAI|N:SCA|LE?")) {
+		out_printf(c, "%g", sim->hor_scale);
+	} else if (match(hdr, "HOR|IZONTAL:MAI|N:SAMPLER|ATE?")) {
+		out_printf(c, "%g", sim_sample_rate(sim));
+	} else if (match(hdr, "HOR|IZONTAL:FAST|FRAME:MAXF|RAMES?")) {
+		out_printf(c, "%ld", 20000000L / sim->record_length);
+	} else if (match(hdr, "WFMP|RE:XINC|R?")
+		   || match(hdr, "WFMO|UTPRE:XINC|R?")) {
+		out_printf(c, "%g", 1.0 / sim_sample_rate(sim));
+	} else if (match(hdr, "WFMP|RE:XZE|RO?")
+		   || match(hdr, "WFMO|UTPRE:XZE|RO?")) {
+		out_printf(c, "%g", -5 * sim->hor_scale);
+	} else if (match(hdr, "WFMP|RE:YMU|LT?")
+		   || match(hdr, "WFMO|UTPRE:YMU|LT?")) {
+		out_printf(c, "%g", 1.0 / 25000);
+	} else if (match(hdr, "WFMP|RE:YOF|F?")
+		   || match(hdr, "WFMO|UTPRE:YOF|F?")
+		   || match(hdr, "WFMP|RE:YZE|RO?")
+		   || match(hdr, "WFMO|UTPRE:YZE|RO?")) {
+		out_printf(c, "0");
+	} else if (match(hdr, "DAT|A:STAR|T?")) {
+		out_printf(c, "%ld", sim->data_start);
+	} else if (match(hdr, "DAT|A:STOP?")) {
+		out_printf(c, "%ld", sim->data_stop);
+	} else if (match(hdr, "DAT|A:FRAMESTAR|T?")) {
+		out_printf(c, "%d", sim->frame_start);
+	} else if (match(hdr, "DAT|A:FRAMESTO|P?")) {
+		out_printf(c, "%d", sim->frame_stop);
+	} else if (match(hdr, "HOR|IZONTAL:FAST|FRAME:STATE?")) {
+		out_printf(c, "%d", sim->fastframe_state);
+	} else if (match(hdr, "HOR|IZONTAL:FAST|FRAME:COUN|T?")) {
+		out_printf(c, "%d", sim->fastframe_count);
+	} else if (hdr[strlen(hdr) - 1] == '?'
+		   && match(ts_hdr, "HOR|IZONTAL:FAST|FRAME:TIMES|TAMP:ALL?")) {
+		sim_timestamps(sim, c, arg);
+	} else if (match(hdr, "DAT|A:SOU|RCE?")) {
+		out_printf(c, "%s", sim->source);
+	} else if (match(hdr, "ACQ|UIRE:MOD|E?")) {
+		out_printf(c, "%s", sim->acq_mode);
+	} else if (match(hdr, "ACQ|UIRE:MAXS|AMPLERATE?")) {
+		out_printf(c, "%g", SIM_MAX_SAMPLE_RATE);
+	} else if (match(hdr, "ACQ|UIRE:NUMAV|G?")) {
+		out_printf(c, "%d", sim->numavg);
+	} else if (match(hdr, "ACQ|UIRE:NUMENV?")) {
+		out_printf(c, "INFINITE");
+	} else if (match(hdr, "ACQ|UIRE:STATE?")) {
+		sim_update(sim);
+		out_printf(c, "%d", sim->acq_state);
+	} else if (match(hdr, "ACQ|UIRE:STOPA|FTER?")) {
+		out_printf(c, "%s",
+			   sim->stop_after_sequence ? "SEQUENCE" : "RUNSTOP");
+	} else if (match(hdr, "CURV|E?")) {
+		sim_curve(sim, c);
+	} else if (match(hdr, "SET?")) {
+		out_printf(c, ":ACQUIRE:STOPAFTER %s;STATE %d;MODE %s;NUMAVG %d;:HORIZONTAL:MAIN:SCALE %g;:HORIZONTAL:RECORDLENGTH %ld",
+			   sim->stop_after_sequence ? "SEQUENCE" : "RUNSTOP",
+			   sim->acq_state, sim->acq_mode, sim->numavg,
+			   sim->hor_scale, sim->record_length);
+	} else if (hdr[strlen(hdr) - 1] == '?') {
+		out_printf(c, "0");
+
+	/* Commands */
+	} else if (match(hdr, "HOR|IZONTAL:RECO|RDLENGTH")) {
+		sim->record_length = atol(arg);
+		if (sim->record_length <= 1000) {
+			sim->record_length = 1000;
+		} else if (sim->record_length <= 10000) {
+			sim->record_length = 10000;
+		} else if (sim->record_length <= 100000) {
+			sim->record_length = 100000;
+		} else if (sim->record_length <= 1000000) {
+			sim->record_length = 1000000;
+		} else {
+			sim->record_length = 10000000;
+		}
+	} else if (match(hdr, "HOR|IZONTAL:MAI|N:SCA|LE")) {
+		sim->hor_scale = atof(arg);
+	} else if (match(hdr, "DAT|A:STAR|T")) {
+		sim->data_start = atol(arg);
+	} else if (match(hdr, "DAT|A:STOP")) {
+		sim->data_stop = atol(arg);
+	} else if (match(hdr, "DAT|A:SOU|RCE")) {
+		snprintf(sim->source, sizeof(sim->source), "%s", arg);
+	} else if (match(hdr, "DAT|A:FRAMESTAR|T")) {
+		sim->frame_start = atoi(arg);
+	} else if (match(hdr, "DAT|A:FRAMESTO|P")) {
+		sim->frame_stop = atoi(arg);
+	} else if (match(hdr, "ACQ|UIRE:MOD|E")) {
+		snprintf(sim->acq_mode, sizeof(sim->acq_mode), "%.3s", arg);
+	} else if (match(hdr, "ACQ|UIRE:NUMAV|G")) {
+		sim->numavg = atoi(arg);
+	} else if (match(hdr, "ACQ|UIRE:STATE")) {
+		if (atoi(arg) || strncasecmp(arg, "RUN", 3) == 0
+		    || strncasecmp(arg, "ON", 2) == 0) {
+			sim_start(sim);
+		} else {
+			sim->acq_state = 0;
+			if (sim->opc_pending) {
+				sim->esr |= 1;
+				sim->opc_pending = 0;
+			}
+		}
+	} else if (sc(hdr, "*OPC")) {
+		/* in run/stop mode there's nothing to wait for */
+		sim_update(sim);
+		if (sim->acq_state && sim->stop_after_sequence) {
+			sim->opc_pending = 1;
+		} else {
+			sim->esr |= 1;
+		}
+	} else if (sc(hdr, "*CLS")) {
+		sim->esr = 0;
+		sim->opc_pending = 0;
+	} else if (sc(hdr, "*ESE")) {
+		sim->ese = atoi(arg);
+	} else if (sc(hdr, "*SRE")) {
+		sim->sre = atoi(arg);
+	} else if (match(hdr, "ACQ|UIRE:STOPA|FTER")) {
+		sim->stop_after_sequence = (strncasecmp(arg, "SEQ", 3) == 0);
+	} else if (match(hdr, "TRAC|E:DATA") || match(hdr, "DATA:DATA")) {
+		sim_arb_data(sim, arg);
+	} else if (match(hdr, "TRAC|E:COPY") || match(hdr, "DATA:COPY")) {
+		sim_arb_copy(sim, arg);
+	} else if (match(hdr, "HOR|IZONTAL:FAST|FRAME:STATE")) {
+		sim->fastframe_state = atoi(arg);
+	} else if (match(hdr, "HOR|IZONTAL:FAST|FRAME:COUN|T")) {
+		sim->fastframe_count = atoi(arg);
+	}
+	/* Anything else is quietly accepted and ignored */
+}
+
+/* Splits a program message into commands, keeping track of the SCPI
+ * "current branch" so that relative headers work, and hands each one to
+ * sim_command() with its full header. */
+static void sim_message(SIM * sim, CONN * c, char *msg, char *end)
+{
+	char branch[256] = "";
+	char hdr[512];
+	char *cmd, *next, *arg, *p;
+
+	for (cmd = msg; cmd; cmd = next) {
+		next = sim_find(cmd, end, ';');
+		if (next) {
+			*next++ = '\0';
+		}
+		while (*cmd == ' ' || *cmd == '\t') {
+			cmd++;
+		}
+		if (*cmd == '\0') {
+			continue;
+		}
+		arg = cmd + strcspn(cmd, " \t");
+		if (*arg) {
+			*arg++ = '\0';
+			while (*arg == ' ' || *arg == '\t') {
+				arg++;
+			}
+		}
+		if (cmd[0] == '*') {
+			snprintf(hdr, sizeof(hdr), "%s", cmd);
+		} else if (cmd[0] == ':') {
+			snprintf(hdr, sizeof(hdr), "%s", cmd + 1);
+		} else {
+			snprintf(hdr, sizeof(hdr), "%s%s", branch, cmd);
+		}
+		if (cmd[0] != '*') {
+			p = strrchr(hdr, ':');
+			if (p) {
+				snprintf(branch, sizeof(branch), "%.*s",
+					 (int)(p - hdr + 1), hdr);
+			} else {
+				branch[0] = '\0';
+			}
+		}
+		sim_command(sim, c, hdr, arg);
+	}
+}
+
+static void serve(SIM * sim, int fd)
+{
+	CONN c;
+	char *buf = NULL, *nl, *start;
+	size_t alloc = 65536, len = 0;
+	ssize_t n;
+
+	memset(&c, 0, sizeof(c));
+	c.fd = fd;
+	buf = (char *)malloc(alloc);
+	for (;;) {
+		if (len == alloc) {
+			alloc *= 2;
+			buf = (char *)realloc(buf, alloc);
+		}
+		n = recv(fd, buf + len, alloc - len, 0);
+		if (n <= 0) {
+			break;
+		}
+		len += n;
+		start = buf;
+		while ((nl = sim_find(start, buf + len, '\n'))) {
+			*nl = '\0';
+			if (nl > start && nl[-1] == '\r') {
+				nl[-1] = '\0';
+			}
+			pthread_mutex_lock(&sim->lock);
+			sim_message(sim, &c, start, nl);
+			pthread_mutex_unlock(&sim->lock);
+			if (c.curve_pending) {
+				sim_curve_data(&c);
+			}
+			out_flush(&c);
+			start = nl + 1;
+		}
+		len -= start - buf;
+		memmove(buf, start, len);
+	}
+	free(buf);
+	free(c.out);
+	close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	int port = 4000;
+	int acq_ms = 0;
+	int index = 1;
+	int lfd, fd, one = 1;
+	struct sockaddr_in addr;
+	pthread_mutexattr_t attr;
+	SIM *sim;
+
+	while (index < argc) {
+		if (sc(argv[index], "-port") || sc(argv[index], "-p")) {
+			sscanf(argv[++index], "%d", &port);
+		} else if (sc(argv[index], "-acq_time") || sc(argv[index], "-a")) {
+			sscanf(argv[++index], "%d", &acq_ms);
+		} else {
+			printf("%s: pretends to be a Tek DPO4000 scope, on a raw SCPI socket\n",
+			       argv[0]);
+			printf("Run using %s [arguments]\n\n", argv[0]);
+			printf("OPTIONAL ARGUMENTS:\n");
+			printf("-p      -port                    : TCP port to listen on (default 4000)\n");
+			printf("-a      -acq_time                : time for each acquisition (ms, default 0)\n\n");
+			printf("EXAMPLE:\n");
+			printf("%s -p 4000 & tgetwf -ip socket:localhost:4000 -f test -c 1\n",
+			       argv[0]);
+			exit(1);
+		}
+		index++;
+	}
+
+	/* The scope itself, shared by all the connections' processes */
+	sim = (SIM *) mmap(NULL, sizeof(SIM), PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sim == MAP_FAILED) {
+		printf("error: could not allocate shared memory, quitting...\n");
+		exit(2);
+	}
+	memset(sim, 0, sizeof(SIM));
+	sim->arbs = (char *)mmap(NULL, SIM_ARB_SLOTS * SIM_ARB_LEN,
+				 PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sim->arbs == MAP_FAILED) {
+		printf("error: could not allocate shared memory, quitting...\n");
+		exit(2);
+	}
+	sim->record_length = 10000;
+	sim->hor_scale = 1e-6;
+	sim->data_start = 1;
+	sim->data_stop = 10000;
+	strcpy(sim->source, "CH1");
+	strcpy(sim->acq_mode, "SAMPLE");
+	sim->numavg = 16;
+	sim->fastframe_count = 1;
+	sim->frame_start = sim->frame_stop = 1;
+	sim->acq_ms = acq_ms;
+	sim->started = time(NULL);
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&sim->lock, &attr);
+	sim_start(sim);
+
+	signal(SIGCHLD, SIG_IGN);	/* don't leave zombies */
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || listen(lfd, 8) < 0) {
+		printf("error: could not listen on port %d, quitting...\n", port);
+		exit(2);
+	}
+	for (;;) {
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			continue;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (fork() == 0) {
+			close(lfd);
+			serve(sim, fd);
+			exit(0);
+		}
+		close(fd);
+	}
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcasecmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
@@ -0,0 +1,398 @@
+/* tek_session_bench.cc
+ * How long do quick control queries have to wait while another thread is
+ * pulling traces off the same scope? Runs the same workload three ways:
+ *  - one link shared with a plain mutex (what you'd do without a session)
+ *  - a session (tek_session.h), downloading each trace in one go
+ *  - a session, downloading in chunks, so control queries get in between
+ * One thread downloads traces as fast as it can while the others each ask
+ * ACQUIRE:MODE? every few ms, and the time each query takes is recorded.
+ * It also times handing requests to a session from several threads at
+ * once, with no I/O involved, to show what the queue itself costs.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "tek_vxi11.h"
+#include "tek_transport.h"
+#include "tek_session.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+BOOL sc(const char *, const char *);
+
+#define MAX_CONTROL	32
+#define MODE_MUTEX	0
+#define MODE_SESSION	1
+#define MODE_CHUNKS	2
+
+typedef struct {
+	/* the link, one way or the other */
+	VXI11_CLINK *clink;
+	pthread_mutex_t lock;
+	TEK_SESSION *session;
+	int mode;
+	char channel[20];
+	long buf_size, chunk_points;
+	unsigned long timeout;
+	double stop_at;		/* tek_time_us() */
+	int control_ms;		/* between control queries */
+
+	/* results */
+	long no_traces;
+	double *latency[MAX_CONTROL];	/* ms */
+	int no_queries[MAX_CONTROL];
+	int max_queries;
+} BENCH;
+
+typedef struct {
+	BENCH *b;
+	int id;
+} CONTROL_ARG;
+
+static void *bulk_thread(void *arg)
+{
+	BENCH *b = (BENCH *) arg;
+	char *buf = new char[b->buf_size];
+	char source[20];
+	TEK_FUTURE *f;
+	long bytes;
+
+	while (tek_time_us() < b->stop_at) {
+		if (b->mode == MODE_MUTEX) {
+			snprintf(source, sizeof(source), "%s", b->channel);
+			pthread_mutex_lock(&b->lock);
+			bytes = tek_scope_get_data(b->clink, source, 0, buf,
+						   b->buf_size, b->timeout);
+			pthread_mutex_unlock(&b->lock);
+		} else {
+			f = tek_session_get_data(b->session, b->channel, buf,
+						 b->buf_size,
+						 b->mode == MODE_CHUNKS ?
+						 b->chunk_points : 0,
+						 TEK_PRIORITY_BULK);
+			bytes = tek_future_wait(f);
+			tek_future_free(f);
+		}
+		if (bytes <= 0) {
+			printf("problem reading a trace\n");
+			break;
+		}
+		b->no_traces++;
+	}
+	delete[]buf;
+	return NULL;
+}
+
+static void *control_thread(void *arg)
+{
+	CONTROL_ARG *c = (CONTROL_ARG *) arg;
+	BENCH *b = c->b;
+	char reply[256];
+	double t0;
+	long ret;
+
+	while (tek_time_us() < b->stop_at
+	       && b->no_queries[c->id] < b->max_queries) {
+		t0 = tek_time_us();
+		if (b->mode == MODE_MUTEX) {
+			pthread_mutex_lock(&b->lock);
+			ret = tek_send_and_receive(b->clink, "ACQUIRE:MODE?", reply,
+						   sizeof(reply), b->timeout);
+			pthread_mutex_unlock(&b->lock);
+		} else {
+			ret = tek_session_send_and_receive(b->session,
+							   "ACQUIRE:MODE?",
+							   reply,
+							   sizeof(reply));
+		}
+		if (ret != 0) {
+			printf("problem with a control query\n");
+			break;
+		}
+		b->latency[c->id][b->no_queries[c->id]++] =
+		    (tek_time_us() - t0) / 1000;
+		tek_sleep_us(1000.0 * b->control_ms);
+	}
+	return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void run(BENCH * b, int mode, int no_control, double secs)
+{
+	pthread_t bulk, control[MAX_CONTROL];
+	CONTROL_ARG args[MAX_CONTROL];
+	double *all, sum = 0;
+	int i, j, n = 0;
+	const char *name[] = { "mutex", "session", "session, chunks" };
+
+	b->mode = mode;
+	b->no_traces = 0;
+	if (mode != MODE_MUTEX) {
+		b->session = tek_session_open(b->clink, b->timeout);
+		if (b->session == NULL) {
+			return;
+		}
+	}
+	b->stop_at = tek_time_us() + 1e6 * secs;
+	pthread_create(&bulk, NULL, bulk_thread, b);
+	for (i = 0; i < no_control; i++) {
+		args[i].b = b;
+		args[i].id = i;
+		b->no_queries[i] = 0;
+		pthread_create(&control[i], NULL, control_thread, &args[i]);
+	}
+	pthread_join(bulk, NULL);
+	for (i = 0; i < no_control; i++) {
+		pthread_join(control[i], NULL);
+	}
+	if (mode != MODE_MUTEX) {
+		tek_session_close(b->session);
+		b->session = NULL;
+	}
+
+	all = new double[no_control * b->max_queries + 1];
+	for (i = 0; i < no_control; i++) {
+		for (j = 0; j < b->no_queries[i]; j++) {
+			all[n++] = b->latency[i][j];
+			sum += b->latency[i][j];
+		}
+	}
+	qsort(all, n, sizeof(double), compare_doubles);
+	if (n > 0) {
+		printf("%-16s %8.1f %8d %9.3f %9.3f %9.3f %9.3f\n", name[mode],
+		       b->no_traces / secs, n, sum / n, all[n / 2],
+		       all[(n * 99) / 100], all[n - 1]);
+	} else {
+		printf("%-16s %8.1f %8d\n", name[mode], b->no_traces / secs, 0);
+	}
+	delete[]all;
+}
+
+/* Handing in requests that don't do anything, from several threads */
+static long nothing(VXI11_CLINK * clink, void *arg)
+{
+	return 0;
+}
+
+typedef struct {
+	TEK_SESSION *session;
+	int n;
+	double submit_us;
+} SUBMIT_ARG;
+
+static void *submit_thread(void *arg)
+{
+	SUBMIT_ARG *a = (SUBMIT_ARG *) arg;
+	TEK_FUTURE **f = new TEK_FUTURE *[a->n];
+	double t0;
+	int i;
+
+	t0 = tek_time_us();
+	for (i = 0; i < a->n; i++) {
+		f[i] = tek_session_call(a->session, nothing, NULL,
+					TEK_PRIORITY_NORMAL);
+	}
+	a->submit_us = tek_time_us() - t0;
+	for (i = 0; i < a->n; i++) {
+		tek_future_free(f[i]);
+	}
+	delete[]f;
+	return NULL;
+}
+
+static void submit_bench(VXI11_CLINK * clink, int no_threads, int n)
+{
+	pthread_t threads[MAX_CONTROL];
+	SUBMIT_ARG args[MAX_CONTROL];
+	TEK_SESSION *session;
+	double t0, total, submit = 0;
+	int i;
+
+	session = tek_session_open(clink, 1000);
+	if (session == NULL) {
+		return;
+	}
+	t0 = tek_time_us();
+	for (i = 0; i < no_threads; i++) {
+		args[i].session = session;
+		args[i].n = n;
+		pthread_create(&threads[i], NULL, submit_thread, &args[i]);
+	}
+	for (i = 0; i < no_threads; i++) {
+		pthread_join(threads[i], NULL);
+		submit += args[i].submit_us;
+	}
+	total = tek_time_us() - t0;
+	tek_session_close(session);
+	printf("%d threads handing in %d requests each: %.0f ns per request handed in, %.2f M requests/s done\n",
+	       no_threads, n, 1000 * submit / (no_threads * n),
+	       no_threads * n / total);
+}
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	static char *device_ip = NULL;
+	BENCH b;
+	BOOL got_channel = FALSE;
+	long npoints = 0;
+	int no_control = 4;
+	double secs = 5;
+	int index = 1;
+	int i;
+
+	progname = argv[0];
+	memset(&b, 0, sizeof(b));
+	b.timeout = 10000;
+	b.control_ms = 5;
+
+	while (index < argc) {
+		if (sc(argv[index], "-ip") || sc(argv[index], "-ip_address")
+		    || sc(argv[index], "-IP")) {
+			device_ip = argv[++index];
+		}
+
+		if (sc(argv[index], "-channel") || sc(argv[index], "-c")
+		    || sc(argv[index], "-scope_channel")) {
+			snprintf(b.channel, 20, "%s", argv[++index]);
+			got_channel = TRUE;
+		}
+
+		if (sc(argv[index], "-no_points") || sc(argv[index], "-n")
+		    || sc(argv[index], "-points")) {
+			sscanf(argv[++index], "%ld", &npoints);
+		}
+
+		if (sc(argv[index], "-chunk")) {
+			sscanf(argv[++index], "%ld", &b.chunk_points);
+		}
+
+		if (sc(argv[index], "-threads") || sc(argv[index], "-q")) {
+			sscanf(argv[++index], "%d", &no_control);
+		}
+
+		if (sc(argv[index], "-every")) {
+			sscanf(argv[++index], "%d", &b.control_ms);
+		}
+
+		if (sc(argv[index], "-seconds") || sc(argv[index], "-s")) {
+			sscanf(argv[++index], "%lg", &secs);
+		}
+
+		if (sc(argv[index], "-timeout") || sc(argv[index], "-t")) {
+			sscanf(argv[++index], "%lu", &b.timeout);
+		}
+
+		index++;
+	}
+	if (no_control < 1) {
+		no_control = 1;
+	}
+	if (no_control > MAX_CONTROL) {
+		no_control = MAX_CONTROL;
+	}
+
+	if (device_ip == NULL || got_channel == FALSE) {
+		printf("%s: compares control query latency, with traces being\n",
+		       progname);
+		printf("downloaded at the same time, over a shared link and a session\n");
+		printf("Run using %s [arguments]\n\n", progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf("-ip     -ip_address     -IP      : IP address of scope\n");
+		printf("-c      -scope_channel  -channel : scope channel (1,2,3,4,M,REF1-REF4,D0-D15)\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf("-n      -no_points       -points : set record length\n");
+		printf("-chunk                           : points per chunk (default 1/16 of a trace)\n");
+		printf("-q      -threads                 : control query threads (default 4)\n");
+		printf("-every                           : ms between each thread's queries (default 5)\n");
+		printf("-s      -seconds                 : how long to run each way (default 5)\n");
+		printf("-t      -timeout                 : timeout (in milliseconds)\n\n");
+		printf("EXAMPLE:\n");
+		printf("%s -ip 128.243.74.98 -c 1 -n 1000000\n", progname);
+		exit(1);
+	}
+
+	if (tek_open(&b.clink, device_ip)) {
+		printf("Quitting...\n");
+		exit(2);
+	}
+	if (tek_scope_init(b.clink) != 0) {
+		printf("Quitting...\n");
+		exit(2);
+	}
+	b.buf_size = tek_scope_set_for_capture(b.clink, 0, npoints, b.timeout);
+	if (b.buf_size <= 0) {
+		printf("Quitting...\n");
+		exit(2);
+	}
+	if (b.chunk_points <= 0) {
+		b.chunk_points = b.buf_size / 2 / 16;
+		if (b.chunk_points < 1000) {
+			b.chunk_points = 1000;
+		}
+	}
+	b.max_queries = (int)(1000 * secs / (b.control_ms > 0 ? b.control_ms : 1))
+	    + 1;
+	for (i = 0; i < no_control; i++) {
+		b.latency[i] = new double[b.max_queries];
+	}
+	pthread_mutex_init(&b.lock, NULL);
+
+	printf("%ld byte traces, %d control threads, each querying every %d ms, chunks of %ld points\n\n",
+	       b.buf_size, no_control, b.control_ms, b.chunk_points);
+	printf("%-16s %8s %8s %9s %9s %9s %9s\n", "", "traces/s", "queries",
+	       "mean ms", "median ms", "99% ms", "max ms");
+	run(&b, MODE_MUTEX, no_control, secs);
+	run(&b, MODE_SESSION, no_control, secs);
+	run(&b, MODE_CHUNKS, no_control, secs);
+	printf("\n");
+	submit_bench(b.clink, 1, 100000);
+	submit_bench(b.clink, no_control, 100000);
+
+	for (i = 0; i < no_control; i++) {
+		delete[]b.latency[i];
+	}
+	tek_close(b.clink, device_ip);
+	return 0;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
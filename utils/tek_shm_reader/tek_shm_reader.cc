@@ -0,0 +1,211 @@
+/* tek_shm_reader.cc
+ * Example consumer of the shared memory trace ring that tgetwf -shm
+ * publishes to (see library/tek_shm.h). It attaches to the ring, prints a
+ * line about each trace as it arrives (looking at the data in place, no
+ * copying) and optionally saves them as .wf/.wfi files. Run as many of
+ * these as you like alongside one tgetwf; a slow reader only loses traces
+ * itself, and says how many.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tek_vxi11.h"
+#include "tek_transport.h"
+#include "tek_shm.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+BOOL sc(const char *, const char *);
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	char *shm_name = NULL;
+	char wfname[256];
+	char wfiname[256];
+	FILE *f_wf = NULL;
+	FILE *wfi;
+	BOOL got_file = FALSE;
+	BOOL quiet = FALSE;
+	unsigned long timeout = 10000;
+	long repeat = 0;
+	long count = 0, torn = 0;
+	int index = 1;
+	TEK_SHM *shm;
+	TEK_SHM_INFO saved;
+	const TEK_SHM_INFO *info;
+	const char *data;
+	const short *p;
+	long bytes, i, n;
+	short min, max;
+	double age_ms, total_age_ms = 0;
+
+	progname = argv[0];
+	memset(&saved, 0, sizeof(saved));
+
+	while (index < argc) {
+		if (sc(argv[index], "-shm")) {
+			shm_name = argv[++index];
+		}
+
+		if (sc(argv[index], "-filename") || sc(argv[index], "-f")
+		    || sc(argv[index], "-file")) {
+			snprintf(wfname, 256, "%s.wf", argv[++index]);
+			snprintf(wfiname, 256, "%s.wfi", argv[index]);
+			got_file = TRUE;
+		}
+
+		if (sc(argv[index], "-repeat") || sc(argv[index], "-r")
+		    || sc(argv[index], "-rep")) {
+			sscanf(argv[++index], "%ld", &repeat);
+		}
+
+		if (sc(argv[index], "-timeout") || sc(argv[index], "-t")) {
+			sscanf(argv[++index], "%lu", &timeout);
+		}
+
+		if (sc(argv[index], "-quiet") || sc(argv[index], "-q")) {
+			quiet = TRUE;
+		}
+
+		index++;
+	}
+
+	if (shm_name == NULL) {
+		printf("%s: reads traces published by tgetwf -shm\n", progname);
+		printf("Run using %s [arguments]\n\n", progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf("-shm                             : name of the shared memory ring\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf("-f      -filename       -file    : also save traces (without extension)\n");
+		printf("-r      -repeat          -rep    : stop after 'r' traces (0 = until tgetwf stops)\n");
+		printf("-t      -timeout                 : give up if nothing arrives for this long (ms)\n");
+		printf("-q      -quiet                   : don't print a line for each trace\n\n");
+		printf("EXAMPLE:\n");
+		printf("tgetwf -ip 128.243.74.98 -c 1 -shm /tek_scope -r 0 &\n");
+		printf("%s -shm /tek_scope -f test -r 100\n", progname);
+		exit(1);
+	}
+
+	shm = tek_shm_attach(shm_name);
+	if (!shm) {
+		printf("Quitting...\n");
+		exit(2);
+	}
+	if (got_file == TRUE) {
+		f_wf = fopen(wfname, "wb");
+		if (!f_wf) {
+			printf("error: could not open file for writing, quitting...\n");
+			exit(3);
+		}
+	}
+
+	while (repeat == 0 || count < repeat) {
+		bytes = tek_shm_read(shm, &info, &data, timeout);
+		if (bytes == 0) {
+			printf("Nothing for %lu ms, stopping\n", timeout);
+			break;
+		}
+		if (bytes < 0) {
+			break;	/* tgetwf has finished */
+		}
+
+		/* Look at the data where it is */
+		p = (const short *)data;
+		n = bytes / 2;
+		min = max = (n > 0) ? p[0] : 0;
+		for (i = 1; i < n; i++) {
+			if (p[i] < min)
+				min = p[i];
+			if (p[i] > max)
+				max = p[i];
+		}
+		if (f_wf) {
+			fwrite(data, 1, bytes, f_wf);
+		}
+		age_ms = (tek_time_us() - info->time_us) / 1000;
+		saved = *info;
+
+		/* Did it change under our feet? If so, forget it */
+		if (tek_shm_read_done(shm) != 0) {
+			torn++;
+			if (f_wf) {
+				fseek(f_wf, -bytes, SEEK_CUR);
+			}
+			continue;
+		}
+		count++;
+		total_age_ms += age_ms;
+		if (quiet == FALSE) {
+			printf("trace %llu: %ld points from %s, %g to %g V, %.3f ms old\n",
+			       (unsigned long long)saved.seq, n, saved.source,
+			       saved.vgain * min + saved.voffset,
+			       saved.vgain * max + saved.voffset, age_ms);
+		}
+	}
+
+	printf("%ld traces read, %llu lost (%ld overwritten while reading)",
+	       count, (unsigned long long)tek_shm_lost(shm), torn);
+	if (count > 0) {
+		printf(", mean age %.3f ms", total_age_ms / count);
+	}
+	printf("\n");
+	tek_shm_close(shm);
+
+	if (f_wf) {
+		fclose(f_wf);
+		wfi = fopen(wfiname, "w");
+		if (wfi) {
+			fprintf(wfi, "%% %s\n", wfiname);
+			fprintf(wfi, "%% Waveform captured using %s\n\n", progname);
+			fprintf(wfi, "%% Number of bytes:\n%llu\n\n",
+				(unsigned long long)saved.bytes / (saved.no_traces ? saved.no_traces : 1));
+			fprintf(wfi, "%% Vertical gain:\n%g\n\n", saved.vgain);
+			fprintf(wfi, "%% Vertical offset:\n%g\n\n", -saved.voffset);
+			fprintf(wfi, "%% Horizontal interval:\n%g\n\n", saved.hinterval);
+			fprintf(wfi, "%% Horizontal offset:\n%g\n\n", saved.hoffset);
+			fprintf(wfi, "%% Number of traces:\n%ld\n\n",
+				count * (saved.no_traces ? saved.no_traces : 1));
+			fprintf(wfi, "%% Number of bytes per data-point:\n%d\n\n", 2);
+			fprintf(wfi,
+				"%% Keep all datapoints (0 or missing knocks off 1 point, legacy lecroy):\n%d\n\n",
+				1);
+			fclose(wfi);
+		}
+	}
+	return 0;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
@@ -0,0 +1,589 @@
+/* tek_sweep.cc
+ * Steps a Tek AFG3000 through a range of frequencies, amplitudes, offsets
+ * or arbitrary waveforms, and captures a trace from a scope at each step:
+ * the experiment we used to do with a shell script calling tek_afg and
+ * tgetwf in turn (opening both instruments again at every step).
+ *
+ * Here both links stay open, and the two instruments work side by side.
+ * As soon as the scope has finished acquiring step k, the AFG is told to
+ * move on to step k+1, while step k's data is still coming off the scope
+ * and being written to disk. The scope only waits for the AFG to say it's
+ * done (*OPC?), plus any settling time you ask for (-settle), before the
+ * next acquisition. At the end there's a breakdown of where each step's
+ * time went.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "tek_vxi11.h"
+#include "tek_transport.h"
+#include "tek_arb_cache.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+BOOL sc(const char *, const char *);
+
+#define PARAM_FREQ	0
+#define PARAM_AMPL	1
+#define PARAM_OFFSET	2
+#define PARAM_ARB	3
+
+/* As in tek_afg_upload_arb */
+#define ARB_BUF_LEN	262144
+#define MAX_ARBS	256
+
+/* Timings of one step (all in us, from tek_time_us()) */
+typedef struct {
+	double value;
+	double afg_start, afg_done, ready;	/* ready = after settling */
+	double acq_start, acq_done;
+	double xfer_done, written;
+} STEP;
+
+typedef struct {
+	/* set up before we start */
+	VXI11_CLINK *scope, *afg;
+	char channel[20];
+	int param, afg_ch, user;
+	char *arb[MAX_ARBS];
+	long arb_len[MAX_ARBS];
+	TEK_ARB_CACHE *cache;	/* NULL to send every arb every time */
+	double settle_ms;
+	unsigned long timeout;
+	BOOL serial;
+	int no_steps;
+	STEP *steps;
+	FILE *f_wf;
+	long buf_size;
+
+	/* who's got how far, under the lock */
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	int no_ready;		/* steps the AFG is set up for */
+	int no_acquired;	/* steps the scope has acquired */
+	int no_written;
+	BOOL failed;
+
+	/* two trace buffers: one being filled, one being written */
+	char *buf[2];
+	long bytes[2];
+	int no_full;		/* steps waiting to be written */
+} SWEEP;
+
+static void set_failed(SWEEP * s)
+{
+	pthread_mutex_lock(&s->lock);
+	s->failed = TRUE;
+	pthread_cond_broadcast(&s->changed);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* Waits until *count reaches n (or something has gone wrong). Returns 0,
+ * or -1 if it has. */
+static int wait_for(SWEEP * s, int *count, int n)
+{
+	int ret;
+
+	pthread_mutex_lock(&s->lock);
+	while (*count < n && !s->failed) {
+		pthread_cond_wait(&s->changed, &s->lock);
+	}
+	ret = s->failed ? -1 : 0;
+	pthread_mutex_unlock(&s->lock);
+	return ret;
+}
+
+static void step_done(SWEEP * s, int *count)
+{
+	pthread_mutex_lock(&s->lock);
+	(*count)++;
+	pthread_cond_broadcast(&s->changed);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static int afg_set(SWEEP * s, int k)
+{
+	char *buf;
+	int ret;
+
+	switch (s->param) {
+	case PARAM_FREQ:
+		return tek_send_printf(s->afg, "SOUR%d:FREQ:FIX %fHz",
+				       s->afg_ch, s->steps[k].value);
+	case PARAM_AMPL:
+		return tek_send_printf(s->afg, "SOUR%d:VOLT:LEV:IMM:AMPL %fVPP",
+				       s->afg_ch, s->steps[k].value);
+	case PARAM_OFFSET:
+		return tek_send_printf(s->afg, "SOUR%d:VOLT:LEV:IMM:OFFS %fV",
+				       s->afg_ch, s->steps[k].value);
+	default:
+		if (s->cache) {
+			ret = tek_afg_send_arb_cached(s->afg, s->cache,
+						      s->arb[k], s->arb_len[k],
+						      0);
+			if (ret < 0) {
+				return ret;
+			}
+			return tek_send_printf(s->afg, "SOUR%d:FUNC:SHAP USER%d",
+					       s->afg_ch, ret);
+		}
+		/* tek_afg_send_arb() swaps the bytes in place */
+		buf = new char[s->arb_len[k]];
+		memcpy(buf, s->arb[k], s->arb_len[k]);
+		ret = tek_afg_send_arb(s->afg, buf, s->arb_len[k], s->user);
+		delete[]buf;
+		if (ret != 0) {
+			return ret;
+		}
+		return tek_send_printf(s->afg, "SOUR%d:FUNC:SHAP USER%d",
+				       s->afg_ch, s->user);
+	}
+}
+
+/* The AFG side: step k can't start until the scope has acquired step k-1 */
+static void *afg_thread(void *arg)
+{
+	SWEEP *s = (SWEEP *) arg;
+	STEP *st;
+	int k;
+
+	for (k = 0; k < s->no_steps; k++) {
+		if (wait_for(s, s->serial ? &s->no_written : &s->no_acquired, k)
+		    != 0) {
+			break;
+		}
+		st = &s->steps[k];
+		st->afg_start = tek_time_us();
+		/* *OPC? comes back once the AFG has actually made the change */
+		if (afg_set(s, k) != 0
+		    || tek_obtain_long_value(s->afg, "*OPC?", s->timeout) != 1) {
+			printf("Problem setting the AFG for step %d, stopping...\n",
+			       k + 1);
+			set_failed(s);
+			break;
+		}
+		st->afg_done = tek_time_us();
+		if (s->settle_ms > 0) {
+			tek_sleep_us(1000 * s->settle_ms);
+		}
+		st->ready = tek_time_us();
+		step_done(s, &s->no_ready);
+	}
+	return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+	SWEEP *s = (SWEEP *) arg;
+	int k;
+
+	for (k = 0; k < s->no_steps; k++) {
+		if (wait_for(s, &s->no_acquired, k + 1) != 0) {
+			break;
+		}
+		pthread_mutex_lock(&s->lock);
+		while (s->no_full == 0 && !s->failed) {
+			pthread_cond_wait(&s->changed, &s->lock);
+		}
+		pthread_mutex_unlock(&s->lock);
+		if (s->no_full == 0) {
+			break;
+		}
+		if (s->f_wf) {
+			fwrite(s->buf[k % 2], sizeof(char), s->bytes[k % 2],
+			       s->f_wf);
+		}
+		s->steps[k].written = tek_time_us();
+		pthread_mutex_lock(&s->lock);
+		s->no_full--;
+		s->no_written++;
+		pthread_cond_broadcast(&s->changed);
+		pthread_mutex_unlock(&s->lock);
+	}
+	return NULL;
+}
+
+/* The scope side, in the main thread */
+static void scope_steps(SWEEP * s)
+{
+	STEP *st;
+	long bytes;
+	int k;
+
+	for (k = 0; k < s->no_steps; k++) {
+		if (wait_for(s, &s->no_ready, k + 1) != 0) {
+			break;
+		}
+		st = &s->steps[k];
+		st->acq_start = tek_time_us();
+		if (tek_obtain_long_value(s->scope, "ACQUIRE:STATE 1;*OPC?",
+					  s->timeout) != 1) {
+			printf("Problem acquiring step %d, maybe you need a longer timeout?\n",
+			       k + 1);
+			set_failed(s);
+			break;
+		}
+		st->acq_done = tek_time_us();
+
+		/* wait for a free buffer (only if the disk is slower than the
+		 * scope) before letting the AFG go on to the next step */
+		pthread_mutex_lock(&s->lock);
+		while (s->no_full == 2 && !s->failed) {
+			pthread_cond_wait(&s->changed, &s->lock);
+		}
+		pthread_mutex_unlock(&s->lock);
+		step_done(s, &s->no_acquired);
+
+		/* the AFG is changing while this comes off */
+		bytes = tek_scope_get_data(s->scope, s->channel, 0,
+					   s->buf[k % 2], s->buf_size,
+					   s->timeout);
+		if (bytes <= 0) {
+			printf("Problem reading the data for step %d, stopping...\n",
+			       k + 1);
+			set_failed(s);
+			break;
+		}
+		st->xfer_done = tek_time_us();
+		s->bytes[k % 2] = bytes;
+		pthread_mutex_lock(&s->lock);
+		s->no_full++;
+		pthread_cond_broadcast(&s->changed);
+		pthread_mutex_unlock(&s->lock);
+	}
+}
+
+static void report(SWEEP * s, const char *logname, double t_begin,
+		   double t_end)
+{
+	FILE *f = NULL;
+	STEP *st;
+	double afg, settle, wait, acq, xfer, write, total;
+	double sum[6] = { 0, 0, 0, 0, 0, 0 };
+	int k, n = s->no_written;
+
+	if (logname) {
+		f = fopen(logname, "w");
+		if (f == NULL) {
+			printf("error: could not open %s for writing\n", logname);
+		} else {
+			fprintf(f, "%% step value afg_ms settle_ms scope_wait_ms acquire_ms transfer_ms write_ms\n");
+		}
+	}
+	printf("step        value   afg ms settle ms  wait ms   acq ms  xfer ms write ms\n");
+	for (k = 0; k < n; k++) {
+		st = &s->steps[k];
+		afg = (st->afg_done - st->afg_start) / 1000;
+		settle = (st->ready - st->afg_done) / 1000;
+		/* how long the scope sat waiting for the AFG */
+		wait = (st->acq_start - (k > 0 ? s->steps[k - 1].xfer_done
+					 : t_begin)) / 1000;
+		acq = (st->acq_done - st->acq_start) / 1000;
+		xfer = (st->xfer_done - st->acq_done) / 1000;
+		write = (st->written - st->xfer_done) / 1000;
+		printf("%4d %12g %8.2f %9.2f %8.2f %8.2f %8.2f %8.2f\n", k + 1,
+		       st->value, afg, settle, wait, acq, xfer, write);
+		if (f) {
+			fprintf(f, "%d %g %.3f %.3f %.3f %.3f %.3f %.3f\n", k + 1,
+				st->value, afg, settle, wait, acq, xfer, write);
+		}
+		sum[0] += afg;
+		sum[1] += settle;
+		sum[2] += wait;
+		sum[3] += acq;
+		sum[4] += xfer;
+		sum[5] += write;
+	}
+	if (f) {
+		fclose(f);
+	}
+	total = (t_end - t_begin) / 1000;
+	printf("%d steps in %.1f ms (%.2f ms/step)", n, total,
+	       n ? total / n : 0);
+	if (!s->serial) {
+		printf("; one after the other would have taken %.1f ms",
+		       sum[0] + sum[1] + sum[3] + sum[4] + sum[5]);
+	}
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	static char *scope_ip = NULL;
+	static char *afg_ip = NULL;
+	char wfname[256];
+	char wfiname[256];
+	char logname[256];
+	BOOL got_file = FALSE;
+	BOOL got_channel = FALSE;
+	BOOL log_spacing = FALSE;
+	double start = 0, stop = 0, t_begin, t_end;
+	int index = 1;
+	int no_arbs = 0;
+	BOOL use_cache = FALSE;
+	TEK_ARB_CACHE cache;
+	int k;
+	FILE *fi;
+	pthread_t afg_tid, writer_tid;
+	SWEEP s;
+
+	progname = argv[0];
+	memset(&s, 0, sizeof(s));
+	s.param = -1;
+	s.afg_ch = 1;
+	s.user = 1;
+	s.no_steps = 0;
+	s.timeout = 10000;
+
+	while (index < argc) {
+		if (sc(argv[index], "-scope") || sc(argv[index], "-ip")) {
+			scope_ip = argv[++index];
+		}
+
+		if (sc(argv[index], "-afg")) {
+			afg_ip = argv[++index];
+		}
+
+		if (sc(argv[index], "-channel") || sc(argv[index], "-c")) {
+			snprintf(s.channel, 20, "%s", argv[++index]);
+			got_channel = TRUE;
+		}
+
+		if (sc(argv[index], "-filename") || sc(argv[index], "-f")
+		    || sc(argv[index], "-file")) {
+			snprintf(wfname, 256, "%s.wf", argv[++index]);
+			snprintf(wfiname, 256, "%s.wfi", argv[index]);
+			snprintf(logname, 256, "%s.sweep", argv[index]);
+			got_file = TRUE;
+		}
+
+		if (sc(argv[index], "-frequency") || sc(argv[index], "-freq")) {
+			s.param = PARAM_FREQ;
+		}
+
+		if (sc(argv[index], "-amplitude") || sc(argv[index], "-ampl")) {
+			s.param = PARAM_AMPL;
+		}
+
+		if (sc(argv[index], "-offset") || sc(argv[index], "-offs")) {
+			s.param = PARAM_OFFSET;
+		}
+
+		if (sc(argv[index], "-arb") && no_arbs < MAX_ARBS) {
+			s.param = PARAM_ARB;
+			fi = fopen(argv[++index], "rb");
+			if (fi == NULL) {
+				printf("error: could not open %s, quitting...\n",
+				       argv[index]);
+				exit(3);
+			}
+			s.arb[no_arbs] = new char[ARB_BUF_LEN];
+			s.arb_len[no_arbs] =
+			    fread(s.arb[no_arbs], sizeof(char), ARB_BUF_LEN, fi);
+			fclose(fi);
+			no_arbs++;
+		}
+
+		if (sc(argv[index], "-start")) {
+			sscanf(argv[++index], "%lg", &start);
+		}
+
+		if (sc(argv[index], "-stop")) {
+			sscanf(argv[++index], "%lg", &stop);
+		}
+
+		if (sc(argv[index], "-steps") || sc(argv[index], "-n")) {
+			sscanf(argv[++index], "%d", &s.no_steps);
+		}
+
+		if (sc(argv[index], "-log")) {
+			log_spacing = TRUE;
+		}
+
+		if (sc(argv[index], "-afg_channel") || sc(argv[index], "-ac")) {
+			sscanf(argv[++index], "%d", &s.afg_ch);
+		}
+
+		if (sc(argv[index], "-user")) {
+			sscanf(argv[++index], "%d", &s.user);
+		}
+
+		if (sc(argv[index], "-cache")) {
+			use_cache = TRUE;
+		}
+
+		if (sc(argv[index], "-settle")) {
+			sscanf(argv[++index], "%lg", &s.settle_ms);
+		}
+
+		if (sc(argv[index], "-serial")) {
+			s.serial = TRUE;
+		}
+
+		if (sc(argv[index], "-timeout") || sc(argv[index], "-t")) {
+			sscanf(argv[++index], "%lu", &s.timeout);
+		}
+
+		index++;
+	}
+	if (s.param == PARAM_ARB) {
+		s.no_steps = no_arbs;
+	}
+
+	if (scope_ip == NULL || afg_ip == NULL || got_channel == FALSE
+	    || got_file == FALSE || s.param < 0 || s.no_steps < 1
+	    || (log_spacing && (start <= 0 || stop <= 0))) {
+		printf("%s: steps a Tek AFG through some settings, capturing a scope trace\n",
+		       progname);
+		printf("at each one, with the AFG and scope working in parallel\n");
+		printf("Run using %s [arguments]\n\n", progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf("-scope  -ip                      : IP address of scope\n");
+		printf("-afg                             : IP address of AFG\n");
+		printf("-c      -channel                 : scope channel (1,2,3,4,M,REF1-REF4,D0-D15)\n");
+		printf("-f      -filename       -file    : filename (without extension)\n");
+		printf("and one of:\n");
+		printf("-freq   -frequency               : step the frequency (Hz)\n");
+		printf("-ampl   -amplitude               : step the amplitude (Vpp)\n");
+		printf("-offs   -offset                  : step the offset (V)\n");
+		printf("            with -start, -stop and -steps (-n), and -log for log spacing\n");
+		printf("-arb                             : an arbitrary waveform file for each step\n");
+		printf("                                   (repeat, one per step, in order)\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf("-ac     -afg_channel             : AFG channel (default 1)\n");
+		printf("-user                            : AFG user memory for -arb (default 1)\n");
+		printf("-cache                           : with -arb, don't send waveforms the AFG\n");
+		printf("                                   already has, and use all 4 user memories\n");
+		printf("                                   (-user is ignored; see tek_arb_cache.h)\n");
+		printf("-settle                          : extra time to let things settle after\n");
+		printf("                                   each AFG change (ms, default 0)\n");
+		printf("-serial                          : don't overlap the AFG and the scope\n");
+		printf("                                   (for comparison)\n");
+		printf("-t      -timeout                 : timeout (in milliseconds)\n\n");
+		printf("OUTPUTS:\n");
+		printf("filename.wf    : binary data of the traces, one per step\n");
+		printf("filename.wfi   : waveform information (text)\n");
+		printf("filename.sweep : the value and timings of each step (text)\n\n");
+		printf("EXAMPLE:\n");
+		printf("%s -scope 128.243.74.98 -afg 128.243.74.107 -c 1 -f sweep -freq -start 1e6 -stop 10e6 -steps 10\n",
+		       progname);
+		printf("%s -scope 128.243.74.98 -afg 128.243.74.107 -c 1 -f arbs -arb a.arb -arb b.arb\n",
+		       progname);
+		exit(1);
+	}
+
+	s.steps = new STEP[s.no_steps];
+	memset(s.steps, 0, s.no_steps * sizeof(STEP));
+	for (k = 0; k < s.no_steps; k++) {
+		if (s.param == PARAM_ARB) {
+			s.steps[k].value = k + 1;
+		} else if (s.no_steps == 1) {
+			s.steps[k].value = start;
+		} else if (log_spacing) {
+			s.steps[k].value = start * pow(stop / start,
+						       (double)k / (s.no_steps - 1));
+		} else {
+			s.steps[k].value = start + (stop - start) * k
+			    / (s.no_steps - 1);
+		}
+	}
+
+	s.f_wf = fopen(wfname, "w");
+	if (s.f_wf == NULL) {
+		printf("error: could not open file for writing, quitting...\n");
+		exit(3);
+	}
+	if (tek_open(&s.scope, scope_ip) || tek_open(&s.afg, afg_ip)) {
+		printf("Quitting...\n");
+		exit(2);
+	}
+	if (use_cache && s.param == PARAM_ARB) {
+		if (tek_arb_cache_open(s.afg, &cache, NULL) != 0) {
+			printf("Quitting...\n");
+			exit(2);
+		}
+		s.cache = &cache;
+	}
+	if (tek_scope_init(s.scope) != 0) {
+		printf("Quitting...\n");
+		exit(2);
+	}
+	/* single sequence, for ACQUIRE:STATE 1 in each step */
+	s.buf_size = tek_scope_set_for_capture(s.scope, 1, s.timeout);
+	if (s.buf_size <= 0) {
+		printf("Quitting...\n");
+		exit(2);
+	}
+	s.buf[0] = new char[s.buf_size];
+	s.buf[1] = new char[s.buf_size];
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.changed, NULL);
+
+	printf("Sweeping %d steps%s...\n", s.no_steps,
+	       s.serial ? ", one thing at a time" : "");
+	t_begin = tek_time_us();
+	pthread_create(&afg_tid, NULL, afg_thread, &s);
+	pthread_create(&writer_tid, NULL, writer_thread, &s);
+	scope_steps(&s);
+	pthread_join(afg_tid, NULL);
+	pthread_join(writer_tid, NULL);
+	t_end = tek_time_us();
+
+	fclose(s.f_wf);
+	if (s.no_written > 0) {
+		tek_scope_write_wfi_file(s.scope, wfiname, s.channel, progname,
+					 s.no_written, s.timeout);
+	}
+	report(&s, logname, t_begin, t_end);
+	if (s.cache) {
+		printf("Arbs: %lu sent, %lu copied from edit memory, %lu already there\n",
+		       cache.no_sent, cache.no_copied, cache.no_hits);
+	}
+
+	tek_close(s.afg, afg_ip);
+	tek_close(s.scope, scope_ip);
+	delete[]s.buf[0];
+	delete[]s.buf[1];
+	delete[]s.steps;
+	for (k = 0; k < no_arbs; k++) {
+		delete[]s.arb[k];
+	}
+	return s.failed ? 2 : 0;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
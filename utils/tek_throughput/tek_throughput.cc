@@ -0,0 +1,232 @@
+/* tek_throughput.cc
+ * Measures how quickly traces can be pulled off a scope, over one or more
+ * links, and prints the results side by side. Handy for comparing transports
+ * to the same scope, e.g.
+ *
+ *   tek_throughput -ip 128.243.74.98 -ip socket:128.243.74.98 -c 1 -r 50
+ *
+ * Each address is opened with tek_open(), so anything it understands
+ * (including record: and replay:) can be compared.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tek_vxi11.h"
+#include "tek_transport.h"
+
+#ifdef WIN32
+#define snprintf sprintf_s
+#endif
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+#define MAX_LINKS 8
+
+BOOL sc(const char *, const char *);
+
+typedef struct {
+	const char *ip;
+	int ok;
+	long bytes_per_trace;
+	int traces;
+	double setup_ms;
+	double total_ms;
+	double min_ms, max_ms;
+	double msgs;		/* messages to and from the scope, per trace */
+} RESULT;
+
+static void run(RESULT * res, char *channel, long npoints, int repeat,
+		BOOL clear_sweeps, unsigned long timeout)
+{
+	VXI11_CLINK *clink;
+	char *buf;
+	long buf_size, bytes;
+	double t0, t1;
+	unsigned long w0, r0, w1, r1;
+	int i;
+
+	res->ok = 0;
+	t0 = tek_time_us();
+	if (tek_open(&clink, res->ip)) {
+		printf("%s: could not open link\n", res->ip);
+		return;
+	}
+	if (tek_scope_init(clink) != 0) {
+		printf("%s: could not initialise scope\n", res->ip);
+		tek_close(clink, res->ip);
+		return;
+	}
+	if (npoints > 0) {
+		tek_scope_set_record_length(clink, npoints);
+	}
+	buf_size = tek_scope_set_for_capture(clink, clear_sweeps, timeout);
+	if (buf_size <= 0) {
+		printf("%s: could not set scope up for capture\n", res->ip);
+		tek_close(clink, res->ip);
+		return;
+	}
+	buf = new char[buf_size];
+	res->setup_ms = (tek_time_us() - t0) / 1000;
+	res->bytes_per_trace = buf_size;
+	res->min_ms = 1e30;
+	res->max_ms = 0;
+	res->total_ms = 0;
+	tek_io_counts(&w0, &r0);
+	for (i = 0; i < repeat; i++) {
+		t0 = tek_time_us();
+		bytes = tek_scope_get_data(clink, channel, clear_sweeps, buf,
+					   buf_size, timeout);
+		t1 = (tek_time_us() - t0) / 1000;
+		if (bytes <= 0) {
+			printf("%s: problem reading trace %d\n", res->ip, i + 1);
+			break;
+		}
+		res->bytes_per_trace = bytes;
+		res->total_ms += t1;
+		if (t1 < res->min_ms) {
+			res->min_ms = t1;
+		}
+		if (t1 > res->max_ms) {
+			res->max_ms = t1;
+		}
+	}
+	tek_io_counts(&w1, &r1);
+	res->traces = i;
+	res->ok = (i > 0);
+	if (i > 0) {
+		res->msgs = (double)(w1 - w0 + r1 - r0) / i;
+	}
+	delete[]buf;
+	tek_close(clink, res->ip);
+}
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	RESULT res[MAX_LINKS];
+	int no_links = 0;
+	char channel[20];
+	BOOL got_scope_channel = FALSE;
+	BOOL clear_sweeps = TRUE;
+	unsigned long timeout = 10000;
+	long npoints = 0;
+	int repeat = 20;
+	int index = 1;
+	int i;
+	double mean;
+
+	progname = argv[0];
+	memset(res, 0, sizeof(res));
+
+	while (index < argc) {
+		if (sc(argv[index], "-ip") || sc(argv[index], "-ip_address")
+		    || sc(argv[index], "-IP")) {
+			if (no_links < MAX_LINKS) {
+				res[no_links++].ip = argv[++index];
+			} else {
+				index++;
+			}
+		}
+
+		if (sc(argv[index], "-channel") || sc(argv[index], "-c")
+		    || sc(argv[index], "-scope_channel")) {
+			snprintf(channel, 20, "%s", argv[++index]);
+			got_scope_channel = TRUE;
+		}
+
+		if (sc(argv[index], "-no_points") || sc(argv[index], "-n")
+		    || sc(argv[index], "-points")) {
+			sscanf(argv[++index], "%ld", &npoints);
+		}
+
+		if (sc(argv[index], "-repeat") || sc(argv[index], "-r")
+		    || sc(argv[index], "-rep")) {
+			sscanf(argv[++index], "%d", &repeat);
+		}
+
+		if (sc(argv[index], "-no_clear_sweeps")
+		    || sc(argv[index], "-noclsw")
+		    || sc(argv[index], "-no_clear")) {
+			clear_sweeps = FALSE;
+		}
+
+		if (sc(argv[index], "-timeout") || sc(argv[index], "-t")) {
+			sscanf(argv[++index], "%lu", &timeout);
+		}
+
+		index++;
+	}
+
+	if (no_links == 0 || got_scope_channel == FALSE || repeat < 1) {
+		printf("%s: compares trace transfer rates over one or more links\n",
+		       progname);
+		printf("Run using %s [arguments]\n\n", progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf("-ip     -ip_address     -IP      : address to test (up to %d, use -ip more than once)\n",
+		       MAX_LINKS);
+		printf("-c      -scope_channel  -channel : scope channel (1,2,3,4,M,REF1-REF4,D0-D15)\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf("-n      -no_points       -points : set record length\n");
+		printf("-r      -repeat          -rep    : traces to transfer per link (default 20)\n");
+		printf("-noclsw -no_clear_sweeps -noclear: no clear sweeps (transfer only)\n");
+		printf("-t      -timeout                 : timeout (in milliseconds)\n\n");
+		printf("EXAMPLE:\n");
+		printf("%s -ip 128.243.74.98 -ip socket:128.243.74.98 -c 1 -n 100000\n",
+		       progname);
+		exit(1);
+	}
+
+	for (i = 0; i < no_links; i++) {
+		run(&res[i], channel, npoints, repeat, clear_sweeps, timeout);
+	}
+
+	printf("\n%-32s %8s %7s %9s %9s %9s %9s %9s %7s\n", "link", "bytes",
+	       "traces", "setup ms", "mean ms", "min ms", "max ms", "MB/s",
+	       "msgs/tr");
+	for (i = 0; i < no_links; i++) {
+		if (!res[i].ok) {
+			printf("%-32.32s %8s\n", res[i].ip, "failed");
+			continue;
+		}
+		mean = res[i].total_ms / res[i].traces;
+		printf("%-32.32s %8ld %7d %9.2f %9.3f %9.3f %9.3f %9.2f %7.1f\n",
+		       res[i].ip, res[i].bytes_per_trace, res[i].traces,
+		       res[i].setup_ms, mean, res[i].min_ms, res[i].max_ms,
+		       res[i].bytes_per_trace / (mean * 1000), res[i].msgs);
+	}
+	return 0;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
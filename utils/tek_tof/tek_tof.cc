@@ -0,0 +1,304 @@
+/* tek_tof.cc
+ * Time of flight from .wf/.wfi files (from tgetwf): every trace is
+ * cross-correlated against a reference pulse (cut out of one of the
+ * traces, usually the first), and the delay from the reference to the best
+ * matching echo is written out, in seconds, with how good the match is.
+ * The correlating is done by library/tek_xcorr.h, on all the cores, and
+ * the .wf files are memory-mapped (library/tek_wf.h), so there's no
+ * reading in. At the end it says how many traces a second it managed, to
+ * compare with how fast they're being captured.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tek_vxi11.h"
+#include "tek_transport.h"
+#include "tek_wf.h"
+#include "tek_xcorr.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+BOOL sc(const char *, const char *);
+
+#define MAX_FILES	1024
+
+/* The reference pulse, and where it was */
+typedef struct {
+	double *volts;
+	long len;
+	double time;		/* of its first point, from the trigger (s) */
+	double hinterval;
+} REFERENCE;
+
+static int get_reference(const char *name, long trace, double start,
+			 double stop, REFERENCE * ref)
+{
+	TEK_WF wf;
+	double *volts;
+	long first, last;
+
+	if (tek_wf_open(&wf, name) != 0) {
+		printf("error: could not open %s\n", name);
+		return -1;
+	}
+	if (trace < 0 || trace >= wf.no_traces) {
+		printf("error: %s has no trace %ld\n", name, trace);
+		tek_wf_close(&wf);
+		return -1;
+	}
+	volts = new double[wf.no_points];
+	tek_wf_trace_volts(&wf, trace, volts);
+
+	first = (long)ceil((start - wf.hoffset) / wf.hinterval);
+	last = (long)floor((stop - wf.hoffset) / wf.hinterval);
+	if (first < 0) {
+		first = 0;
+	}
+	if (last > wf.no_points - 1) {
+		last = wf.no_points - 1;
+	}
+	if (last <= first) {
+		printf("error: no points between %g and %g s in %s\n", start,
+		       stop, name);
+		delete[]volts;
+		tek_wf_close(&wf);
+		return -1;
+	}
+	ref->len = last - first + 1;
+	ref->volts = new double[ref->len];
+	memcpy(ref->volts, volts + first, ref->len * sizeof(double));
+	ref->time = tek_wf_time(&wf, first);
+	ref->hinterval = wf.hinterval;
+	delete[]volts;
+	tek_wf_close(&wf);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	const char *names[MAX_FILES];
+	const char *refname = NULL;
+	const char *outname = NULL;
+	FILE *out = stdout;
+	REFERENCE ref;
+	TEK_XCORR *x = NULL;
+	TEK_XCORR_RESULT *r;
+	TEK_WF wf;
+	long ref_trace = 0;
+	long plan_len = 0;
+	long t, traces_done = 0;
+	double ref_start = 0, ref_stop = 0;
+	double t_min = 0, t_max = 0;
+	double t0, ms = 0;
+	double plan_hoffset = 0;
+	BOOL got_window = FALSE;
+	BOOL either_sign = FALSE;
+	int no_files = 0;
+	int no_threads = 0;
+	int no_failed = 0;
+	int index = 1;
+	int i;
+
+	progname = argv[0];
+
+	while (index < argc) {
+		if (sc(argv[index], "-filename") || sc(argv[index], "-f")
+		    || sc(argv[index], "-file")) {
+			index++;
+			if (no_files == MAX_FILES) {
+				printf("error: no more than %d files, quitting...\n",
+				       MAX_FILES);
+				exit(1);
+			}
+			names[no_files++] = argv[index];
+		}
+
+		if (sc(argv[index], "-reference") || sc(argv[index], "-ref")) {
+			refname = argv[++index];
+		}
+
+		if (sc(argv[index], "-ref_trace") || sc(argv[index], "-rt")) {
+			sscanf(argv[++index], "%ld", &ref_trace);
+		}
+
+		if (sc(argv[index], "-ref_start") || sc(argv[index], "-rs")) {
+			sscanf(argv[++index], "%lg", &ref_start);
+			got_window = TRUE;
+		}
+
+		if (sc(argv[index], "-ref_stop") || sc(argv[index], "-re")) {
+			sscanf(argv[++index], "%lg", &ref_stop);
+		}
+
+		if (sc(argv[index], "-min")) {
+			sscanf(argv[++index], "%lg", &t_min);
+		}
+
+		if (sc(argv[index], "-max")) {
+			sscanf(argv[++index], "%lg", &t_max);
+		}
+
+		if (sc(argv[index], "-either") || sc(argv[index], "-e")) {
+			either_sign = TRUE;
+		}
+
+		if (sc(argv[index], "-out") || sc(argv[index], "-o")) {
+			outname = argv[++index];
+		}
+
+		if (sc(argv[index], "-threads") || sc(argv[index], "-j")) {
+			sscanf(argv[++index], "%d", &no_threads);
+		}
+
+		index++;
+	}
+
+	if (no_files == 0 || got_window == FALSE || ref_stop <= ref_start) {
+		printf("%s: time of flight, by cross-correlating every trace in .wf files\n",
+		       progname);
+		printf("against a reference pulse\n");
+		printf("Run using %s [arguments]\n\n", progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf("-f      -file           -filename: .wf file (repeat for more)\n");
+		printf("-rs     -ref_start               : the reference pulse starts...\n");
+		printf("-re     -ref_stop                : ...and stops at these times (s, from\n");
+		printf("                                   the trigger, as in the .wfi file)\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf("-ref    -reference               : .wf file to take the reference from\n");
+		printf("                                   (default: the first -f)\n");
+		printf("-rt     -ref_trace               : trace to take it from (default 0)\n");
+		printf("-min                             : only look for echoes that start...\n");
+		printf("-max                             : ...between these times (s, from the\n");
+		printf("                                   trigger)\n");
+		printf("-e      -either                  : inverted echoes count too (they get a\n");
+		printf("                                   negative peak)\n");
+		printf("-o      -out                     : write the results here (default: the\n");
+		printf("                                   screen)\n");
+		printf("-j      -threads                 : no of threads (default: one per core)\n\n");
+		printf("OUTPUT:\n");
+		printf("For each file, a %% line with its name, then for each trace:\n");
+		printf("trace, delay from the reference pulse to the echo (s), and the\n");
+		printf("correlation coefficient at the peak (1 is a perfect match).\n\n");
+		printf("EXAMPLE:\n");
+		printf("%s -f echoes -rs 1.2e-6 -re 1.8e-6 -min 5e-6 -max 40e-6 -o tof.txt\n",
+		       progname);
+		exit(1);
+	}
+
+	if (refname == NULL) {
+		refname = names[0];
+	}
+	if (get_reference(refname, ref_trace, ref_start, ref_stop, &ref) != 0) {
+		exit(2);
+	}
+	if (outname) {
+		out = fopen(outname, "w");
+		if (out == NULL) {
+			printf("error: could not open %s for writing, quitting...\n",
+			       outname);
+			exit(2);
+		}
+	}
+
+	for (i = 0; i < no_files; i++) {
+		if (tek_wf_open(&wf, names[i]) != 0) {
+			printf("error: could not open %s\n", names[i]);
+			no_failed++;
+			continue;
+		}
+		if (fabs(wf.hinterval - ref.hinterval) > 1e-6 * ref.hinterval) {
+			printf("error: %s isn't sampled at the same rate as the reference\n",
+			       names[i]);
+			no_failed++;
+			tek_wf_close(&wf);
+			continue;
+		}
+		/* The reference's spectrum only needs working out again if
+		 * the traces are a different length; the search window if
+		 * they start at a different time */
+		if (x == NULL || wf.no_points != plan_len) {
+			tek_xcorr_free(x);
+			x = tek_xcorr_new(ref.volts, ref.len, wf.no_points,
+					  wf.hinterval);
+			if (x == NULL) {
+				no_failed++;
+				tek_wf_close(&wf);
+				continue;
+			}
+			plan_len = wf.no_points;
+			plan_hoffset = wf.hoffset + 1;	/* i.e. not this */
+		}
+		if (wf.hoffset != plan_hoffset) {
+			tek_xcorr_search(x, t_min - wf.hoffset, t_max - wf.hoffset,
+					 either_sign);
+			plan_hoffset = wf.hoffset;
+		}
+
+		r = new TEK_XCORR_RESULT[wf.no_traces];
+		t0 = tek_time_us();
+		tek_xcorr_traces(x, wf.data, wf.no_bytes, wf.bytes_per_point,
+				 wf.no_traces, r, no_threads);
+		ms += (tek_time_us() - t0) / 1000;
+		traces_done += wf.no_traces;
+
+		fprintf(out, "%% %s\n", names[i]);
+		for (t = 0; t < wf.no_traces; t++) {
+			if (isnan(r[t].delay)) {
+				fprintf(out, "%ld NaN 0\n", t);
+				continue;
+			}
+			fprintf(out, "%ld %.9g %.4f\n", t,
+				wf.hoffset + r[t].delay - ref.time, r[t].peak);
+		}
+		delete[]r;
+		tek_wf_close(&wf);
+	}
+
+	if (ms > 0) {
+		printf("%s%ld traces in %.1f ms (%.0f traces/s)\n",
+		       out == stdout ? "% " : "", traces_done, ms,
+		       traces_done / (ms / 1000));
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+	tek_xcorr_free(x);
+	delete[]ref.volts;
+	return no_failed ? 2 : 0;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
@@ -0,0 +1,241 @@
+/* tek_trace_get.cc
+ * Gets traces from tek_trace_server rather than from the scope itself, so
+ * that any number of these (and other clients) can share one scope. Saves
+ * them as .wf/.wfi files, just as tgetwf would.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "tek_transport.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+BOOL sc(const char *, const char *);
+
+/* Reads exactly len bytes, returns -1 if the server goes away first */
+static int read_all(int fd, char *buf, long len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = recv(fd, buf, len, 0);
+		if (n <= 0) {
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Reads the reply line (without the newline) */
+static int read_line(int fd, char *line, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len - 1; i++) {
+		if (read_all(fd, line + i, 1) < 0) {
+			return -1;
+		}
+		if (line[i] == '\n') {
+			break;
+		}
+	}
+	line[i] = '\0';
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	const char *path = "/tmp/tek_trace_server.sock";
+	const char *request = "fresh";
+	char source[20];
+	char wfname[256];
+	char wfiname[256];
+	char line[256];
+	FILE *f_wf = NULL;
+	FILE *wfi;
+	BOOL got_source = FALSE;
+	BOOL got_file = FALSE;
+	BOOL quiet = FALSE;
+	long repeat = 1;
+	long count = 0;
+	long buf_size = 0;
+	char *buf = NULL;
+	int index = 1;
+	int fd;
+	struct sockaddr_un addr;
+	unsigned long seq;
+	long bytes = 0;
+	double vgain = 0, voffset = 0, hinterval = 0, hoffset = 0, age_ms;
+	double start;
+
+	progname = argv[0];
+
+	while (index < argc) {
+		if (sc(argv[index], "-channel") || sc(argv[index], "-c")
+		    || sc(argv[index], "-ch")) {
+			snprintf(source, sizeof(source), "%s", argv[++index]);
+			got_source = TRUE;
+		}
+
+		if (sc(argv[index], "-socket") || sc(argv[index], "-s")) {
+			path = argv[++index];
+		}
+
+		if (sc(argv[index], "-filename") || sc(argv[index], "-f")
+		    || sc(argv[index], "-file")) {
+			snprintf(wfname, 256, "%s.wf", argv[++index]);
+			snprintf(wfiname, 256, "%s.wfi", argv[index]);
+			got_file = TRUE;
+		}
+
+		if (sc(argv[index], "-repeat") || sc(argv[index], "-r")
+		    || sc(argv[index], "-rep")) {
+			sscanf(argv[++index], "%ld", &repeat);
+		}
+
+		if (sc(argv[index], "-latest") || sc(argv[index], "-l")) {
+			request = "latest";
+		}
+
+		if (sc(argv[index], "-quiet") || sc(argv[index], "-q")) {
+			quiet = TRUE;
+		}
+
+		index++;
+	}
+
+	if (got_source == FALSE) {
+		printf("%s: gets traces from tek_trace_server\n", progname);
+		printf("Run using %s [arguments]\n\n", progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf("-c      -channel        -ch      : source channel (1-4, M, REF1 etc)\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf("-f      -filename       -file    : save traces (without extension)\n");
+		printf("-s      -socket                  : server's socket\n");
+		printf("                                   (default /tmp/tek_trace_server.sock)\n");
+		printf("-r      -repeat          -rep    : get 'r' traces (default 1)\n");
+		printf("-l      -latest                  : happy with the server's latest trace,\n");
+		printf("                                   however old (default: a fresh one)\n");
+		printf("-q      -quiet                   : don't print a line for each trace\n\n");
+		printf("EXAMPLE:\n");
+		printf("tek_trace_server -ip 128.243.74.98 &\n");
+		printf("%s -c 1 -f test -r 10\n", progname);
+		exit(1);
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		printf("error: could not connect to %s (is tek_trace_server running?)\n",
+		       path);
+		exit(2);
+	}
+	if (got_file == TRUE) {
+		f_wf = fopen(wfname, "wb");
+		if (!f_wf) {
+			printf("error: could not open file for writing, quitting...\n");
+			exit(3);
+		}
+	}
+
+	snprintf(line, sizeof(line), "%s %s\n", request, source);
+	while (count < repeat) {
+		start = tek_time_us();
+		if (send(fd, line, strlen(line), 0) < 0) {
+			break;
+		}
+		if (read_line(fd, line, sizeof(line)) < 0) {
+			printf("error: lost the server\n");
+			break;
+		}
+		if (sscanf(line, "OK %lu %ld %lg %lg %lg %lg %lg", &seq, &bytes,
+			   &vgain, &voffset, &hinterval, &hoffset,
+			   &age_ms) != 7) {
+			printf("server says: %s\n", line);
+			break;
+		}
+		if (bytes > buf_size) {
+			delete[]buf;
+			buf = new char[bytes];
+			buf_size = bytes;
+		}
+		if (read_all(fd, buf, bytes) < 0) {
+			printf("error: lost the server\n");
+			break;
+		}
+		if (f_wf) {
+			fwrite(buf, sizeof(char), bytes, f_wf);
+		}
+		if (quiet == FALSE) {
+			printf("trace %lu: %ld bytes, %.3f ms old, took %.3f ms\n",
+			       seq, bytes, age_ms, (tek_time_us() - start) / 1000);
+		}
+		count++;
+		snprintf(line, sizeof(line), "%s %s\n", request, source);
+	}
+	close(fd);
+	delete[]buf;
+
+	if (f_wf) {
+		fclose(f_wf);
+		wfi = fopen(wfiname, "w");
+		if (wfi) {
+			fprintf(wfi, "%% %s\n", wfiname);
+			fprintf(wfi, "%% Waveform captured using %s\n\n", progname);
+			fprintf(wfi, "%% Number of bytes:\n%ld\n\n", bytes);
+			fprintf(wfi, "%% Vertical gain:\n%g\n\n", vgain);
+			fprintf(wfi, "%% Vertical offset:\n%g\n\n", -voffset);
+			fprintf(wfi, "%% Horizontal interval:\n%g\n\n", hinterval);
+			fprintf(wfi, "%% Horizontal offset:\n%g\n\n", hoffset);
+			fprintf(wfi, "%% Number of traces:\n%ld\n\n", count);
+			fprintf(wfi, "%% Number of bytes per data-point:\n%d\n\n", 2);
+			fprintf(wfi,
+				"%% Keep all datapoints (0 or missing knocks off 1 point, legacy lecroy):\n%d\n\n",
+				1);
+			fclose(wfi);
+		}
+	}
+	return count == repeat ? 0 : 4;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
@@ -0,0 +1,557 @@
+/* tek_trace_server.cc
+ * Shares one scope between any number of local programs. The server owns
+ * the link: it opens and sets up the scope once, then listens on a Unix
+ * socket for requests for traces. Requests for the same source that come
+ * in while the scope is busy are all answered by the same transfer, and
+ * the latest trace (and its scaling) for each source is kept, so that a
+ * client that just wants "whatever you've got" gets it straight away.
+ *
+ * Protocol: the client sends one line per request,
+ *   fresh SOURCE     a trace acquired after the request arrived
+ *   latest SOURCE    the most recent trace we have (fresh, if we have none)
+ *   forget           forget the cached traces and scaling, e.g. after
+ *                    changing the scope's settings by hand
+ * where SOURCE is 1-4, M, CH1, REF2 etc, as for tgetwf. The reply to
+ * fresh/latest is one text line
+ *   OK seq bytes vgain voffset hinterval hoffset age_ms
+ * (volts = vgain * data[i] + voffset, as tek_scope_get_scaling) followed
+ * by bytes of raw 16-bit data. Anything else gets "ERR message".
+ * tek_trace_get is a client that saves the result as .wf/.wfi files.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "tek_vxi11.h"
+#include "tek_transport.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+#define MAX_CLIENTS	64
+#define MAX_SOURCES	24
+#define MAX_REQUEST	128
+
+BOOL sc(const char *, const char *);
+
+/* A captured trace. Shared by every client it's being sent to, and freed
+ * when the last one has finished with it. */
+typedef struct {
+	int refs;
+	unsigned long seq;
+	double t_captured;	/* tek_time_us() */
+	double vgain, voffset, hinterval, hoffset;
+	long bytes;
+	char *data;
+} TRACE;
+
+typedef struct {
+	char name[20];
+	TRACE *latest;
+	BOOL got_scaling;
+	double vgain, voffset, hinterval, hoffset;
+	int waiting;		/* clients waiting for a fresh trace */
+} SOURCE;
+
+typedef struct {
+	int fd;
+	char in[MAX_REQUEST];
+	size_t in_len;
+	int waiting_for;	/* source index, or -1 */
+	double t_asked;		/* tek_time_us() */
+	char header[256];
+	size_t header_len, header_sent;
+	TRACE *out;		/* being sent */
+	long out_sent;
+} CLIENT;
+
+static SOURCE sources[MAX_SOURCES];
+static int no_sources = 0;
+static CLIENT clients[MAX_CLIENTS];
+static int no_clients = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+/* stats */
+static unsigned long no_requests = 0, no_transfers = 0, no_cached = 0;
+
+static void stop_handler(int sig)
+{
+	stop_requested = 1;
+}
+
+static void trace_release(TRACE * t)
+{
+	if (t && --t->refs == 0) {
+		delete[]t->data;
+		free(t);
+	}
+}
+
+static int source_find(const char *name)
+{
+	char source[20];
+	int i;
+
+	snprintf(source, sizeof(source), "%s", name);
+	tek_scope_channel_str(source);
+	for (i = 0; i < no_sources; i++) {
+		if (strcmp(sources[i].name, source) == 0) {
+			return i;
+		}
+	}
+	if (no_sources == MAX_SOURCES) {
+		return -1;
+	}
+	memset(&sources[no_sources], 0, sizeof(SOURCE));
+	snprintf(sources[no_sources].name, sizeof(sources[0].name), "%s",
+		 source);
+	return no_sources++;
+}
+
+static void client_reply(CLIENT * c, const char *fmt, const char *msg)
+{
+	c->header_len = snprintf(c->header, sizeof(c->header), fmt, msg);
+	c->header_sent = 0;
+}
+
+static void client_send_trace(CLIENT * c, TRACE * t)
+{
+	c->header_len = snprintf(c->header, sizeof(c->header),
+				 "OK %lu %ld %.10g %.10g %.10g %.10g %.3f\n",
+				 t->seq, t->bytes, t->vgain, t->voffset,
+				 t->hinterval, t->hoffset,
+				 (tek_time_us() - t->t_captured) / 1000);
+	c->header_sent = 0;
+	c->out = t;
+	c->out_sent = 0;
+	t->refs++;
+}
+
+static BOOL client_busy(CLIENT * c)
+{
+	return c->waiting_for >= 0 || c->header_sent < c->header_len;
+}
+
+/* Handles one request line */
+static void client_request(CLIENT * c, char *line)
+{
+	char cmd[32], name[20];
+	int n, i;
+
+	n = sscanf(line, "%31s %19s", cmd, name);
+	if (n < 1) {
+		return;
+	}
+	no_requests++;
+	if (sc(cmd, "forget")) {
+		for (i = 0; i < no_sources; i++) {
+			trace_release(sources[i].latest);
+			sources[i].latest = NULL;
+			sources[i].got_scaling = FALSE;
+		}
+		client_reply(c, "OK %s\n", "forgotten");
+		return;
+	}
+	if (n < 2 || !(sc(cmd, "fresh") || sc(cmd, "latest"))) {
+		client_reply(c, "ERR %s\n", "unknown request");
+		return;
+	}
+	i = source_find(name);
+	if (i < 0) {
+		client_reply(c, "ERR %s\n", "too many sources");
+		return;
+	}
+	if (sc(cmd, "latest") && sources[i].latest) {
+		no_cached++;
+		client_send_trace(c, sources[i].latest);
+		return;
+	}
+	sources[i].waiting++;
+	c->waiting_for = i;
+	c->t_asked = tek_time_us();
+}
+
+static void client_drop(int k)
+{
+	CLIENT *c = &clients[k];
+
+	if (c->waiting_for >= 0) {
+		sources[c->waiting_for].waiting--;
+	}
+	trace_release(c->out);
+	close(c->fd);
+	clients[k] = clients[--no_clients];
+}
+
+/* Sends as much as the client will take without blocking. Returns -1 if
+ * it has gone away. */
+static int client_write(CLIENT * c)
+{
+	ssize_t n;
+
+	while (c->header_sent < c->header_len) {
+		n = send(c->fd, c->header + c->header_sent,
+			 c->header_len - c->header_sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+		}
+		c->header_sent += n;
+	}
+	while (c->out && c->out_sent < c->out->bytes) {
+		n = send(c->fd, c->out->data + c->out_sent,
+			 c->out->bytes - c->out_sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+		}
+		c->out_sent += n;
+	}
+	if (c->out) {
+		trace_release(c->out);
+		c->out = NULL;
+	}
+	return 0;
+}
+
+/* Reads whatever the client has sent, and acts on any complete lines, as
+ * long as it isn't still waiting for (or being sent) an earlier reply.
+ * Returns -1 if it has gone away. */
+static int client_read(CLIENT * c)
+{
+	ssize_t n;
+	char *nl;
+
+	if (c->in_len < sizeof(c->in) - 1) {
+		n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len,
+			 0);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+			return -1;
+		}
+		if (n > 0) {
+			c->in_len += n;
+		}
+	}
+	while (!client_busy(c) && !c->out
+	       && (nl = (char *)memchr(c->in, '\n', c->in_len))) {
+		*nl = '\0';
+		client_request(c, c->in);
+		c->in_len -= nl + 1 - c->in;
+		memmove(c->in, nl + 1, c->in_len);
+	}
+	if (c->in_len == sizeof(c->in) - 1 && !memchr(c->in, '\n', c->in_len)) {
+		return -1;	/* not talking our language */
+	}
+	return 0;
+}
+
+/* Tells everyone waiting on source i that it didn't work */
+static void fail(int i, const char *msg)
+{
+	int k;
+
+	printf("Problem reading data from %s (%s)\n", sources[i].name, msg);
+	for (k = 0; k < no_clients; k++) {
+		if (clients[k].waiting_for == i) {
+			clients[k].waiting_for = -1;
+			client_reply(&clients[k], "ERR %s\n", msg);
+		}
+	}
+	sources[i].waiting = 0;
+}
+
+/* One transfer for everyone who was waiting on source i by the time the
+ * acquisition started (t_start). Anyone who asked later gets the next. */
+static void capture(VXI11_CLINK * clink, int i, BOOL clear_sweeps,
+		    long buf_size, unsigned long timeout, double t_start)
+{
+	SOURCE *s = &sources[i];
+	TRACE *t;
+	int k;
+	static unsigned long seq = 0;
+
+	t = (TRACE *) calloc(1, sizeof(TRACE));
+	t->data = new char[buf_size];
+	t->refs = 1;
+	t->bytes = tek_scope_get_data(clink, s->name, clear_sweeps, t->data,
+				      buf_size, timeout);
+	t->t_captured = tek_time_us();
+	no_transfers++;
+	if (t->bytes <= 0) {
+		fail(i, "problem reading the data");
+		trace_release(t);
+		return;
+	}
+	if (!s->got_scaling) {
+		tek_scope_get_scaling(clink, &s->vgain, &s->voffset,
+				      &s->hinterval, &s->hoffset);
+		s->got_scaling = TRUE;
+	}
+	t->seq = seq++;
+	t->vgain = s->vgain;
+	t->voffset = s->voffset;
+	t->hinterval = s->hinterval;
+	t->hoffset = s->hoffset;
+
+	trace_release(s->latest);
+	s->latest = t;		/* the cache keeps our reference */
+	for (k = 0; k < no_clients; k++) {
+		if (clients[k].waiting_for == i
+		    && clients[k].t_asked <= t_start) {
+			clients[k].waiting_for = -1;
+			client_send_trace(&clients[k], t);
+			s->waiting--;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	static char *device_ip;
+	const char *path = "/tmp/tek_trace_server.sock";
+	VXI11_CLINK *clink;
+	BOOL got_ip = FALSE;
+	BOOL clear_sweeps = TRUE;
+	unsigned long timeout = 10000;
+	long npoints = 0;
+	long buf_size;
+	int index = 1;
+	int lfd, fd, i, k, next;
+	int armed = -1;		/* source being acquired, if clearing sweeps */
+	double t_armed = 0;
+	struct sockaddr_un addr;
+	struct pollfd pfd[MAX_CLIENTS + 1];
+
+	progname = argv[0];
+
+	while (index < argc) {
+		if (sc(argv[index], "-ip") || sc(argv[index], "-ip_address")
+		    || sc(argv[index], "-IP")) {
+			device_ip = argv[++index];
+			got_ip = TRUE;
+		}
+
+		if (sc(argv[index], "-socket") || sc(argv[index], "-s")) {
+			path = argv[++index];
+		}
+
+		if (sc(argv[index], "-no_points") || sc(argv[index], "-n")
+		    || sc(argv[index], "-points")) {
+			sscanf(argv[++index], "%ld", &npoints);
+		}
+
+		if (sc(argv[index], "-no_clear_sweeps")
+		    || sc(argv[index], "-noclsw")
+		    || sc(argv[index], "-no_clear")) {
+			clear_sweeps = FALSE;
+		}
+
+		if (sc(argv[index], "-timeout") || sc(argv[index], "-t")) {
+			sscanf(argv[++index], "%lu", &timeout);
+		}
+
+		index++;
+	}
+
+	if (got_ip == FALSE) {
+		printf("%s: shares one scope between many local programs\n",
+		       progname);
+		printf("Run using %s [arguments]\n\n", progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf("-ip     -ip_address     -IP      : IP address of scope (eg 128.243.74.98)\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf("-s      -socket                  : Unix socket to listen on\n");
+		printf("                                   (default /tmp/tek_trace_server.sock)\n");
+		printf("-n      -no_points       -points : set record length\n");
+		printf("-noclsw -no_clear_sweeps -noclear: no clear sweeps (if averaging)\n");
+		printf("-t      -timeout                 : timeout (in milliseconds)\n\n");
+		printf("EXAMPLE:\n");
+		printf("%s -ip 128.243.74.98 &\n", progname);
+		printf("tek_trace_get -c 1 -f test\n");
+		exit(1);
+	}
+
+	if (tek_open(&clink, device_ip) || tek_scope_init(clink) != 0) {
+		printf("Quitting...\n");
+		exit(2);
+	}
+	if (npoints > 0) {
+		tek_scope_set_record_length(clink, npoints);
+	}
+	buf_size = tek_scope_set_for_capture(clink, clear_sweeps, timeout);
+	if (buf_size <= 0) {
+		printf("Could not set the scope up for capture, quitting...\n");
+		exit(2);
+	}
+
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	unlink(path);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || listen(lfd, 16) < 0) {
+		printf("error: could not listen on %s, quitting...\n", path);
+		exit(2);
+	}
+	fcntl(lfd, F_SETFL, O_NONBLOCK);
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	signal(SIGPIPE, SIG_IGN);
+	printf("Serving %ld-point traces from %s on %s\n", buf_size / 2,
+	       device_ip, path);
+
+	next = 0;
+	while (!stop_requested) {
+		/* If anybody wants a fresh trace, get it now. Anybody else
+		 * who asks for the same source while we're at it will get
+		 * the next one, along with everyone else who asked by then.
+		 * Take the sources in turn, so that none is starved.
+		 * If we're clearing sweeps, the acquisition could take a
+		 * while (e.g. averaging), so we arm the scope and keep an eye
+		 * on it (see tek_scope_arm), rather than sitting in *OPC?;
+		 * in the meantime we carry on serving everyone else from
+		 * what we've got. */
+		if (armed >= 0) {
+			k = tek_scope_poll(clink);
+			if (k != 0) {
+				capture(clink, armed, FALSE, buf_size, timeout,
+					t_armed);
+				armed = -1;
+			} else if (tek_time_us() - t_armed > timeout * 1000.0) {
+				fail(armed, "timed out waiting for the scope");
+				armed = -1;
+			}
+		}
+		for (k = 0; armed < 0 && k < no_sources; k++) {
+			i = (next + k) % no_sources;
+			if (sources[i].waiting > 0) {
+				next = i + 1;
+				t_armed = tek_time_us();
+				if (clear_sweeps == FALSE) {
+					capture(clink, i, FALSE, buf_size,
+						timeout, t_armed);
+				} else if (tek_scope_arm(clink) == 0) {
+					armed = i;
+				} else {
+					fail(i, "could not arm the scope");
+				}
+				break;
+			}
+		}
+
+		pfd[0].fd = lfd;
+		pfd[0].events = POLLIN;
+		for (k = 0; k < no_clients; k++) {
+			pfd[k + 1].fd = clients[k].fd;
+			pfd[k + 1].events = POLLIN;
+			if (clients[k].header_sent < clients[k].header_len
+			    || clients[k].out) {
+				pfd[k + 1].events |= POLLOUT;
+			}
+		}
+		/* don't hang about in poll() if there's work to do */
+		for (k = 0, i = 0; k < no_sources; k++) {
+			i += sources[k].waiting;
+		}
+		if (armed >= 0) {
+			i = 2;	/* ms, between looking at the scope */
+		} else if (i > 0) {
+			i = 0;
+		} else {
+			i = 1000;
+		}
+		if (poll(pfd, no_clients + 1, i) < 0) {
+			continue;
+		}
+
+		for (k = no_clients - 1; k >= 0; k--) {
+			if ((pfd[k + 1].revents & (POLLOUT | POLLERR | POLLHUP))
+			    && client_write(&clients[k]) < 0) {
+				client_drop(k);
+				continue;
+			}
+			if ((pfd[k + 1].revents & (POLLIN | POLLHUP))
+			    || (!client_busy(&clients[k]) && !clients[k].out
+				&& clients[k].in_len > 0)) {
+				if (client_read(&clients[k]) < 0) {
+					client_drop(k);
+					continue;
+				}
+			}
+			/* replies from the cache can go straight away */
+			if (client_write(&clients[k]) < 0) {
+				client_drop(k);
+			}
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+				if (no_clients == MAX_CLIENTS) {
+					close(fd);
+					continue;
+				}
+				fcntl(fd, F_SETFL, O_NONBLOCK);
+				memset(&clients[no_clients], 0, sizeof(CLIENT));
+				clients[no_clients].fd = fd;
+				clients[no_clients].waiting_for = -1;
+				no_clients++;
+			}
+		}
+	}
+
+	printf("\n%lu requests, %lu transfers, %lu served from the cache\n",
+	       no_requests, no_transfers, no_cached);
+	if (no_transfers > 0) {
+		printf("%.2f requests per transfer\n",
+		       (double)(no_requests - no_cached) / no_transfers);
+	}
+	for (k = no_clients - 1; k >= 0; k--) {
+		client_drop(k);
+	}
+	for (i = 0; i < no_sources; i++) {
+		trace_release(sources[i].latest);
+	}
+	close(lfd);
+	unlink(path);
+	tek_close(clink, device_ip);
+	return 0;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
@@ -0,0 +1,642 @@
+/* tek_wf_convert.cc
+ * Converts a whole directory tree of .wf/.wfi captures (from tgetwf) into
+ * something other people can read without loadwf.m: raw float32, CSV,
+ * NumPy .npy, or a directory of one float32 file per column. All in volts.
+ *
+ * Every core gets a thread. The files are shared out at the start, biggest
+ * first, and a thread that runs out of its own steals from the others, so
+ * one huge capture near the end doesn't leave everyone else idle. Input is
+ * memory-mapped (library/tek_wf.h) and output is built up in big buffers
+ * and written in large sequential chunks, so the disk is kept busy too.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * The author's email address is steve.sharples@nottingham.ac.uk
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "tek_vxi11.h"
+#include "tek_transport.h"
+#include "tek_wf.h"
+
+#ifndef	BOOL
+#define	BOOL	int
+#endif
+#ifndef TRUE
+#define	TRUE	1
+#endif
+#ifndef FALSE
+#define	FALSE	0
+#endif
+
+BOOL sc(const char *, const char *);
+
+#define FMT_F32		0
+#define FMT_CSV		1
+#define FMT_NPY		2
+#define FMT_COL		3
+
+#define OUT_BUF_SIZE	(8 * 1024 * 1024)
+
+typedef struct {
+	char *base;		/* path of the capture, without .wf/.wfi */
+	char *out_base;		/* path of the output, without extension */
+	long long bytes;	/* of the .wf file */
+} JOB;
+
+/* Each thread's share of the jobs. It takes from the tail of its own;
+ * other threads steal from the head. */
+typedef struct {
+	pthread_mutex_t lock;
+	long *jobs;
+	long head, tail;
+} DEQUE;
+
+typedef struct {
+	int fd;
+	char *buf;
+	size_t len;
+	long long written;
+	BOOL failed;
+} OUT;
+
+static JOB *jobs = NULL;
+static long no_jobs = 0, jobs_alloc = 0;
+static DEQUE *deques;
+static int no_threads;
+static int format = FMT_NPY;
+static BOOL quiet = FALSE;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static long no_done = 0, no_failed = 0, no_stolen = 0;
+static long long bytes_in = 0, bytes_out = 0;
+
+/*****************************************************************************
+ * Finding the captures                                                      *
+ *****************************************************************************/
+
+static void add_job(const char *base, const char *rel, const char *out_dir,
+		    long long bytes)
+{
+	size_t len;
+
+	if (no_jobs == jobs_alloc) {
+		jobs_alloc = jobs_alloc ? 2 * jobs_alloc : 1024;
+		jobs = (JOB *) realloc(jobs, jobs_alloc * sizeof(JOB));
+		if (!jobs) {
+			printf("error: out of memory, quitting...\n");
+			exit(2);
+		}
+	}
+	jobs[no_jobs].base = strdup(base);
+	if (out_dir) {
+		len = strlen(out_dir) + strlen(rel) + 2;
+		jobs[no_jobs].out_base = (char *)malloc(len);
+		snprintf(jobs[no_jobs].out_base, len, "%s/%s", out_dir, rel);
+	} else {
+		jobs[no_jobs].out_base = strdup(base);
+	}
+	jobs[no_jobs].bytes = bytes;
+	no_jobs++;
+}
+
+/* Looks for name.wfi files with a name.wf next to them, all the way down.
+ * rel is the path below the top directory (for putting the output in the
+ * same place under out_dir). Doesn't follow symbolic links to directories,
+ * so can't go round in circles. */
+static void walk(const char *dir, const char *rel, const char *out_dir)
+{
+	DIR *d;
+	struct dirent *e;
+	struct stat st;
+	char path[4096], sub[4096];
+	size_t len;
+
+	d = opendir(dir);
+	if (d == NULL) {
+		printf("Warning: could not open directory %s\n", dir);
+		return;
+	}
+	while ((e = readdir(d)) != NULL) {
+		if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+			continue;
+		}
+		if (snprintf(path, sizeof(path), "%s/%s", dir, e->d_name) >=
+		    (int)sizeof(path)
+		    || snprintf(sub, sizeof(sub), "%s%s%s", rel,
+				*rel ? "/" : "", e->d_name) >= (int)sizeof(sub)) {
+			printf("Warning: skipping %s/%s, the name is too long\n",
+			       dir, e->d_name);
+			continue;
+		}
+		if (lstat(path, &st) != 0) {
+			continue;
+		}
+		if (S_ISDIR(st.st_mode)) {
+			walk(path, sub, out_dir);
+			continue;
+		}
+		len = strlen(path);
+		if (len < 5 || strcmp(path + len - 4, ".wfi") != 0) {
+			continue;
+		}
+		/* name.wfi -> name.wf -> name */
+		path[len - 1] = '\0';
+		if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+			path[len - 4] = '\0';
+			sub[strlen(sub) - 4] = '\0';
+			add_job(path, sub, out_dir, (long long)st.st_size);
+		}
+	}
+	closedir(d);
+}
+
+/* mkdir -p of everything up to the last slash in path */
+static void make_parent_dirs(const char *path)
+{
+	char dir[4200];
+	char *p;
+
+	if (snprintf(dir, sizeof(dir), "%s", path) >= (int)sizeof(dir)) {
+		return;
+	}
+	for (p = dir + 1; *p; p++) {
+		if (*p == '/') {
+			*p = '\0';
+			mkdir(dir, 0777);
+			*p = '/';
+		}
+	}
+}
+
+/*****************************************************************************
+ * Writing                                                                   *
+ *****************************************************************************/
+
+static int out_open(OUT * out, const char *name)
+{
+	memset(out, 0, sizeof(OUT));
+	out->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out->fd < 0) {
+		if (!quiet) {
+			printf("error: could not open %s for writing (%s)\n",
+			       name, strerror(errno));
+		}
+		return -1;
+	}
+	out->buf = (char *)malloc(OUT_BUF_SIZE);
+	if (!out->buf) {
+		close(out->fd);
+		return -1;
+	}
+	return 0;
+}
+
+static void out_flush(OUT * out)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < out->len && !out->failed) {
+		n = write(out->fd, out->buf + done, out->len - done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			out->failed = TRUE;
+			break;
+		}
+		done += n;
+	}
+	out->written += done;
+	out->len = 0;
+}
+
+/* Room for at least len more bytes */
+static char *out_space(OUT * out, size_t len)
+{
+	if (out->len + len > OUT_BUF_SIZE) {
+		out_flush(out);
+	}
+	return out->buf + out->len;
+}
+
+static void out_float(OUT * out, float x)
+{
+	memcpy(out_space(out, sizeof(float)), &x, sizeof(float));
+	out->len += sizeof(float);
+}
+
+static void out_text(OUT * out, const char *fmt, double x)
+{
+	out->len += snprintf(out_space(out, 32), 32, fmt, x);
+}
+
+/* Returns the number of bytes written, or -1 */
+static long long out_close(OUT * out)
+{
+	out_flush(out);
+	free(out->buf);
+	if (close(out->fd) != 0) {
+		out->failed = TRUE;
+	}
+	return out->failed ? -1 : out->written;
+}
+
+static float volts(const TEK_WF * wf, const char *trace, long i)
+{
+	if (wf->bytes_per_point == 1) {
+		return (float)(wf->vgain * ((const signed char *)trace)[i]
+			       - wf->voffset);
+	}
+	if (wf->bytes_per_point == 4) {
+		return (float)(wf->vgain * ((const int32_t *)trace)[i]
+			       - wf->voffset);
+	}
+	return (float)(wf->vgain * ((const short *)trace)[i] - wf->voffset);
+}
+
+static const char *trace_ptr(const TEK_WF * wf, long t)
+{
+	if (wf->bytes_per_point == 4) {
+		return (const char *)tek_wf_trace32(wf, t);
+	}
+	return (wf->bytes_per_point == 1) ? (const char *)tek_wf_trace8(wf, t)
+	    : (const char *)tek_wf_trace16(wf, t);
+}
+
+/* One trace after another, float32 */
+static void write_f32(OUT * out, const TEK_WF * wf)
+{
+	const char *p;
+	long t, i;
+
+	for (t = 0; t < wf->no_traces; t++) {
+		p = trace_ptr(wf, t);
+		for (i = 0; i < wf->no_points; i++) {
+			out_float(out, volts(wf, p, i));
+		}
+	}
+}
+
+/* The same, with a NumPy header: shape (traces, points) */
+static void write_npy(OUT * out, const TEK_WF * wf)
+{
+	char hdr[128];
+	int len;
+
+	len = snprintf(hdr, sizeof(hdr),
+		       "{'descr': '<f4', 'fortran_order': False, 'shape': (%ld, %ld), }",
+		       wf->no_traces, wf->no_points);
+	/* magic, version, header length, header: padded with spaces to a
+	 * multiple of 64, and ending in a newline */
+	while ((10 + len + 1) % 64 != 0) {
+		hdr[len++] = ' ';
+	}
+	hdr[len++] = '\n';
+	memcpy(out_space(out, 10), "\x93NUMPY\x01\x00", 8);
+	out->buf[out->len + 8] = (char)(len & 0xff);
+	out->buf[out->len + 9] = (char)(len >> 8);
+	out->len += 10;
+	memcpy(out_space(out, len), hdr, len);
+	out->len += len;
+	write_f32(out, wf);
+}
+
+/* A row per point: time, then each trace */
+static void write_csv(OUT * out, const TEK_WF * wf)
+{
+	const char **p;
+	long t, i;
+
+	p = new const char *[wf->no_traces];
+	out->len += snprintf(out_space(out, 8), 8, "time");
+	for (t = 0; t < wf->no_traces; t++) {
+		p[t] = trace_ptr(wf, t);
+		out->len += snprintf(out_space(out, 24), 24, ",trace%ld", t);
+	}
+	out_space(out, 1)[0] = '\n';
+	out->len++;
+	for (i = 0; i < wf->no_points; i++) {
+		out_text(out, "%.9g", tek_wf_time(wf, i));
+		for (t = 0; t < wf->no_traces; t++) {
+			out_text(out, ",%.7g", volts(wf, p[t], i));
+		}
+		out_space(out, 1)[0] = '\n';
+		out->len++;
+	}
+	delete[]p;
+}
+
+/* A directory, with time.f32 and one traceN.f32 per trace */
+static long long write_columns(const char *dir, const TEK_WF * wf)
+{
+	OUT out;
+	char name[4200];
+	const char *p;
+	long long total = 0, n;
+	long t, i;
+
+	mkdir(dir, 0777);
+	for (t = -1; t < wf->no_traces; t++) {
+		if (t < 0) {
+			n = snprintf(name, sizeof(name), "%s/time.f32", dir);
+		} else {
+			n = snprintf(name, sizeof(name), "%s/trace%ld.f32", dir,
+				     t);
+		}
+		if (n >= (long long)sizeof(name) || out_open(&out, name) != 0) {
+			return -1;
+		}
+		p = (t < 0) ? NULL : trace_ptr(wf, t);
+		for (i = 0; i < wf->no_points; i++) {
+			out_float(&out, p ? volts(wf, p, i)
+				  : (float)tek_wf_time(wf, i));
+		}
+		n = out_close(&out);
+		if (n < 0) {
+			return -1;
+		}
+		total += n;
+	}
+	return total;
+}
+
+static int convert(JOB * job)
+{
+	static const char *ext[] = { ".f32", ".csv", ".npy", ".cols" };
+	TEK_WF wf;
+	OUT out;
+	char name[4200];
+	long long written;
+
+	if (snprintf(name, sizeof(name), "%s%s", job->out_base, ext[format]) >=
+	    (int)sizeof(name)) {
+		if (!quiet) {
+			printf("error: the output name for %s is too long\n",
+			       job->base);
+		}
+		return -1;
+	}
+	if (tek_wf_open(&wf, job->base) != 0) {
+		return -1;
+	}
+	/* we'll go through it from start to finish (except for CSV) */
+	if (wf.data && format != FMT_CSV) {
+		madvise((void *)wf.data, wf.size, MADV_SEQUENTIAL);
+	}
+	make_parent_dirs(name);
+	if (format == FMT_COL) {
+		written = write_columns(name, &wf);
+	} else if (out_open(&out, name) != 0) {
+		written = -1;
+	} else {
+		if (format == FMT_F32) {
+			write_f32(&out, &wf);
+		} else if (format == FMT_CSV) {
+			write_csv(&out, &wf);
+		} else {
+			write_npy(&out, &wf);
+		}
+		written = out_close(&out);
+	}
+	tek_wf_close(&wf);
+	if (written < 0) {
+		if (!quiet) {
+			printf("error: could not write %s\n", name);
+		}
+		return -1;
+	}
+	pthread_mutex_lock(&stats_lock);
+	bytes_in += job->bytes;
+	bytes_out += written;
+	pthread_mutex_unlock(&stats_lock);
+	return 0;
+}
+
+/*****************************************************************************
+ * The thread pool                                                           *
+ *****************************************************************************/
+
+static long take_own(DEQUE * d)
+{
+	long j = -1;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->tail > d->head) {
+		j = d->jobs[--d->tail];
+	}
+	pthread_mutex_unlock(&d->lock);
+	return j;
+}
+
+static long steal(DEQUE * d)
+{
+	long j = -1;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->tail > d->head) {
+		j = d->jobs[d->head++];
+	}
+	pthread_mutex_unlock(&d->lock);
+	return j;
+}
+
+static void *worker(void *arg)
+{
+	int me = (int)(long)arg, k;
+	long j;
+	BOOL stolen;
+
+	for (;;) {
+		stolen = FALSE;
+		j = take_own(&deques[me]);
+		for (k = 1; j < 0 && k < no_threads; k++) {
+			j = steal(&deques[(me + k) % no_threads]);
+			stolen = TRUE;
+		}
+		if (j < 0) {
+			break;	/* nothing left anywhere: no new jobs appear */
+		}
+		k = convert(&jobs[j]);
+		pthread_mutex_lock(&stats_lock);
+		if (k == 0) {
+			no_done++;
+		} else {
+			no_failed++;
+		}
+		no_stolen += stolen;
+		pthread_mutex_unlock(&stats_lock);
+	}
+	return NULL;
+}
+
+static int compare_size(const void *a, const void *b)
+{
+	long long x = ((const JOB *)a)->bytes, y = ((const JOB *)b)->bytes;
+
+	return (x < y) - (x > y);	/* biggest first */
+}
+
+int main(int argc, char *argv[])
+{
+	static char *progname;
+	char *dir = NULL;
+	char *out_dir = NULL;
+	int index = 1;
+	int t;
+	long j;
+	pthread_t *threads;
+	double t_start, secs;
+
+	progname = argv[0];
+	no_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	while (index < argc) {
+		if (sc(argv[index], "-dir") || sc(argv[index], "-d")) {
+			dir = argv[++index];
+		}
+
+		if (sc(argv[index], "-out") || sc(argv[index], "-o")) {
+			out_dir = argv[++index];
+		}
+
+		if (sc(argv[index], "-format") || sc(argv[index], "-fmt")) {
+			index++;
+			if (sc(argv[index], "f32") || sc(argv[index], "float")) {
+				format = FMT_F32;
+			} else if (sc(argv[index], "csv")) {
+				format = FMT_CSV;
+			} else if (sc(argv[index], "npy")) {
+				format = FMT_NPY;
+			} else if (sc(argv[index], "col")
+				   || sc(argv[index], "columns")) {
+				format = FMT_COL;
+			} else {
+				printf("unknown format '%s'\n", argv[index]);
+				dir = NULL;
+			}
+		}
+
+		if (sc(argv[index], "-threads") || sc(argv[index], "-j")) {
+			sscanf(argv[++index], "%d", &no_threads);
+		}
+
+		if (sc(argv[index], "-quiet") || sc(argv[index], "-q")) {
+			quiet = TRUE;
+		}
+
+		index++;
+	}
+
+	if (dir == NULL) {
+		printf("%s: converts all the .wf/.wfi captures in a directory tree\n",
+		       progname);
+		printf("Run using %s [arguments]\n\n", progname);
+		printf("REQUIRED ARGUMENTS:\n");
+		printf("-d      -dir                     : directory to look in (and below)\n");
+		printf("OPTIONAL ARGUMENTS:\n");
+		printf("-fmt    -format                  : npy (default): NumPy, float32 volts,\n");
+		printf("                                   shape (traces, points)\n");
+		printf("                                   f32: float32 volts, trace after trace\n");
+		printf("                                   csv: time, then a column per trace\n");
+		printf("                                   col: a directory per capture, with\n");
+		printf("                                   time.f32 and traceN.f32\n");
+		printf("-o      -out                     : put the output under here, in the same\n");
+		printf("                                   layout (default: next to each capture)\n");
+		printf("-j      -threads                 : no of threads (default: one per core)\n");
+		printf("-q      -quiet                   : don't print errors for each file\n\n");
+		printf("EXAMPLE:\n");
+		printf("%s -d /data/captures -o /data/numpy -fmt npy\n",
+		       progname);
+		exit(1);
+	}
+	if (no_threads < 1) {
+		no_threads = 1;
+	}
+
+	walk(dir, "", out_dir);
+	if (no_jobs == 0) {
+		printf("No captures found in %s\n", dir);
+		exit(0);
+	}
+	printf("Converting %ld captures with %d threads...\n", no_jobs,
+	       no_threads);
+
+	/* Biggest first, dealt out in turn, so everyone starts with about the
+	 * same amount; stealing evens out the rest */
+	qsort(jobs, no_jobs, sizeof(JOB), compare_size);
+	deques = new DEQUE[no_threads];
+	for (t = 0; t < no_threads; t++) {
+		pthread_mutex_init(&deques[t].lock, NULL);
+		deques[t].jobs = new long[no_jobs / no_threads + 1];
+		deques[t].head = deques[t].tail = 0;
+	}
+	/* each thread takes from its tail, so put the biggest there */
+	for (j = no_jobs - 1; j >= 0; j--) {
+		t = (int)(j % no_threads);
+		deques[t].jobs[deques[t].tail++] = j;
+	}
+
+	t_start = tek_time_us();
+	threads = new pthread_t[no_threads];
+	for (t = 1; t < no_threads; t++) {
+		pthread_create(&threads[t], NULL, worker, (void *)(long)t);
+	}
+	worker((void *)0L);
+	for (t = 1; t < no_threads; t++) {
+		pthread_join(threads[t], NULL);
+	}
+	secs = (tek_time_us() - t_start) / 1e6;
+
+	printf("Converted %ld captures (%ld failed, %ld stolen) in %.2f s\n",
+	       no_done, no_failed, no_stolen, secs);
+	if (secs > 0) {
+		printf("%.1f files/s, %.3f GB/s in, %.3f GB/s out\n",
+		       no_done / secs, bytes_in / secs / 1e9,
+		       bytes_out / secs / 1e9);
+	}
+
+	for (t = 0; t < no_threads; t++) {
+		delete[]deques[t].jobs;
+	}
+	delete[]deques;
+	delete[]threads;
+	for (j = 0; j < no_jobs; j++) {
+		free(jobs[j].base);
+		free(jobs[j].out_base);
+	}
+	free(jobs);
+	return no_failed ? 2 : 0;
+}
+
+/* string compare (sc) function for parsing... ignore */
+BOOL sc(const char *con, const char *var)
+{
+	if (strcmp(con, var) == 0) {
+		return TRUE;
+	}
+	return FALSE;
+}
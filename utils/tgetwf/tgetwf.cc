@@ -36,13 +36,25 @@
  * The author's email address is steve.sharples@nottingham.ac.uk
  */
 
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "tek_vxi11.h"
+#include "tek_transport.h"
+#include "tek_shm.h"
+#include "tek_parallel.h"
+#include "tek_timestamps.h"
+#include "tek_measure.h"
+#include "tek_digital.h"
+#include "tek_decimate.h"
+#include "tek_plan.h"
 
 #ifdef WIN32
 #define snprintf sprintf_s
+#else
+#include <pthread.h>
 #endif
 
 #ifndef	BOOL
@@ -57,6 +69,514 @@
 
 BOOL sc(const char *, const char *);
 
+/*****************************************************************************
+ * Measurements                                                              *
+ *****************************************************************************/
+
+/* With -meas, every trace (or every segment, in segmented mode) is measured
+ * as it comes in (see tek_measure.h), and gets a line in the measurements
+ * file, whether or not the trace itself is being kept. */
+
+typedef struct {
+	FILE *f;
+	int traces_per_buf;	/* segments per acquisition, or 1 */
+	BOOL got_scaling;
+	double vgain, voffset, hinterval, hoffset;
+	TEK_MEASUREMENTS *m;
+	long trace;		/* next trace number */
+} MEASURE_LOG;
+
+/* Needs a trace to have been got first, for the DATA:SOURCE */
+static void measure_get_scaling(VXI11_CLINK * clink, MEASURE_LOG * ml)
+{
+	if (ml->got_scaling == FALSE) {
+		tek_scope_get_scaling(clink, &ml->vgain, &ml->voffset,
+				      &ml->hinterval, &ml->hoffset);
+		ml->got_scaling = TRUE;
+	}
+}
+
+static void measure_buf(MEASURE_LOG * ml, const char *buf, long bytes)
+{
+	int t;
+
+	tek_measure_traces(buf, bytes / 2 / ml->traces_per_buf,
+			   ml->traces_per_buf, ml->vgain, ml->voffset,
+			   ml->hinterval, ml->m, 0);
+	for (t = 0; t < ml->traces_per_buf; t++) {
+		tek_measure_write(ml->f, ml->trace++, &ml->m[t]);
+	}
+}
+
+/*****************************************************************************
+ * Digital channels                                                          *
+ *****************************************************************************/
+
+/* With -dig, we get all 16 digital lines at once (DATA:SOURCE DIGITAL) and
+ * keep only the edges on each line, in filename.wfd (see tek_digital.h),
+ * instead of the samples in filename.wf */
+
+typedef struct {
+	int traces_per_buf;	/* segments per acquisition, or 1 */
+	long raw_bytes, stored_bytes;
+} DIGITAL_LOG;
+
+static void digital_write_buf(DIGITAL_LOG * dl, FILE * f, const char *buf,
+			      long bytes)
+{
+	TEK_DIGITAL d;
+	long n = bytes / 2 / dl->traces_per_buf, written;
+	int t;
+
+	for (t = 0; t < dl->traces_per_buf; t++) {
+		if (tek_digital_decode(buf + 2 * n * t, n, &d) != 0) {
+			continue;
+		}
+		written = tek_digital_write(f, &d);
+		if (written > 0) {
+			dl->stored_bytes += written;
+		}
+		tek_digital_free(&d);
+	}
+	dl->raw_bytes += bytes;
+}
+
+/*****************************************************************************
+ * Decimation                                                                *
+ *****************************************************************************/
+
+/* With -dec, every trace (or segment) is low-pass filtered and only every
+ * Nth point of it is written to filename.wf (see tek_decimate.h), and the
+ * .wfi file is written to match. -meas and -shm still get the whole trace. */
+
+typedef struct {
+	TEK_DECIMATE *d;
+	int traces_per_buf;	/* segments per acquisition, or 1 */
+	char *out;
+	long out_size;
+	long raw_bytes, stored_bytes;
+} DECIMATE_LOG;
+
+static void decimate_write_buf(DECIMATE_LOG * xl, FILE * f, const char *buf,
+			       long bytes)
+{
+	long n = bytes / 2 / xl->traces_per_buf, out_bytes;
+
+	out_bytes = tek_decimate_points(xl->d, n)
+	    * tek_decimate_bytes_per_point(xl->d) * xl->traces_per_buf;
+	if (out_bytes > xl->out_size) {
+		delete[]xl->out;
+		xl->out = new char[out_bytes];
+		xl->out_size = out_bytes;
+	}
+	out_bytes = tek_decimate_traces(xl->d, buf, n, xl->traces_per_buf,
+					xl->out, 0);
+	if (out_bytes > 0) {
+		fwrite(xl->out, sizeof(char), out_bytes, f);
+		xl->stored_bytes += out_bytes;
+	}
+	xl->raw_bytes += bytes;
+}
+
+/*****************************************************************************
+ * Continuous (unattended) capture                                           *
+ *****************************************************************************/
+
+/* In continuous mode the main thread does nothing but capture, into a ring
+ * of buffers that are all allocated up front, and a second thread writes
+ * them to disk. If the disk (or anything else) can't keep up and the ring
+ * fills, we either wait for a free buffer ("stall", the default, nothing is
+ * lost but the capture rate drops) or carry on capturing into a scratch
+ * buffer and throw the trace away ("drop", the capture rate is kept up but
+ * traces are lost, and counted).
+ *
+ * With -shm, the buffers are the slots of a shared memory ring (see
+ * tek_shm.h), so each trace is captured straight into shared memory and
+ * published to any other processes that are watching, as well as (if
+ * there's a file) being written to disk. With -meas, the writer thread
+ * does the measuring too, so it doesn't hold up the capturing. */
+
+#define POLICY_STALL	0
+#define POLICY_DROP	1
+
+typedef struct {
+	int size;		/* number of buffers */
+	char **buf;
+	long *bytes;		/* bytes in each buffer */
+	double *t_start;	/* when the capture into each buffer began (us) */
+	int head, tail, count;
+	int done;		/* no more traces coming */
+#ifndef WIN32
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty, not_full;
+#endif
+	TEK_SHM *shm;		/* buffers are in here, if not NULL */
+	FILE *f_wf;		/* may be NULL, with -shm or -meas */
+	MEASURE_LOG *ml;	/* may be NULL */
+	DIGITAL_LOG *dl;	/* if not NULL, write edges not samples */
+	DECIMATE_LOG *xl;	/* if not NULL, write it decimated */
+	long written;
+	double *write_lat;	/* capture start to written, per trace (ms) */
+} RING;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void stop_handler(int sig)
+{
+	stop_requested = 1;
+}
+
+static int ring_init(RING * ring, int size, long buf_size, TEK_SHM * shm,
+		     FILE * f_wf, long max_traces)
+{
+	int i;
+
+	memset(ring, 0, sizeof(RING));
+	ring->size = size;
+	ring->buf = (char **)calloc(size, sizeof(char *));
+	ring->bytes = (long *)calloc(size, sizeof(long));
+	ring->t_start = (double *)calloc(size, sizeof(double));
+	ring->write_lat = (double *)malloc(max_traces * sizeof(double));
+	if (!ring->buf || !ring->bytes || !ring->t_start || !ring->write_lat) {
+		return -1;
+	}
+	ring->shm = shm;
+	for (i = 0; i < size && !shm; i++) {
+		ring->buf[i] = new char[buf_size];
+	}
+	ring->f_wf = f_wf;
+#ifndef WIN32
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->not_empty, NULL);
+	pthread_cond_init(&ring->not_full, NULL);
+#endif
+	return 0;
+}
+
+static void ring_free(RING * ring)
+{
+	int i;
+
+	for (i = 0; i < ring->size && !ring->shm; i++) {
+		delete[]ring->buf[i];
+	}
+	free(ring->buf);
+	free(ring->bytes);
+	free(ring->t_start);
+	free(ring->write_lat);
+#ifndef WIN32
+	pthread_mutex_destroy(&ring->lock);
+	pthread_cond_destroy(&ring->not_empty);
+	pthread_cond_destroy(&ring->not_full);
+#endif
+}
+
+/* Writes the oldest full buffer to disk. Called with the lock held (if
+ * there is one), but drops it while actually writing. */
+static void ring_write_one(RING * ring)
+{
+	int slot = ring->tail;
+	double latency;
+
+#ifndef WIN32
+	pthread_mutex_unlock(&ring->lock);
+#endif
+	if (ring->f_wf && ring->dl) {
+		digital_write_buf(ring->dl, ring->f_wf, ring->buf[slot],
+				  ring->bytes[slot]);
+	} else if (ring->f_wf && ring->xl) {
+		decimate_write_buf(ring->xl, ring->f_wf, ring->buf[slot],
+				   ring->bytes[slot]);
+	} else if (ring->f_wf) {
+		fwrite(ring->buf[slot], sizeof(char), ring->bytes[slot],
+		       ring->f_wf);
+	}
+	if (ring->ml) {
+		measure_buf(ring->ml, ring->buf[slot], ring->bytes[slot]);
+	}
+	latency = (tek_time_us() - ring->t_start[slot]) / 1000;
+#ifndef WIN32
+	pthread_mutex_lock(&ring->lock);
+#endif
+	ring->write_lat[ring->written++] = latency;
+	ring->tail = (ring->tail + 1) % ring->size;
+	ring->count--;
+}
+
+#ifndef WIN32
+static void *ring_writer(void *arg)
+{
+	RING *ring = (RING *) arg;
+
+	pthread_mutex_lock(&ring->lock);
+	for (;;) {
+		while (ring->count == 0 && !ring->done) {
+			pthread_cond_wait(&ring->not_empty, &ring->lock);
+		}
+		if (ring->count == 0) {
+			break;
+		}
+		ring_write_one(ring);
+		pthread_cond_signal(&ring->not_full);
+	}
+	pthread_mutex_unlock(&ring->lock);
+	return NULL;
+}
+#endif
+
+/*****************************************************************************
+ * FastFrame timestamps                                                      *
+ *****************************************************************************/
+
+/* With -ts, after each segmented acquisition we ask for the trigger times
+ * of all of its frames in one go, append them to filename.wft (one record
+ * per frame, in the same order as the frames in filename.wf, whether or
+ * not the scope gave us its time), and add the intervals between them to
+ * some statistics for the end. */
+
+typedef struct {
+	FILE *f;		/* may be NULL, with -shm and no -f */
+	double file_t0;
+	long no_frames;		/* per acquisition */
+	int64_t *t_ps;
+	uint32_t *flags;
+	uint32_t trace;
+	TEK_TS_STATS stats;
+} TS_LOG;
+
+static int ts_log_timestamps(VXI11_CLINK * clink, char *channel,
+			     TS_LOG * ts, unsigned long timeout)
+{
+	double t0;
+	long n, i;
+
+	n = tek_scope_get_timestamps(clink, channel, ts->no_frames, &t0,
+				     ts->t_ps, timeout);
+	if (n < 0) {
+		n = 0;
+	}
+	tek_timestamps_analyse(ts->t_ps, n, ts->flags, &ts->stats);
+	/* Frames the scope didn't give us a time for still get a record,
+	 * so that the records keep lining up with the frames in the .wf */
+	for (i = n; i < ts->no_frames; i++) {
+		ts->t_ps[i] = 0;
+		ts->flags[i] = TEK_TS_MISSING;
+	}
+	if (n == 0) {
+		t0 = (ts->file_t0 >= 0) ? ts->file_t0 : (double)time(NULL);
+	}
+	if (ts->f) {
+		tek_timestamps_write(ts->f, &ts->file_t0, t0, ts->t_ps,
+				     ts->flags, ts->no_frames, ts->trace);
+	}
+	ts->trace++;
+	return (n > 0) ? 0 : -1;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Prints percentiles of n values. Sorts them in place. */
+static void print_percentiles(const char *what, double *v, long n)
+{
+	if (n <= 0) {
+		return;
+	}
+	qsort(v, n, sizeof(double), compare_double);
+	printf("%s (ms): p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n", what,
+	       v[(long)(0.50 * (n - 1))], v[(long)(0.90 * (n - 1))],
+	       v[(long)(0.99 * (n - 1))], v[n - 1]);
+}
+
+/* Captures until we've got max_traces traces (0 for no limit), the
+ * duration (in seconds, 0 for no limit) is up, or we get SIGINT/SIGTERM.
+ * If rate > 0, captures are started at that many per second; if the scope
+ * can't keep up, we carry on as fast as possible and count how many were
+ * late. Returns the number of traces written. */
+static long continuous_capture(VXI11_CLINK * clink, char *channel,
+			       BOOL clear_sweeps, long buf_size,
+			       unsigned long timeout, FILE * f_wf,
+			       TEK_SHM * shm, int segments, long max_traces,
+			       double duration, double rate, int ring_size,
+			       int policy, TS_LOG * ts, MEASURE_LOG * ml,
+			       DIGITAL_LOG * dl, DECIMATE_LOG * xl)
+{
+	RING ring;
+	TEK_SHM_INFO info;
+	char *scratch = NULL;
+	double *capture_lat;
+	long captured = 0, dropped = 0, late = 0, latency_size;
+	double t_begin, t_next, t_now, t0, period;
+	long bytes_returned;
+	int slot;
+#ifndef WIN32
+	pthread_t writer;
+#endif
+
+	/* latency arrays: one entry per trace, grown as needed if unlimited */
+	latency_size = (max_traces > 0) ? max_traces : 65536;
+	capture_lat = (double *)malloc(latency_size * sizeof(double));
+#ifdef WIN32
+	ring_size = 1;		/* no writer thread; write each one as we go */
+#endif
+	if (!capture_lat
+	    || ring_init(&ring, ring_size, buf_size, shm, f_wf,
+			 latency_size) != 0) {
+		printf("error: could not allocate buffers, quitting...\n");
+		exit(2);
+	}
+	ring.ml = ml;
+	ring.dl = dl;
+	ring.xl = xl;
+	if (policy == POLICY_DROP) {
+		scratch = new char[buf_size];
+	}
+
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+#ifndef WIN32
+	pthread_create(&writer, NULL, ring_writer, &ring);
+#endif
+	period = (rate > 0) ? 1e6 / rate : 0;
+	t_begin = t_next = tek_time_us();
+
+	while (!stop_requested && (max_traces == 0 || captured < max_traces)) {
+		t_now = tek_time_us();
+		if (duration > 0 && t_now - t_begin >= duration * 1e6) {
+			break;
+		}
+		if (period > 0) {
+			if (t_now < t_next) {
+				tek_sleep_us(t_next - t_now);
+			} else if (t_now - t_next > period) {
+				/* fallen behind: don't try to catch up */
+				late++;
+				t_next = t_now;
+			}
+			t_next += period;
+		}
+
+		/* find somewhere to put it */
+#ifndef WIN32
+		pthread_mutex_lock(&ring.lock);
+		if (policy == POLICY_STALL) {
+			while (ring.count == ring.size) {
+				pthread_cond_wait(&ring.not_full, &ring.lock);
+			}
+		}
+#endif
+		slot = (ring.count < ring.size) ? ring.head : -1;
+#ifndef WIN32
+		pthread_mutex_unlock(&ring.lock);
+#endif
+
+		if (shm && slot >= 0) {
+			ring.buf[slot] = tek_shm_write_begin(shm, NULL);
+		}
+		t0 = tek_time_us();
+		bytes_returned = tek_scope_get_data(clink, channel, clear_sweeps,
+						    slot >= 0 ? ring.buf[slot] : scratch,
+						    buf_size, timeout);
+		if (bytes_returned <= 0) {
+			printf("Problem reading the data, stopping...\n");
+			break;
+		}
+		if (captured == latency_size) {
+			latency_size *= 2;
+			capture_lat = (double *)realloc(capture_lat,
+							latency_size * sizeof(double));
+#ifndef WIN32
+			pthread_mutex_lock(&ring.lock);
+#endif
+			ring.write_lat = (double *)realloc(ring.write_lat,
+							   latency_size * sizeof(double));
+#ifndef WIN32
+			pthread_mutex_unlock(&ring.lock);
+#endif
+			if (!capture_lat || !ring.write_lat) {
+				printf("error: out of memory, stopping...\n");
+				exit(2);
+			}
+		}
+		capture_lat[captured++] = (tek_time_us() - t0) / 1000;
+		if (ml) {
+			/* before the writer thread gets its first trace */
+			measure_get_scaling(clink, ml);
+		}
+
+		if (slot < 0) {
+			dropped++;
+			continue;
+		}
+		/* only for traces that are kept, so the .wft matches the .wf */
+		if (ts && ts_log_timestamps(clink, channel, ts, timeout) != 0) {
+			printf("Problem reading the timestamps, carrying on...\n");
+		}
+		if (shm) {
+			if (captured == 1) {
+				/* assume the scaling stays put from here on */
+				memset(&info, 0, sizeof(info));
+				tek_scope_get_scaling(clink, &info.vgain,
+						      &info.voffset,
+						      &info.hinterval,
+						      &info.hoffset);
+				info.no_traces = segments;
+				info.bytes_per_point = 2;
+				snprintf(info.source, sizeof(info.source),
+					 "%.15s", channel);
+			}
+			tek_shm_write_end(shm, bytes_returned, &info);
+		}
+		ring.bytes[slot] = bytes_returned;
+		ring.t_start[slot] = t0;
+#ifndef WIN32
+		pthread_mutex_lock(&ring.lock);
+		ring.head = (ring.head + 1) % ring.size;
+		ring.count++;
+		pthread_cond_signal(&ring.not_empty);
+		pthread_mutex_unlock(&ring.lock);
+#else
+		ring.count++;
+		ring_write_one(&ring);
+#endif
+	}
+	t_now = tek_time_us();
+
+	/* let the writer empty the ring */
+#ifndef WIN32
+	pthread_mutex_lock(&ring.lock);
+	ring.done = 1;
+	pthread_cond_signal(&ring.not_empty);
+	pthread_mutex_unlock(&ring.lock);
+	pthread_join(writer, NULL);
+#endif
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	printf("Captured %ld traces in %.2f s (%.2f traces/s), %ld written, %ld dropped\n",
+	       captured, (t_now - t_begin) / 1e6,
+	       captured / ((t_now - t_begin) / 1e6), ring.written, dropped);
+	if (period > 0) {
+		printf("Target rate %g traces/s, fell behind %ld times\n", rate,
+		       late);
+	}
+	print_percentiles("Capture latency", capture_lat, captured);
+	if (f_wf || ml) {
+		print_percentiles("Capture-to-disk latency", ring.write_lat,
+				  ring.written);
+	}
+
+	free(capture_lat);
+	delete[]scratch;
+	captured = ring.written;
+	ring_free(&ring);
+	return captured;
+}
+
 int main(int argc, char *argv[])
 {
 
@@ -66,6 +586,7 @@ int main(int argc, char *argv[])
 	FILE *f_wf;
 	char wfname[256];
 	char wfiname[256];
+	char wfdname[256];
 	long buf_size;
 	char *buf;
 	unsigned long timeout = 10000;	/* in ms (= 10 seconds) */
@@ -82,11 +603,41 @@ int main(int argc, char *argv[])
 	int no_averages, actual_no_averages;
 	int count = 0;
 	int repeat = 1;
-	int no_traces_acquired;
+	int no_traces_acquired = 1;
 	char ch;
 	int index = 1;
 	long npoints = 0;
 	long actual_npoints;
+	BOOL continuous = FALSE;
+	BOOL got_repeat = FALSE;
+	double duration = 0;
+	double rate = 0;
+	int ring_size = 8;
+	int policy = POLICY_STALL;
+	char *shm_name = NULL;
+	BOOL got_shm = FALSE;
+	TEK_SHM *shm = NULL;
+	int no_links = 1, actual_no_links;
+	BOOL got_links = FALSE;
+	BOOL got_timestamps = FALSE;
+	char wftname[256];
+	TS_LOG ts;
+	BOOL got_measure = FALSE;
+	char *measname = NULL;
+	MEASURE_LOG ml;
+	BOOL got_digital = FALSE;
+	DIGITAL_LOG dl;
+	BOOL got_decimate = FALSE;
+	BOOL decimate_cic = FALSE;
+	int decimate_factor = 1;
+	int decimate_taps = 0;
+	int decimate_output = TEK_DECIMATE_INT16;
+	DECIMATE_LOG xl;
+	BOOL got_plan = FALSE;
+	BOOL plan_only = FALSE;
+	double min_rate = 0, span = 0;
+	double roi_start = 0, roi_stop = 0;
+	TEK_PLAN plan;
 
 	VXI11_CLINK *clink;		/* client link (actually a structure contining CLIENT and VXI11_LINK pointers) */
 
@@ -97,6 +648,8 @@ int main(int argc, char *argv[])
 		    || sc(argv[index], "-file")) {
 			snprintf(wfname, 256, "%s.wf", argv[++index]);
 			snprintf(wfiname, 256, "%s.wfi", argv[index]);
+			snprintf(wftname, 256, "%s.wft", argv[index]);
+			snprintf(wfdname, 256, "%s.wfd", argv[index]);
 			got_file = TRUE;
 		}
 
@@ -120,6 +673,27 @@ int main(int argc, char *argv[])
 			sscanf(argv[++index], "%ld", &npoints);
 		}
 
+		if (sc(argv[index], "-min_rate") || sc(argv[index], "-sr")) {
+			sscanf(argv[++index], "%lg", &min_rate);
+			got_plan = TRUE;
+		}
+
+		if (sc(argv[index], "-span")) {
+			sscanf(argv[++index], "%lg", &span);
+			got_plan = TRUE;
+		}
+
+		if (sc(argv[index], "-roi")) {
+			sscanf(argv[++index], "%lg", &roi_start);
+			sscanf(argv[++index], "%lg", &roi_stop);
+			got_plan = TRUE;
+		}
+
+		if (sc(argv[index], "-plan")) {
+			plan_only = TRUE;
+			got_plan = TRUE;
+		}
+
 		if (sc(argv[index], "-averages") || sc(argv[index], "-a")
 		    || sc(argv[index], "-aver")) {
 			sscanf(argv[++index], "%d", &no_averages);
@@ -174,6 +748,82 @@ int main(int argc, char *argv[])
 		if (sc(argv[index], "-repeat") || sc(argv[index], "-r")
 		    || sc(argv[index], "-rep")) {
 			sscanf(argv[++index], "%d", &repeat);
+			got_repeat = TRUE;
+		}
+
+		if (sc(argv[index], "-continuous") || sc(argv[index], "-cont")) {
+			continuous = TRUE;
+		}
+
+		if (sc(argv[index], "-duration") || sc(argv[index], "-dur")) {
+			sscanf(argv[++index], "%lg", &duration);
+			continuous = TRUE;
+		}
+
+		if (sc(argv[index], "-rate") || sc(argv[index], "-tr")) {
+			sscanf(argv[++index], "%lg", &rate);
+			continuous = TRUE;
+		}
+
+		if (sc(argv[index], "-ring")) {
+			sscanf(argv[++index], "%d", &ring_size);
+			if (ring_size < 1)
+				ring_size = 1;
+		}
+
+		if (sc(argv[index], "-drop")) {
+			policy = POLICY_DROP;
+		}
+
+		if (sc(argv[index], "-stall")) {
+			policy = POLICY_STALL;
+		}
+
+		if (sc(argv[index], "-shm")) {
+			shm_name = argv[++index];
+			if (strcmp(shm_name, "-") == 0)
+				shm_name = NULL;	/* anonymous (memfd) */
+			got_shm = TRUE;
+			continuous = TRUE;
+		}
+
+		if (sc(argv[index], "-links") || sc(argv[index], "-par")) {
+			if (sscanf(argv[++index], "%d", &no_links) != 1) {
+				no_links = -1;
+			}
+			got_links = TRUE;
+		}
+
+		if (sc(argv[index], "-digital") || sc(argv[index], "-dig")) {
+			snprintf(channel, 20, "DIGITAL");
+			got_scope_channel = TRUE;
+			got_digital = TRUE;
+		}
+
+		if (sc(argv[index], "-decimate") || sc(argv[index], "-dec")) {
+			sscanf(argv[++index], "%d", &decimate_factor);
+			got_decimate = (decimate_factor > 1);
+		}
+
+		if (sc(argv[index], "-dec_cic") || sc(argv[index], "-cic")) {
+			decimate_cic = TRUE;
+		}
+
+		if (sc(argv[index], "-dec_taps")) {
+			sscanf(argv[++index], "%d", &decimate_taps);
+		}
+
+		if (sc(argv[index], "-dec_32")) {
+			decimate_output = TEK_DECIMATE_INT32;
+		}
+
+		if (sc(argv[index], "-measure") || sc(argv[index], "-meas")) {
+			measname = argv[++index];
+			got_measure = TRUE;
+		}
+
+		if (sc(argv[index], "-timestamps") || sc(argv[index], "-ts")) {
+			got_timestamps = TRUE;
 		}
 
 		if (sc(argv[index], "-clear_sweeps") || sc(argv[index], "-clsw")
@@ -194,7 +844,10 @@ int main(int argc, char *argv[])
 		index++;
 	}
 
-	if (got_file == FALSE || got_ip == FALSE || got_scope_channel == FALSE) {
+	if ((got_file == FALSE && got_shm == FALSE && got_measure == FALSE
+	     && plan_only == FALSE)
+	    || got_ip == FALSE
+	    || got_scope_channel == FALSE) {
 		printf
 		    ("%s: grabs a waveform from a Tektronix scope via ethernet, by Steve (Aug 09)\n",
 		     progname);
@@ -211,6 +864,22 @@ int main(int argc, char *argv[])
 		    ("-t      -timeout                 : timout (in milliseconds)\n");
 		printf
 		    ("-n      -no_points       -points : set maximum no of points\n");
+		printf
+		    ("-sr     -min_rate                : sample at least this fast (S/s), with the\n");
+		printf
+		    ("                                   smallest record length that does\n");
+		printf
+		    ("-span                            : only get this long (s) from the middle of\n");
+		printf
+		    ("                                   the screen\n");
+		printf
+		    ("-roi                             : only get from..to these times (s, from the\n");
+		printf
+		    ("                                   trigger)\n");
+		printf
+		    ("-plan                            : say what -sr/-span/-roi would do, how\n");
+		printf
+		    ("                                   many bytes, and how long, then quit\n");
 		printf
 		    ("-a      -averages        -aver   : set no of averages (<=1 means sample mode)\n");
 		printf
@@ -232,20 +901,133 @@ int main(int argc, char *argv[])
 		printf
 		    ("-clsw   -clear_sweeps    -clear  : clear sweeps/'single acquisition' mode\n");
 		printf
-		    ("-noclsw -no_clear_sweeps -noclear: no clear sweeps (if averaging)\n\n");
+		    ("-noclsw -no_clear_sweeps -noclear: no clear sweeps (if averaging)\n");
+		printf
+		    ("-cont   -continuous              : capture unattended, until 'r' traces,\n");
+		printf
+		    ("                                   the duration, or Ctrl-C (r 0 = no limit)\n");
+		printf
+		    ("-dur    -duration                : stop after this many seconds (continuous)\n");
+		printf
+		    ("-tr     -rate                    : target traces/s (continuous, default flat out)\n");
+		printf
+		    ("-ring                            : no of capture buffers (continuous, default 8)\n");
+		printf
+		    ("-stall / -drop                   : if the buffers fill, wait (default) or\n");
+		printf
+		    ("                                   drop traces (continuous)\n");
+		printf
+		    ("-shm                             : also publish traces to shared memory ring\n");
+		printf
+		    ("                                   of this name (\"-\" for anonymous), with\n");
+		printf
+		    ("                                   -ring slots; -f is then optional\n");
+		printf
+		    ("-links  -par                     : download each trace over this many links\n");
+		printf
+		    ("                                   at once (0 = try a few, use the quickest)\n");
+		printf
+		    ("-ts     -timestamps              : also get the trigger time of every segment\n");
+		printf
+		    ("                                   (segmented mode), and interval statistics\n");
+		printf
+		    ("-meas   -measure                 : measure every trace/segment (Vpp, RMS,\n");
+		printf
+		    ("                                   rise time, frequency etc) into this file;\n");
+		printf
+		    ("                                   -f is then optional\n");
+		printf
+		    ("-dig    -digital                 : get all of D0-D15 at once, and store just\n");
+		printf
+		    ("                                   the edges on each line (instead of -c)\n");
+		printf
+		    ("-dec    -decimate                : low-pass filter each trace and only keep\n");
+		printf
+		    ("                                   every Nth point of it in filename.wf\n");
+		printf
+		    ("-cic    -dec_cic                 : ... with a CIC filter, rather than FIR\n");
+		printf
+		    ("-dec_taps                        : FIR taps per output point (default 16),\n");
+		printf
+		    ("                                   or CIC stages (default 4)\n");
+		printf
+		    ("-dec_32                          : store decimated points as 32 bits, to\n");
+		printf
+		    ("                                   keep the extra resolution\n\n");
 		printf("OUTPUTS:\n");
 		printf("filename.wf  : binary data of waveform\n");
-		printf("filename.wfi : waveform information (text)\n\n");
+		printf("filename.wfi : waveform information (text)\n");
+		printf("filename.wft : trigger timestamps, with -ts (binary, see\n");
+		printf("               tek_timestamps.h)\n");
+		printf("filename.wfd : edges on D0-D15, with -dig instead of filename.wf\n");
+		printf("               (binary, see tek_digital.h)\n");
+		printf("measurements : one line per trace, with -meas (text, see\n");
+		printf("               tek_measure.h)\n\n");
 		printf
 		    ("In Matlab, use loadwf or similar to load and process the waveform\n\n");
 		printf("EXAMPLE:\n");
 		printf("%s -ip 128.243.74.98 -f test -c 2 -r 0 -clsw\n",
 		       progname);
+		printf("%s -ip 128.243.74.98 -f test -c 2 -cont -dur 60 -tr 10\n",
+		       progname);
+		printf("%s -ip 128.243.74.98 -c 2 -shm /tek_scope -r 0\n",
+		       progname);
+		printf("%s -ip 128.243.74.98 -f test -c 1 -seg 1000 -ts -r 10\n",
+		       progname);
+		printf("%s -ip 128.243.74.98 -meas test.txt -c 1 -cont -dur 60\n",
+		       progname);
+		printf("%s -ip 128.243.74.98 -f test -dig -n 10000000\n",
+		       progname);
+		printf("%s -ip 128.243.74.98 -f test -c 1 -n 10000000 -dec 50\n",
+		       progname);
+		printf("%s -ip 128.243.74.98 -f test -c 1 -sr 1e9 -roi 2e-6 6e-6 -r 100\n",
+		       progname);
 		exit(1);
 	}
 
-	f_wf = fopen(wfname, "w");
-	if (f_wf > 0) {
+	if (got_links == TRUE
+	    && (no_links < 0 || no_links > TEK_PARALLEL_MAX_LINKS)) {
+		printf("error: -links must be from 1 to %d (or 0, to try a few and use the quickest)\n",
+		       TEK_PARALLEL_MAX_LINKS);
+		exit(1);
+	}
+
+	if (got_plan == TRUE && got_digital == TRUE) {
+		printf("-sr, -span, -roi and -plan don't go with -dig, ignoring them\n");
+		got_plan = FALSE;
+		plan_only = FALSE;
+	}
+
+	if (got_plan == TRUE && npoints > 0) {
+		printf("-n is ignored with -sr, -span, -roi or -plan\n");
+	}
+
+	/* Nothing gets captured with -plan, so don't empty the file */
+	if (plan_only == TRUE) {
+		got_file = FALSE;
+	}
+
+	if (got_decimate == TRUE && got_digital == TRUE) {
+		printf("-dec doesn't go with -dig, ignoring it\n");
+		got_decimate = FALSE;
+	}
+
+	if (got_timestamps == TRUE && got_segmented == FALSE) {
+		printf("-ts only makes sense with -seg, ignoring it\n");
+		got_timestamps = FALSE;
+	}
+
+	f_wf = NULL;
+	if (got_file == TRUE && got_digital == TRUE) {
+		f_wf = fopen(wfdname, "wb");
+		if (f_wf != NULL && tek_digital_write_magic(f_wf) < 0) {
+			fclose(f_wf);
+			f_wf = NULL;
+		}
+	} else if (got_file == TRUE) {
+		f_wf = fopen(wfname, "w");
+	}
+	if (f_wf != NULL || got_file == FALSE) {
 		/* This utility illustrates the general idea behind how data is acquired.
 		 * First we open the device, referenced by an IP address, and obtain
 		 * a client id, and a link id, all contained in a "VXI11_CLINK" structure.  Each
@@ -262,6 +1044,25 @@ int main(int argc, char *argv[])
 			exit(2);
 		}
 
+		/* Rather than -n, work out the smallest record length, and the
+		 * part of it to get back, for the sample rate and time asked for
+		 * (see tek_plan.h), and say what it'll cost before anything's
+		 * armed */
+		if (got_plan == TRUE) {
+			if (tek_plan_make(clink, min_rate, span, roi_start,
+					  roi_stop, &plan) != 0) {
+				printf("Quitting...\n");
+				exit(2);
+			}
+			tek_plan_measure_link(clink, channel, &plan, timeout);
+			tek_plan_print(&plan, got_segmented ? no_segments : 1);
+			if (plan_only == TRUE) {
+				tek_close(clink, device_ip);
+				exit(0);
+			}
+			npoints = plan.record_length;
+		}
+
 		/* If we've specified the number of points (ie record length), then set it.
 		 * Otherwise, leave the scope in the condition it's in, in that respect. */
 		if (npoints > 0) {
@@ -275,6 +1076,13 @@ int main(int argc, char *argv[])
 		/* Set up the scope. This function also returns the no of bytes needed */
 		buf_size =
 		    tek_scope_set_for_capture(clink, clear_sweeps, timeout);
+		if (got_plan == TRUE) {
+			buf_size = tek_plan_set_window(clink, &plan);
+			if (buf_size < 0) {
+				printf("Quitting...\n");
+				exit(2);
+			}
+		}
 		if (got_segmented == TRUE) {
 			buf_size = buf_size * no_segments;
 			no_traces_acquired = no_segments;
@@ -331,45 +1139,199 @@ int main(int argc, char *argv[])
 			     no_averages, actual_no_averages);
 		}
 
-		/* Sit in a loop until we're done with taking measurements */
-		do {
-			/* This is where we transfer the data from the scope to the PC. */
-			bytes_returned =
-			    tek_scope_get_data(clink, channel, clear_sweeps,
-					       buf, buf_size, timeout);
-			if (bytes_returned <= 0) {
-				printf
-				    ("Problem reading the data, quitting...\n");
+		/* Long records or lots of segments come off quicker in several
+		 * pieces at once, over several links (see tek_parallel.h) */
+		if (got_links == TRUE) {
+			actual_no_links =
+			    tek_scope_use_links(clink, device_ip, no_links,
+						timeout);
+			printf("Downloading over %d link%s.\n", actual_no_links,
+			       actual_no_links == 1 ? "" : "s");
+		}
+
+		/* Trigger times of the segments, alongside the segments themselves */
+		if (got_timestamps == TRUE) {
+			memset(&ts, 0, sizeof(ts));
+			ts.file_t0 = -1;
+			ts.no_frames = no_traces_acquired;
+			ts.t_ps = new int64_t[ts.no_frames];
+			ts.flags = new uint32_t[ts.no_frames];
+			if (got_file == TRUE) {
+				ts.f = fopen(wftname, "wb");
+				if (ts.f == NULL) {
+					printf("error: could not open %s for writing, quitting...\n", wftname);
+					exit(3);
+				}
+			}
+		}
+
+		if (got_digital == TRUE) {
+			memset(&dl, 0, sizeof(dl));
+			dl.traces_per_buf =
+			    got_segmented ? no_traces_acquired : 1;
+		}
+
+		/* Fewer points to the disk than come off the scope */
+		if (got_decimate == TRUE) {
+			memset(&xl, 0, sizeof(xl));
+			xl.traces_per_buf =
+			    got_segmented ? no_traces_acquired : 1;
+			if (decimate_cic == TRUE) {
+				xl.d = tek_decimate_new_cic(decimate_factor,
+							    decimate_taps,
+							    decimate_output);
+			} else {
+				xl.d = tek_decimate_new_fir(decimate_factor,
+							    decimate_taps,
+							    decimate_output);
+			}
+			if (xl.d == NULL) {
+				printf("Quitting...\n");
 				exit(2);
 			}
+		}
 
-			/* Now write the data to the file */
-			fwrite(buf, sizeof(char), bytes_returned, f_wf);
-			count++;
-			if (count != repeat) {
-				printf
-				    ("Trace %d acquired. Press 'Enter' to take another, or\n",
-				     count);
-				printf("'q' then 'Enter' to stop here: ");
-				ch = (char)getchar();
-				if (ch != '\n')
-					getchar();
-				if (ch == 'q')
-					repeat = count;
+		/* Numbers rather than (or as well as) traces */
+		if (got_measure == TRUE) {
+			memset(&ml, 0, sizeof(ml));
+			ml.traces_per_buf =
+			    got_segmented ? no_traces_acquired : 1;
+			ml.m = new TEK_MEASUREMENTS[ml.traces_per_buf];
+			ml.f = fopen(measname, "w");
+			if (ml.f == NULL) {
+				printf("error: could not open %s for writing, quitting...\n", measname);
+				exit(3);
 			}
-		} while (count != repeat);
+			tek_measure_write_header(ml.f);
+		}
+
+		/* Anybody else who wants the traces can have them from here */
+		if (got_shm == TRUE) {
+			shm = tek_shm_create(shm_name, buf_size, ring_size);
+			if (!shm) {
+				printf("Quitting...\n");
+				exit(2);
+			}
+			printf("Publishing traces to shared memory '%s'\n",
+			       tek_shm_name(shm));
+		}
+
+		/* In continuous mode, there's nobody to press Enter */
+		if (continuous == TRUE) {
+			count =
+			    continuous_capture(clink, channel, clear_sweeps,
+					       buf_size, timeout, f_wf, shm,
+					       got_segmented ? no_traces_acquired : 1,
+					       got_repeat ? repeat : 0,
+					       duration, rate, ring_size,
+					       policy,
+					       got_timestamps ? &ts : NULL,
+					       got_measure ? &ml : NULL,
+					       got_digital ? &dl : NULL,
+					       got_decimate ? &xl : NULL);
+			tek_shm_close(shm);
+			if (got_segmented == TRUE) {
+				no_traces_acquired *= count;
+			}
+		} else {
+			/* Sit in a loop until we're done with taking measurements */
+			do {
+				/* This is where we transfer the data from the scope to the PC. */
+				bytes_returned =
+				    tek_scope_get_data(clink, channel, clear_sweeps,
+						       buf, buf_size, timeout);
+				if (bytes_returned <= 0) {
+					printf
+					    ("Problem reading the data, quitting...\n");
+					exit(2);
+				}
+
+				/* Now write the data to the file */
+				if (f_wf != NULL && got_digital == TRUE) {
+					digital_write_buf(&dl, f_wf, buf,
+							  bytes_returned);
+				} else if (f_wf != NULL && got_decimate == TRUE) {
+					decimate_write_buf(&xl, f_wf, buf,
+							   bytes_returned);
+				} else if (f_wf != NULL) {
+					fwrite(buf, sizeof(char),
+					       bytes_returned, f_wf);
+				}
+				if (got_measure == TRUE) {
+					measure_get_scaling(clink, &ml);
+					measure_buf(&ml, buf, bytes_returned);
+				}
+				if (got_timestamps == TRUE
+				    && ts_log_timestamps(clink, channel, &ts,
+							 timeout) != 0) {
+					printf("Problem reading the timestamps, carrying on...\n");
+				}
+				count++;
+				if (count != repeat) {
+					printf
+					    ("Trace %d acquired. Press 'Enter' to take another, or\n",
+					     count);
+					printf("'q' then 'Enter' to stop here: ");
+					ch = (char)getchar();
+					if (ch != '\n')
+						getchar();
+					if (ch == 'q')
+						repeat = count;
+				}
+			} while (count != repeat);
+		}
 		if (got_segmented == FALSE) {
 			no_traces_acquired = count;
 			if (no_traces_acquired > 1)
 				printf("A total of %d traces were acquired.\n",
 				       no_traces_acquired);
 		}
-		fclose(f_wf);
 		delete[]buf;
+		if (got_digital == TRUE && got_file == TRUE) {
+			printf("Digital lines: %ld bytes of samples stored as %ld bytes of edges\n",
+			       dl.raw_bytes, dl.stored_bytes + 8);
+		}
+		if (got_decimate == TRUE && got_file == TRUE) {
+			printf("Decimated by %d: %ld bytes of samples stored as %ld bytes\n",
+			       decimate_factor, xl.raw_bytes, xl.stored_bytes);
+		}
+		if (got_measure == TRUE) {
+			fclose(ml.f);
+			delete[]ml.m;
+			printf("%ld traces measured, see %s\n", ml.trace,
+			       measname);
+		}
+		if (got_timestamps == TRUE) {
+			tek_timestamps_print_stats(&ts.stats);
+			if (ts.f) {
+				fclose(ts.f);
+			}
+			delete[]ts.t_ps;
+			delete[]ts.flags;
+		}
+		if (got_file == TRUE) {
+			fclose(f_wf);
 
-		/* Here we gather waveform information and write the wfi file */
-		tek_scope_write_wfi_file(clink, wfiname, progname,
-					 no_traces_acquired, timeout);
+			/* Here we gather waveform information and write the wfi file */
+			if (got_decimate == TRUE) {
+				tek_decimate_write_wfi_file(clink, xl.d, wfiname,
+							    progname,
+							    no_traces_acquired,
+							    timeout);
+			} else if (got_plan == TRUE) {
+				tek_plan_write_wfi_file(clink, &plan, wfiname,
+							progname,
+							no_traces_acquired);
+			} else {
+				tek_scope_write_wfi_file(clink, wfiname, progname,
+							 no_traces_acquired,
+							 timeout);
+			}
+		}
+		if (got_decimate == TRUE) {
+			tek_decimate_free(xl.d);
+			delete[]xl.out;
+		}
 
 		/* Finally we sever the link to the client. */
 		tek_close(clink, device_ip);	// could also use "vxi11_close_device()"